@@ -0,0 +1,499 @@
+/* eslint no-unused-vars: "off" */
+/* eslint no-implicit-coercion: "off" */
+
+'use strict';
+
+/**
+ * Per-call cost of the binding: sync vs async calls, iterator batch
+ * sizes, VirtualTransaction flush sizes, promise and buffer creation,
+ * and the native Tree against the JS trees (and raw C, with --c).
+ *
+ * Usage:
+ *   node bench/binding.js [--json] [--keys N] [--c urkel_bench] [group...]
+ *
+ * Groups: calls, alloc, iterator, vtx, impl.
+ */
+
+const assert = require('bsert');
+const fs = require('fs');
+const os = require('os');
+const Path = require('path');
+const crypto = require('crypto');
+const {execFileSync} = require('child_process');
+const util = require('./util');
+const nurkel = require('../lib');
+
+const {Tree, MemTree, UrkelTree} = nurkel;
+
+const GROUPS = ['calls', 'alloc', 'iterator', 'vtx', 'impl'];
+const BATCH_SIZES = [1, 10, 100, 1000, 10000];
+const IN_FLIGHT = 256;
+const PROOFS = 100;
+const PREFIX = Path.resolve(__dirname, 'bindingdb');
+const URKEL_PREFIX = Path.resolve(__dirname, 'bindingdb-urkel');
+
+const results = [];
+
+function parseArgs(args) {
+  const options = {
+    json: false,
+    keys: 20000,
+    c: null,
+    groups: []
+  };
+
+  for (let i = 0; i < args.length; i++) {
+    switch (args[i]) {
+      case '--json':
+        options.json = true;
+        break;
+      case '--keys':
+        options.keys = +args[++i];
+        assert(options.keys >= PROOFS, 'Bad --keys.');
+        break;
+      case '--c':
+        options.c = Path.resolve(args[++i]);
+        break;
+      default:
+        assert(GROUPS.includes(args[i]), `Unknown group: ${args[i]}.`);
+        options.groups.push(args[i]);
+        break;
+    }
+  }
+
+  if (options.groups.length === 0)
+    options.groups = GROUPS.slice();
+
+  return options;
+}
+
+const options = parseArgs(process.argv.slice(2));
+
+function record(name, ops, nsec) {
+  const result = {
+    name,
+    ops,
+    nsec,
+    opsPerSec: ops / (nsec / 1e9),
+    nsecPerOp: nsec / ops
+  };
+
+  results.push(result);
+
+  if (!options.json) {
+    console.log('%s: %d ops/sec, %d ns/op',
+      name.padEnd(32),
+      Math.round(result.opsPerSec),
+      Math.round(result.nsecPerOp));
+  }
+}
+
+async function run(name, ops, fn) {
+  record(name, ops, await util.measure(fn));
+}
+
+function section(name) {
+  if (!options.json)
+    console.log('\n%s:', name);
+}
+
+function randomItems(count) {
+  const items = [];
+
+  for (let i = 0; i < count; i++)
+    items.push([crypto.randomBytes(32), crypto.randomBytes(100)]);
+
+  return items;
+}
+
+function rmdir(path) {
+  fs.rmSync(path, { recursive: true, force: true });
+}
+
+async function populate(tree, items) {
+  const txn = tree.txn();
+  await txn.open();
+
+  for (const [key, value] of items)
+    await txn.insert(key, value);
+
+  await txn.commit();
+  await txn.close();
+}
+
+async function inFlight(items, fn) {
+  // Keeps several calls queued on the thread pool at once.
+  for (let i = 0; i < items.length; i += IN_FLIGHT) {
+    const jobs = [];
+
+    for (const item of items.slice(i, i + IN_FLIGHT))
+      jobs.push(fn(item));
+
+    await Promise.all(jobs);
+  }
+}
+
+/*
+ * Sync vs async calls
+ */
+
+async function benchCalls(tree, items) {
+  const n = items.length;
+  const root = tree.rootHash();
+  const proofs = [];
+
+  section('Calls (sync vs async)');
+
+  await run('treeRootHash (async)', n, async () => {
+    for (let i = 0; i < n; i++)
+      await tree.treeRootHash();
+  });
+
+  await run('treeRootHashSync', n, () => {
+    for (let i = 0; i < n; i++)
+      tree.treeRootHashSync();
+  });
+
+  await run('hash (async)', n, async () => {
+    for (const [key] of items)
+      await Tree.hash(key);
+  });
+
+  await run('hashSync', n, () => {
+    for (const [key] of items)
+      Tree.hashSync(key);
+  });
+
+  await run('get (async)', n, async () => {
+    for (const [key] of items)
+      assert(await tree.get(key));
+  });
+
+  await run(`get (async, ${IN_FLIGHT} in flight)`, n, async () => {
+    await inFlight(items, async ([key]) => assert(await tree.get(key)));
+  });
+
+  await run('getSync', n, () => {
+    for (const [key] of items)
+      assert(tree.getSync(key));
+  });
+
+  await run('has (async)', n, async () => {
+    for (const [key] of items)
+      assert(await tree.has(key));
+  });
+
+  await run('hasSync', n, () => {
+    for (const [key] of items)
+      assert(tree.hasSync(key));
+  });
+
+  await run('prove (async)', n, async () => {
+    for (const [key] of items)
+      await tree.prove(key);
+  });
+
+  await run('proveSync', n, () => {
+    for (const [key] of items)
+      tree.proveSync(key);
+  });
+
+  for (let i = 0; i < PROOFS; i++)
+    proofs.push([items[i][0], tree.proveSync(items[i][0])]);
+
+  await run('verify (async)', n, async () => {
+    for (let i = 0; i < n; i++) {
+      const [key, proof] = proofs[i % PROOFS];
+      await Tree.verify(root, key, proof);
+    }
+  });
+
+  await run('verifySync', n, () => {
+    for (let i = 0; i < n; i++) {
+      const [key, proof] = proofs[i % PROOFS];
+      Tree.verifySync(root, key, proof);
+    }
+  });
+
+  const fresh = randomItems(n);
+  const txn = tree.txn();
+  await txn.open();
+
+  await run('tx insert (async)', n, async () => {
+    for (const [key, value] of fresh)
+      await txn.insert(key, value);
+  });
+
+  await run('tx remove (async)', n, async () => {
+    for (const [key] of fresh)
+      await txn.remove(key);
+  });
+
+  await run('tx insertSync', n, () => {
+    for (const [key, value] of fresh)
+      txn.insertSync(key, value);
+  });
+
+  await run('tx removeSync', n, () => {
+    for (const [key] of fresh)
+      txn.removeSync(key);
+  });
+
+  await txn.close();
+}
+
+/*
+ * Promise and buffer creation
+ */
+
+async function benchAlloc(items) {
+  const n = items.length;
+
+  section('Allocation (per call overhead)');
+
+  await run('await resolved promise', n, async () => {
+    for (let i = 0; i < n; i++)
+      await Promise.resolve();
+  });
+
+  await run('await new Promise', n, async () => {
+    for (let i = 0; i < n; i++)
+      await new Promise(resolve => resolve());
+  });
+
+  await run('await setImmediate', n, async () => {
+    for (let i = 0; i < n; i++)
+      await new Promise(resolve => setImmediate(resolve));
+  });
+
+  await run('Buffer.alloc(32)', n, () => {
+    for (let i = 0; i < n; i++)
+      Buffer.alloc(32);
+  });
+
+  await run('Buffer.allocUnsafe(100)', n, () => {
+    for (let i = 0; i < n; i++)
+      Buffer.allocUnsafe(100);
+  });
+
+  await run('Buffer.from (copy 100)', n, () => {
+    for (const [, value] of items)
+      Buffer.from(value);
+  });
+}
+
+/*
+ * Iterator batch sizes
+ */
+
+async function benchIterator(tree, items) {
+  const n = items.length;
+
+  section('Iterator (cache size)');
+
+  for (const size of BATCH_SIZES) {
+    const snap = tree.snapshot();
+    await snap.open();
+
+    let count = 0;
+
+    await run(`iterate (async, cache=${size})`, n, async () => {
+      const iter = snap.iterator(size);
+
+      for await (const [key, value] of iter)
+        count++;
+
+      await iter.end();
+    });
+
+    assert.strictEqual(count, n);
+
+    count = 0;
+
+    await run(`iterate (sync, cache=${size})`, n, async () => {
+      const iter = snap.iterator(size);
+
+      for (const [key, value] of iter)
+        count++;
+
+      await iter.end();
+    });
+
+    assert.strictEqual(count, n);
+
+    await snap.close();
+  }
+}
+
+/*
+ * VirtualTransaction flush sizes
+ */
+
+async function benchVTX(tree, items) {
+  const n = items.length;
+  const fresh = randomItems(n);
+
+  section('VirtualTransaction (flush size)');
+
+  for (const size of BATCH_SIZES) {
+    const vtx = tree.vtxn();
+    await vtx.open();
+
+    await run(`vtx insert (async, flush=${size})`, n, async () => {
+      for (let i = 0; i < n; i++) {
+        const [key, value] = fresh[i];
+
+        await vtx.insert(key, value);
+
+        if ((i + 1) % size === 0)
+          await vtx.flush();
+      }
+
+      await vtx.flush();
+    });
+
+    await vtx.clear();
+
+    await run(`vtx insertSync (flush=${size})`, n, () => {
+      for (let i = 0; i < n; i++) {
+        const [key, value] = fresh[i];
+
+        vtx.insertSync(key, value);
+
+        if ((i + 1) % size === 0)
+          vtx.flushSync();
+      }
+
+      vtx.flushSync();
+    });
+
+    await vtx.close();
+  }
+}
+
+/*
+ * Tree implementations
+ */
+
+function fromC(items) {
+  // Names in the JSON of deps/liburkel/test/bench.c.
+  const names = {
+    'insert (random)': 'insert (C)',
+    'commit (random)': 'commit (C)',
+    'get (head, uniform)': 'get (C)',
+    'prove (head)': 'prove (C)'
+  };
+
+  const out = execFileSync(options.c, [
+    '--json',
+    '--keys', String(items.length),
+    'insert',
+    'get',
+    'prove'
+  ], { cwd: os.tmpdir() });
+
+  for (const result of JSON.parse(out.toString()).results) {
+    if (names[result.name])
+      record(names[result.name], result.ops, result.nsec);
+  }
+}
+
+async function benchImpl(items) {
+  const n = items.length;
+  const trees = [
+    ['Tree', () => new Tree({ prefix: PREFIX })],
+    ['MemTree', () => new MemTree()],
+    ['UrkelTree', () => new UrkelTree({ prefix: URKEL_PREFIX })]
+  ];
+
+  section('Implementations');
+
+  for (const [name, create] of trees) {
+    rmdir(PREFIX);
+    rmdir(URKEL_PREFIX);
+
+    const tree = create();
+    await tree.open();
+
+    const txn = tree.txn();
+    await txn.open();
+
+    await run(`insert (${name})`, n, async () => {
+      for (const [key, value] of items)
+        await txn.insert(key, value);
+    });
+
+    await run(`commit (${name})`, 1, async () => {
+      await txn.commit();
+    });
+
+    await txn.close();
+
+    await run(`get (${name})`, n, async () => {
+      for (const [key] of items)
+        assert(await tree.get(key));
+    });
+
+    await run(`prove (${name})`, n, async () => {
+      for (const [key] of items)
+        await tree.prove(key);
+    });
+
+    await tree.close();
+  }
+
+  rmdir(PREFIX);
+  rmdir(URKEL_PREFIX);
+
+  if (options.c)
+    fromC(items);
+}
+
+/*
+ * Main
+ */
+
+(async () => {
+  const items = randomItems(options.keys);
+  const selected = group => options.groups.includes(group);
+
+  if (!options.json)
+    console.log('Benchmarking the binding with %d keys.', options.keys);
+
+  if (selected('alloc'))
+    await benchAlloc(items);
+
+  if (selected('calls') || selected('iterator') || selected('vtx')) {
+    rmdir(PREFIX);
+
+    const tree = new Tree({ prefix: PREFIX });
+    await tree.open();
+    await populate(tree, items);
+
+    if (selected('calls'))
+      await benchCalls(tree, items);
+
+    if (selected('iterator'))
+      await benchIterator(tree, items);
+
+    if (selected('vtx'))
+      await benchVTX(tree, items);
+
+    await tree.close();
+
+    rmdir(PREFIX);
+  }
+
+  if (selected('impl'))
+    await benchImpl(items);
+
+  if (options.json) {
+    console.log(JSON.stringify({
+      keys: options.keys,
+      results
+    }, null, 2));
+  }
+})().catch((err) => {
+  console.error(err);
+  process.exit(1);
+});
@@ -59,9 +59,18 @@ function bench(time) {
   return process.hrtime();
 }
 
+async function measure(fn) {
+  const start = process.hrtime.bigint();
+
+  await fn();
+
+  return Number(process.hrtime.bigint() - start);
+}
+
 exports.memory = memory;
 exports.logMemory = logMemory;
 exports.wait = wait;
 exports.now = now;
 exports.bench = bench;
+exports.measure = measure;
 
@@ -1,5 +1,6 @@
 {
   "variables": {
+    "usdt%": "false",
     "conditions": [
       ["OS == 'win'", {
         "tls_keyword%": "__declspec(thread)"
@@ -15,6 +16,10 @@
       "sources": [
         "./deps/liburkel/src/bits.c",
         "./deps/liburkel/src/blake2b.c",
+        "./deps/liburkel/src/compress.c",
+        "./deps/liburkel/src/crc32c.c",
+        "./deps/liburkel/src/filter.c",
+        "./deps/liburkel/src/index.c",
         "./deps/liburkel/src/internal.c",
         "./deps/liburkel/src/io.c",
         "./deps/liburkel/src/nodes.c",
@@ -77,6 +82,9 @@
         }],
         ["tls_keyword != 'none'", {
           "defines": ["URKEL_TLS=<(tls_keyword)"]
+        }],
+        ["usdt == 'true' and OS == 'linux'", {
+          "defines": ["URKEL_USDT"]
         }]
       ],
     },
@@ -91,6 +99,7 @@
         "./src/transaction.c",
         "./src/util.c",
         "./src/common.c",
+        "./src/latency.c",
         "./src/blake2b.c"
       ],
       "conditions": [
@@ -12,6 +12,7 @@ extern "C" {
 #endif
 
 #include <stddef.h>
+#include <stdint.h>
 
 /*
  * Visibility
@@ -53,6 +54,69 @@ typedef struct urkel_tree_stat_s {
   size_t size;  /* Total size of all files (except meta), in bytes. */
 } urkel_tree_stat_t;
 
+typedef struct urkel_tree_options_s {
+  unsigned int flags; /* URKEL_OPTION_* flags. */
+  unsigned int durability; /* URKEL_DURABLE_* mode. */
+  unsigned int sync_commits; /* Batch mode: sync every N commits. */
+  unsigned int sync_interval; /* Batch mode: sync every N milliseconds. */
+  size_t memory; /* Memory budget in bytes (0 = unlimited). */
+  size_t tx_memory; /* Spill transactions above this (0 = never). */
+  unsigned int tx_levels; /* Levels kept in memory after a commit. */
+  unsigned int warm_levels; /* Levels prefetched on open (0 = off). */
+} urkel_tree_options_t;
+
+typedef struct urkel_memory_s {
+  size_t limit; /* Budget set at open (0 = unlimited). */
+  size_t used; /* Sum of the below. */
+  size_t buffer; /* Write buffer. */
+  size_t cache; /* Cached roots. */
+  size_t dedup; /* Value dedup table. */
+  size_t txs; /* Nodes held by transactions. */
+  size_t other; /* Charged through urkel_memory_charge. */
+} urkel_memory_t;
+
+typedef struct urkel_lock_metrics_s {
+  uint64_t contended; /* Acquisitions which had to wait. */
+  uint64_t wait_time; /* Total time spent waiting. */
+  uint64_t max_wait; /* Longest single wait. */
+} urkel_lock_metrics_t;
+
+typedef struct urkel_metrics_s {
+  /* Counters since open. Times are in microseconds. */
+  uint64_t node_reads; /* Node records read from disk. */
+  uint64_t value_reads; /* Values read from disk. */
+  uint64_t bytes_read;
+  uint64_t bytes_written;
+  uint64_t root_hits; /* Historical roots found in the cache. */
+  uint64_t root_misses;
+  uint64_t filter_hits; /* Lookups the key filter answered. */
+  uint64_t filter_misses;
+  uint64_t index_hits; /* Lookups the key index answered. */
+  uint64_t index_misses;
+  uint64_t dedup_hits; /* Values shared instead of written. */
+  uint64_t dedup_misses;
+  uint64_t commits;
+  uint64_t commit_time;
+  uint64_t flushes;
+  uint64_t flush_time;
+  uint64_t syncs;
+  uint64_t sync_time;
+  uint64_t file_opens;
+  uint64_t file_evictions;
+  uint64_t history_scans; /* Meta records read looking up old roots. */
+  urkel_lock_metrics_t tree_read; /* With URKEL_OPTION_LOCKSTATS. */
+  urkel_lock_metrics_t tree_write;
+  urkel_lock_metrics_t tx_read; /* All transactions of the tree. */
+  urkel_lock_metrics_t tx_write;
+} urkel_metrics_t;
+
+typedef struct urkel_scrub_s {
+  size_t nodes; /* Node records read. */
+  size_t values; /* Values read. */
+  size_t checked; /* Records verified against a checksum. */
+  size_t corrupt; /* Records which failed to read or verify. */
+} urkel_scrub_t;
+
 /*
  * Error Number
  */
@@ -75,14 +139,43 @@ __urkel_get_errno(void);
 #define URKEL_EBADWRITE 11
 #define URKEL_EBADOPEN 12
 #define URKEL_EITEREND 13
+#define URKEL_ENOMEM 14
+
+/*
+ * Options
+ */
+
+#define URKEL_OPTION_FILTER (1 << 0) /* Key filter for negative lookups. */
+#define URKEL_OPTION_INDEX (1 << 1) /* Key index for head root lookups. */
+#define URKEL_OPTION_COMPRESS (1 << 2) /* Compress leaf values on disk. */
+#define URKEL_OPTION_DEDUP (1 << 3) /* Share storage of identical values. */
+#define URKEL_OPTION_DIRECT (1 << 4) /* Bypass the page cache on writes. */
+#define URKEL_OPTION_CHECKSUM (1 << 5) /* CRC32C on every record. */
+#define URKEL_OPTION_ATTACH (1 << 6) /* Keep nodes resolved by tx reads. */
+#define URKEL_OPTION_LOCKSTATS (1 << 7) /* Time contended lock waits. */
+
+/*
+ * Durability
+ */
+
+#define URKEL_DURABLE_NONE 0 /* Never sync. */
+#define URKEL_DURABLE_COMMIT 1 /* Sync every commit. */
+#define URKEL_DURABLE_BATCH 2 /* Sync in the background. */
+#define URKEL_DURABLE_ROLLOVER 3 /* Sync when a data file fills up. */
 
 /*
  * Database
  */
 
+URKEL_EXTERN void
+urkel_tree_options_init(urkel_tree_options_t *options);
+
 URKEL_EXTERN urkel_t *
 urkel_open(const char *prefix);
 
+URKEL_EXTERN urkel_t *
+urkel_open_ex(const char *prefix, const urkel_tree_options_t *options);
+
 URKEL_EXTERN void
 urkel_close(urkel_t *tree);
 
@@ -101,6 +194,21 @@ urkel_hash(unsigned char *hash, const void *data, size_t size);
 URKEL_EXTERN void
 urkel_root(urkel_t *tree, unsigned char *hash);
 
+URKEL_EXTERN void
+urkel_durable_root(urkel_t *tree, unsigned char *hash);
+
+URKEL_EXTERN void
+urkel_memory_usage(urkel_t *tree, urkel_memory_t *usage);
+
+URKEL_EXTERN int
+urkel_memory_charge(urkel_t *tree, size_t size);
+
+URKEL_EXTERN void
+urkel_memory_release(urkel_t *tree, size_t size);
+
+URKEL_EXTERN void
+urkel_metrics(urkel_t *tree, urkel_metrics_t *metrics);
+
 URKEL_EXTERN int
 urkel_inject(urkel_t *tree, const unsigned char *hash);
 
@@ -130,6 +238,12 @@ urkel_compact(const char *dst_prefix,
               const char *src_prefix,
               const unsigned char *hash);
 
+URKEL_EXTERN int
+urkel_scrub(urkel_t *tree,
+            const unsigned char *root,
+            unsigned int threads,
+            urkel_scrub_t *stats);
+
 URKEL_EXTERN int
 urkel_prove(urkel_t *tree,
             unsigned char **proof_raw,
@@ -156,6 +270,9 @@ urkel_iterate(urkel_t *tree, const unsigned char *root);
 URKEL_EXTERN urkel_tx_t *
 urkel_tx_create(urkel_t *tree, const unsigned char *hash);
 
+URKEL_EXTERN urkel_tx_t *
+urkel_tx_fork(urkel_tx_t *tx);
+
 URKEL_EXTERN void
 urkel_tx_destroy(urkel_tx_t *tx);
 
@@ -186,6 +303,15 @@ urkel_tx_insert(urkel_tx_t *tx,
 URKEL_EXTERN int
 urkel_tx_remove(urkel_tx_t *tx, const unsigned char *key);
 
+URKEL_EXTERN size_t
+urkel_tx_savepoint(urkel_tx_t *tx);
+
+URKEL_EXTERN int
+urkel_tx_rollback_to(urkel_tx_t *tx, size_t savepoint);
+
+URKEL_EXTERN int
+urkel_tx_release(urkel_tx_t *tx, size_t savepoint);
+
 URKEL_EXTERN int
 urkel_tx_prove(urkel_tx_t *tx,
                unsigned char **proof_raw,
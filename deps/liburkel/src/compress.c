@@ -0,0 +1,238 @@
+/*!
+ * compress.c - value compression for liburkel
+ * Copyright (c) 2020, Christopher Jeffrey (MIT License).
+ * https://github.com/handshake-org/liburkel
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "compress.h"
+#include "internal.h"
+#include "util.h"
+
+/*
+ * LZ4 Block Format
+ *
+ * A minimal greedy compressor producing standard LZ4
+ * blocks. Values are at most URKEL_VALUE_SIZE bytes,
+ * so a small position table on the stack suffices and
+ * offsets always fit in the 16 bit format field.
+ *
+ * See: https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+ */
+
+#define LZ4_HASH_LOG 10
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5 /* Trailing bytes which must be literals. */
+#define LZ4_MF_LIMIT 12 /* No match may start in the last 12 bytes. */
+#define LZ4_MAX_OFFSET 0xffff
+
+static uint32_t
+lz4_hash(const unsigned char *p) {
+  return (urkel_read32(p) * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+static unsigned char *
+lz4_write_length(unsigned char *op, const unsigned char *oend, size_t len) {
+  while (len >= 255) {
+    if (op >= oend)
+      return NULL;
+
+    *op++ = 255;
+    len -= 255;
+  }
+
+  if (op >= oend)
+    return NULL;
+
+  *op++ = len;
+
+  return op;
+}
+
+static unsigned char *
+lz4_write_sequence(unsigned char *op,
+                   const unsigned char *oend,
+                   const unsigned char *lit,
+                   size_t lit_len,
+                   size_t offset,
+                   size_t match_len) {
+  unsigned char *token;
+  size_t ml = match_len - LZ4_MIN_MATCH;
+
+  if (op >= oend)
+    return NULL;
+
+  token = op++;
+
+  if (lit_len >= 15) {
+    *token = 15 << 4;
+    op = lz4_write_length(op, oend, lit_len - 15);
+
+    if (op == NULL)
+      return NULL;
+  } else {
+    *token = lit_len << 4;
+  }
+
+  if ((size_t)(oend - op) < lit_len)
+    return NULL;
+
+  if (lit_len > 0)
+    memcpy(op, lit, lit_len);
+
+  op += lit_len;
+
+  /* Last sequence: literals only. */
+  if (match_len == 0)
+    return op;
+
+  if (oend - op < 2)
+    return NULL;
+
+  op = urkel_write16(op, offset);
+
+  if (ml >= 15) {
+    *token |= 15;
+    op = lz4_write_length(op, oend, ml - 15);
+  } else {
+    *token |= ml;
+  }
+
+  return op;
+}
+
+size_t
+urkel_compress(unsigned char *out,
+               size_t out_size,
+               const unsigned char *in,
+               size_t in_len) {
+  /* Returns zero if the output does not fit in `out_size`. */
+  uint16_t table[1 << LZ4_HASH_LOG];
+  const unsigned char *oend = out + out_size;
+  unsigned char *op = out;
+  size_t anchor = 0;
+  size_t ip = 0;
+
+  CHECK(in_len <= LZ4_MAX_OFFSET);
+
+  memset(table, 0, sizeof(table));
+
+  if (in_len > LZ4_MF_LIMIT) {
+    size_t limit = in_len - LZ4_MF_LIMIT;
+    size_t match_limit = in_len - LZ4_LAST_LITERALS;
+
+    while (ip < limit) {
+      uint32_t h = lz4_hash(in + ip);
+      size_t ref = table[h];
+      size_t len;
+
+      table[h] = ip + 1;
+
+      if (ref == 0 || urkel_read32(in + ref - 1) != urkel_read32(in + ip)) {
+        ip += 1;
+        continue;
+      }
+
+      ref -= 1;
+      len = LZ4_MIN_MATCH;
+
+      while (ip + len < match_limit && in[ref + len] == in[ip + len])
+        len += 1;
+
+      op = lz4_write_sequence(op, oend, in + anchor, ip - anchor,
+                              ip - ref, len);
+
+      if (op == NULL)
+        return 0;
+
+      ip += len;
+      anchor = ip;
+    }
+  }
+
+  op = lz4_write_sequence(op, oend, in + anchor, in_len - anchor, 0, 0);
+
+  if (op == NULL)
+    return 0;
+
+  return op - out;
+}
+
+static int
+lz4_read_length(const unsigned char **ip,
+                const unsigned char *iend,
+                size_t *len) {
+  unsigned int byte;
+
+  do {
+    if (*ip >= iend)
+      return 0;
+
+    byte = *(*ip)++;
+    *len += byte;
+  } while (byte == 255);
+
+  return 1;
+}
+
+int
+urkel_decompress(unsigned char *out,
+                 size_t *out_len,
+                 size_t out_size,
+                 const unsigned char *in,
+                 size_t in_len) {
+  const unsigned char *ip = in;
+  const unsigned char *iend = in + in_len;
+  unsigned char *op = out;
+  unsigned char *oend = out + out_size;
+
+  while (ip < iend) {
+    unsigned int token = *ip++;
+    size_t lit_len = token >> 4;
+    size_t match_len = token & 15;
+    size_t offset;
+
+    if (lit_len == 15 && !lz4_read_length(&ip, iend, &lit_len))
+      return 0;
+
+    if ((size_t)(iend - ip) < lit_len || (size_t)(oend - op) < lit_len)
+      return 0;
+
+    if (lit_len > 0)
+      memcpy(op, ip, lit_len);
+
+    ip += lit_len;
+    op += lit_len;
+
+    if (ip == iend)
+      break;
+
+    if (iend - ip < 2)
+      return 0;
+
+    offset = urkel_read16(ip);
+    ip += 2;
+
+    if (offset == 0 || offset > (size_t)(op - out))
+      return 0;
+
+    if (match_len == 15 && !lz4_read_length(&ip, iend, &match_len))
+      return 0;
+
+    match_len += LZ4_MIN_MATCH;
+
+    if ((size_t)(oend - op) < match_len)
+      return 0;
+
+    /* Byte by byte: the match may overlap the output. */
+    while (match_len--) {
+      *op = *(op - offset);
+      op++;
+    }
+  }
+
+  *out_len = op - out;
+
+  return 1;
+}
@@ -0,0 +1,30 @@
+/*!
+ * compress.h - value compression for liburkel
+ * Copyright (c) 2020, Christopher Jeffrey (MIT License).
+ * https://github.com/handshake-org/liburkel
+ */
+
+#ifndef _URKEL_COMPRESS_H
+#define _URKEL_COMPRESS_H
+
+#include <stddef.h>
+#include "internal.h"
+
+/*
+ * Compression
+ */
+
+size_t
+urkel_compress(unsigned char *out,
+               size_t out_size,
+               const unsigned char *in,
+               size_t in_len);
+
+int
+urkel_decompress(unsigned char *out,
+                 size_t *out_len,
+                 size_t out_size,
+                 const unsigned char *in,
+                 size_t in_len);
+
+#endif /* _URKEL_COMPRESS_H */
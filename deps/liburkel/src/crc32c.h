@@ -0,0 +1,20 @@
+/*!
+ * crc32c.h - crc32c for liburkel
+ * Copyright (c) 2020, Christopher Jeffrey (MIT License).
+ * https://github.com/handshake-org/liburkel
+ */
+
+#ifndef _URKEL_CRC32C_H
+#define _URKEL_CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC32C
+ */
+
+uint32_t
+urkel_crc32c(const unsigned char *data, size_t len);
+
+#endif /* _URKEL_CRC32C_H */
@@ -0,0 +1,159 @@
+/*!
+ * filter.c - key filter for liburkel
+ * Copyright (c) 2020, Christopher Jeffrey (MIT License).
+ * https://github.com/handshake-org/liburkel
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "filter.h"
+#include "internal.h"
+#include "util.h"
+
+/*
+ * Blocked Bloom Filter
+ *
+ * Every key maps to a single 512 bit block
+ * and sets FILTER_HASHES bits within it, so
+ * a lookup touches exactly one cache line.
+ *
+ * The filter is sized for ~1% false positives
+ * at `capacity` keys. Keys are never removed;
+ * the filter is a superset of the keys it has
+ * seen and is rebuilt by the store when needed.
+ */
+
+#define FILTER_BITS_PER_KEY 10
+#define FILTER_HASHES 7
+#define FILTER_BLOCK_BITS (URKEL_FILTER_BLOCK * 8)
+#define FILTER_HEADER_SIZE 16
+
+static size_t
+urkel_filter_index(const urkel_filter_t *filter,
+                   const unsigned char *key,
+                   uint32_t *a,
+                   uint32_t *b) {
+  uint32_t h1 = urkel_murmur3(key, URKEL_KEY_SIZE, 0xfba4c795);
+  uint32_t h2 = urkel_murmur3(key, URKEL_KEY_SIZE, 0x6c078965);
+
+  *a = h2 & (FILTER_BLOCK_BITS - 1);
+  *b = (h2 >> 9) | 1;
+
+  return h1 % filter->length;
+}
+
+void
+urkel_filter_init(urkel_filter_t *filter, size_t capacity) {
+  size_t bits;
+
+  if (capacity < URKEL_FILTER_MIN_KEYS)
+    capacity = URKEL_FILTER_MIN_KEYS;
+
+  bits = capacity * FILTER_BITS_PER_KEY;
+
+  filter->length = (bits + FILTER_BLOCK_BITS - 1) / FILTER_BLOCK_BITS;
+  filter->blocks = checked_malloc(filter->length * URKEL_FILTER_BLOCK);
+  filter->count = 0;
+  filter->capacity = capacity;
+
+  memset(filter->blocks, 0, filter->length * URKEL_FILTER_BLOCK);
+}
+
+void
+urkel_filter_clear(urkel_filter_t *filter) {
+  if (filter->blocks != NULL)
+    free(filter->blocks);
+
+  filter->blocks = NULL;
+  filter->length = 0;
+  filter->count = 0;
+  filter->capacity = 0;
+}
+
+void
+urkel_filter_add(urkel_filter_t *filter, const unsigned char *key) {
+  uint32_t a, b;
+  size_t index = urkel_filter_index(filter, key, &a, &b);
+  unsigned char *block = filter->blocks + index * URKEL_FILTER_BLOCK;
+  int i;
+
+  for (i = 0; i < FILTER_HASHES; i++) {
+    uint32_t bit = (a + i * b) & (FILTER_BLOCK_BITS - 1);
+
+    block[bit >> 3] |= 1 << (bit & 7);
+  }
+
+  filter->count += 1;
+}
+
+int
+urkel_filter_has(const urkel_filter_t *filter, const unsigned char *key) {
+  uint32_t a, b;
+  size_t index = urkel_filter_index(filter, key, &a, &b);
+  const unsigned char *block = filter->blocks + index * URKEL_FILTER_BLOCK;
+  int i;
+
+  for (i = 0; i < FILTER_HASHES; i++) {
+    uint32_t bit = (a + i * b) & (FILTER_BLOCK_BITS - 1);
+
+    if (!(block[bit >> 3] & (1 << (bit & 7))))
+      return 0;
+  }
+
+  return 1;
+}
+
+int
+urkel_filter_full(const urkel_filter_t *filter) {
+  return filter->count > filter->capacity;
+}
+
+size_t
+urkel_filter_size(const urkel_filter_t *filter) {
+  return FILTER_HEADER_SIZE + filter->length * URKEL_FILTER_BLOCK;
+}
+
+unsigned char *
+urkel_filter_write(const urkel_filter_t *filter, unsigned char *data) {
+  size_t size = filter->length * URKEL_FILTER_BLOCK;
+
+  data = urkel_write64(data, filter->count);
+  data = urkel_write64(data, filter->capacity);
+  data = urkel_write(data, filter->blocks, size);
+
+  return data;
+}
+
+int
+urkel_filter_read(urkel_filter_t *filter,
+                  const unsigned char *data,
+                  size_t len) {
+  uint64_t count, capacity;
+  urkel_filter_t tmp;
+
+  if (len < FILTER_HEADER_SIZE)
+    return 0;
+
+  count = urkel_read64(data + 0);
+  capacity = urkel_read64(data + 8);
+
+  if (capacity < URKEL_FILTER_MIN_KEYS || capacity > (SIZE_MAX >> 5))
+    return 0;
+
+  urkel_filter_init(&tmp, capacity);
+
+  if (len != urkel_filter_size(&tmp)) {
+    urkel_filter_clear(&tmp);
+    return 0;
+  }
+
+  memcpy(tmp.blocks, data + FILTER_HEADER_SIZE,
+         tmp.length * URKEL_FILTER_BLOCK);
+
+  tmp.count = count;
+
+  *filter = tmp;
+
+  return 1;
+}
@@ -0,0 +1,62 @@
+/*!
+ * filter.h - key filter for liburkel
+ * Copyright (c) 2020, Christopher Jeffrey (MIT License).
+ * https://github.com/handshake-org/liburkel
+ */
+
+#ifndef _URKEL_FILTER_H
+#define _URKEL_FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "internal.h"
+
+/*
+ * Defines
+ */
+
+#define URKEL_FILTER_BLOCK 64 /* 512 bit blocks (one cache line). */
+#define URKEL_FILTER_MIN_KEYS 4096
+
+/*
+ * Structs
+ */
+
+typedef struct urkel_filter_s {
+  unsigned char *blocks;
+  size_t length; /* Number of blocks. */
+  size_t count; /* Keys added since the last rebuild. */
+  size_t capacity; /* Keys the filter was sized for. */
+} urkel_filter_t;
+
+/*
+ * Filter
+ */
+
+void
+urkel_filter_init(urkel_filter_t *filter, size_t capacity);
+
+void
+urkel_filter_clear(urkel_filter_t *filter);
+
+void
+urkel_filter_add(urkel_filter_t *filter, const unsigned char *key);
+
+int
+urkel_filter_has(const urkel_filter_t *filter, const unsigned char *key);
+
+int
+urkel_filter_full(const urkel_filter_t *filter);
+
+size_t
+urkel_filter_size(const urkel_filter_t *filter);
+
+unsigned char *
+urkel_filter_write(const urkel_filter_t *filter, unsigned char *data);
+
+int
+urkel_filter_read(urkel_filter_t *filter,
+                  const unsigned char *data,
+                  size_t len);
+
+#endif /* _URKEL_FILTER_H */
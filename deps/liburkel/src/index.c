@@ -0,0 +1,527 @@
+/*!
+ * index.c - key index for liburkel
+ * Copyright (c) 2020, Christopher Jeffrey (MIT License).
+ * https://github.com/handshake-org/liburkel
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "index.h"
+#include "internal.h"
+#include "io.h"
+#include "nodes.h"
+#include "util.h"
+
+/*
+ * On-disk Hash Table
+ *
+ * Maps leaf keys to the pointer of their leaf node. The
+ * file is a header page followed by `buckets` pages of
+ * 40 byte slots (key, pointer, state). A key hashes to a
+ * page and probes linearly into the following pages when
+ * it is full, so a lookup is almost always a single read.
+ *
+ * Removals leave tombstones behind. The table is rebuilt
+ * with twice the live entries once it is 3/4 used.
+ *
+ * The header records the root the index describes and
+ * whether it was closed cleanly. An index which was not
+ * closed cleanly is never trusted.
+ */
+
+#define INDEX_MAGIC 0x6d6b6964
+#define INDEX_SLOT_SIZE (URKEL_KEY_SIZE + URKEL_PTR_SIZE + 1)
+#define INDEX_SLOTS (URKEL_INDEX_PAGE / INDEX_SLOT_SIZE)
+#define INDEX_HEADER_SIZE (4 + 1 + URKEL_HASH_SIZE + 24)
+#define INDEX_MIN_BUCKETS 16
+#define INDEX_SCAN_PAGES 64
+#define INDEX_EMPTY 0
+#define INDEX_LIVE 1
+#define INDEX_DEAD 2
+
+typedef struct urkel_index_page_s {
+  unsigned char data[URKEL_INDEX_PAGE];
+  uint64_t page;
+  int valid;
+  int dirty;
+} urkel_index_page_t;
+
+/*
+ * Helpers
+ */
+
+static uint64_t
+urkel_index_bucket(const urkel_index_t *idx, const unsigned char *key) {
+  return urkel_murmur3(key, URKEL_KEY_SIZE, 0x8d5a2e61) % idx->buckets;
+}
+
+static uint64_t
+urkel_index_capacity(const urkel_index_t *idx) {
+  return idx->buckets * INDEX_SLOTS;
+}
+
+static int64_t
+urkel_index_offset(uint64_t bucket) {
+  return (int64_t)(bucket + 1) * URKEL_INDEX_PAGE;
+}
+
+static int
+urkel_index_write_header(const urkel_index_t *idx, int clean) {
+  unsigned char data[INDEX_HEADER_SIZE + 20];
+  unsigned char *raw = data;
+
+  raw = urkel_write32(raw, INDEX_MAGIC);
+  raw = urkel_write8(raw, clean);
+  raw = urkel_write(raw, idx->root, URKEL_HASH_SIZE);
+  raw = urkel_write64(raw, idx->buckets);
+  raw = urkel_write64(raw, idx->count);
+  raw = urkel_write64(raw, idx->used);
+  raw = urkel_checksum(raw, data, raw - data, idx->key);
+
+  return urkel_fs_pwrite(idx->fd, data, raw - data, 0);
+}
+
+static int
+urkel_index_read_header(urkel_index_t *idx) {
+  unsigned char data[INDEX_HEADER_SIZE + 20];
+  unsigned char expect[20];
+  const unsigned char *raw = data;
+
+  if (!urkel_fs_pread(idx->fd, data, sizeof(data), 0))
+    return 0;
+
+  urkel_checksum(expect, data, INDEX_HEADER_SIZE, idx->key);
+
+  if (memcmp(expect, data + INDEX_HEADER_SIZE, 20) != 0)
+    return 0;
+
+  if (urkel_read32(raw) != INDEX_MAGIC)
+    return 0;
+
+  if (urkel_read8(raw + 4) != 1)
+    return 0;
+
+  raw += 5;
+
+  memcpy(idx->root, raw, URKEL_HASH_SIZE);
+  raw += URKEL_HASH_SIZE;
+
+  idx->buckets = urkel_read64(raw + 0);
+  idx->count = urkel_read64(raw + 8);
+  idx->used = urkel_read64(raw + 16);
+
+  if (idx->buckets < INDEX_MIN_BUCKETS || idx->buckets > 0xffffffff)
+    return 0;
+
+  if (idx->count > idx->used || idx->used > urkel_index_capacity(idx))
+    return 0;
+
+  return 1;
+}
+
+static int
+urkel_index_load(const urkel_index_t *idx,
+                 urkel_index_page_t *page,
+                 uint64_t bucket) {
+  if (page->valid && page->page == bucket)
+    return 1;
+
+  if (page->dirty) {
+    if (!urkel_fs_pwrite(idx->fd, page->data, URKEL_INDEX_PAGE,
+                         urkel_index_offset(page->page))) {
+      return 0;
+    }
+  }
+
+  page->valid = 0;
+  page->dirty = 0;
+
+  if (!urkel_fs_pread(idx->fd, page->data, URKEL_INDEX_PAGE,
+                      urkel_index_offset(bucket))) {
+    return 0;
+  }
+
+  page->page = bucket;
+  page->valid = 1;
+
+  return 1;
+}
+
+static int
+urkel_index_store(const urkel_index_t *idx, urkel_index_page_t *page) {
+  if (!page->dirty)
+    return 1;
+
+  if (!urkel_fs_pwrite(idx->fd, page->data, URKEL_INDEX_PAGE,
+                       urkel_index_offset(page->page))) {
+    return 0;
+  }
+
+  page->dirty = 0;
+
+  return 1;
+}
+
+static void
+urkel_index_set(urkel_index_page_t *page,
+                size_t slot,
+                const urkel_index_entry_t *entry) {
+  unsigned char *raw = page->data + slot * INDEX_SLOT_SIZE;
+
+  raw = urkel_write(raw, entry->key, URKEL_KEY_SIZE);
+  raw = urkel_pointer_write(&entry->ptr, raw);
+  raw = urkel_write8(raw, INDEX_LIVE);
+
+  page->dirty = 1;
+}
+
+static int
+urkel_index_put(urkel_index_t *idx,
+                urkel_index_page_t *page,
+                const urkel_index_entry_t *entry) {
+  uint64_t bucket = entry->bucket;
+  uint64_t dead_bucket = 0;
+  size_t dead_slot = 0;
+  int dead = 0;
+  uint64_t i;
+  size_t j;
+
+  for (i = 0; i < idx->buckets; i++) {
+    if (!urkel_index_load(idx, page, bucket))
+      return 0;
+
+    for (j = 0; j < INDEX_SLOTS; j++) {
+      unsigned char *raw = page->data + j * INDEX_SLOT_SIZE;
+      unsigned int state = raw[INDEX_SLOT_SIZE - 1];
+
+      if (state == INDEX_EMPTY)
+        goto insert;
+
+      if (state == INDEX_DEAD) {
+        if (!dead) {
+          dead_bucket = bucket;
+          dead_slot = j;
+          dead = 1;
+        }
+        continue;
+      }
+
+      if (memcmp(raw, entry->key, URKEL_KEY_SIZE) != 0)
+        continue;
+
+      if (entry->remove) {
+        raw[INDEX_SLOT_SIZE - 1] = INDEX_DEAD;
+        page->dirty = 1;
+        idx->count -= 1;
+      } else {
+        urkel_index_set(page, j, entry);
+      }
+
+      return 1;
+    }
+
+    bucket = (bucket + 1) % idx->buckets;
+  }
+
+  /* No empty slot anywhere (cannot happen below the load limit). */
+  if (!dead)
+    return entry->remove;
+
+insert:
+  if (entry->remove)
+    return 1;
+
+  if (dead) {
+    if (!urkel_index_load(idx, page, dead_bucket))
+      return 0;
+
+    j = dead_slot;
+  } else {
+    idx->used += 1;
+  }
+
+  urkel_index_set(page, j, entry);
+
+  idx->count += 1;
+
+  return 1;
+}
+
+static int
+urkel_index_compare(const void *a, const void *b) {
+  const urkel_index_entry_t *x = a;
+  const urkel_index_entry_t *y = b;
+
+  if (x->bucket != y->bucket)
+    return x->bucket < y->bucket ? -1 : 1;
+
+  if (x->seq != y->seq)
+    return x->seq < y->seq ? -1 : 1;
+
+  return 0;
+}
+
+static int
+urkel_index_write(urkel_index_t *idx,
+                  urkel_index_entry_t *entries,
+                  size_t len) {
+  urkel_index_page_t *page = checked_malloc(sizeof(urkel_index_page_t));
+  int ret = 0;
+  size_t i;
+
+  page->valid = 0;
+  page->dirty = 0;
+
+  /* Visit pages in order, keeping per-key order intact. */
+  for (i = 0; i < len; i++) {
+    entries[i].seq = i;
+    entries[i].bucket = urkel_index_bucket(idx, entries[i].key);
+  }
+
+  if (len > 1)
+    qsort(entries, len, sizeof(urkel_index_entry_t), urkel_index_compare);
+
+  for (i = 0; i < len; i++) {
+    if (!urkel_index_put(idx, page, &entries[i]))
+      goto fail;
+  }
+
+  if (!urkel_index_store(idx, page))
+    goto fail;
+
+  ret = 1;
+fail:
+  free(page);
+  return ret;
+}
+
+static int
+urkel_index_resize(urkel_index_t *idx, uint64_t capacity) {
+  unsigned char *data = checked_malloc(INDEX_SCAN_PAGES * URKEL_INDEX_PAGE);
+  urkel_index_entry_t *entries;
+  char path[URKEL_PATH_MAX + 2];
+  size_t len = strlen(idx->path);
+  urkel_index_t tmp;
+  uint64_t bucket = 0;
+  int ret = 0;
+
+  entries = checked_malloc(INDEX_SCAN_PAGES * INDEX_SLOTS
+                         * sizeof(urkel_index_entry_t));
+
+  memcpy(path, idx->path, len);
+  memcpy(path + len, "~", 2);
+
+  if (!urkel_index_create(&tmp, path, idx->key, capacity))
+    goto fail;
+
+  while (bucket < idx->buckets) {
+    uint64_t pages = idx->buckets - bucket;
+    size_t count = 0;
+    size_t i;
+
+    if (pages > INDEX_SCAN_PAGES)
+      pages = INDEX_SCAN_PAGES;
+
+    if (!urkel_fs_pread(idx->fd, data, pages * URKEL_INDEX_PAGE,
+                        urkel_index_offset(bucket))) {
+      goto done;
+    }
+
+    for (i = 0; i < pages * INDEX_SLOTS; i++) {
+      const unsigned char *raw = data + (i / INDEX_SLOTS) * URKEL_INDEX_PAGE
+                                      + (i % INDEX_SLOTS) * INDEX_SLOT_SIZE;
+      urkel_index_entry_t *entry = &entries[count];
+
+      if (raw[INDEX_SLOT_SIZE - 1] != INDEX_LIVE)
+        continue;
+
+      memcpy(entry->key, raw, URKEL_KEY_SIZE);
+      urkel_pointer_read(&entry->ptr, raw + URKEL_KEY_SIZE);
+      entry->remove = 0;
+
+      count += 1;
+    }
+
+    if (!urkel_index_write(&tmp, entries, count))
+      goto done;
+
+    bucket += pages;
+  }
+
+  if (!urkel_fs_rename(path, idx->path))
+    goto done;
+
+  memcpy(tmp.path, idx->path, len + 1);
+  memcpy(tmp.root, idx->root, URKEL_HASH_SIZE);
+
+  urkel_fs_close(idx->fd);
+
+  *idx = tmp;
+
+  ret = 1;
+done:
+  if (!ret) {
+    urkel_index_close(&tmp, 0);
+    urkel_fs_unlink(path);
+  }
+fail:
+  free(entries);
+  free(data);
+  return ret;
+}
+
+/*
+ * Index
+ */
+
+int
+urkel_index_open(urkel_index_t *idx,
+                 const char *path,
+                 const unsigned char *key) {
+  size_t len = strlen(path);
+  urkel_stat_t st;
+
+  if (len > URKEL_PATH_MAX)
+    return 0;
+
+  memcpy(idx->path, path, len + 1);
+  memcpy(idx->key, key, URKEL_HASH_SIZE);
+
+  idx->fd = urkel_fs_open(path, URKEL_O_RDWR | URKEL_O_RANDOM, 0);
+
+  if (idx->fd == -1)
+    return 0;
+
+  if (!urkel_index_read_header(idx))
+    goto fail;
+
+  if (!urkel_fs_fstat(idx->fd, &st))
+    goto fail;
+
+  if ((uint64_t)st.st_size != (idx->buckets + 1) * URKEL_INDEX_PAGE)
+    goto fail;
+
+  /* Not trusted again until we close cleanly. */
+  if (!urkel_index_write_header(idx, 0))
+    goto fail;
+
+  if (!urkel_fs_fdatasync(idx->fd))
+    goto fail;
+
+  return 1;
+fail:
+  urkel_fs_close(idx->fd);
+  idx->fd = -1;
+  return 0;
+}
+
+int
+urkel_index_create(urkel_index_t *idx,
+                   const char *path,
+                   const unsigned char *key,
+                   uint64_t capacity) {
+  int flags = URKEL_O_RDWR | URKEL_O_CREAT | URKEL_O_TRUNC | URKEL_O_RANDOM;
+  size_t len = strlen(path);
+  uint64_t buckets;
+
+  if (len > URKEL_PATH_MAX)
+    return 0;
+
+  /* Start at half load. */
+  buckets = (capacity * 2 + INDEX_SLOTS - 1) / INDEX_SLOTS;
+
+  if (buckets < INDEX_MIN_BUCKETS)
+    buckets = INDEX_MIN_BUCKETS;
+
+  if (buckets > 0xffffffff)
+    return 0;
+
+  memcpy(idx->path, path, len + 1);
+  memcpy(idx->key, key, URKEL_HASH_SIZE);
+  memset(idx->root, 0, URKEL_HASH_SIZE);
+
+  idx->buckets = buckets;
+  idx->count = 0;
+  idx->used = 0;
+  idx->fd = urkel_fs_open(path, flags, 0640);
+
+  if (idx->fd == -1)
+    return 0;
+
+  if (!urkel_fs_ftruncate(idx->fd, urkel_index_offset(buckets))
+      || !urkel_index_write_header(idx, 0)) {
+    urkel_fs_close(idx->fd);
+    urkel_fs_unlink(path);
+    idx->fd = -1;
+    return 0;
+  }
+
+  return 1;
+}
+
+void
+urkel_index_close(urkel_index_t *idx, int clean) {
+  if (idx->fd == -1)
+    return;
+
+  if (clean) {
+    if (urkel_fs_fdatasync(idx->fd) && urkel_index_write_header(idx, 1))
+      urkel_fs_fdatasync(idx->fd);
+  }
+
+  urkel_fs_close(idx->fd);
+
+  idx->fd = -1;
+}
+
+int
+urkel_index_get(const urkel_index_t *idx,
+                urkel_pointer_t *ptr,
+                const unsigned char *key) {
+  unsigned char data[URKEL_INDEX_PAGE];
+  uint64_t bucket = urkel_index_bucket(idx, key);
+  uint64_t i;
+  size_t j;
+
+  for (i = 0; i < idx->buckets; i++) {
+    if (!urkel_fs_pread(idx->fd, data, URKEL_INDEX_PAGE,
+                        urkel_index_offset(bucket))) {
+      return -1;
+    }
+
+    for (j = 0; j < INDEX_SLOTS; j++) {
+      const unsigned char *raw = data + j * INDEX_SLOT_SIZE;
+      unsigned int state = raw[INDEX_SLOT_SIZE - 1];
+
+      if (state == INDEX_EMPTY)
+        return 0;
+
+      if (state != INDEX_LIVE)
+        continue;
+
+      if (memcmp(raw, key, URKEL_KEY_SIZE) == 0) {
+        urkel_pointer_read(ptr, raw + URKEL_KEY_SIZE);
+        return 1;
+      }
+    }
+
+    bucket = (bucket + 1) % idx->buckets;
+  }
+
+  return 0;
+}
+
+int
+urkel_index_apply(urkel_index_t *idx,
+                  urkel_index_entry_t *entries,
+                  size_t len) {
+  uint64_t limit = urkel_index_capacity(idx) / 4 * 3;
+
+  if (idx->used + len > limit) {
+    if (!urkel_index_resize(idx, idx->count + len))
+      return 0;
+  }
+
+  return urkel_index_write(idx, entries, len);
+}
@@ -0,0 +1,73 @@
+/*!
+ * index.h - key index for liburkel
+ * Copyright (c) 2020, Christopher Jeffrey (MIT License).
+ * https://github.com/handshake-org/liburkel
+ */
+
+#ifndef _URKEL_INDEX_H
+#define _URKEL_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "bits.h"
+#include "internal.h"
+#include "io.h"
+#include "nodes.h"
+
+/*
+ * Defines
+ */
+
+#define URKEL_INDEX_PAGE 4096
+
+/*
+ * Structs
+ */
+
+typedef struct urkel_index_s {
+  char path[URKEL_PATH_MAX + 1];
+  unsigned char key[URKEL_HASH_SIZE]; /* Checksum key. */
+  unsigned char root[URKEL_HASH_SIZE]; /* Root the index describes. */
+  int fd;
+  uint64_t buckets; /* Number of pages (excluding header). */
+  uint64_t count; /* Live entries. */
+  uint64_t used; /* Live entries and tombstones. */
+} urkel_index_t;
+
+typedef struct urkel_index_entry_s {
+  unsigned char key[URKEL_KEY_SIZE];
+  urkel_pointer_t ptr;
+  int remove;
+  size_t seq;
+  uint64_t bucket;
+} urkel_index_entry_t;
+
+/*
+ * Index
+ */
+
+int
+urkel_index_open(urkel_index_t *idx,
+                 const char *path,
+                 const unsigned char *key);
+
+int
+urkel_index_create(urkel_index_t *idx,
+                   const char *path,
+                   const unsigned char *key,
+                   uint64_t capacity);
+
+void
+urkel_index_close(urkel_index_t *idx, int clean);
+
+int
+urkel_index_get(const urkel_index_t *idx,
+                urkel_pointer_t *ptr,
+                const unsigned char *key);
+
+int
+urkel_index_apply(urkel_index_t *idx,
+                  urkel_index_entry_t *entries,
+                  size_t len);
+
+#endif /* _URKEL_INDEX_H */
@@ -7,6 +7,7 @@
 #ifndef _URKEL_INTERNAL_H
 #define _URKEL_INTERNAL_H
 
+#include <stdint.h>
 #include <stdlib.h>
 
 /*
@@ -114,6 +115,53 @@
 #define kh_inline URKEL_INLINE
 #define kh_unused URKEL_UNUSED
 
+/*
+ * Atomics
+ */
+
+/* Relaxed 64-bit counters: no ordering, only no lost updates. */
+#if URKEL_GNUC_PREREQ(4, 7) || __has_builtin(__atomic_fetch_add)
+#  define urkel_atomic_add(x, y) \
+    ((void)__atomic_fetch_add(x, y, __ATOMIC_RELAXED))
+#  define urkel_atomic_load(x) __atomic_load_n(x, __ATOMIC_RELAXED)
+#elif defined(_MSC_VER)
+#  include <intrin.h>
+#  define urkel_atomic_add(x, y) \
+    ((void)_InterlockedExchangeAdd64((volatile __int64 *)(x), (__int64)(y)))
+#  define urkel_atomic_load(x) \
+    ((uint64_t)_InterlockedOr64((volatile __int64 *)(x), 0))
+#else
+#  define urkel_atomic_add(x, y) ((void)(*(x) += (y)))
+#  define urkel_atomic_load(x) (*(x))
+#endif
+
+/* Raise `*x` to `y` if it is lower. */
+static URKEL_INLINE void
+urkel_atomic_max(uint64_t *x, uint64_t y) {
+  uint64_t cur = urkel_atomic_load(x);
+
+  while (cur < y) {
+#if URKEL_GNUC_PREREQ(4, 7) || __has_builtin(__atomic_compare_exchange_n)
+    /* A failed swap reloads `cur`. */
+    if (__atomic_compare_exchange_n(x, &cur, y, 1, __ATOMIC_RELAXED,
+                                    __ATOMIC_RELAXED)) {
+      break;
+    }
+#elif defined(_MSC_VER)
+    uint64_t old = (uint64_t)_InterlockedCompareExchange64(
+      (volatile __int64 *)x, (__int64)y, (__int64)cur);
+
+    if (old == cur)
+      break;
+
+    cur = old;
+#else
+    *x = y;
+    break;
+#endif
+  }
+}
+
 /*
  * Helpers
  */
@@ -10,6 +10,8 @@
 #  include "io_posix.c"
 #endif
 
+#include "internal.h"
+
 /*
  * High-level Calls
  */
@@ -73,3 +75,42 @@ urkel_fs_close_lock(int fd) {
   urkel_fs_flock(fd, URKEL_LOCK_UN);
   urkel_fs_close(fd);
 }
+
+/*
+ * Lock Statistics
+ */
+
+static uint64_t
+urkel_lockstat_clock(void) {
+  urkel_timespec_t ts;
+
+  urkel_time_get(&ts);
+
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t
+urkel_lockstat_start(const urkel_lockstat_t *stat) {
+  /* Only called once a try-lock has failed. */
+  if (stat == NULL)
+    return 0;
+
+  return urkel_lockstat_clock();
+}
+
+void
+urkel_lockstat_record(urkel_lockstat_t *stat, uint64_t start) {
+  uint64_t now, wait;
+
+  if (stat == NULL)
+    return;
+
+  now = urkel_lockstat_clock();
+
+  /* The clock is not monotonic. */
+  wait = now > start ? now - start : 0;
+
+  urkel_atomic_add(&stat->contended, 1);
+  urkel_atomic_add(&stat->wait_time, wait);
+  urkel_atomic_max(&stat->max_wait, wait);
+}
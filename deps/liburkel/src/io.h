@@ -30,6 +30,7 @@
 #define URKEL_O_SEQUENTIAL (1 << 13)
 #define URKEL_O_RANDOM     (1 << 14)
 #define URKEL_O_MMAP       (1 << 15)
+#define URKEL_O_DIRECT     (1 << 16)
 
 #define URKEL_S_IFMT   00170000
 #define URKEL_S_IFBLK  0060000
@@ -127,10 +128,17 @@ typedef struct urkel_dirent_s {
   char d_name[256];
 } urkel_dirent_t;
 
+typedef struct urkel_iovec_s {
+  const void *base;
+  size_t len;
+} urkel_iovec_t;
+
 typedef struct urkel_file_s {
   int fd;
+  int wfd; /* Unbuffered write descriptor, or -1. */
   uint32_t index;
   uint64_t size;
+  uint64_t alloc;
   void *base;
   int mapped;
   char _storage[32];
@@ -138,9 +146,21 @@ typedef struct urkel_file_s {
 
 struct urkel_mutex_s;
 struct urkel_rwlock_s;
+struct urkel_cond_s;
+struct urkel_thread_s;
 
 typedef struct urkel_mutex_s urkel_mutex_t;
 typedef struct urkel_rwlock_s urkel_rwlock_t;
+typedef struct urkel_cond_s urkel_cond_t;
+typedef struct urkel_thread_s urkel_thread_t;
+
+typedef void urkel_thread_f(void *arg);
+
+typedef struct urkel_lockstat_s {
+  uint64_t contended; /* Acquisitions which had to wait. */
+  uint64_t wait_time; /* Total time waited, in microseconds. */
+  uint64_t max_wait;
+} urkel_lockstat_t;
 
 /*
  * Filesystem
@@ -194,6 +214,9 @@ urkel_fs_read(int fd, void *dst, size_t len);
 int
 urkel_fs_write(int fd, const void *src, size_t len);
 
+int
+urkel_fs_writev(int fd, const urkel_iovec_t *iov, size_t count);
+
 int
 urkel_fs_pread(int fd, void *dst, size_t len, int64_t pos);
 
@@ -228,6 +251,15 @@ urkel_file_pread(const urkel_file_t *file, void *dst, size_t len, uint64_t pos);
 int
 urkel_file_write(urkel_file_t *file, const void *src, size_t len);
 
+int
+urkel_file_writev(urkel_file_t *file, const urkel_iovec_t *iov, size_t count);
+
+int
+urkel_file_allocate(urkel_file_t *file, uint64_t size);
+
+int
+urkel_file_release(urkel_file_t *file);
+
 int
 urkel_file_sync(const urkel_file_t *file);
 
@@ -287,6 +319,9 @@ urkel_rwlock_destroy(urkel_rwlock_t *mtx);
 void
 urkel_rwlock_wrlock(urkel_rwlock_t *mtx);
 
+int
+urkel_rwlock_trywrlock(urkel_rwlock_t *mtx);
+
 void
 urkel_rwlock_wrunlock(urkel_rwlock_t *mtx);
 
@@ -296,6 +331,50 @@ urkel_rwlock_rdlock(urkel_rwlock_t *mtx);
 void
 urkel_rwlock_rdunlock(urkel_rwlock_t *mtx);
 
+void
+urkel_rwlock_watch(urkel_rwlock_t *mtx,
+                   urkel_lockstat_t *rd,
+                   urkel_lockstat_t *wr);
+
+/*
+ * Lock Statistics
+ */
+
+uint64_t
+urkel_lockstat_start(const urkel_lockstat_t *stat);
+
+void
+urkel_lockstat_record(urkel_lockstat_t *stat, uint64_t start);
+
+/*
+ * Condition Variable
+ */
+
+urkel_cond_t *
+urkel_cond_create(void);
+
+void
+urkel_cond_destroy(urkel_cond_t *cond);
+
+void
+urkel_cond_signal(urkel_cond_t *cond);
+
+void
+urkel_cond_wait(urkel_cond_t *cond, urkel_mutex_t *mtx);
+
+int
+urkel_cond_timedwait(urkel_cond_t *cond, urkel_mutex_t *mtx, uint64_t msec);
+
+/*
+ * Thread
+ */
+
+urkel_thread_t *
+urkel_thread_create(urkel_thread_f *start, void *arg);
+
+void
+urkel_thread_join(urkel_thread_t *thread);
+
 /*
  * Time
  */
@@ -64,6 +64,7 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #ifdef HAVE_MMAP
 #include <sys/mman.h>
 #endif
@@ -98,6 +99,7 @@
 #endif
 
 #include "io.h"
+#include "probes.h"
 
 /*
  * Structs
@@ -114,10 +116,28 @@ typedef struct urkel_mutex_s {
 typedef struct urkel_rwlock_s {
 #if defined(HAVE_PTHREAD)
   pthread_rwlock_t handle;
+#endif
+  urkel_lockstat_t *rd; /* Contention stats (see urkel_rwlock_watch). */
+  urkel_lockstat_t *wr;
+} urkel__rwlock_t;
+
+typedef struct urkel_cond_s {
+#if defined(HAVE_PTHREAD)
+  pthread_cond_t handle;
 #else
   void *unused;
 #endif
-} urkel__rwlock_t;
+} urkel__cond_t;
+
+typedef struct urkel_thread_s {
+#if defined(HAVE_PTHREAD)
+  pthread_t handle;
+  urkel_thread_f *start;
+  void *arg;
+#else
+  void *unused;
+#endif
+} urkel__thread_t;
 
 /*
  * Filesystem
@@ -187,6 +207,11 @@ urkel_fs__flags_api_to_os(int flags) {
     out |= O_TRUNC;
 #endif
 
+#ifdef O_DIRECT
+  if (flags & URKEL_O_DIRECT)
+    out |= O_DIRECT;
+#endif
+
   return out;
 }
 
@@ -935,6 +960,63 @@ urkel_fs_write(int fd, const void *src, size_t len) {
   return len == 0;
 }
 
+int
+urkel_fs_writev(int fd, const urkel_iovec_t *iov, size_t count) {
+  struct iovec vec[64];
+  size_t off = 0;
+  size_t i = 0;
+  ssize_t nwrite;
+
+  for (;;) {
+    size_t len = 0;
+    int n = 0;
+
+    while (i < count && iov[i].len == off) {
+      i += 1;
+      off = 0;
+    }
+
+    if (i == count)
+      break;
+
+    while (n < 64 && i + n < count) {
+      const unsigned char *base = iov[i + n].base;
+      size_t skip = n == 0 ? off : 0;
+
+      vec[n].iov_base = (void *)(base + skip);
+      vec[n].iov_len = iov[i + n].len - skip;
+
+      len += vec[n].iov_len;
+      n += 1;
+    }
+
+    do {
+      nwrite = writev(fd, vec, n);
+    } while (nwrite < 0 && (errno == EINTR || errno == EAGAIN));
+
+    if (nwrite <= 0)
+      break;
+
+    if ((size_t)nwrite > len)
+      abort();
+
+    while (nwrite > 0) {
+      size_t left = iov[i].len - off;
+
+      if ((size_t)nwrite < left) {
+        off += nwrite;
+        break;
+      }
+
+      nwrite -= (ssize_t)left;
+      i += 1;
+      off = 0;
+    }
+  }
+
+  return i == count;
+}
+
 int
 urkel_fs_pread(int fd, void *dst, size_t len, int64_t pos) {
   unsigned char *buf = dst;
@@ -1080,7 +1162,7 @@ urkel_file_open(const char *name, int flags, uint32_t mode) {
   struct stat st;
   int fd;
 
-  fd = urkel_fs_open(name, flags, mode);
+  fd = urkel_fs_open(name, flags & ~URKEL_O_DIRECT, mode);
 
   if (fd == -1)
     return NULL;
@@ -1098,8 +1180,10 @@ urkel_file_open(const char *name, int flags, uint32_t mode) {
   }
 
   file->fd = fd;
+  file->wfd = -1;
   file->index = 0;
   file->size = st.st_size;
+  file->alloc = 0;
   file->base = NULL;
   file->mapped = 0;
 
@@ -1125,6 +1209,23 @@ urkel_file_open(const char *name, int flags, uint32_t mode) {
   }
 #endif
 
+  /* Writes bypass the page cache through a second descriptor,
+     leaving reads buffered and free of alignment rules. Where
+     the filesystem refuses, writes simply stay buffered. */
+#if defined(O_DIRECT)
+  if (flags & URKEL_O_DIRECT)
+    file->wfd = urkel_fs_open(name, flags & ~URKEL_O_CREAT, 0);
+#elif defined(__APPLE__) && defined(F_NOCACHE)
+  if (flags & URKEL_O_DIRECT) {
+    file->wfd = urkel_fs_open(name, flags & ~URKEL_O_CREAT, 0);
+
+    if (file->wfd != -1 && fcntl(file->wfd, F_NOCACHE, 1) == -1) {
+      close(file->wfd);
+      file->wfd = -1;
+    }
+  }
+#endif
+
   return file;
 }
 
@@ -1152,6 +1253,22 @@ urkel_file_pread(const urkel_file_t *file,
 
 int
 urkel_file_write(urkel_file_t *file, const void *src, size_t len) {
+  urkel_iovec_t iov;
+
+  iov.base = src;
+  iov.len = len;
+
+  return urkel_file_writev(file, &iov, 1);
+}
+
+int
+urkel_file_writev(urkel_file_t *file, const urkel_iovec_t *iov, size_t count) {
+  size_t len = 0;
+  size_t i;
+
+  for (i = 0; i < count; i++)
+    len += iov[i].len;
+
   if (len == 0)
     return 1;
 
@@ -1164,7 +1281,7 @@ urkel_file_write(urkel_file_t *file, const void *src, size_t len) {
   }
 #endif
 
-  if (!urkel_fs_write(file->fd, src, len))
+  if (!urkel_fs_writev(file->wfd != -1 ? file->wfd : file->fd, iov, count))
     return 0;
 
   file->size += len;
@@ -1183,6 +1300,57 @@ urkel_file_write(urkel_file_t *file, const void *src, size_t len) {
   return 1;
 }
 
+int
+urkel_file_allocate(urkel_file_t *file, uint64_t size) {
+  /* Reserve blocks up to `size` without moving the end of file. */
+  uint64_t start = file->alloc > file->size ? file->alloc : file->size;
+
+  if (size <= start)
+    return 1;
+
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+  if (fallocate(file->fd, FALLOC_FL_KEEP_SIZE, start, size - start) != 0)
+    return 0;
+#elif defined(__APPLE__) && defined(F_PREALLOCATE)
+  {
+    fstore_t fst;
+
+    fst.fst_flags = F_ALLOCATECONTIG;
+    fst.fst_posmode = F_PEOFPOSMODE;
+    fst.fst_offset = 0;
+    fst.fst_length = size - start;
+    fst.fst_bytesalloc = 0;
+
+    if (fcntl(file->fd, F_PREALLOCATE, &fst) == -1) {
+      fst.fst_flags = F_ALLOCATEALL;
+
+      if (fcntl(file->fd, F_PREALLOCATE, &fst) == -1)
+        return 0;
+    }
+  }
+#else
+  return 0;
+#endif
+
+  file->alloc = size;
+
+  return 1;
+}
+
+int
+urkel_file_release(urkel_file_t *file) {
+  /* Truncating to the current size frees the reserved blocks. */
+  if (file->alloc <= file->size)
+    return 1;
+
+  if (ftruncate(file->fd, file->size) != 0)
+    return 0;
+
+  file->alloc = 0;
+
+  return 1;
+}
+
 int
 urkel_file_sync(const urkel_file_t *file) {
   return urkel_fs_fsync(file->fd);
@@ -1205,6 +1373,9 @@ urkel_file_close(urkel_file_t *file) {
   if (file->fd != -1)
     ret &= (close(file->fd) == 0);
 
+  if (file->wfd != -1)
+    ret &= (close(file->wfd) == 0);
+
   free(file);
 
   return ret;
@@ -1478,6 +1649,9 @@ urkel_rwlock_create(void) {
     abort();
 #endif
 
+  mtx->rd = NULL;
+  mtx->wr = NULL;
+
   return mtx;
 }
 
@@ -1493,10 +1667,44 @@ urkel_rwlock_destroy(urkel__rwlock_t *mtx) {
 
 void
 urkel_rwlock_wrlock(urkel__rwlock_t *mtx) {
+#ifdef HAVE_PTHREAD
+  uint64_t start;
+
+  URKEL_PROBE2(rwlock__wait, mtx, 1);
+
+  /* Only contended acquisitions are timed. */
+  if (mtx->wr == NULL || pthread_rwlock_trywrlock(&mtx->handle) != 0) {
+    start = urkel_lockstat_start(mtx->wr);
+
+    if (pthread_rwlock_wrlock(&mtx->handle) != 0)
+      abort();
+
+    urkel_lockstat_record(mtx->wr, start);
+  }
+
+  URKEL_PROBE2(rwlock__acquire, mtx, 1);
+#else
   (void)mtx;
+#endif
+}
+
+int
+urkel_rwlock_trywrlock(urkel__rwlock_t *mtx) {
 #ifdef HAVE_PTHREAD
-  if (pthread_rwlock_wrlock(&mtx->handle) != 0)
+  int err = pthread_rwlock_trywrlock(&mtx->handle);
+
+  if (err == EBUSY || err == EDEADLK)
+    return 0;
+
+  if (err != 0)
     abort();
+
+  return 1;
+#else
+  /* Without threads we cannot tell whether
+     the caller already holds the lock. */
+  (void)mtx;
+  return 0;
 #endif
 }
 
@@ -1511,10 +1719,24 @@ urkel_rwlock_wrunlock(urkel__rwlock_t *mtx) {
 
 void
 urkel_rwlock_rdlock(urkel__rwlock_t *mtx) {
-  (void)mtx;
 #ifdef HAVE_PTHREAD
-  if (pthread_rwlock_rdlock(&mtx->handle) != 0)
-    abort();
+  uint64_t start;
+
+  URKEL_PROBE2(rwlock__wait, mtx, 0);
+
+  /* Only contended acquisitions are timed. */
+  if (mtx->rd == NULL || pthread_rwlock_tryrdlock(&mtx->handle) != 0) {
+    start = urkel_lockstat_start(mtx->rd);
+
+    if (pthread_rwlock_rdlock(&mtx->handle) != 0)
+      abort();
+
+    urkel_lockstat_record(mtx->rd, start);
+  }
+
+  URKEL_PROBE2(rwlock__acquire, mtx, 0);
+#else
+  (void)mtx;
 #endif
 }
 
@@ -1527,6 +1749,152 @@ urkel_rwlock_rdunlock(urkel__rwlock_t *mtx) {
 #endif
 }
 
+void
+urkel_rwlock_watch(urkel__rwlock_t *mtx,
+                   urkel_lockstat_t *rd,
+                   urkel_lockstat_t *wr) {
+  mtx->rd = rd;
+  mtx->wr = wr;
+}
+
+/*
+ * Condition Variable
+ */
+
+urkel__cond_t *
+urkel_cond_create(void) {
+  urkel__cond_t *cond = malloc(sizeof(urkel__cond_t));
+
+  if (cond == NULL) {
+    abort();
+    return NULL;
+  }
+
+#ifdef HAVE_PTHREAD
+  if (pthread_cond_init(&cond->handle, NULL) != 0)
+    abort();
+#endif
+
+  return cond;
+}
+
+void
+urkel_cond_destroy(urkel__cond_t *cond) {
+#ifdef HAVE_PTHREAD
+  if (pthread_cond_destroy(&cond->handle) != 0)
+    abort();
+#endif
+
+  free(cond);
+}
+
+void
+urkel_cond_signal(urkel__cond_t *cond) {
+  (void)cond;
+#ifdef HAVE_PTHREAD
+  if (pthread_cond_signal(&cond->handle) != 0)
+    abort();
+#endif
+}
+
+void
+urkel_cond_wait(urkel__cond_t *cond, urkel__mutex_t *mtx) {
+  (void)cond;
+  (void)mtx;
+#ifdef HAVE_PTHREAD
+  if (pthread_cond_wait(&cond->handle, &mtx->handle) != 0)
+    abort();
+#endif
+}
+
+int
+urkel_cond_timedwait(urkel__cond_t *cond,
+                     urkel__mutex_t *mtx,
+                     uint64_t msec) {
+  /* Returns zero on timeout. */
+#ifdef HAVE_PTHREAD
+  struct timespec ts;
+  struct timeval tv;
+  uint64_t nsec;
+  int ret;
+
+  if (gettimeofday(&tv, NULL) != 0)
+    abort();
+
+  nsec = (uint64_t)tv.tv_usec * 1000 + (msec % 1000) * 1000000;
+
+  ts.tv_sec = tv.tv_sec + msec / 1000 + nsec / 1000000000;
+  ts.tv_nsec = nsec % 1000000000;
+
+  ret = pthread_cond_timedwait(&cond->handle, &mtx->handle, &ts);
+
+  if (ret == ETIMEDOUT)
+    return 0;
+
+  if (ret != 0)
+    abort();
+
+  return 1;
+#else
+  (void)cond;
+  (void)mtx;
+  (void)msec;
+  return 0;
+#endif
+}
+
+/*
+ * Thread
+ */
+
+#ifdef HAVE_PTHREAD
+static void *
+urkel_thread_run(void *ptr) {
+  urkel__thread_t *thread = ptr;
+
+  thread->start(thread->arg);
+
+  return NULL;
+}
+#endif
+
+urkel__thread_t *
+urkel_thread_create(urkel_thread_f *start, void *arg) {
+  /* Returns NULL if threads are unavailable. */
+#ifdef HAVE_PTHREAD
+  urkel__thread_t *thread = malloc(sizeof(urkel__thread_t));
+
+  if (thread == NULL) {
+    abort();
+    return NULL;
+  }
+
+  thread->start = start;
+  thread->arg = arg;
+
+  if (pthread_create(&thread->handle, NULL, urkel_thread_run, thread) != 0) {
+    free(thread);
+    return NULL;
+  }
+
+  return thread;
+#else
+  (void)start;
+  (void)arg;
+  return NULL;
+#endif
+}
+
+void
+urkel_thread_join(urkel__thread_t *thread) {
+#ifdef HAVE_PTHREAD
+  if (pthread_join(thread->handle, NULL) != 0)
+    abort();
+#endif
+
+  free(thread);
+}
+
 /*
  * Time
  */
@@ -57,8 +57,20 @@ typedef struct urkel_rwlock_s {
   unsigned int readers;
   CRITICAL_SECTION readers_lock;
   HANDLE write_semaphore;
+  urkel_lockstat_t *rd; /* Contention stats (see urkel_rwlock_watch). */
+  urkel_lockstat_t *wr;
 } urkel__rwlock_t;
 
+typedef struct urkel_cond_s {
+  HANDLE event; /* Auto-reset: wakes a single waiter. */
+} urkel__cond_t;
+
+typedef struct urkel_thread_s {
+  HANDLE handle;
+  urkel_thread_f *start;
+  void *arg;
+} urkel__thread_t;
+
 /*
  * Filesystem
  */
@@ -565,6 +577,18 @@ urkel_fs_write(int fd, const void *src, size_t len) {
   return len == 0;
 }
 
+int
+urkel_fs_writev(int fd, const urkel_iovec_t *iov, size_t count) {
+  size_t i;
+
+  for (i = 0; i < count; i++) {
+    if (!urkel_fs_write(fd, iov[i].base, iov[i].len))
+      return 0;
+  }
+
+  return 1;
+}
+
 int
 urkel_fs_pread(int fd, void *dst, size_t len, int64_t pos) {
   HANDLE handle = (HANDLE)_get_osfhandle(fd);
@@ -748,8 +772,10 @@ urkel_file_open(const char *name, int flags, uint32_t mode) {
     abort();
 
   file->fd = fd;
+  file->wfd = -1;
   file->index = 0;
   file->size = len.QuadPart;
+  file->alloc = 0;
   file->base = NULL;
   file->mapped = 0;
 
@@ -827,6 +853,22 @@ urkel_file_pread(const urkel_file_t *file,
 
 int
 urkel_file_write(urkel_file_t *file, const void *src, size_t len) {
+  urkel_iovec_t iov;
+
+  iov.base = src;
+  iov.len = len;
+
+  return urkel_file_writev(file, &iov, 1);
+}
+
+int
+urkel_file_writev(urkel_file_t *file, const urkel_iovec_t *iov, size_t count) {
+  size_t len = 0;
+  size_t i;
+
+  for (i = 0; i < count; i++)
+    len += iov[i].len;
+
   if (len == 0)
     return 1;
 
@@ -844,7 +886,7 @@ urkel_file_write(urkel_file_t *file, const void *src, size_t len) {
     file->base = NULL;
   }
 
-  if (!urkel_fs_write(file->fd, src, len))
+  if (!urkel_fs_writev(file->fd, iov, count))
     return 0;
 
   file->size += len;
@@ -877,6 +919,20 @@ urkel_file_write(urkel_file_t *file, const void *src, size_t len) {
   return 1;
 }
 
+int
+urkel_file_allocate(urkel_file_t *file, uint64_t size) {
+  /* Not implemented. Files grow as they are written. */
+  (void)file;
+  (void)size;
+  return 0;
+}
+
+int
+urkel_file_release(urkel_file_t *file) {
+  (void)file;
+  return 1;
+}
+
 int
 urkel_file_sync(const urkel_file_t *file) {
   return urkel_fs_fsync(file->fd);
@@ -1013,6 +1069,8 @@ urkel_rwlock_create(void) {
   InitializeCriticalSection(&mtx->readers_lock);
 
   mtx->readers = 0;
+  mtx->rd = NULL;
+  mtx->wr = NULL;
 
   return mtx;
 }
@@ -1026,12 +1084,36 @@ urkel_rwlock_destroy(urkel__rwlock_t *mtx) {
 
 void
 urkel_rwlock_wrlock(urkel__rwlock_t *mtx) {
-  DWORD r = WaitForSingleObject(mtx->write_semaphore, INFINITE);
+  DWORD r = WAIT_TIMEOUT;
+  uint64_t start;
+
+  /* Only contended acquisitions are timed. */
+  if (mtx->wr != NULL)
+    r = WaitForSingleObject(mtx->write_semaphore, 0);
+
+  if (r == WAIT_TIMEOUT) {
+    start = urkel_lockstat_start(mtx->wr);
+    r = WaitForSingleObject(mtx->write_semaphore, INFINITE);
+    urkel_lockstat_record(mtx->wr, start);
+  }
 
   if (r != WAIT_OBJECT_0)
     abort();
 }
 
+int
+urkel_rwlock_trywrlock(urkel__rwlock_t *mtx) {
+  DWORD r = WaitForSingleObject(mtx->write_semaphore, 0);
+
+  if (r == WAIT_TIMEOUT)
+    return 0;
+
+  if (r != WAIT_OBJECT_0)
+    abort();
+
+  return 1;
+}
+
 void
 urkel_rwlock_wrunlock(urkel__rwlock_t *mtx) {
   if (!ReleaseSemaphore(mtx->write_semaphore, 1, NULL))
@@ -1040,16 +1122,37 @@ urkel_rwlock_wrunlock(urkel__rwlock_t *mtx) {
 
 void
 urkel_rwlock_rdlock(urkel__rwlock_t *mtx) {
-  EnterCriticalSection(&mtx->readers_lock);
+  uint64_t start = 0;
+  int waited = 0;
+
+  if (mtx->rd == NULL || !TryEnterCriticalSection(&mtx->readers_lock)) {
+    start = urkel_lockstat_start(mtx->rd);
+    waited = 1;
+    EnterCriticalSection(&mtx->readers_lock);
+  }
 
   if (++mtx->readers == 1) {
-    DWORD r = WaitForSingleObject(mtx->write_semaphore, INFINITE);
+    DWORD r = WAIT_TIMEOUT;
+
+    if (mtx->rd != NULL)
+      r = WaitForSingleObject(mtx->write_semaphore, 0);
+
+    if (r == WAIT_TIMEOUT) {
+      if (!waited)
+        start = urkel_lockstat_start(mtx->rd);
+
+      waited = 1;
+      r = WaitForSingleObject(mtx->write_semaphore, INFINITE);
+    }
 
     if (r != WAIT_OBJECT_0)
       abort();
   }
 
   LeaveCriticalSection(&mtx->readers_lock);
+
+  if (waited)
+    urkel_lockstat_record(mtx->rd, start);
 }
 
 void
@@ -1064,6 +1167,132 @@ urkel_rwlock_rdunlock(urkel__rwlock_t *mtx) {
   LeaveCriticalSection(&mtx->readers_lock);
 }
 
+void
+urkel_rwlock_watch(urkel__rwlock_t *mtx,
+                   urkel_lockstat_t *rd,
+                   urkel_lockstat_t *wr) {
+  mtx->rd = rd;
+  mtx->wr = wr;
+}
+
+/*
+ * Condition Variable
+ */
+
+/* CONDITION_VARIABLE requires Vista. We only ever
+   have a single waiter, so an auto-reset event is
+   sufficient and cannot lose a wakeup. */
+
+urkel__cond_t *
+urkel_cond_create(void) {
+  urkel__cond_t *cond = malloc(sizeof(urkel__cond_t));
+
+  if (cond == NULL) {
+    abort();
+    return NULL;
+  }
+
+  cond->event = CreateEventA(NULL, FALSE, FALSE, NULL);
+
+  if (cond->event == NULL)
+    abort();
+
+  return cond;
+}
+
+void
+urkel_cond_destroy(urkel__cond_t *cond) {
+  CloseHandle(cond->event);
+  free(cond);
+}
+
+void
+urkel_cond_signal(urkel__cond_t *cond) {
+  if (!SetEvent(cond->event))
+    abort();
+}
+
+void
+urkel_cond_wait(urkel__cond_t *cond, urkel__mutex_t *mtx) {
+  DWORD r;
+
+  LeaveCriticalSection(&mtx->handle);
+
+  r = WaitForSingleObject(cond->event, INFINITE);
+
+  EnterCriticalSection(&mtx->handle);
+
+  if (r != WAIT_OBJECT_0)
+    abort();
+}
+
+int
+urkel_cond_timedwait(urkel__cond_t *cond,
+                     urkel__mutex_t *mtx,
+                     uint64_t msec) {
+  DWORD r;
+
+  if (msec >= INFINITE)
+    msec = INFINITE - 1;
+
+  LeaveCriticalSection(&mtx->handle);
+
+  r = WaitForSingleObject(cond->event, (DWORD)msec);
+
+  EnterCriticalSection(&mtx->handle);
+
+  if (r == WAIT_TIMEOUT)
+    return 0;
+
+  if (r != WAIT_OBJECT_0)
+    abort();
+
+  return 1;
+}
+
+/*
+ * Thread
+ */
+
+static DWORD WINAPI
+urkel_thread_run(LPVOID ptr) {
+  urkel__thread_t *thread = ptr;
+
+  thread->start(thread->arg);
+
+  return 0;
+}
+
+urkel__thread_t *
+urkel_thread_create(urkel_thread_f *start, void *arg) {
+  urkel__thread_t *thread = malloc(sizeof(urkel__thread_t));
+
+  if (thread == NULL) {
+    abort();
+    return NULL;
+  }
+
+  thread->start = start;
+  thread->arg = arg;
+  thread->handle = CreateThread(NULL, 0, urkel_thread_run, thread, 0, NULL);
+
+  if (thread->handle == NULL) {
+    free(thread);
+    return NULL;
+  }
+
+  return thread;
+}
+
+void
+urkel_thread_join(urkel__thread_t *thread) {
+  if (WaitForSingleObject(thread->handle, INFINITE) != WAIT_OBJECT_0)
+    abort();
+
+  CloseHandle(thread->handle);
+  free(thread);
+}
+
 /*
  * Time
  */
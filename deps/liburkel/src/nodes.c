@@ -18,6 +18,25 @@
 
 static urkel_node_t urkel_node_null;
 
+/*
+ * Allocation Meter
+ */
+
+/* Net bytes of nodes and values allocated by the calling thread.
+   Transactions measure themselves by sampling this around each
+   operation, so the counter only has to be thread local. */
+
+#if defined(URKEL_TLS)
+static URKEL_TLS size_t urkel_node_bytes;
+#define METER_ALLOC(n) (urkel_node_bytes += (n))
+#define METER_FREE(n) (urkel_node_bytes -= (n))
+#else
+#define METER_ALLOC(n) ((void)0)
+#define METER_FREE(n) ((void)0)
+#endif
+
+#define VALUE_BYTES(n) ((n) + 1)
+
 /*
  * Pointer
  */
@@ -64,6 +83,7 @@ void
 urkel_node_init(urkel_node_t *node, unsigned int type) {
   node->type = type;
   node->flags = 0;
+  node->refs = 0;
 
   memset(node->hash, 0, sizeof(node->hash));
 
@@ -93,6 +113,7 @@ urkel_node_init(urkel_node_t *node, unsigned int type) {
 
       leaf->value = NULL;
       leaf->size = 0;
+      leaf->crc = 0;
 
       urkel_pointer_init(&leaf->vptr);
 
@@ -134,6 +155,8 @@ urkel_node_clear(urkel_node_t *node) {
       urkel_leaf_t *leaf = &node->u.leaf;
 
       if (leaf->value != NULL) {
+        METER_FREE(VALUE_BYTES(leaf->size));
+
         free(leaf->value);
 
         leaf->value = NULL;
@@ -183,11 +206,13 @@ urkel_node_store(urkel_node_t *node,
                  const unsigned char *data,
                  size_t size) {
   urkel_leaf_t *leaf = &node->u.leaf;
-  unsigned char *value = checked_malloc(size + 1);
+  unsigned char *value = checked_malloc(VALUE_BYTES(size));
 
   CHECK(node->type == URKEL_NODE_LEAF);
   CHECK(!(node->flags & URKEL_FLAG_VALUE));
 
+  METER_ALLOC(VALUE_BYTES(size));
+
   if (size > 0)
     memcpy(value, data, size);
 
@@ -220,6 +245,7 @@ urkel_node_to_hash(const urkel_node_t *node, urkel_node_t *out) {
 
   if (node->type == URKEL_NODE_NULL) {
     *out = *node;
+    out->refs = 0;
     return;
   }
 
@@ -266,9 +292,70 @@ urkel_node_set(urkel_node_t *node, unsigned int bit, urkel_node_t *child) {
   }
 }
 
+size_t
+urkel_node_allocated(void) {
+#if defined(URKEL_TLS)
+  return urkel_node_bytes;
+#else
+  return 0;
+#endif
+}
+
+urkel_node_t *
+urkel_node_alloc(void) {
+  METER_ALLOC(sizeof(urkel_node_t));
+  return checked_malloc(sizeof(urkel_node_t));
+}
+
+void
+urkel_node_free(urkel_node_t *node) {
+  METER_FREE(sizeof(urkel_node_t));
+  free(node);
+}
+
+urkel_node_t *
+urkel_node_ref(urkel_node_t *node) {
+  CHECK(node != &urkel_node_null);
+
+  node->refs += 1;
+
+  return node;
+}
+
+urkel_node_t *
+urkel_node_copy(const urkel_node_t *node) {
+  /* Shallow copy: children are shared with `node`. */
+  urkel_node_t *out = urkel_node_alloc();
+
+  *out = *node;
+
+  out->refs = 0;
+
+  switch (node->type) {
+    case URKEL_NODE_INTERNAL: {
+      urkel_node_ref(out->u.internal.left);
+      urkel_node_ref(out->u.internal.right);
+      break;
+    }
+
+    case URKEL_NODE_LEAF: {
+      if (node->flags & URKEL_FLAG_VALUE) {
+        out->u.leaf.value = NULL;
+        out->flags &= ~URKEL_FLAG_VALUE;
+
+        urkel_node_store(out, node->u.leaf.value, node->u.leaf.size);
+      }
+
+      break;
+    }
+  }
+
+  return out;
+}
+
 urkel_node_t *
 urkel_node_create(unsigned int type) {
-  urkel_node_t *node = checked_malloc(sizeof(urkel_node_t));
+  urkel_node_t *node = urkel_node_alloc();
 
   urkel_node_init(node, type);
 
@@ -327,10 +414,16 @@ urkel_node_create_hash(const unsigned char *hash) {
 
 void
 urkel_node_destroy(urkel_node_t *node, int recurse) {
+  /* Shared nodes only lose an owner. */
+  if (node->refs > 0) {
+    node->refs -= 1;
+    return;
+  }
+
   switch (node->type) {
     case URKEL_NODE_NULL: {
       CHECK(node != &urkel_node_null);
-      free(node);
+      urkel_node_free(node);
       break;
     }
 
@@ -342,7 +435,7 @@ urkel_node_destroy(urkel_node_t *node, int recurse) {
         urkel_node_destroy(internal->right, 1);
       }
 
-      free(node);
+      urkel_node_free(node);
 
       break;
     }
@@ -350,16 +443,18 @@ urkel_node_destroy(urkel_node_t *node, int recurse) {
     case URKEL_NODE_LEAF: {
       urkel_leaf_t *leaf = &node->u.leaf;
 
-      if (leaf->value != NULL)
+      if (leaf->value != NULL) {
+        METER_FREE(VALUE_BYTES(leaf->size));
         free(leaf->value);
+      }
 
-      free(node);
+      urkel_node_free(node);
 
       break;
     }
 
     case URKEL_NODE_HASH: {
-      free(node);
+      urkel_node_free(node);
       break;
     }
 
@@ -370,6 +465,34 @@ urkel_node_destroy(urkel_node_t *node, int recurse) {
   }
 }
 
+void
+urkel_node_unshare(urkel_node_t *node) {
+  /* Replacing an internal node hands its children over
+     to the replacement. A shared node keeps its own, so
+     the replacement needs references of its own. */
+  const urkel_internal_t *internal = &node->u.internal;
+
+  CHECK(node->type == URKEL_NODE_INTERNAL);
+
+  if (node->refs > 0) {
+    urkel_node_ref(internal->left);
+    urkel_node_ref(internal->right);
+  }
+}
+
+void
+urkel_node_reshare(urkel_node_t *node) {
+  /* Undo urkel_node_unshare when nothing was replaced. */
+  const urkel_internal_t *internal = &node->u.internal;
+
+  CHECK(node->type == URKEL_NODE_INTERNAL);
+
+  if (node->refs > 0) {
+    urkel_node_destroy(internal->left, 0);
+    urkel_node_destroy(internal->right, 0);
+  }
+}
+
 const unsigned char *
 urkel_node_hash(urkel_node_t *node) {
   if (node->flags & URKEL_FLAG_HASHED)
@@ -575,10 +698,14 @@ urkel_node_write(const urkel_node_t *node, unsigned char *data) {
 
     case URKEL_NODE_LEAF: {
       const urkel_leaf_t *leaf = &node->u.leaf;
+      unsigned int type = URKEL_NODE_LEAF;
 
       CHECK(node->flags & URKEL_FLAG_SAVED);
 
-      data = urkel_write8(data, URKEL_NODE_LEAF);
+      if (node->flags & URKEL_FLAG_COMPRESSED)
+        type |= 1 << 4;
+
+      data = urkel_write8(data, type);
       data = urkel_pointer_write(&leaf->vptr, data);
       data = urkel_write(data, leaf->key, URKEL_KEY_SIZE);
 
@@ -601,6 +728,16 @@ urkel_node_write(const urkel_node_t *node, unsigned char *data) {
 
 int
 urkel_node_read(urkel_node_t *node, const unsigned char *data, size_t len) {
+  return urkel_node_decode(node, NULL, data, len);
+}
+
+int
+urkel_node_decode(urkel_node_t *node,
+                  urkel_node_t *children,
+                  const unsigned char *data,
+                  size_t len) {
+  /* Children are decoded into `children` (two nodes)
+     when it is given, and allocated otherwise. */
   unsigned int type;
 
   if (len < 1)
@@ -664,8 +801,16 @@ urkel_node_read(urkel_node_t *node, const unsigned char *data, size_t len) {
       if (len < 2 * (URKEL_PTR_SIZE + URKEL_HASH_SIZE))
         return 0;
 
-      left = urkel_node_create(URKEL_NODE_HASH);
-      right = urkel_node_create(URKEL_NODE_HASH);
+      if (children != NULL) {
+        left = &children[0];
+        right = &children[1];
+
+        urkel_node_init(left, URKEL_NODE_HASH);
+        urkel_node_init(right, URKEL_NODE_HASH);
+      } else {
+        left = urkel_node_create(URKEL_NODE_HASH);
+        right = urkel_node_create(URKEL_NODE_HASH);
+      }
 
       urkel_pointer_read(&left->ptr, data);
       data += URKEL_PTR_SIZE;
@@ -690,9 +835,13 @@ urkel_node_read(urkel_node_t *node, const unsigned char *data, size_t len) {
 
     case URKEL_NODE_LEAF: {
       urkel_leaf_t *leaf = &node->u.leaf;
+      unsigned int flags = type >> 4;
 
       urkel_node_init(node, URKEL_NODE_LEAF);
 
+      if (flags & ~1)
+        return 0;
+
       if (len < URKEL_PTR_SIZE + URKEL_KEY_SIZE)
         return 0;
 
@@ -704,6 +853,9 @@ urkel_node_read(urkel_node_t *node, const unsigned char *data, size_t len) {
 
       node->flags |= URKEL_FLAG_SAVED;
 
+      if (flags & 1)
+        node->flags |= URKEL_FLAG_COMPRESSED;
+
       break;
     }
 
@@ -718,3 +870,145 @@ urkel_node_read(urkel_node_t *node, const unsigned char *data, size_t len) {
 
   return 1;
 }
+
+/*
+ * View
+ */
+
+int
+urkel_view_parse(urkel_view_t *view, size_t size) {
+  /* Checks the same things as urkel_node_decode, so
+     that the accessors below stay within the record. */
+  const unsigned char *data = view->data;
+  size_t len = size;
+
+  if (len < 1 || len > sizeof(view->data))
+    return 0;
+
+  view->type = urkel_read8(data) & 15;
+  view->flags = urkel_read8(data) >> 4;
+  view->bits = 0;
+  view->children = 1;
+  view->sealed = 0;
+
+  len -= 1;
+
+  switch (view->type) {
+    case URKEL_NODE_INTERNAL: {
+      if (view->flags & 1) {
+        size_t bytes;
+
+        if (len < 2)
+          return 0;
+
+        if (view->flags & 2) {
+          view->bits = urkel_read16(data + 1);
+
+          if (view->bits < 0x100)
+            return 0;
+
+          view->children += 2;
+          len -= 2;
+        } else {
+          view->bits = urkel_read8(data + 1);
+
+          if (view->bits == 0)
+            return 0;
+
+          view->children += 1;
+          len -= 1;
+        }
+
+        bytes = (view->bits + 7) / 8;
+
+        if (len < bytes)
+          return 0;
+
+        view->children += bytes;
+        len -= bytes;
+      }
+
+      if (len < 2 * (URKEL_PTR_SIZE + URKEL_HASH_SIZE))
+        return 0;
+
+      view->len = view->children + 2 * (URKEL_PTR_SIZE + URKEL_HASH_SIZE);
+
+      return 1;
+    }
+
+    case URKEL_NODE_LEAF: {
+      if (view->flags & ~1)
+        return 0;
+
+      if (len < URKEL_PTR_SIZE + URKEL_KEY_SIZE)
+        return 0;
+
+      view->len = 1 + URKEL_PTR_SIZE + URKEL_KEY_SIZE;
+
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+void
+urkel_view_prefix(const urkel_view_t *view, urkel_bits_t *prefix) {
+  const unsigned char *data = view->data + 1 + (view->flags & 2 ? 2 : 1);
+
+  CHECK(view->type == URKEL_NODE_INTERNAL);
+
+  urkel_bits_init(prefix, view->bits);
+
+  if (view->bits > 0)
+    urkel_read(prefix->data, data, (view->bits + 7) / 8);
+}
+
+void
+urkel_view_pointer(const urkel_view_t *view,
+                   unsigned int bit,
+                   urkel_pointer_t *ptr) {
+  size_t off = view->children + bit * (URKEL_PTR_SIZE + URKEL_HASH_SIZE);
+
+  CHECK(view->type == URKEL_NODE_INTERNAL);
+
+  urkel_pointer_read(ptr, view->data + off);
+}
+
+const unsigned char *
+urkel_view_hash(const urkel_view_t *view, unsigned int bit) {
+  size_t off = view->children + bit * (URKEL_PTR_SIZE + URKEL_HASH_SIZE);
+
+  CHECK(view->type == URKEL_NODE_INTERNAL);
+
+  return view->data + off + URKEL_PTR_SIZE;
+}
+
+const unsigned char *
+urkel_view_key(const urkel_view_t *view) {
+  CHECK(view->type == URKEL_NODE_LEAF);
+  return view->data + 1 + URKEL_PTR_SIZE;
+}
+
+void
+urkel_view_leaf(const urkel_view_t *view, urkel_node_t *node) {
+  /* Enough of a leaf for urkel_store_retrieve. */
+  urkel_leaf_t *leaf = &node->u.leaf;
+
+  CHECK(view->type == URKEL_NODE_LEAF);
+
+  urkel_node_init(node, URKEL_NODE_LEAF);
+  urkel_pointer_read(&leaf->vptr, view->data + 1);
+
+  memcpy(leaf->key, urkel_view_key(view), URKEL_KEY_SIZE);
+
+  node->flags |= URKEL_FLAG_SAVED;
+
+  if (view->flags & 1)
+    node->flags |= URKEL_FLAG_COMPRESSED;
+
+  if (view->sealed) {
+    leaf->crc = view->crc;
+    node->flags |= URKEL_FLAG_CHECKSUM;
+  }
+}
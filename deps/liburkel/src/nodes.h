@@ -24,6 +24,8 @@
 #define URKEL_FLAG_WRITTEN 2
 #define URKEL_FLAG_SAVED 4
 #define URKEL_FLAG_VALUE 8
+#define URKEL_FLAG_COMPRESSED 16
+#define URKEL_FLAG_CHECKSUM 32
 
 #define URKEL_PTR_SIZE 7
 
@@ -57,11 +59,13 @@ typedef struct urkel_leaf_s {
   unsigned char *value;
   size_t size;
   urkel_pointer_t vptr;
+  uint32_t crc; /* CRC32C of the stored value (URKEL_FLAG_CHECKSUM). */
 } urkel_leaf_t;
 
 typedef struct urkel_node_s {
   unsigned int type;
   unsigned int flags;
+  unsigned int refs; /* Owners besides the first (forked transactions). */
   unsigned char hash[URKEL_HASH_SIZE];
   urkel_pointer_t ptr;
   union {
@@ -70,6 +74,26 @@ typedef struct urkel_node_s {
   } u;
 } urkel_node_t;
 
+/* A node decoded together with its children, for
+   traversals which do not keep what they read. */
+typedef struct urkel_frame_s {
+  urkel_node_t node;
+  urkel_node_t children[2];
+} urkel_frame_t;
+
+/* A node record interpreted in place. Fields are only
+   decoded when a traversal asks for them. */
+typedef struct urkel_view_s {
+  unsigned char data[URKEL_NODE_SIZE + 4]; /* Record and checksum. */
+  size_t len; /* Record length, not counting checksums. */
+  unsigned int type;
+  unsigned int flags; /* Flags from the type byte. */
+  size_t bits; /* Prefix length (internal). */
+  size_t children; /* Offset of the child pointers (internal). */
+  uint32_t crc; /* CRC32C of the stored value (leaf). */
+  int sealed; /* Whether `crc` is set. */
+} urkel_view_t;
+
 /*
  * Pointer
  */
@@ -122,6 +146,21 @@ urkel_node_get(const urkel_node_t *node, unsigned int bit);
 void
 urkel_node_set(urkel_node_t *node, unsigned int bit, urkel_node_t *child);
 
+size_t
+urkel_node_allocated(void);
+
+urkel_node_t *
+urkel_node_alloc(void);
+
+void
+urkel_node_free(urkel_node_t *node);
+
+urkel_node_t *
+urkel_node_ref(urkel_node_t *node);
+
+urkel_node_t *
+urkel_node_copy(const urkel_node_t *node);
+
 urkel_node_t *
 urkel_node_create(unsigned int type);
 
@@ -145,6 +184,12 @@ urkel_node_create_hash(const unsigned char *hash);
 void
 urkel_node_destroy(urkel_node_t *node, int recurse);
 
+void
+urkel_node_unshare(urkel_node_t *node);
+
+void
+urkel_node_reshare(urkel_node_t *node);
+
 const unsigned char *
 urkel_node_hash(urkel_node_t *node);
 
@@ -168,4 +213,34 @@ urkel_node_write(const urkel_node_t *node, unsigned char *data);
 int
 urkel_node_read(urkel_node_t *node, const unsigned char *data, size_t len);
 
+int
+urkel_node_decode(urkel_node_t *node,
+                  urkel_node_t *children,
+                  const unsigned char *data,
+                  size_t len);
+
+/*
+ * View
+ */
+
+int
+urkel_view_parse(urkel_view_t *view, size_t size);
+
+void
+urkel_view_prefix(const urkel_view_t *view, urkel_bits_t *prefix);
+
+void
+urkel_view_pointer(const urkel_view_t *view,
+                   unsigned int bit,
+                   urkel_pointer_t *ptr);
+
+const unsigned char *
+urkel_view_hash(const urkel_view_t *view, unsigned int bit);
+
+const unsigned char *
+urkel_view_key(const urkel_view_t *view);
+
+void
+urkel_view_leaf(const urkel_view_t *view, urkel_node_t *node);
+
 #endif /* _URKEL_NODES_H */
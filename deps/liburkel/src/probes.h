@@ -0,0 +1,36 @@
+/*!
+ * probes.h - static tracepoints for liburkel
+ * Copyright (c) 2020, Christopher Jeffrey (MIT License).
+ * https://github.com/handshake-org/liburkel
+ */
+
+#ifndef _URKEL_PROBES_H
+#define _URKEL_PROBES_H
+
+/*
+ * Probes
+ */
+
+/* USDT probes under the `urkel` provider, compiled in with
+   URKEL_USDT (Linux, needs <sys/sdt.h>). A probe is a single
+   nop until a tracer attaches to it. Without URKEL_USDT the
+   arguments are not evaluated. */
+
+#if defined(URKEL_USDT)
+#  include <sys/sdt.h>
+#  define URKEL_PROBE1(name, a) \
+     DTRACE_PROBE1(urkel, name, a)
+#  define URKEL_PROBE2(name, a, b) \
+     DTRACE_PROBE2(urkel, name, a, b)
+#  define URKEL_PROBE3(name, a, b, c) \
+     DTRACE_PROBE3(urkel, name, a, b, c)
+#  define URKEL_PROBE4(name, a, b, c, d) \
+     DTRACE_PROBE4(urkel, name, a, b, c, d)
+#else
+#  define URKEL_PROBE1(name, a) do { } while (0)
+#  define URKEL_PROBE2(name, a, b) do { } while (0)
+#  define URKEL_PROBE3(name, a, b, c) do { } while (0)
+#  define URKEL_PROBE4(name, a, b, c, d) do { } while (0)
+#endif
+
+#endif /* _URKEL_PROBES_H */
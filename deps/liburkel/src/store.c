@@ -9,10 +9,15 @@
 #include <string.h>
 #include <urkel.h>
 #include "bits.h"
+#include "compress.h"
+#include "crc32c.h"
 #include "internal.h"
+#include "filter.h"
+#include "index.h"
 #include "khash.h"
 #include "io.h"
 #include "nodes.h"
+#include "probes.h"
 #include "store.h"
 #include "util.h"
 
@@ -21,19 +26,43 @@
  */
 
 /* Max read size on linux, and lower than off_t max. */
+#ifdef URKEL_MAX_FILE_SIZE
+#define MAX_FILE_SIZE URKEL_MAX_FILE_SIZE /* For tests. */
+#else
 #define MAX_FILE_SIZE 0x7ffff000 /* File max = 2 GB */
+#endif
 #define MAX_FILES 0x7fff /* DB max = 64 TB. */
 #define MAX_OPEN_FILES 32
 #define META_SIZE (4 + (URKEL_PTR_SIZE * 2) + 20)
 #define META_MAGIC 0x6d726b6c
 #define WRITE_BUFFER (64 << 20)
+#define WRITE_BUFFER_SHARE 4 /* At most 1/4 of the memory budget. */
 #define READ_BUFFER (1 << 20)
+#define SEGMENT_SIZE (1 << 20) /* Write buffer segment (block multiple). */
 #define SLAB_SIZE (READ_BUFFER - (READ_BUFFER % META_SIZE))
 #define WRITE_FLAGS (URKEL_O_RDWR | URKEL_O_CREAT | URKEL_O_APPEND \
                    | URKEL_O_RANDOM | URKEL_O_MMAP)
 #define READ_FLAGS (URKEL_O_RDONLY | URKEL_O_RANDOM | URKEL_O_MMAP)
 #define CACHE_HASH(k) urkel_murmur3(k, URKEL_HASH_SIZE, 0)
 #define CACHE_EQUAL(a, b) (memcmp(a, b, URKEL_HASH_SIZE) == 0)
+#define FILTER_MAGIC 0x666c7472
+#define FILTER_ROOTS 64
+#define LOOKUP_BATCH 65536
+#define COMPRESS_MIN_SIZE 32
+#define DEDUP_MIN_SIZE 32
+#define DEDUP_MAX_VALUES (1 << 18)
+#define SYNC_INTERVAL 1000 /* Default batch interval (ms). */
+#define PREPARE_MARGIN (MAX_FILE_SIZE / 4) /* Create the next file here. */
+#define RESERVE_MIN (1 << 20) /* Smallest preallocation step. */
+#define RESERVE_MAX (256 << 20) /* Largest preallocation step. */
+#define DIRECT_ALIGN 4096 /* Block size for direct writes. */
+#define CHECKSUM_SIZE 4
+#define RECORD_SIZE (URKEL_NODE_SIZE + CHECKSUM_SIZE)
+#define SCRUB_THREADS 64
+#define SCRUB_SPLIT 16 /* Subtrees per scrub thread. */
+#define WARM_MAGIC 0x7761726d
+#define WARM_CHUNK (1 << 20) /* Largest prefetch read. */
+#define WARM_GAP (64 << 10) /* Read through gaps up to this size. */
 
 /*
  * Structs
@@ -45,8 +74,17 @@ typedef struct urkel_meta_s {
   urkel_node_t root_node;
 } urkel_meta_t;
 
+typedef struct urkel_segment_s {
+  unsigned char *data; /* Block aligned. */
+  unsigned char *alloc; /* Allocation backing `data`. */
+} urkel_segment_t;
+
 typedef struct urkel_slab_s {
-  unsigned char *data; /* Preallocated slab. */
+  urkel_segment_t *segs; /* Fixed size segments, reused across flushes. */
+  urkel_iovec_t *iov; /* Scratch vector for flushes. */
+  size_t segs_len; /* Number of allocated segments. */
+  size_t segs_size; /* Allocated length of `segs` and `iov`. */
+  size_t align; /* Flushes and rollovers end on a multiple of this. */
   size_t data_size; /* Total bytes allocated. */
   size_t data_len; /* Total bytes written. */
   size_t data_off; /* Bytes written since last file rollover. */
@@ -77,14 +115,103 @@ typedef struct urkel_rng_s {
   size_t pos;
 } urkel_rng_t;
 
+typedef struct urkel_keys_s {
+  urkel_filter_t filter;
+  unsigned char roots[FILTER_ROOTS][URKEL_HASH_SIZE]; /* Covered roots. */
+  size_t roots_len;
+  size_t roots_pos;
+} urkel_keys_t;
+
+typedef struct urkel_lookup_s {
+  urkel_index_t table;
+  int valid; /* Table describes `table.root`. */
+  urkel_index_entry_t *log; /* Changes queued by the current commit. */
+  size_t log_len;
+  size_t log_size;
+} urkel_lookup_t;
+
+typedef struct urkel_value_s {
+  unsigned char hash[URKEL_HASH_SIZE]; /* Hash of the uncompressed value. */
+  urkel_pointer_t ptr;
+  unsigned int flags; /* URKEL_FLAG_COMPRESSED and URKEL_FLAG_CHECKSUM. */
+  uint32_t crc;
+} urkel_value_t;
+
+KHASH_INIT(values, const unsigned char *,
+           urkel_value_t *, 1, CACHE_HASH, CACHE_EQUAL)
+
+typedef struct urkel_dedup_s {
+  khash_t(values) *map; /* NULL if disabled. */
+  urkel_value_t **pending; /* Values written by the current commit. */
+  size_t pending_len;
+  size_t pending_size;
+} urkel_dedup_t;
+
+typedef struct urkel_retired_s {
+  urkel_file_t *file;
+  unsigned char root[URKEL_HASH_SIZE]; /* Last root fully in `file`. */
+  uint64_t seq;
+  struct urkel_retired_s *next;
+} urkel_retired_t;
+
+typedef struct urkel_syncer_s {
+  unsigned int mode; /* URKEL_DURABLE_* */
+  unsigned int commits; /* Batch: sync after this many commits. */
+  unsigned int interval; /* Batch: sync after this many milliseconds. */
+  uint32_t requested; /* Last file requested ahead (write lock). */
+  urkel_mutex_t *lock; /* Guards everything below. */
+  urkel_mutex_t *file_lock; /* Held while syncing or replacing `current`. */
+  urkel_cond_t *cond; /* Signals the worker. */
+  urkel_cond_t *done; /* Signaled by the worker. */
+  urkel_thread_t *thread; /* NULL if threads are unavailable. */
+  urkel_retired_t *retired; /* Full files waiting to be synced and closed. */
+  urkel_retired_t *retired_tail;
+  urkel_file_t *next; /* Next data file, created ahead of time. */
+  uint32_t prepare; /* Index of the file to create next. */
+  unsigned int pending; /* Commits since the last batch sync. */
+  uint64_t seq; /* Commit counter. */
+  uint64_t rollovers;
+  int busy;
+  int failed; /* A retired file failed to sync. */
+  int stop;
+  unsigned char root[URKEL_HASH_SIZE]; /* Last committed root. */
+  unsigned char durable[URKEL_HASH_SIZE]; /* Last root known to be synced. */
+  uint64_t durable_seq;
+} urkel_syncer_t;
+
+typedef struct urkel_governor_s {
+  urkel_mutex_t *lock; /* Guards `usage`. */
+  urkel_memory_t usage;
+} urkel_governor_t;
+
+typedef struct urkel_warmer_s {
+  unsigned int levels; /* Levels listed in the manifest (0 = off). */
+  urkel_pointer_t *ptrs; /* Owned by the worker while it runs. */
+  size_t len;
+  size_t size;
+  urkel_mutex_t *lock; /* Guards `stop`. */
+  urkel_thread_t *thread;
+  int stop;
+} urkel_warmer_t;
+
 typedef struct urkel_store_s {
   char prefix[URKEL_PATH_MAX + 1];
   size_t prefix_len;
   unsigned char key[URKEL_HASH_SIZE];
+  unsigned int flags;
+  int write_flags;
   urkel_slab_t slab;
   urkel_filemap_t files;
   urkel_cache_t cache;
   urkel_rng_t rng;
+  urkel_keys_t keys;
+  urkel_lookup_t lookup;
+  urkel_dedup_t dedup;
+  urkel_syncer_t syncer;
+  urkel_governor_t governor;
+  urkel_warmer_t warmer;
+  urkel_metrics_t metrics; /* Updated with urkel_atomic_add. */
+  size_t write_buffer; /* Flush the slab once it holds this much. */
   urkel_meta_t state;
   urkel_meta_t last_meta;
   int lock_fd;
@@ -96,7 +223,7 @@ typedef struct urkel_store_s {
  * Constants
  */
 
-static urkel_file_t urkel_null_file = {-1, 0, 0, NULL, 0, {0}};
+static urkel_file_t urkel_null_file = {-1, -1, 0, 0, 0, NULL, 0, {0}};
 
 /*
  * Meta Root
@@ -154,12 +281,35 @@ urkel_meta_read(urkel_meta_t *meta,
 static void
 urkel_slab_init(urkel_slab_t *slab) {
   memset(slab, 0, sizeof(*slab));
+  slab->align = 1;
+}
+
+static void
+urkel_slab_release(urkel_slab_t *slab) {
+  /* Free the segments of an empty slab. */
+  size_t i;
+
+  CHECK(slab->data_len == 0);
+
+  for (i = 0; i < slab->segs_len; i++)
+    free(slab->segs[i].alloc);
+
+  slab->segs_len = 0;
+  slab->data_size = 0;
 }
 
 static void
 urkel_slab_clear(urkel_slab_t *slab) {
-  if (slab->data != NULL)
-    free(slab->data);
+  size_t i;
+
+  for (i = 0; i < slab->segs_len; i++)
+    free(slab->segs[i].alloc);
+
+  if (slab->segs != NULL)
+    free(slab->segs);
+
+  if (slab->iov != NULL)
+    free(slab->iov);
 
   if (slab->offsets != NULL)
     free(slab->offsets);
@@ -168,9 +318,93 @@ urkel_slab_clear(urkel_slab_t *slab) {
 }
 
 static void
-urkel_slab_write(urkel_slab_t *slab, const unsigned char *data, size_t len) {
-  size_t needs = slab->data_len + len;
+urkel_slab_grow(urkel_slab_t *slab) {
+  /* Add a segment. Earlier segments never move, so
+     growing the buffer costs no copies. */
+  unsigned char *alloc;
+
+  if (slab->segs_len == slab->segs_size) {
+    size_t size = slab->segs_size == 0 ? 8 : slab->segs_size * 2;
+
+    slab->segs = checked_realloc(slab->segs, size * sizeof(urkel_segment_t));
+    slab->iov = checked_realloc(slab->iov, size * sizeof(urkel_iovec_t));
+    slab->segs_size = size;
+  }
+
+  /* The data must stay block aligned for direct io. */
+  alloc = checked_malloc(SEGMENT_SIZE + DIRECT_ALIGN - 1);
+
+  slab->segs[slab->segs_len].alloc = alloc;
+  slab->segs[slab->segs_len].data =
+    alloc + ((DIRECT_ALIGN - ((uintptr_t)alloc % DIRECT_ALIGN))
+             % DIRECT_ALIGN);
+  slab->segs_len += 1;
+
+  slab->data_size += SEGMENT_SIZE;
+}
+
+static void
+urkel_slab_put(urkel_slab_t *slab, const unsigned char *data, size_t len) {
+  /* Append `len` bytes of `data` (or zeroes). */
+  while (len > 0) {
+    size_t index = slab->data_len / SEGMENT_SIZE;
+    size_t pos = slab->data_len % SEGMENT_SIZE;
+    size_t size = SEGMENT_SIZE - pos;
+
+    if (size > len)
+      size = len;
+
+    if (index == slab->segs_len)
+      urkel_slab_grow(slab);
+
+    if (data != NULL) {
+      memcpy(slab->segs[index].data + pos, data, size);
+      data += size;
+    } else {
+      memset(slab->segs[index].data + pos, 0, size);
+    }
+
+    slab->data_len += size;
+    slab->data_off += size;
+    slab->file_pos += size;
+
+    len -= size;
+  }
+}
+
+static size_t
+urkel_slab_iov(urkel_slab_t *slab, size_t off, size_t len) {
+  /* Describe `len` bytes at `off` in `slab->iov`. */
+  size_t count = 0;
+
+  while (len > 0) {
+    size_t pos = off % SEGMENT_SIZE;
+    size_t size = SEGMENT_SIZE - pos;
 
+    if (size > len)
+      size = len;
+
+    slab->iov[count].base = slab->segs[off / SEGMENT_SIZE].data + pos;
+    slab->iov[count].len = size;
+
+    count += 1;
+    off += size;
+    len -= size;
+  }
+
+  return count;
+}
+
+static void
+urkel_slab_pad(urkel_slab_t *slab) {
+  /* Zero fill up to the next multiple of `align`. */
+  size_t size = (slab->align - (slab->file_pos % slab->align)) % slab->align;
+
+  urkel_slab_put(slab, NULL, size);
+}
+
+static void
+urkel_slab_write(urkel_slab_t *slab, const unsigned char *data, size_t len) {
   CHECK(len <= MAX_FILE_SIZE);
 
   if (slab->offsets_len == 0) {
@@ -179,6 +413,8 @@ urkel_slab_write(urkel_slab_t *slab, const unsigned char *data, size_t len) {
   }
 
   if (slab->file_pos + len > MAX_FILE_SIZE) {
+    urkel_slab_pad(slab);
+
     if (slab->steps == slab->offsets_len) {
       size_t new_size = (slab->offsets_len + 2) * sizeof(size_t);
 
@@ -193,21 +429,7 @@ urkel_slab_write(urkel_slab_t *slab, const unsigned char *data, size_t len) {
     slab->file_index += 1;
   }
 
-  if (slab->data_size < needs) {
-    slab->data_size = (slab->data_size * 3) / 2;
-
-    if (slab->data_size < needs)
-      slab->data_size = (needs * 3) / 2;
-
-    slab->data = checked_realloc(slab->data, slab->data_size);
-  }
-
-  if (len > 0)
-    memcpy(slab->data + slab->data_len, data, len);
-
-  slab->data_len += len;
-  slab->data_off += len;
-  slab->file_pos += len;
+  urkel_slab_put(slab, data, len);
 }
 
 /*
@@ -406,485 +628,2557 @@ urkel_rng_rand(urkel_rng_t *rng) {
 }
 
 /*
- * Data Store
+ * Key Filter
  */
 
 static void
-urkel_store_path(const data_store_t *store, char *path, const char *name) {
-  memcpy(path, store->prefix, store->prefix_len);
+urkel_keys_init(urkel_keys_t *keys) {
+  memset(keys, 0, sizeof(*keys));
+}
 
-  path += store->prefix_len;
+static void
+urkel_keys_clear(urkel_keys_t *keys) {
+  urkel_filter_clear(&keys->filter);
+  urkel_keys_init(keys);
+}
 
-  *path++ = URKEL_PATH_SEP;
+static int
+urkel_keys_enabled(const urkel_keys_t *keys) {
+  return keys->filter.blocks != NULL;
+}
 
-  while (*name)
-    *path++ = *name++;
+static void
+urkel_keys_reset(urkel_keys_t *keys) {
+  /* Filter no longer covers any root. */
+  keys->roots_len = 0;
+  keys->roots_pos = 0;
+}
 
-  *path++ = '\0';
+static int
+urkel_keys_covers(const urkel_keys_t *keys, const unsigned char *root_hash) {
+  size_t i;
+
+  for (i = 0; i < keys->roots_len; i++) {
+    if (memcmp(keys->roots[i], root_hash, URKEL_HASH_SIZE) == 0)
+      return 1;
+  }
+
+  return 0;
 }
 
 static void
-urkel_store_path_index(const data_store_t *store, char *path, uint32_t index) {
-  char name[11];
+urkel_keys_push(urkel_keys_t *keys, const unsigned char *root_hash) {
+  if (urkel_keys_covers(keys, root_hash))
+    return;
 
-  urkel_serialize_u32(name, index);
-  urkel_store_path(store, path, name);
+  memcpy(keys->roots[keys->roots_pos], root_hash, URKEL_HASH_SIZE);
+
+  keys->roots_pos = (keys->roots_pos + 1) % FILTER_ROOTS;
+
+  if (keys->roots_len < FILTER_ROOTS)
+    keys->roots_len += 1;
 }
 
+/*
+ * Key Index
+ */
+
 static void
-urkel_store_close_file(data_store_t *, uint32_t);
+urkel_lookup_init(urkel_lookup_t *lookup) {
+  memset(lookup, 0, sizeof(*lookup));
+  lookup->table.fd = -1;
+}
 
 static void
-urkel_store_evict(data_store_t *store) {
-  /* Write lock is held. */
-  while (store->files.size > MAX_OPEN_FILES) {
-    size_t num = urkel_rng_rand(&store->rng);
-    size_t tries = num % (store->files.size - 1);
-    size_t i;
+urkel_lookup_clear(urkel_lookup_t *lookup) {
+  if (lookup->log != NULL)
+    free(lookup->log);
 
-    for (i = 1; i < store->files.len; i++) {
-      if (store->files.items[i] == NULL)
-        continue;
+  urkel_lookup_init(lookup);
+}
 
-      if (i == store->index)
-        continue;
+static int
+urkel_lookup_enabled(const urkel_lookup_t *lookup) {
+  return lookup->table.fd != -1 && lookup->valid;
+}
 
-      if (tries == 0) {
-        urkel_store_close_file(store, i);
-        break;
-      }
+static void
+urkel_lookup_push(urkel_lookup_t *lookup,
+                  const unsigned char *key,
+                  const urkel_pointer_t *ptr,
+                  int remove) {
+  urkel_index_entry_t *entry;
 
-      tries -= 1;
-    }
+  if (lookup->log_len == lookup->log_size) {
+    size_t size = lookup->log_size == 0 ? 64 : lookup->log_size * 2;
+
+    lookup->log = checked_realloc(lookup->log, size * sizeof(*entry));
+    lookup->log_size = size;
   }
-}
 
-static urkel_file_t *
-urkel_store_open_file(data_store_t *store, uint32_t index, int flags) {
-  char path[URKEL_PATH_MAX + 1];
-  urkel_file_t *file;
+  entry = &lookup->log[lookup->log_len++];
 
-  if (index == 0 || index > store->index + 1)
-    return NULL;
+  memcpy(entry->key, key, URKEL_KEY_SIZE);
 
-  file = urkel_filemap_lookup(&store->files, index);
+  if (ptr != NULL)
+    entry->ptr = *ptr;
+  else
+    urkel_pointer_init(&entry->ptr);
 
-  if (file != NULL)
-    return file;
+  entry->remove = remove;
+}
 
-  urkel_store_path_index(store, path, index);
+static int
+urkel_lookup_flush(urkel_lookup_t *lookup) {
+  int ret = urkel_index_apply(&lookup->table, lookup->log, lookup->log_len);
 
-  file = urkel_file_open(path, flags, 0640);
+  lookup->log_len = 0;
 
-  if (file == NULL)
-    return NULL;
+  return ret;
+}
 
-  file->index = index;
+/*
+ * Value Dedup
+ */
 
-  if (flags == WRITE_FLAGS) {
-    /* Only evict if the write lock is held. */
-    urkel_store_evict(store);
-  }
+static void
+urkel_dedup_init(urkel_dedup_t *dedup, int enabled) {
+  memset(dedup, 0, sizeof(*dedup));
 
-  urkel_filemap_insert(&store->files, file);
+  if (enabled) {
+    dedup->map = kh_init(values);
 
-  return file;
+    CHECK(dedup->map != NULL);
+  }
 }
 
 static void
-urkel_store_close_file(data_store_t *store, uint32_t index) {
-  /* Write lock is held. */
-  urkel_file_t *file = urkel_filemap_remove(&store->files, index);
-
-  if (file != NULL) {
-    if (file == store->current) {
-      store->current = &urkel_null_file;
-      store->index = 0;
-    }
+urkel_dedup_reset(urkel_dedup_t *dedup) {
+  khiter_t iter = kh_begin(dedup->map);
 
-    urkel_file_close(file);
+  for (; iter != kh_end(dedup->map); iter++) {
+    if (kh_exist(dedup->map, iter))
+      free(kh_value(dedup->map, iter));
   }
+
+  kh_clear(values, dedup->map);
+
+  dedup->pending_len = 0;
 }
 
-static int
-urkel_store_read(data_store_t *store,
-                 unsigned char *out,
-                 size_t size,
-                 uint32_t index,
-                 uint64_t pos) {
-  urkel_file_t *file = urkel_store_open_file(store, index, READ_FLAGS);
+static void
+urkel_dedup_clear(urkel_dedup_t *dedup) {
+  if (dedup->map != NULL) {
+    urkel_dedup_reset(dedup);
+    kh_destroy(values, dedup->map);
+  }
 
-  if (file == NULL)
-    return 0;
+  if (dedup->pending != NULL)
+    free(dedup->pending);
 
-  return urkel_file_pread(file, out, size, pos);
+  urkel_dedup_init(dedup, 0);
 }
 
 static int
-urkel_store_sync(data_store_t *store) {
-  /* Write lock is held. */
-  return urkel_file_datasync(store->current);
+urkel_dedup_enabled(const urkel_dedup_t *dedup) {
+  return dedup->map != NULL;
 }
 
-static int
-urkel_store_write(data_store_t *store,
-                  const unsigned char *data,
-                  size_t size) {
-  /* Write lock is held. */
-  urkel_file_t *file;
-
-  if (store->current->size + size > MAX_FILE_SIZE) {
-    file = urkel_store_open_file(store, store->index + 1, WRITE_FLAGS);
+static const urkel_value_t *
+urkel_dedup_lookup(const urkel_dedup_t *dedup, const unsigned char *hash) {
+  khiter_t iter = kh_get(values, dedup->map, hash);
 
-    if (file == NULL)
-      return 0;
+  if (iter == kh_end(dedup->map))
+    return NULL;
 
-    if (!urkel_store_sync(store))
-      return 0;
+  return kh_value(dedup->map, iter);
+}
 
-    urkel_store_close_file(store, store->index);
+static void
+urkel_dedup_insert(urkel_dedup_t *dedup,
+                   const unsigned char *hash,
+                   const urkel_node_t *node) {
+  urkel_value_t *val;
+  khiter_t iter;
+  int ret = -1;
 
-    store->current = file;
-    store->index = file->index;
-  }
+  /* Stop learning until the next commit resets the table. */
+  if (kh_size(dedup->map) >= DEDUP_MAX_VALUES)
+    return;
 
-  return urkel_file_write(store->current, data, size);
-}
+  val = checked_malloc(sizeof(urkel_value_t));
 
-static int
-urkel_store_read_node(data_store_t *store,
-                      urkel_node_t *out,
-                      const urkel_pointer_t *ptr) {
-  unsigned char data[URKEL_NODE_SIZE];
+  memcpy(val->hash, hash, URKEL_HASH_SIZE);
 
-  if (ptr->size == 0 || ptr->size > URKEL_NODE_SIZE)
-    return 0;
+  val->ptr = node->u.leaf.vptr;
+  val->flags = node->flags & (URKEL_FLAG_COMPRESSED | URKEL_FLAG_CHECKSUM);
+  val->crc = node->u.leaf.crc;
 
-  if (!urkel_store_read(store, data, ptr->size, ptr->index, ptr->pos))
-    return 0;
+  iter = kh_put(values, dedup->map, val->hash, &ret);
 
-  if (!urkel_node_read(out, data, ptr->size))
-    return 0;
+  if (ret == -1) {
+    urkel_abort(); /* LCOV_EXCL_LINE */
+    return;
+  }
 
-  out->ptr = *ptr;
-  out->flags |= URKEL_FLAG_WRITTEN;
+  if (ret == 0) {
+    free(val);
+    return;
+  }
 
-  return 1;
-}
+  kh_value(dedup->map, iter) = val;
 
-static int
-urkel_store_read_root(data_store_t *store,
-                      urkel_node_t *out,
-                      const urkel_pointer_t *ptr) {
-  urkel_node_t node;
+  if (dedup->pending_len == dedup->pending_size) {
+    size_t size = dedup->pending_size == 0 ? 64 : dedup->pending_size * 2;
 
-  if (ptr->index == 0) {
-    urkel_node_init(out, URKEL_NODE_NULL);
-    return 1;
+    dedup->pending = checked_realloc(dedup->pending, size * sizeof(val));
+    dedup->pending_size = size;
   }
 
-  if (!urkel_store_read_node(store, &node, ptr))
-    return 0;
+  dedup->pending[dedup->pending_len++] = val;
+}
 
-  /* Edge case when our root is a leaf. */
-  /* We need to recalculate the hash. */
-  if (node.type == URKEL_NODE_LEAF) {
-    unsigned char value[URKEL_VALUE_SIZE];
-    size_t size;
+static void
+urkel_dedup_commit(urkel_dedup_t *dedup) {
+  dedup->pending_len = 0;
 
-    if (!urkel_store_retrieve(store, &node, value, &size))
-      return 0;
+  if (kh_size(dedup->map) >= DEDUP_MAX_VALUES)
+    urkel_dedup_reset(dedup);
+}
 
-    urkel_node_store(&node, value, size);
-  }
+static void
+urkel_dedup_rollback(urkel_dedup_t *dedup) {
+  /* Values written by a failed commit may never reach the disk. */
+  while (dedup->pending_len > 0) {
+    urkel_value_t *val = dedup->pending[--dedup->pending_len];
+    khiter_t iter = kh_get(values, dedup->map, val->hash);
 
-  urkel_node_hash(&node);
-  urkel_node_to_hash(&node, out);
-  urkel_node_clear(&node);
+    CHECK(iter != kh_end(dedup->map));
 
-  urkel_cache_insert(&store->cache, out);
+    kh_del(values, dedup->map, iter);
 
-  return 1;
+    free(val);
+  }
 }
 
-urkel_node_t *
-urkel_store_get_root(data_store_t *store) {
-  urkel_node_t *node = checked_malloc(sizeof(urkel_node_t));
+/*
+ * Memory Governor
+ */
 
-  *node = store->state.root_node;
+/* Transactions (and callers of urkel_memory_charge) draw on the
+   budget from any thread. Memory held by the store itself is
+   recomputed under the write lock whenever it may have changed,
+   and dropped by urkel_store_trim when a commit leaves the budget
+   exceeded. */
 
-  return node;
-}
+static void
+urkel_governor_init(urkel_governor_t *gov, size_t limit) {
+  memset(gov, 0, sizeof(*gov));
 
-const unsigned char *
-urkel_store_root_hash(data_store_t *store) {
-  return store->state.root_node.hash;
+  gov->lock = urkel_mutex_create();
+  gov->usage.limit = limit;
 }
 
-int
-urkel_store_retrieve(data_store_t *store,
-                     const urkel_node_t *node,
-                     unsigned char *out,
-                     size_t *size) {
-  const urkel_leaf_t *leaf = &node->u.leaf;
-  const urkel_pointer_t *ptr = &leaf->vptr;
+static void
+urkel_governor_clear(urkel_governor_t *gov) {
+  if (gov->lock != NULL)
+    urkel_mutex_destroy(gov->lock);
 
-  CHECK(node->type == URKEL_NODE_LEAF);
+  memset(gov, 0, sizeof(*gov));
+}
 
-  if (node->flags & URKEL_FLAG_VALUE) {
-    CHECK(leaf->size <= URKEL_VALUE_SIZE);
+static size_t
+urkel_governor_used(const urkel_memory_t *usage) {
+  return usage->buffer
+       + usage->cache
+       + usage->dedup
+       + usage->txs
+       + usage->other;
+}
 
-    if (leaf->size > 0)
-      memcpy(out, leaf->value, leaf->size);
+static size_t
+urkel_cache_memory(const urkel_cache_t *cache) {
+  return kh_size(cache->map) * sizeof(urkel_node_t)
+       + kh_n_buckets(cache->map) * 2 * sizeof(void *);
+}
 
-    *size = leaf->size;
+static size_t
+urkel_dedup_memory(const urkel_dedup_t *dedup) {
+  size_t size = dedup->pending_size * sizeof(urkel_value_t *);
 
-    return 1;
+  if (dedup->map != NULL) {
+    size += kh_size(dedup->map) * sizeof(urkel_value_t);
+    size += kh_n_buckets(dedup->map) * 2 * sizeof(void *);
   }
 
-  CHECK(node->flags & URKEL_FLAG_SAVED);
+  return size;
+}
 
-  if (ptr->size > URKEL_VALUE_SIZE)
-    return 0;
+static void
+urkel_store_account(data_store_t *store) {
+  /* Write lock is held. */
+  urkel_governor_t *gov = &store->governor;
+  size_t buffer = store->slab.data_size;
+  size_t cache = urkel_cache_memory(&store->cache);
+  size_t dedup = urkel_dedup_memory(&store->dedup);
 
-  if (!urkel_store_read(store, out, ptr->size, ptr->index, ptr->pos))
-    return 0;
+  urkel_mutex_lock(gov->lock);
 
-  *size = ptr->size;
+  gov->usage.buffer = buffer;
+  gov->usage.cache = cache;
+  gov->usage.dedup = dedup;
 
-  return 1;
+  urkel_mutex_unlock(gov->lock);
+}
+
+void
+urkel_store_memory(data_store_t *store, urkel_memory_t *usage) {
+  urkel_governor_t *gov = &store->governor;
+
+  urkel_mutex_lock(gov->lock);
+
+  *usage = gov->usage;
+  usage->used = urkel_governor_used(usage);
+
+  urkel_mutex_unlock(gov->lock);
+}
+
+int
+urkel_store_over_budget(data_store_t *store) {
+  urkel_governor_t *gov = &store->governor;
+  int ret;
+
+  urkel_mutex_lock(gov->lock);
+
+  ret = gov->usage.limit != 0
+     && urkel_governor_used(&gov->usage) > gov->usage.limit;
+
+  urkel_mutex_unlock(gov->lock);
+
+  return ret;
+}
+
+int
+urkel_store_charge(data_store_t *store, size_t size) {
+  urkel_governor_t *gov = &store->governor;
+  urkel_memory_t *usage = &gov->usage;
+  int ret = 1;
+
+  urkel_mutex_lock(gov->lock);
+
+  if (usage->limit != 0 && urkel_governor_used(usage) + size > usage->limit)
+    ret = 0;
+  else
+    usage->other += size;
+
+  urkel_mutex_unlock(gov->lock);
+
+  return ret;
+}
+
+void
+urkel_store_release(data_store_t *store, size_t size) {
+  urkel_governor_t *gov = &store->governor;
+
+  urkel_mutex_lock(gov->lock);
+
+  CHECK(gov->usage.other >= size);
+
+  gov->usage.other -= size;
+
+  urkel_mutex_unlock(gov->lock);
+}
+
+void
+urkel_store_charge_tx(data_store_t *store, size_t alloc, size_t freed) {
+  urkel_governor_t *gov = &store->governor;
+
+  urkel_mutex_lock(gov->lock);
+
+  gov->usage.txs += alloc;
+  gov->usage.txs -= freed;
+
+  urkel_mutex_unlock(gov->lock);
+}
+
+void
+urkel_store_trim(data_store_t *store) {
+  /* Write lock is held. */
+  urkel_slab_t *slab = &store->slab;
+
+  /* The slab is empty between commits. */
+  if (slab->data_len == 0)
+    urkel_slab_release(slab);
+
+  /* Roots between the newest one and where the history
+     walk left off are only reachable through the cache. */
+  urkel_cache_clear(&store->cache);
+  urkel_cache_init(&store->cache);
+
+  store->last_meta = store->state;
+
+  if (urkel_dedup_enabled(&store->dedup))
+    urkel_dedup_reset(&store->dedup);
+
+  urkel_store_account(store);
+}
+
+/*
+ * Metrics
+ */
+
+/* Counters are bumped from any thread without a lock, so
+   reads and writes never serialize on them. A snapshot is
+   not atomic as a whole. */
+
+static uint64_t
+urkel_store_clock(void) {
+  urkel_timespec_t ts;
+
+  urkel_time_get(&ts);
+
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t
+urkel_store_elapsed(uint64_t start) {
+  uint64_t now = urkel_store_clock();
+
+  /* The clock is not monotonic. */
+  return now > start ? now - start : 0;
+}
+
+void
+urkel_store_metrics(data_store_t *store, urkel_metrics_t *metrics) {
+  /* Every field is a uint64_t. */
+  const uint64_t *src = (const uint64_t *)&store->metrics;
+  uint64_t *dst = (uint64_t *)metrics;
+  size_t i;
+
+  for (i = 0; i < sizeof(urkel_metrics_t) / sizeof(uint64_t); i++)
+    dst[i] = urkel_atomic_load(&src[i]);
+}
+
+/*
+ * Background Sync
+ */
+
+/* A single worker thread per store retires full data files
+   (datasync and close), creates the next data file ahead of
+   time, and performs batched syncs. None of this happens
+   under the tree lock, so rollovers do not stall commits. */
+
+static int
+urkel_store_sync(data_store_t *);
+
+static int
+urkel_store_datasync(data_store_t *, const urkel_file_t *);
+
+static void
+urkel_store_path_index(const data_store_t *, char *, uint32_t);
+
+static void
+urkel_syncer_durable(urkel_syncer_t *syncer,
+                     const unsigned char *root,
+                     uint64_t seq) {
+  /* Syncer lock is held. */
+  if (seq < syncer->durable_seq)
+    return;
+
+  memcpy(syncer->durable, root, URKEL_HASH_SIZE);
+
+  syncer->durable_seq = seq;
+}
+
+static int
+urkel_syncer_wait(urkel_syncer_t *syncer) {
+  /* Syncer lock is held. Returns 1 if a batch sync is due. */
+  while (!syncer->stop
+         && syncer->retired == NULL
+         && syncer->prepare == 0) {
+    if (syncer->mode != URKEL_DURABLE_BATCH) {
+      urkel_cond_wait(syncer->cond, syncer->lock);
+      continue;
+    }
+
+    if (syncer->commits > 0 && syncer->pending >= syncer->commits)
+      return 1;
+
+    if (syncer->interval == 0) {
+      urkel_cond_wait(syncer->cond, syncer->lock);
+      continue;
+    }
+
+    if (!urkel_cond_timedwait(syncer->cond, syncer->lock, syncer->interval))
+      return syncer->pending > 0;
+  }
+
+  return 0;
+}
+
+static void
+urkel_syncer_run(void *arg) {
+  data_store_t *store = arg;
+  urkel_syncer_t *syncer = &store->syncer;
+  unsigned char root[URKEL_HASH_SIZE];
+  char path[URKEL_PATH_MAX + 1];
+  urkel_retired_t *list, *item;
+  urkel_file_t *next;
+  uint32_t prepare;
+  uint64_t seq = 0;
+  uint64_t rollovers = 0;
+  int due, synced, ret = 0;
+
+  urkel_mutex_lock(syncer->lock);
+
+  for (;;) {
+    due = urkel_syncer_wait(syncer);
+
+    if (syncer->stop && syncer->retired == NULL)
+      break;
+
+    list = syncer->retired;
+    prepare = syncer->prepare;
+
+    syncer->retired = NULL;
+    syncer->retired_tail = NULL;
+    syncer->prepare = 0;
+    syncer->busy = 1;
+
+    if (due) {
+      memcpy(root, syncer->root, URKEL_HASH_SIZE);
+
+      seq = syncer->seq;
+      rollovers = syncer->rollovers;
+
+      syncer->pending = 0;
+    }
+
+    urkel_mutex_unlock(syncer->lock);
+
+    /* Oldest first, so the durable root only moves forward. */
+    while (list != NULL) {
+      item = list;
+      list = item->next;
+
+      urkel_file_release(item->file);
+
+      /* Nothing is synced (or durable) without a mode. */
+      ret = 1;
+      synced = 0;
+
+      if (syncer->mode != URKEL_DURABLE_NONE)
+        ret = synced = urkel_store_datasync(store, item->file);
+
+      urkel_file_close(item->file);
+
+      urkel_mutex_lock(syncer->lock);
+
+      if (synced)
+        urkel_syncer_durable(syncer, item->root, item->seq);
+      else if (!ret)
+        syncer->failed = 1;
+
+      urkel_mutex_unlock(syncer->lock);
+
+      free(item);
+    }
+
+    next = NULL;
+
+    if (prepare != 0) {
+      urkel_store_path_index(store, path, prepare);
+
+      next = urkel_file_open(path, store->write_flags, 0640);
+
+      if (next != NULL) {
+        next->index = prepare;
+        urkel_file_allocate(next, RESERVE_MAX);
+      }
+    }
+
+    if (due) {
+      urkel_mutex_lock(syncer->file_lock);
+      ret = urkel_store_sync(store);
+      urkel_mutex_unlock(syncer->file_lock);
+    }
+
+    urkel_mutex_lock(syncer->lock);
+
+    /* A rollover since the snapshot may have retired a
+       file holding part of `root` which is not synced yet. */
+    if (due) {
+      if (ret && syncer->rollovers == rollovers)
+        urkel_syncer_durable(syncer, root, seq);
+      else
+        syncer->pending += 1;
+    }
+
+    if (next != NULL) {
+      if (syncer->next != NULL)
+        urkel_file_close(syncer->next);
+
+      syncer->next = next;
+    }
+
+    syncer->busy = 0;
+
+    urkel_cond_signal(syncer->done);
+  }
+
+  urkel_mutex_unlock(syncer->lock);
+}
+
+static void
+urkel_syncer_init(urkel_syncer_t *syncer,
+                  const urkel_tree_options_t *options) {
+  memset(syncer, 0, sizeof(*syncer));
+
+  syncer->mode = options->durability;
+  syncer->commits = options->sync_commits;
+  syncer->interval = options->sync_interval;
+  syncer->lock = urkel_mutex_create();
+  syncer->file_lock = urkel_mutex_create();
+
+  if (syncer->commits == 0 && syncer->interval == 0)
+    syncer->interval = SYNC_INTERVAL;
+}
+
+static void
+urkel_syncer_start(data_store_t *store) {
+  urkel_syncer_t *syncer = &store->syncer;
+  const unsigned char *root = store->state.root_node.hash;
+
+  memcpy(syncer->root, root, URKEL_HASH_SIZE);
+  memcpy(syncer->durable, root, URKEL_HASH_SIZE);
+
+  syncer->cond = urkel_cond_create();
+  syncer->done = urkel_cond_create();
+  syncer->thread = urkel_thread_create(urkel_syncer_run, store);
+
+  /* No threads on this platform: rollovers are synchronous. */
+  if (syncer->thread == NULL && syncer->mode == URKEL_DURABLE_BATCH)
+    syncer->mode = URKEL_DURABLE_COMMIT;
+}
+
+static void
+urkel_syncer_clear(data_store_t *store) {
+  urkel_syncer_t *syncer = &store->syncer;
+  char path[URKEL_PATH_MAX + 1];
+
+  if (syncer->thread != NULL) {
+    urkel_mutex_lock(syncer->lock);
+    syncer->stop = 1;
+    urkel_cond_signal(syncer->cond);
+    urkel_mutex_unlock(syncer->lock);
+
+    /* Finishes retiring files before exiting. */
+    urkel_thread_join(syncer->thread);
+  }
+
+  if (syncer->cond != NULL) {
+    urkel_cond_destroy(syncer->cond);
+    urkel_cond_destroy(syncer->done);
+  }
+
+  /* Unused, and empty unless it was opened by a rollover
+     that did not wait for it. */
+  if (syncer->next != NULL) {
+    urkel_store_path_index(store, path, syncer->next->index);
+
+    if (syncer->next->index > store->index)
+      urkel_fs_unlink(path);
+
+    urkel_file_close(syncer->next);
+  }
+
+  if (store->current != NULL) {
+    urkel_file_release(store->current);
+
+    /* Leave nothing unsynced behind on a clean close. */
+    if (syncer->mode == URKEL_DURABLE_COMMIT
+        || syncer->mode == URKEL_DURABLE_BATCH) {
+      urkel_store_sync(store);
+    }
+  }
+
+  urkel_mutex_destroy(syncer->lock);
+  urkel_mutex_destroy(syncer->file_lock);
+
+  memset(syncer, 0, sizeof(*syncer));
+}
+
+static urkel_file_t *
+urkel_syncer_take_next(urkel_syncer_t *syncer, uint32_t index) {
+  /* Write lock is held. */
+  urkel_file_t *file = NULL;
+
+  urkel_mutex_lock(syncer->lock);
+
+  if (syncer->next != NULL) {
+    if (syncer->next->index == index)
+      file = syncer->next;
+    else
+      urkel_file_close(syncer->next);
+
+    syncer->next = NULL;
+  }
+
+  urkel_mutex_unlock(syncer->lock);
+
+  return file;
+}
+
+static void
+urkel_syncer_prepare(urkel_syncer_t *syncer, uint32_t index) {
+  /* Write lock is held. */
+  if (syncer->thread == NULL || syncer->requested == index)
+    return;
+
+  syncer->requested = index;
+
+  urkel_mutex_lock(syncer->lock);
+  syncer->prepare = index;
+  urkel_cond_signal(syncer->cond);
+  urkel_mutex_unlock(syncer->lock);
+}
+
+static void
+urkel_syncer_retire(urkel_syncer_t *syncer,
+                    urkel_file_t *file,
+                    const unsigned char *root) {
+  /* Write lock is held. */
+  urkel_retired_t *item = checked_malloc(sizeof(urkel_retired_t));
+
+  item->file = file;
+  item->next = NULL;
+
+  memcpy(item->root, root, URKEL_HASH_SIZE);
+
+  urkel_mutex_lock(syncer->lock);
+
+  item->seq = syncer->seq;
+
+  if (syncer->retired_tail != NULL)
+    syncer->retired_tail->next = item;
+  else
+    syncer->retired = item;
+
+  syncer->retired_tail = item;
+  syncer->rollovers += 1;
+
+  urkel_cond_signal(syncer->cond);
+  urkel_mutex_unlock(syncer->lock);
+}
+
+static int
+urkel_syncer_drain(urkel_syncer_t *syncer) {
+  /* Write lock is held. Waits for retired files to be synced. */
+  int ret;
+
+  urkel_mutex_lock(syncer->lock);
+
+  while (syncer->retired != NULL || syncer->busy)
+    urkel_cond_wait(syncer->done, syncer->lock);
+
+  ret = !syncer->failed;
+
+  syncer->failed = 0;
+
+  urkel_mutex_unlock(syncer->lock);
+
+  return ret;
+}
+
+static int
+urkel_syncer_commit(data_store_t *store, const unsigned char *root) {
+  /* Write lock is held. Data has been flushed. */
+  urkel_syncer_t *syncer = &store->syncer;
+
+  if (syncer->mode == URKEL_DURABLE_COMMIT) {
+    if (syncer->thread != NULL && !urkel_syncer_drain(syncer))
+      return 0;
+
+    if (!urkel_store_sync(store))
+      return 0;
+  }
+
+  urkel_mutex_lock(syncer->lock);
+
+  memcpy(syncer->root, root, URKEL_HASH_SIZE);
+
+  syncer->seq += 1;
+
+  if (syncer->mode == URKEL_DURABLE_COMMIT)
+    urkel_syncer_durable(syncer, root, syncer->seq);
+
+  if (syncer->mode == URKEL_DURABLE_BATCH) {
+    syncer->pending += 1;
+
+    if (syncer->commits > 0 && syncer->pending >= syncer->commits)
+      urkel_cond_signal(syncer->cond);
+  }
+
+  urkel_mutex_unlock(syncer->lock);
+
+  return 1;
+}
+
+/*
+ * Data Store
+ */
+
+static void
+urkel_store_path(const data_store_t *store, char *path, const char *name) {
+  memcpy(path, store->prefix, store->prefix_len);
+
+  path += store->prefix_len;
+
+  *path++ = URKEL_PATH_SEP;
+
+  while (*name)
+    *path++ = *name++;
+
+  *path++ = '\0';
+}
+
+static void
+urkel_store_path_index(const data_store_t *store, char *path, uint32_t index) {
+  char name[11];
+
+  urkel_serialize_u32(name, index);
+  urkel_store_path(store, path, name);
+}
+
+static void
+urkel_store_close_file(data_store_t *, uint32_t);
+
+static void
+urkel_store_adopt_file(data_store_t *, urkel_file_t *);
+
+static void
+urkel_store_evict(data_store_t *store) {
+  /* Write lock is held. */
+  while (store->files.size > MAX_OPEN_FILES) {
+    size_t num = urkel_rng_rand(&store->rng);
+    size_t tries = num % (store->files.size - 1);
+    size_t i;
+
+    for (i = 1; i < store->files.len; i++) {
+      if (store->files.items[i] == NULL)
+        continue;
+
+      if (i == store->index)
+        continue;
+
+      if (tries == 0) {
+        urkel_store_close_file(store, i);
+        urkel_atomic_add(&store->metrics.file_evictions, 1);
+        break;
+      }
+
+      tries -= 1;
+    }
+  }
+}
+
+static urkel_file_t *
+urkel_store_open_file(data_store_t *store, uint32_t index, int flags) {
+  char path[URKEL_PATH_MAX + 1];
+  urkel_file_t *file;
+
+  if (index == 0 || index > store->index + 1)
+    return NULL;
+
+  file = urkel_filemap_lookup(&store->files, index);
+
+  if (file != NULL)
+    return file;
+
+  urkel_store_path_index(store, path, index);
+
+  file = urkel_file_open(path, flags, 0640);
+
+  if (file == NULL)
+    return NULL;
+
+  file->index = index;
+
+  urkel_atomic_add(&store->metrics.file_opens, 1);
+
+  if (flags == store->write_flags) {
+    urkel_store_adopt_file(store, file);
+    return file;
+  }
+
+  urkel_filemap_insert(&store->files, file);
+
+  return file;
+}
+
+static void
+urkel_store_adopt_file(data_store_t *store, urkel_file_t *file) {
+  /* Write lock is held. */
+  urkel_store_evict(store);
+  urkel_filemap_insert(&store->files, file);
+}
+
+static void
+urkel_store_close_file(data_store_t *store, uint32_t index) {
+  /* Write lock is held. */
+  urkel_file_t *file = urkel_filemap_remove(&store->files, index);
+
+  if (file != NULL) {
+    if (file == store->current) {
+      store->current = &urkel_null_file;
+      store->index = 0;
+    }
+
+    urkel_file_close(file);
+  }
+}
+
+static int
+urkel_store_read(data_store_t *store,
+                 unsigned char *out,
+                 size_t size,
+                 uint32_t index,
+                 uint64_t pos) {
+  urkel_file_t *file = urkel_store_open_file(store, index, READ_FLAGS);
+
+  URKEL_PROBE4(read, index, pos, size, out);
+
+  if (file == NULL)
+    return 0;
+
+  urkel_atomic_add(&store->metrics.bytes_read, size);
+
+  return urkel_file_pread(file, out, size, pos);
+}
+
+static int
+urkel_store_datasync(data_store_t *store, const urkel_file_t *file) {
+  uint64_t start = urkel_store_clock();
+  int ret = urkel_file_datasync(file);
+
+  urkel_atomic_add(&store->metrics.syncs, 1);
+  urkel_atomic_add(&store->metrics.sync_time, urkel_store_elapsed(start));
+
+  return ret;
+}
+
+static int
+urkel_store_sync(data_store_t *store) {
+  /* Write lock or syncer file lock is held. */
+  return urkel_store_datasync(store, store->current);
+}
+
+static void
+urkel_store_reserve(urkel_file_t *file, size_t size) {
+  /* Preallocate ahead of appends in steps which grow with
+     the file, so that data files stay contiguous on disk.
+     Failure (e.g. no filesystem support) is harmless. */
+  uint64_t step = file->size;
+
+  if (step < RESERVE_MIN)
+    step = RESERVE_MIN;
+
+  if (step > RESERVE_MAX)
+    step = RESERVE_MAX;
+
+  step += file->size + size;
+
+  if (step > MAX_FILE_SIZE)
+    step = MAX_FILE_SIZE;
+
+  urkel_file_allocate(file, step);
+}
+
+static int
+urkel_store_write(data_store_t *store,
+                  const urkel_iovec_t *iov,
+                  size_t count,
+                  size_t size) {
+  /* Write lock is held. */
+  urkel_syncer_t *syncer = &store->syncer;
+  urkel_file_t *file;
+
+  if (store->current->size + size > MAX_FILE_SIZE) {
+    const unsigned char *root = store->state.root_node.hash;
+    urkel_file_t *old;
+
+    URKEL_PROBE2(rollover, store->index, store->current->size);
+
+    if (syncer->thread == NULL) {
+      file = urkel_store_open_file(store, store->index + 1,
+                                   store->write_flags);
+
+      if (file == NULL)
+        return 0;
+
+      urkel_file_release(store->current);
+
+      if (syncer->mode != URKEL_DURABLE_NONE) {
+        if (!urkel_store_sync(store))
+          return 0;
+
+        urkel_mutex_lock(syncer->lock);
+        urkel_syncer_durable(syncer, root, syncer->seq);
+        urkel_mutex_unlock(syncer->lock);
+      }
+
+      urkel_store_close_file(store, store->index);
+
+      store->current = file;
+      store->index = file->index;
+    } else {
+      file = urkel_syncer_take_next(syncer, store->index + 1);
+
+      if (file != NULL)
+        urkel_store_adopt_file(store, file);
+      else
+        file = urkel_store_open_file(store, store->index + 1,
+                                     store->write_flags);
+
+      if (file == NULL)
+        return 0;
+
+      urkel_mutex_lock(syncer->file_lock);
+
+      old = urkel_filemap_remove(&store->files, store->index);
+
+      store->current = file;
+      store->index = file->index;
+
+      urkel_mutex_unlock(syncer->file_lock);
+
+      /* The worker syncs and closes it. */
+      urkel_syncer_retire(syncer, old, root);
+    }
+  }
+
+  if (store->current->size + size > MAX_FILE_SIZE - PREPARE_MARGIN)
+    urkel_syncer_prepare(syncer, store->index + 1);
+
+  if (store->current->size + size > store->current->alloc)
+    urkel_store_reserve(store->current, size);
+
+  urkel_atomic_add(&store->metrics.bytes_written, size);
+
+  return urkel_file_writev(store->current, iov, count);
+}
+
+static size_t
+urkel_store_seal(const data_store_t *store,
+                 const urkel_node_t *node,
+                 unsigned char *data,
+                 size_t size) {
+  /* Append checksums to a node record. A leaf also
+     carries the checksum of its value, so leaves are
+     either sealed along with their value or not at all. */
+  if (!(store->flags & URKEL_OPTION_CHECKSUM))
+    return size;
+
+  if (node->type == URKEL_NODE_LEAF) {
+    if (!(node->flags & URKEL_FLAG_CHECKSUM))
+      return size;
+
+    urkel_write32(data + size, node->u.leaf.crc);
+    size += CHECKSUM_SIZE;
+  }
+
+  urkel_write32(data + size, urkel_crc32c(data, size));
+
+  return size + CHECKSUM_SIZE;
+}
+
+static int
+urkel_store_unseal(urkel_node_t *node,
+                   const unsigned char *data,
+                   size_t size) {
+  /* Checksums are optional, and their presence is
+     implied by the record size. See urkel_store_seal. */
+  size_t len = urkel_node_size(node);
+  size_t extra = CHECKSUM_SIZE;
+
+  if (size == len)
+    return 1;
+
+  if (node->type == URKEL_NODE_LEAF)
+    extra += CHECKSUM_SIZE;
+
+  if (size != len + extra)
+    return 0;
+
+  if (node->type == URKEL_NODE_LEAF) {
+    node->u.leaf.crc = urkel_read32(data + len);
+    node->flags |= URKEL_FLAG_CHECKSUM;
+  }
+
+  size -= CHECKSUM_SIZE;
+
+  return urkel_crc32c(data, size) == urkel_read32(data + size);
+}
+
+static int
+urkel_store_decode_node(data_store_t *store,
+                        urkel_node_t *out,
+                        urkel_node_t *children,
+                        const urkel_pointer_t *ptr) {
+  unsigned char data[RECORD_SIZE];
+
+  URKEL_PROBE3(resolve, ptr->index, ptr->pos, ptr->size);
+
+  if (ptr->size == 0 || ptr->size > RECORD_SIZE)
+    return 0;
+
+  if (!urkel_store_read(store, data, ptr->size, ptr->index, ptr->pos))
+    return 0;
+
+  urkel_atomic_add(&store->metrics.node_reads, 1);
+
+  if (!urkel_node_decode(out, children, data, ptr->size))
+    return 0;
+
+  if (!urkel_store_unseal(out, data, ptr->size)) {
+    if (children == NULL)
+      urkel_node_clear(out);
+
+    return 0;
+  }
+
+  out->ptr = *ptr;
+  out->flags |= URKEL_FLAG_WRITTEN;
+
+  return 1;
+}
+
+static int
+urkel_store_read_node(data_store_t *store,
+                      urkel_node_t *out,
+                      const urkel_pointer_t *ptr) {
+  return urkel_store_decode_node(store, out, NULL, ptr);
+}
+
+int
+urkel_store_read_view(data_store_t *store,
+                      urkel_view_t *view,
+                      const urkel_pointer_t *ptr) {
+  /* Checksums work as in urkel_store_unseal. */
+  size_t extra = CHECKSUM_SIZE;
+  size_t size = ptr->size;
+
+  URKEL_PROBE3(resolve, ptr->index, ptr->pos, ptr->size);
+
+  if (size == 0 || size > RECORD_SIZE || size > sizeof(view->data))
+    return 0;
+
+  if (!urkel_store_read(store, view->data, size, ptr->index, ptr->pos))
+    return 0;
+
+  urkel_atomic_add(&store->metrics.node_reads, 1);
+
+  if (!urkel_view_parse(view, size))
+    return 0;
+
+  if (size == view->len)
+    return 1;
+
+  if (view->type == URKEL_NODE_LEAF)
+    extra += CHECKSUM_SIZE;
+
+  if (size != view->len + extra)
+    return 0;
+
+  if (view->type == URKEL_NODE_LEAF) {
+    view->crc = urkel_read32(view->data + view->len);
+    view->sealed = 1;
+  }
+
+  size -= CHECKSUM_SIZE;
+
+  return urkel_crc32c(view->data, size) == urkel_read32(view->data + size);
+}
+
+static int
+urkel_store_read_root(data_store_t *store,
+                      urkel_node_t *out,
+                      const urkel_pointer_t *ptr) {
+  urkel_node_t node;
+
+  if (ptr->index == 0) {
+    urkel_node_init(out, URKEL_NODE_NULL);
+    return 1;
+  }
+
+  if (!urkel_store_read_node(store, &node, ptr))
+    return 0;
+
+  /* Edge case when our root is a leaf. */
+  /* We need to recalculate the hash. */
+  if (node.type == URKEL_NODE_LEAF) {
+    unsigned char value[URKEL_VALUE_SIZE];
+    size_t size;
+
+    if (!urkel_store_retrieve(store, &node, value, &size))
+      return 0;
+
+    urkel_node_store(&node, value, size);
+  }
+
+  urkel_node_hash(&node);
+  urkel_node_to_hash(&node, out);
+  urkel_node_clear(&node);
+
+  urkel_cache_insert(&store->cache, out);
+
+  return 1;
+}
+
+urkel_node_t *
+urkel_store_get_root(data_store_t *store) {
+  urkel_node_t *node = urkel_node_alloc();
+
+  *node = store->state.root_node;
+
+  return node;
+}
+
+const unsigned char *
+urkel_store_root_hash(data_store_t *store) {
+  return store->state.root_node.hash;
+}
+
+void
+urkel_store_durable_root(data_store_t *store, unsigned char *hash) {
+  urkel_syncer_t *syncer = &store->syncer;
+
+  urkel_mutex_lock(syncer->lock);
+  memcpy(hash, syncer->durable, URKEL_HASH_SIZE);
+  urkel_mutex_unlock(syncer->lock);
+}
+
+int
+urkel_store_retrieve(data_store_t *store,
+                     const urkel_node_t *node,
+                     unsigned char *out,
+                     size_t *size) {
+  const urkel_leaf_t *leaf = &node->u.leaf;
+  const urkel_pointer_t *ptr = &leaf->vptr;
+
+  CHECK(node->type == URKEL_NODE_LEAF);
+
+  if (node->flags & URKEL_FLAG_VALUE) {
+    CHECK(leaf->size <= URKEL_VALUE_SIZE);
+
+    if (leaf->size > 0)
+      memcpy(out, leaf->value, leaf->size);
+
+    *size = leaf->size;
+
+    return 1;
+  }
+
+  CHECK(node->flags & URKEL_FLAG_SAVED);
+
+  if (ptr->size > URKEL_VALUE_SIZE)
+    return 0;
+
+  urkel_atomic_add(&store->metrics.value_reads, 1);
+
+  if (node->flags & URKEL_FLAG_COMPRESSED) {
+    unsigned char raw[URKEL_VALUE_SIZE];
+
+    if (!urkel_store_read(store, raw, ptr->size, ptr->index, ptr->pos))
+      return 0;
+
+    if ((node->flags & URKEL_FLAG_CHECKSUM)
+        && urkel_crc32c(raw, ptr->size) != leaf->crc) {
+      return 0;
+    }
+
+    return urkel_decompress(out, size, URKEL_VALUE_SIZE, raw, ptr->size);
+  }
+
+  if (!urkel_store_read(store, out, ptr->size, ptr->index, ptr->pos))
+    return 0;
+
+  if ((node->flags & URKEL_FLAG_CHECKSUM)
+      && urkel_crc32c(out, ptr->size) != leaf->crc) {
+    return 0;
+  }
+
+  *size = ptr->size;
+
+  return 1;
+}
+
+urkel_node_t *
+urkel_store_resolve(data_store_t *store, const urkel_node_t *node) {
+  urkel_node_t *out = urkel_node_alloc();
+
+  CHECK(node->type == URKEL_NODE_HASH);
+
+  if (!urkel_store_read_node(store, out, &node->ptr)) {
+    urkel_node_free(out);
+    return NULL;
+  }
+
+  urkel_node_hashed(out, node->hash);
+
+  return out;
+}
+
+int
+urkel_store_resolve_frame(data_store_t *store,
+                          urkel_frame_t *frame,
+                          const urkel_node_t *node) {
+  /* Nothing in the frame needs freeing afterwards. */
+  CHECK(node->type == URKEL_NODE_HASH);
+
+  if (!urkel_store_decode_node(store,
+                               &frame->node,
+                               frame->children,
+                               &node->ptr)) {
+    return 0;
+  }
+
+  urkel_node_hashed(&frame->node, node->hash);
+
+  return 1;
+}
+
+void
+urkel_store_write_node(data_store_t *store, urkel_node_t *node) {
+  /* Write lock is held. */
+  urkel_slab_t *slab = &store->slab;
+  unsigned char raw[RECORD_SIZE];
+  size_t size = urkel_node_write(node, raw) - raw;
+
+  CHECK(node->type == URKEL_NODE_INTERNAL
+     || node->type == URKEL_NODE_LEAF);
+
+  CHECK(!(node->flags & URKEL_FLAG_WRITTEN));
+
+  size = urkel_store_seal(store, node, raw, size);
+
+  urkel_slab_write(slab, raw, size);
+
+  /* Only ever grows: commits which fail simply
+     leave a few extra keys in the filter. */
+  if (node->type == URKEL_NODE_LEAF && urkel_keys_enabled(&store->keys))
+    urkel_filter_add(&store->keys.filter, node->u.leaf.key);
+
+  urkel_node_mark(node, slab->file_index,
+                  slab->file_pos - size,
+                  size);
+
+  /* After marking, so the entry points at the record just written. */
+  if (node->type == URKEL_NODE_LEAF && urkel_lookup_enabled(&store->lookup))
+    urkel_lookup_push(&store->lookup, node->u.leaf.key, &node->ptr, 0);
+}
+
+void
+urkel_store_write_value(data_store_t *store, urkel_node_t *node) {
+  /* Write lock is held. */
+  urkel_slab_t *slab = &store->slab;
+  urkel_leaf_t *leaf = &node->u.leaf;
+
+  unsigned char raw[URKEL_VALUE_SIZE];
+  unsigned char hash[URKEL_HASH_SIZE];
+  const unsigned char *data;
+  int dedup = 0;
+  size_t size = 0;
+
+  CHECK(node->type == URKEL_NODE_LEAF);
+  CHECK(!(node->flags & URKEL_FLAG_SAVED));
+  CHECK(node->flags & URKEL_FLAG_VALUE);
+
+  node->flags &= ~(URKEL_FLAG_COMPRESSED | URKEL_FLAG_CHECKSUM);
+
+  /* Point at an identical value written earlier, if any. */
+  if (urkel_dedup_enabled(&store->dedup) && leaf->size >= DEDUP_MIN_SIZE) {
+    const urkel_value_t *val;
+
+    urkel_hash_raw(hash, leaf->value, leaf->size);
+
+    val = urkel_dedup_lookup(&store->dedup, hash);
+
+    if (val != NULL) {
+      node->flags |= val->flags;
+      leaf->crc = val->crc;
+      urkel_node_save(node, val->ptr.index, val->ptr.pos, val->ptr.size);
+      urkel_atomic_add(&store->metrics.dedup_hits, 1);
+      return;
+    }
+
+    urkel_atomic_add(&store->metrics.dedup_misses, 1);
+
+    dedup = 1;
+  }
+
+  /* Only keep the compressed form if it saves at least a byte.
+     The leaf hash is always computed over the original value. */
+  if ((store->flags & URKEL_OPTION_COMPRESS)
+      && leaf->size >= COMPRESS_MIN_SIZE) {
+    size = urkel_compress(raw, leaf->size - 1, leaf->value, leaf->size);
+  }
+
+  if (size > 0) {
+    data = raw;
+    node->flags |= URKEL_FLAG_COMPRESSED;
+  } else {
+    data = leaf->value;
+    size = leaf->size;
+  }
+
+  if (store->flags & URKEL_OPTION_CHECKSUM) {
+    leaf->crc = urkel_crc32c(data, size);
+    node->flags |= URKEL_FLAG_CHECKSUM;
+  }
+
+  urkel_slab_write(slab, data, size);
+
+  urkel_node_save(node, slab->file_index,
+                  slab->file_pos - size,
+                  size);
+
+  if (dedup) {
+    urkel_dedup_insert(&store->dedup, hash, node);
+  }
+}
+
+int
+urkel_store_needs_flush(const data_store_t *store) {
+  /* Write lock is held. */
+  return store->slab.data_len >= store->write_buffer;
+}
+
+int
+urkel_store_flush(data_store_t *store) {
+  /* Write lock is held. */
+  urkel_slab_t *slab = &store->slab;
+  uint64_t start = urkel_store_clock();
+  size_t off = 0;
+  size_t i = 0;
+
+  urkel_atomic_add(&store->metrics.flushes, 1);
+
+  URKEL_PROBE2(flush__start, slab->data_len, store->index);
+
+  /* Direct writes must cover whole blocks. Nodes never
+     point into the padding, and recovery skips it. */
+  urkel_slab_pad(slab);
+
+  slab->offsets[slab->steps++] = slab->data_off;
+
+  for (; i < slab->start; i++)
+    off += slab->offsets[i];
+
+  /* One vectored write per data file. */
+  for (; i < slab->steps; i++) {
+    size_t len = slab->offsets[i];
+    size_t count = urkel_slab_iov(slab, off, len);
+
+    if (!urkel_store_write(store, slab->iov, count, len)) {
+      slab->steps -= 1;
+      slab->start = i;
+      URKEL_PROBE2(flush__done, slab->data_len, 0);
+      return 0;
+    }
+
+    off += len;
+  }
+
+  URKEL_PROBE2(flush__done, slab->data_len, 1);
+
+  slab->data_len = 0;
+  slab->data_off = 0;
+  slab->steps = 0;
+  slab->start = 0;
+
+  urkel_atomic_add(&store->metrics.flush_time, urkel_store_elapsed(start));
+
+  return 1;
+}
+
+static void
+urkel_store_write_meta(data_store_t *store,
+                       urkel_meta_t *state,
+                       const urkel_node_t *root) {
+  /* Write lock is held. */
+  static const unsigned char padding[META_SIZE] = {0};
+  urkel_slab_t *slab = &store->slab;
+  unsigned char raw[META_SIZE];
+
+  CHECK(root->flags & URKEL_FLAG_WRITTEN);
+
+  *state = store->state;
+
+  state->root_ptr = root->ptr;
+
+  urkel_node_to_hash(root, &state->root_node);
+
+  if (slab->file_pos % META_SIZE) {
+    size_t size = META_SIZE - (slab->file_pos % META_SIZE);
+
+    urkel_slab_write(slab, padding, size);
+  }
+
+  urkel_meta_write(state, raw, store->key);
+  urkel_slab_write(slab, raw, META_SIZE);
+
+  state->meta_ptr.index = slab->file_index;
+  state->meta_ptr.pos = slab->file_pos - META_SIZE;
+}
+
+int
+urkel_store_commit(data_store_t *store,
+                   const urkel_node_t *root,
+                   const unsigned char *base) {
+  /* Write lock is held. */
+  uint64_t start = urkel_store_clock();
+  urkel_meta_t state;
+
+  URKEL_PROBE2(commit__start, root->hash, store->slab.data_len);
+
+  urkel_store_write_meta(store, &state, root);
+
+  if (!urkel_store_flush(store)) {
+    urkel_store_abort(store);
+    URKEL_PROBE2(commit__done, root->hash, 0);
+    return 0;
+  }
+
+  if (!urkel_syncer_commit(store, state.root_node.hash)) {
+    urkel_store_abort(store);
+    URKEL_PROBE2(commit__done, root->hash, 0);
+    return 0;
+  }
+
+  store->state = state;
+
+  /* Same reasoning for the index, except that it
+     also needs the removals from the transaction. */
+  if (urkel_lookup_enabled(&store->lookup)) {
+    urkel_lookup_t *lookup = &store->lookup;
+
+    if (base != NULL
+        && memcmp(base, lookup->table.root, URKEL_HASH_SIZE) == 0
+        && urkel_lookup_flush(lookup)) {
+      memcpy(lookup->table.root, state.root_node.hash, URKEL_HASH_SIZE);
+    } else {
+      lookup->valid = 0;
+    }
+  }
+
+  if (urkel_dedup_enabled(&store->dedup))
+    urkel_dedup_commit(&store->dedup);
+
+  urkel_store_abort(store);
+
+  /* Every leaf written since the filter was built has been added
+     to it, so the new root is covered if the root it was built on
+     top of was. Otherwise we stop trusting the filter until it is
+     rebuilt on the next open. */
+  if (urkel_keys_enabled(&store->keys)) {
+    if (base != NULL && urkel_keys_covers(&store->keys, base))
+      urkel_keys_push(&store->keys, state.root_node.hash);
+    else
+      urkel_keys_reset(&store->keys);
+  }
+
+  if (state.root_node.type != URKEL_NODE_NULL)
+    urkel_cache_insert(&store->cache, &state.root_node);
+
+  urkel_store_evict(store);
+  urkel_store_account(store);
+
+  urkel_atomic_add(&store->metrics.commits, 1);
+  urkel_atomic_add(&store->metrics.commit_time, urkel_store_elapsed(start));
+
+  URKEL_PROBE2(commit__done, root->hash, 1);
+
+  return 1;
+}
+
+void
+urkel_store_abort(data_store_t *store) {
+  /* Write lock is held. */
+  store->lookup.log_len = 0;
+
+  if (urkel_dedup_enabled(&store->dedup))
+    urkel_dedup_rollback(&store->dedup);
+}
+
+int
+urkel_store_spill(data_store_t *store) {
+  /* Write lock is held. */
+  if (store->slab.data_len > 0 && !urkel_store_flush(store)) {
+    urkel_store_abort(store);
+    return 0;
+  }
+
+  /* Spilled nodes are readable now, but they only become
+     reachable once a commit writes a meta record above them.
+     Their values are in the files, so deduplicating against
+     them is safe. Their index entries are not: the index is
+     only updated on commit, and the commit that eventually
+     publishes these leaves will not write them again. We stop
+     trusting the index until it is rebuilt on the next open. */
+  if (urkel_lookup_enabled(&store->lookup))
+    store->lookup.valid = 0;
+
+  if (urkel_dedup_enabled(&store->dedup))
+    urkel_dedup_commit(&store->dedup);
+
+  urkel_store_abort(store);
+  urkel_store_account(store);
+
+  return 1;
+}
+
+static int
+urkel_store_read_meta(data_store_t *store,
+                      urkel_meta_t *meta,
+                      const urkel_pointer_t *ptr) {
+  unsigned char data[META_SIZE];
+
+  if (!urkel_store_read(store, data, META_SIZE, ptr->index, ptr->pos))
+    return 0;
+
+  return urkel_meta_read(meta, data, store->key);
+}
+
+int
+urkel_store_read_history(data_store_t *store,
+                         urkel_node_t *root,
+                         const unsigned char *root_hash) {
+  static const unsigned char zero_hash[URKEL_HASH_SIZE] = {0};
+  urkel_node_t *root_node = &store->state.root_node;
+  urkel_pointer_t *meta_ptr;
+  urkel_pointer_t *root_ptr;
+  urkel_meta_t meta;
+  urkel_node_t node;
+
+  /* Use custom memcmp to avoid a GCC bug. */
+  if (urkel_memcmp(root_hash, zero_hash, URKEL_HASH_SIZE) == 0) {
+    urkel_node_init(root, URKEL_NODE_NULL);
+    return 1;
+  }
+
+  if (memcmp(root_hash, root_node->hash, URKEL_HASH_SIZE) == 0) {
+    *root = *root_node;
+    return 1;
+  }
+
+  if (urkel_cache_lookup(&store->cache, root, root_hash)) {
+    urkel_atomic_add(&store->metrics.root_hits, 1);
+    return 1;
+  }
+
+  urkel_atomic_add(&store->metrics.root_misses, 1);
+
+  for (;;) {
+    meta_ptr = &store->last_meta.meta_ptr;
+
+    if (meta_ptr->index == 0)
+      return 0;
+
+    if (!urkel_store_read_meta(store, &meta, meta_ptr))
+      return 0;
+
+    urkel_atomic_add(&store->metrics.history_scans, 1);
+
+    URKEL_PROBE3(history__scan, meta_ptr->index, meta_ptr->pos, root_hash);
+
+    root_ptr = &meta.root_ptr;
+
+    if (!urkel_store_read_root(store, &node, root_ptr))
+      return 0;
+
+    store->last_meta = meta;
+
+    if (memcmp(node.hash, root_hash, URKEL_HASH_SIZE) == 0) {
+      *root = node;
+      break;
+    }
+  }
+
+  /* The walk cached every root it passed. */
+  urkel_store_account(store);
+
+  return 1;
+}
+
+int
+urkel_store_has_history(data_store_t *store, const unsigned char *root_hash) {
+  urkel_node_t root;
+  int ret;
+
+  ret = urkel_store_read_history(store, &root, root_hash);
+
+  if (ret)
+    urkel_node_clear(&root);
+
+  return ret;
 }
 
 urkel_node_t *
-urkel_store_resolve(data_store_t *store, const urkel_node_t *node) {
-  urkel_node_t *out = checked_malloc(sizeof(urkel_node_t));
+urkel_store_get_history(data_store_t *store, const unsigned char *root_hash) {
+  urkel_node_t *root = urkel_node_alloc();
+
+  if (!urkel_store_read_history(store, root, root_hash)) {
+    urkel_node_free(root);
+    return NULL;
+  }
+
+  return root;
+}
+
+int
+urkel_store_filter_has(data_store_t *store,
+                       const unsigned char *root_hash,
+                       const unsigned char *key) {
+  /* Read lock is held. */
+  urkel_keys_t *keys = &store->keys;
+
+  if (!urkel_keys_enabled(keys))
+    return 1;
+
+  if (!urkel_keys_covers(keys, root_hash)) {
+    urkel_atomic_add(&store->metrics.filter_misses, 1);
+    return 1;
+  }
+
+  if (urkel_filter_has(&keys->filter, key)) {
+    urkel_atomic_add(&store->metrics.filter_misses, 1);
+    return 1;
+  }
+
+  urkel_atomic_add(&store->metrics.filter_hits, 1);
+
+  return 0;
+}
+
+/*
+ * Scrub
+ */
+
+/* Walks every record reachable from a root and checks
+   it without recomputing any hashes: nodes must parse,
+   checksums must match and values must be readable.
+   Subtrees are split between threads, each with its own
+   read handles so that commits are not held up. */
+
+typedef struct urkel_scrubber_s {
+  const data_store_t *store;
+  urkel_pointer_t *stack;
+  size_t len;
+  size_t size;
+  urkel_file_t **files;
+  size_t files_len;
+  urkel_scrub_t stats;
+} urkel_scrubber_t;
+
+static void
+urkel_scrubber_init(urkel_scrubber_t *scrubber, const data_store_t *store) {
+  memset(scrubber, 0, sizeof(*scrubber));
+  scrubber->store = store;
+}
+
+static void
+urkel_scrubber_clear(urkel_scrubber_t *scrubber) {
+  size_t i;
+
+  for (i = 0; i < scrubber->files_len; i++) {
+    if (scrubber->files[i] != NULL)
+      urkel_file_close(scrubber->files[i]);
+  }
+
+  if (scrubber->files != NULL)
+    free(scrubber->files);
+
+  if (scrubber->stack != NULL)
+    free(scrubber->stack);
+
+  urkel_scrubber_init(scrubber, scrubber->store);
+}
+
+static void
+urkel_scrubber_push(urkel_scrubber_t *scrubber, const urkel_pointer_t *ptr) {
+  if (ptr->index == 0)
+    return;
+
+  if (scrubber->len == scrubber->size) {
+    size_t size = scrubber->size == 0 ? 64 : scrubber->size * 2;
+
+    scrubber->stack = checked_realloc(scrubber->stack,
+                                      size * sizeof(urkel_pointer_t));
+    scrubber->size = size;
+  }
+
+  scrubber->stack[scrubber->len++] = *ptr;
+}
+
+static int
+urkel_scrubber_read(urkel_scrubber_t *scrubber,
+                    unsigned char *out,
+                    const urkel_pointer_t *ptr) {
+  char path[URKEL_PATH_MAX + 1];
+  urkel_file_t *file;
+
+  if (ptr->index == 0 || ptr->index >= MAX_FILES)
+    return 0;
+
+  if (ptr->index >= scrubber->files_len) {
+    size_t len = ptr->index + 1;
+
+    scrubber->files = checked_realloc(scrubber->files,
+                                      len * sizeof(urkel_file_t *));
+
+    while (scrubber->files_len < len)
+      scrubber->files[scrubber->files_len++] = NULL;
+  }
+
+  file = scrubber->files[ptr->index];
+
+  if (file == NULL) {
+    urkel_store_path_index(scrubber->store, path, ptr->index);
+
+    file = urkel_file_open(path, READ_FLAGS, 0);
+
+    if (file == NULL)
+      return 0;
+
+    scrubber->files[ptr->index] = file;
+  }
+
+  return urkel_file_pread(file, out, ptr->size, ptr->pos);
+}
+
+static int
+urkel_scrubber_value(urkel_scrubber_t *scrubber, const urkel_node_t *node) {
+  const urkel_leaf_t *leaf = &node->u.leaf;
+  unsigned char raw[URKEL_VALUE_SIZE];
+  unsigned char out[URKEL_VALUE_SIZE];
+  size_t out_len;
+
+  scrubber->stats.values += 1;
+
+  if (leaf->vptr.size > URKEL_VALUE_SIZE)
+    return 0;
+
+  if (!urkel_scrubber_read(scrubber, raw, &leaf->vptr))
+    return 0;
+
+  if (node->flags & URKEL_FLAG_CHECKSUM) {
+    if (urkel_crc32c(raw, leaf->vptr.size) != leaf->crc)
+      return 0;
+
+    scrubber->stats.checked += 1;
+  } else if (node->flags & URKEL_FLAG_COMPRESSED) {
+    return urkel_decompress(out, &out_len, URKEL_VALUE_SIZE,
+                            raw, leaf->vptr.size);
+  }
+
+  return 1;
+}
+
+static void
+urkel_scrubber_visit(urkel_scrubber_t *scrubber, const urkel_pointer_t *ptr) {
+  unsigned char data[RECORD_SIZE];
+  urkel_node_t node;
+  int ok = 0;
+
+  scrubber->stats.nodes += 1;
+
+  if (ptr->size == 0 || ptr->size > RECORD_SIZE)
+    goto done;
+
+  if (!urkel_scrubber_read(scrubber, data, ptr))
+    goto done;
+
+  if (!urkel_node_read(&node, data, ptr->size))
+    goto done;
+
+  if (!urkel_store_unseal(&node, data, ptr->size)) {
+    urkel_node_clear(&node);
+    goto done;
+  }
+
+  if (ptr->size != urkel_node_size(&node))
+    scrubber->stats.checked += 1;
+
+  if (node.type == URKEL_NODE_INTERNAL) {
+    urkel_scrubber_push(scrubber, &node.u.internal.left->ptr);
+    urkel_scrubber_push(scrubber, &node.u.internal.right->ptr);
+    urkel_node_clear(&node);
+    ok = 1;
+  } else {
+    ok = urkel_scrubber_value(scrubber, &node);
+  }
+
+done:
+  if (!ok)
+    scrubber->stats.corrupt += 1;
+}
+
+static void
+urkel_scrubber_run(void *arg) {
+  urkel_scrubber_t *scrubber = arg;
+
+  while (scrubber->len > 0) {
+    urkel_pointer_t ptr = scrubber->stack[--scrubber->len];
+    urkel_scrubber_visit(scrubber, &ptr);
+  }
+}
+
+int
+urkel_store_scrub(const data_store_t *store,
+                  const urkel_node_t *root,
+                  unsigned int threads,
+                  urkel_scrub_t *stats) {
+  urkel_scrubber_t *scrubbers;
+  urkel_thread_t **handles;
+  urkel_scrubber_t seed;
+  size_t i, head = 0;
+
+  memset(stats, 0, sizeof(*stats));
+
+  if (root->type == URKEL_NODE_NULL)
+    return 1;
+
+  if (threads < 1)
+    threads = 1;
+
+  if (threads > SCRUB_THREADS)
+    threads = SCRUB_THREADS;
+
+  /* Breadth first until there is enough work to split. */
+  urkel_scrubber_init(&seed, store);
+  urkel_scrubber_push(&seed, &root->ptr);
+
+  while (head < seed.len && seed.len - head < threads * SCRUB_SPLIT)
+    urkel_scrubber_visit(&seed, &seed.stack[head++]);
+
+  scrubbers = checked_malloc(threads * sizeof(urkel_scrubber_t));
+  handles = checked_malloc(threads * sizeof(urkel_thread_t *));
+
+  for (i = 0; i < threads; i++)
+    urkel_scrubber_init(&scrubbers[i], store);
+
+  for (i = head; i < seed.len; i++)
+    urkel_scrubber_push(&scrubbers[i % threads], &seed.stack[i]);
+
+  for (i = 1; i < threads; i++)
+    handles[i] = urkel_thread_create(urkel_scrubber_run, &scrubbers[i]);
+
+  /* Picks up the work of any thread which failed to start. */
+  urkel_scrubber_run(&scrubbers[0]);
+
+  for (i = 1; i < threads; i++) {
+    if (handles[i] != NULL)
+      urkel_thread_join(handles[i]);
+    else
+      urkel_scrubber_run(&scrubbers[i]);
+  }
+
+  *stats = seed.stats;
+
+  for (i = 0; i < threads; i++) {
+    stats->nodes += scrubbers[i].stats.nodes;
+    stats->values += scrubbers[i].stats.values;
+    stats->checked += scrubbers[i].stats.checked;
+    stats->corrupt += scrubbers[i].stats.corrupt;
+
+    urkel_scrubber_clear(&scrubbers[i]);
+  }
+
+  urkel_scrubber_clear(&seed);
+
+  free(handles);
+  free(scrubbers);
+
+  return stats->corrupt == 0;
+}
+
+typedef int urkel_walk_f(data_store_t *store,
+                         const urkel_node_t *leaf,
+                         void *arg);
+
+static int
+urkel_store_walk(data_store_t *store,
+                 const urkel_node_t *node,
+                 urkel_walk_f *cb,
+                 void *arg) {
+  /* Visit every leaf below a committed node. */
+  urkel_node_t rn;
+  int ret = 1;
+
+  if (node->type == URKEL_NODE_NULL)
+    return 1;
 
   CHECK(node->type == URKEL_NODE_HASH);
 
-  if (!urkel_store_read_node(store, out, &node->ptr)) {
-    free(out);
-    return NULL;
+  if (!urkel_store_read_node(store, &rn, &node->ptr))
+    return 0;
+
+  switch (rn.type) {
+    case URKEL_NODE_INTERNAL: {
+      urkel_internal_t *internal = &rn.u.internal;
+
+      ret = urkel_store_walk(store, internal->left, cb, arg)
+         && urkel_store_walk(store, internal->right, cb, arg);
+
+      break;
+    }
+
+    case URKEL_NODE_LEAF: {
+      ret = cb(store, &rn, arg);
+      break;
+    }
+
+    default: {
+      ret = 0;
+      break;
+    }
+  }
+
+  urkel_node_clear(&rn);
+
+  return ret;
+}
+
+static int
+urkel_store_filter_walk(data_store_t *store,
+                        const urkel_node_t *leaf,
+                        void *arg) {
+  (void)store;
+  urkel_filter_add(arg, leaf->u.leaf.key);
+  return 1;
+}
+
+static int
+urkel_store_filter_build(data_store_t *store, size_t capacity) {
+  /* Walk the current root, growing the filter if we guessed wrong. */
+  urkel_node_t *root = &store->state.root_node;
+  urkel_filter_t filter;
+
+  for (;;) {
+    urkel_filter_init(&filter, capacity);
+
+    if (!urkel_store_walk(store, root, urkel_store_filter_walk, &filter)) {
+      urkel_filter_clear(&filter);
+      return 0;
+    }
+
+    if (!urkel_filter_full(&filter))
+      break;
+
+    capacity = filter.count * 2;
+
+    urkel_filter_clear(&filter);
+  }
+
+  store->keys.filter = filter;
+
+  return 1;
+}
+
+static int
+urkel_store_filter_read(data_store_t *store,
+                        urkel_filter_t *filter,
+                        const char *path) {
+  unsigned char *root_hash = store->state.root_node.hash;
+  unsigned char expect[20];
+  unsigned char *data;
+  urkel_stat_t st;
+  size_t size;
+  int ret = 0;
+
+  if (!urkel_fs_stat(path, &st))
+    return 0;
+
+  if (st.st_size < 4 + URKEL_HASH_SIZE + 20)
+    return 0;
+
+  size = st.st_size;
+  data = checked_malloc(size);
+
+  if (!urkel_fs_read_file(path, data, size))
+    goto fail;
+
+  urkel_checksum(expect, data, size - 20, store->key);
+
+  if (memcmp(expect, data + size - 20, 20) != 0)
+    goto fail;
+
+  if (urkel_read32(data) != FILTER_MAGIC)
+    goto fail;
+
+  /* Stale filter (e.g. we crashed before it was written). */
+  if (memcmp(data + 4, root_hash, URKEL_HASH_SIZE) != 0)
+    goto fail;
+
+  ret = urkel_filter_read(filter, data + 4 + URKEL_HASH_SIZE,
+                                  size - 4 - URKEL_HASH_SIZE - 20);
+fail:
+  free(data);
+  return ret;
+}
+
+static void
+urkel_store_filter_load(data_store_t *store) {
+  unsigned char *root_hash = store->state.root_node.hash;
+  char path[URKEL_PATH_MAX + 1];
+  urkel_filter_t filter;
+  size_t capacity = 0;
+
+  urkel_store_path(store, path, "filter");
+
+  if (urkel_store_filter_read(store, &filter, path)) {
+    if (!urkel_filter_full(&filter)) {
+      store->keys.filter = filter;
+      urkel_keys_push(&store->keys, root_hash);
+      return;
+    }
+
+    capacity = filter.count * 2;
+
+    urkel_filter_clear(&filter);
+  }
+
+  /* The filter is only an optimization. If we fail
+     to rebuild it, lookups fall back to the tree. */
+  if (!urkel_store_filter_build(store, capacity))
+    return;
+
+  urkel_keys_push(&store->keys, root_hash);
+
+  /* The walk may have opened every data file. */
+  urkel_store_evict(store);
+}
+
+static void
+urkel_store_filter_save(data_store_t *store) {
+  unsigned char *root_hash = store->state.root_node.hash;
+  urkel_filter_t *filter = &store->keys.filter;
+  char path[URKEL_PATH_MAX + 1];
+  char tmp[URKEL_PATH_MAX + 1];
+  unsigned char *data, *raw;
+  size_t size;
+
+  if (!urkel_keys_enabled(&store->keys))
+    return;
+
+  urkel_store_path(store, path, "filter");
+  urkel_store_path(store, tmp, "filter~");
+
+  if (!urkel_keys_covers(&store->keys, root_hash)) {
+    urkel_fs_unlink(path);
+    return;
+  }
+
+  size = 4 + URKEL_HASH_SIZE + urkel_filter_size(filter) + 20;
+  data = checked_malloc(size);
+
+  raw = urkel_write32(data, FILTER_MAGIC);
+  raw = urkel_write(raw, root_hash, URKEL_HASH_SIZE);
+  raw = urkel_filter_write(filter, raw);
+  raw = urkel_checksum(raw, data, raw - data, store->key);
+
+  CHECK((size_t)(raw - data) == size);
+
+  if (urkel_fs_write_file(tmp, 0640, data, size))
+    urkel_fs_rename(tmp, path);
+  else
+    urkel_fs_unlink(tmp);
+
+  free(data);
+}
+
+int
+urkel_store_index_get(data_store_t *store,
+                      urkel_node_t *leaf,
+                      const unsigned char *root_hash,
+                      const unsigned char *key) {
+  /* Read lock is held. */
+  urkel_lookup_t *lookup = &store->lookup;
+  urkel_pointer_t ptr;
+  int ret;
+
+  if (!urkel_lookup_enabled(lookup))
+    return -1;
+
+  if (memcmp(root_hash, lookup->table.root, URKEL_HASH_SIZE) != 0)
+    goto miss;
+
+  ret = urkel_index_get(&lookup->table, &ptr, key);
+
+  if (ret == -1)
+    goto miss;
+
+  if (ret == 1) {
+    if (!urkel_store_read_node(store, leaf, &ptr))
+      goto miss;
+
+    if (leaf->type != URKEL_NODE_LEAF
+        || !urkel_node_key_equals(leaf, key)) {
+      urkel_node_clear(leaf);
+      goto miss;
+    }
   }
 
-  urkel_node_hashed(out, node->hash);
+  urkel_atomic_add(&store->metrics.index_hits, 1);
 
-  return out;
+  return ret;
+miss:
+  urkel_atomic_add(&store->metrics.index_misses, 1);
+  return -1;
 }
 
 void
-urkel_store_write_node(data_store_t *store, urkel_node_t *node) {
+urkel_store_index_remove(data_store_t *store, const unsigned char *key) {
   /* Write lock is held. */
-  urkel_slab_t *slab = &store->slab;
-  unsigned char raw[URKEL_NODE_SIZE];
-  size_t size = urkel_node_write(node, raw) - raw;
+  if (urkel_lookup_enabled(&store->lookup))
+    urkel_lookup_push(&store->lookup, key, NULL, 1);
+}
 
-  CHECK(node->type == URKEL_NODE_INTERNAL
-     || node->type == URKEL_NODE_LEAF);
+static int
+urkel_store_index_walk(data_store_t *store,
+                       const urkel_node_t *leaf,
+                       void *arg) {
+  urkel_lookup_t *lookup = arg;
 
-  CHECK(!(node->flags & URKEL_FLAG_WRITTEN));
+  (void)store;
 
-  urkel_slab_write(slab, raw, size);
+  urkel_lookup_push(lookup, leaf->u.leaf.key, &leaf->ptr, 0);
 
-  urkel_node_mark(node, slab->file_index,
-                  slab->file_pos - size,
-                  size);
+  if (lookup->log_len < LOOKUP_BATCH)
+    return 1;
+
+  return urkel_lookup_flush(lookup);
 }
 
-void
-urkel_store_write_value(data_store_t *store, urkel_node_t *node) {
-  /* Write lock is held. */
-  urkel_slab_t *slab = &store->slab;
-  urkel_leaf_t *leaf = &node->u.leaf;
+static void
+urkel_store_index_load(data_store_t *store) {
+  unsigned char *root_hash = store->state.root_node.hash;
+  urkel_lookup_t *lookup = &store->lookup;
+  urkel_index_t *table = &lookup->table;
+  char path[URKEL_PATH_MAX + 1];
+  uint64_t capacity = 0;
 
-  CHECK(node->type == URKEL_NODE_LEAF);
-  CHECK(!(node->flags & URKEL_FLAG_SAVED));
-  CHECK(node->flags & URKEL_FLAG_VALUE);
+  urkel_store_path(store, path, "index");
 
-  urkel_slab_write(slab, leaf->value, leaf->size);
+  if (urkel_index_open(table, path, store->key)) {
+    if (memcmp(table->root, root_hash, URKEL_HASH_SIZE) == 0) {
+      lookup->valid = 1;
+      return;
+    }
 
-  urkel_node_save(node, slab->file_index,
-                  slab->file_pos - leaf->size,
-                  leaf->size);
+    capacity = table->count;
+
+    urkel_index_close(table, 0);
+  }
+
+  if (!urkel_index_create(table, path, store->key, capacity))
+    return;
+
+  if (!urkel_store_walk(store, &store->state.root_node,
+                        urkel_store_index_walk, lookup)
+      || !urkel_lookup_flush(lookup)) {
+    urkel_index_close(table, 0);
+    urkel_lookup_clear(lookup);
+    urkel_fs_unlink(path);
+    return;
+  }
+
+  memcpy(table->root, root_hash, URKEL_HASH_SIZE);
+
+  lookup->valid = 1;
+
+  urkel_store_evict(store);
 }
 
-int
-urkel_store_needs_flush(const data_store_t *store) {
-  /* Write lock is held. */
-  return store->slab.data_len >= WRITE_BUFFER;
+static void
+urkel_store_index_save(data_store_t *store) {
+  urkel_lookup_t *lookup = &store->lookup;
+  int clean = lookup->valid
+           && memcmp(lookup->table.root, store->state.root_node.hash,
+                     URKEL_HASH_SIZE) == 0;
+
+  urkel_index_close(&lookup->table, clean);
 }
 
-int
-urkel_store_flush(data_store_t *store) {
-  /* Write lock is held. */
-  urkel_slab_t *slab = &store->slab;
-  unsigned char *data = slab->data;
-  size_t i = 0;
+/*
+ * Warmup
+ */
 
-  slab->offsets[slab->steps++] = slab->data_off;
+/* On close, the pointers of the nodes in the top levels of
+   the tree are written to a manifest. Every lookup passes
+   through these nodes. On open, a worker thread reads them
+   back in file order, so that they are in the page cache
+   before lookups need them, rather than being faulted in one
+   dependent read at a time. The manifest is only a hint: a
+   stale one (e.g. after a crash) warms the previous tree. */
 
-  for (; i < slab->start; i++)
-    data += slab->offsets[i];
+static void
+urkel_warmer_init(urkel_warmer_t *warmer) {
+  memset(warmer, 0, sizeof(*warmer));
 
-  for (; i < slab->steps; i++) {
-    size_t len = slab->offsets[i];
+  warmer->lock = urkel_mutex_create();
+}
 
-    if (!urkel_store_write(store, data, len)) {
-      slab->steps -= 1;
-      slab->start = i;
-      return 0;
-    }
+static void
+urkel_warmer_push(urkel_warmer_t *warmer, const urkel_pointer_t *ptr) {
+  if (warmer->len == warmer->size) {
+    size_t size = warmer->size == 0 ? 64 : warmer->size * 2;
 
-    data += len;
+    warmer->ptrs = checked_realloc(warmer->ptrs,
+                                   size * sizeof(urkel_pointer_t));
+    warmer->size = size;
   }
 
-  slab->data_len = 0;
-  slab->data_off = 0;
-  slab->steps = 0;
-  slab->start = 0;
+  warmer->ptrs[warmer->len++] = *ptr;
+}
 
-  return 1;
+static int
+urkel_warmer_stopped(urkel_warmer_t *warmer) {
+  int ret;
+
+  urkel_mutex_lock(warmer->lock);
+  ret = warmer->stop;
+  urkel_mutex_unlock(warmer->lock);
+
+  return ret;
+}
+
+static int
+urkel_warmer_compare(const void *a, const void *b) {
+  const urkel_pointer_t *x = a;
+  const urkel_pointer_t *y = b;
+
+  if (x->index != y->index)
+    return x->index < y->index ? -1 : 1;
+
+  if (x->pos != y->pos)
+    return x->pos < y->pos ? -1 : 1;
+
+  return 0;
 }
 
 static void
-urkel_store_write_meta(data_store_t *store,
-                       urkel_meta_t *state,
-                       const urkel_node_t *root) {
-  /* Write lock is held. */
-  static const unsigned char padding[META_SIZE] = {0};
-  urkel_slab_t *slab = &store->slab;
-  unsigned char raw[META_SIZE];
+urkel_warmer_run(void *arg) {
+  data_store_t *store = arg;
+  urkel_warmer_t *warmer = &store->warmer;
+  unsigned char *buf = checked_malloc(WARM_CHUNK);
+  char path[URKEL_PATH_MAX + 1];
+  urkel_pointer_t *ptrs = warmer->ptrs;
+  urkel_file_t *file = NULL;
+  uint32_t index = 0;
+  size_t i = 0;
 
-  CHECK(root->flags & URKEL_FLAG_WRITTEN);
+  qsort(ptrs, warmer->len, sizeof(urkel_pointer_t), urkel_warmer_compare);
 
-  *state = store->state;
+  /* Files are opened separately from the store's, which
+     belong to whichever thread holds the tree lock. */
+  while (i < warmer->len && !urkel_warmer_stopped(warmer)) {
+    uint64_t start = ptrs[i].pos;
+    uint64_t end = start + ptrs[i].size;
+    size_t j = i + 1;
 
-  state->root_ptr = root->ptr;
+    while (j < warmer->len
+           && ptrs[j].index == ptrs[i].index
+           && ptrs[j].pos <= end + WARM_GAP
+           && ptrs[j].pos + ptrs[j].size - start <= WARM_CHUNK) {
+      if (ptrs[j].pos + ptrs[j].size > end)
+        end = ptrs[j].pos + ptrs[j].size;
 
-  urkel_node_to_hash(root, &state->root_node);
+      j += 1;
+    }
 
-  if (slab->file_pos % META_SIZE) {
-    size_t size = META_SIZE - (slab->file_pos % META_SIZE);
+    if (file == NULL || ptrs[i].index != index) {
+      if (file != NULL)
+        urkel_file_close(file);
 
-    urkel_slab_write(slab, padding, size);
+      index = ptrs[i].index;
+
+      urkel_store_path_index(store, path, index);
+
+      file = urkel_file_open(path, READ_FLAGS, 0);
+    }
+
+    if (file != NULL)
+      urkel_file_pread(file, buf, end - start, start);
+
+    i = j;
   }
 
-  urkel_meta_write(state, raw, store->key);
-  urkel_slab_write(slab, raw, META_SIZE);
+  if (file != NULL)
+    urkel_file_close(file);
 
-  state->meta_ptr.index = slab->file_index;
-  state->meta_ptr.pos = slab->file_pos - META_SIZE;
+  free(buf);
 }
 
-int
-urkel_store_commit(data_store_t *store, const urkel_node_t *root) {
-  /* Write lock is held. */
-  urkel_meta_t state;
+static void
+urkel_warmer_stop(urkel_warmer_t *warmer) {
+  if (warmer->thread == NULL)
+    return;
 
-  urkel_store_write_meta(store, &state, root);
+  urkel_mutex_lock(warmer->lock);
+  warmer->stop = 1;
+  urkel_mutex_unlock(warmer->lock);
 
-  if (!urkel_store_flush(store))
-    return 0;
+  urkel_thread_join(warmer->thread);
 
-#ifdef URKEL_FSYNC
-  if (!urkel_store_sync(store))
-    return 0;
-#endif
+  warmer->thread = NULL;
+}
 
-  store->state = state;
+static void
+urkel_warmer_clear(urkel_warmer_t *warmer) {
+  urkel_warmer_stop(warmer);
 
-  if (state.root_node.type != URKEL_NODE_NULL)
-    urkel_cache_insert(&store->cache, &state.root_node);
+  if (warmer->ptrs != NULL)
+    free(warmer->ptrs);
 
-  urkel_store_evict(store);
+  urkel_mutex_destroy(warmer->lock);
 
-  return 1;
+  memset(warmer, 0, sizeof(*warmer));
 }
 
 static int
-urkel_store_read_meta(data_store_t *store,
-                      urkel_meta_t *meta,
-                      const urkel_pointer_t *ptr) {
-  unsigned char data[META_SIZE];
+urkel_store_warm_walk(data_store_t *store,
+                      const urkel_pointer_t *ptr,
+                      unsigned int depth) {
+  urkel_warmer_t *warmer = &store->warmer;
+  urkel_pointer_t child;
+  urkel_view_t view;
+
+  if (!urkel_store_read_view(store, &view, ptr))
+    return 0;
 
-  if (!urkel_store_read(store, data, META_SIZE, ptr->index, ptr->pos))
+  urkel_warmer_push(warmer, ptr);
+
+  if (view.type != URKEL_NODE_INTERNAL || depth + 1 >= warmer->levels)
+    return 1;
+
+  urkel_view_pointer(&view, 0, &child);
+
+  if (!urkel_store_warm_walk(store, &child, depth + 1))
     return 0;
 
-  return urkel_meta_read(meta, data, store->key);
+  urkel_view_pointer(&view, 1, &child);
+
+  return urkel_store_warm_walk(store, &child, depth + 1);
 }
 
-int
-urkel_store_read_history(data_store_t *store,
-                         urkel_node_t *root,
-                         const unsigned char *root_hash) {
-  static const unsigned char zero_hash[URKEL_HASH_SIZE] = {0};
-  urkel_node_t *root_node = &store->state.root_node;
-  urkel_pointer_t *meta_ptr;
-  urkel_pointer_t *root_ptr;
-  urkel_meta_t meta;
-  urkel_node_t node;
+static void
+urkel_store_warm_load(data_store_t *store, unsigned int levels) {
+  urkel_warmer_t *warmer = &store->warmer;
+  char path[URKEL_PATH_MAX + 1];
+  unsigned char expect[20];
+  unsigned char *data = NULL;
+  const unsigned char *raw;
+  urkel_pointer_t ptr;
+  urkel_stat_t st;
+  size_t i, size, count;
 
-  /* Use custom memcmp to avoid a GCC bug. */
-  if (urkel_memcmp(root_hash, zero_hash, URKEL_HASH_SIZE) == 0) {
-    urkel_node_init(root, URKEL_NODE_NULL);
-    return 1;
-  }
+  warmer->levels = levels;
 
-  if (memcmp(root_hash, root_node->hash, URKEL_HASH_SIZE) == 0) {
-    *root = *root_node;
-    return 1;
-  }
+  if (levels == 0)
+    return;
 
-  if (urkel_cache_lookup(&store->cache, root, root_hash))
-    return 1;
+  urkel_store_path(store, path, "warm");
 
-  for (;;) {
-    meta_ptr = &store->last_meta.meta_ptr;
+  if (!urkel_fs_stat(path, &st))
+    return;
 
-    if (meta_ptr->index == 0)
-      return 0;
+  if (st.st_size < 8 + 20)
+    return;
 
-    if (!urkel_store_read_meta(store, &meta, meta_ptr))
-      return 0;
+  size = st.st_size;
+  data = checked_malloc(size);
 
-    root_ptr = &meta.root_ptr;
+  if (!urkel_fs_read_file(path, data, size))
+    goto fail;
 
-    if (!urkel_store_read_root(store, &node, root_ptr))
-      return 0;
+  urkel_checksum(expect, data, size - 20, store->key);
 
-    store->last_meta = meta;
+  if (memcmp(expect, data + size - 20, 20) != 0)
+    goto fail;
 
-    if (memcmp(node.hash, root_hash, URKEL_HASH_SIZE) == 0) {
-      *root = node;
-      break;
-    }
+  if (urkel_read32(data) != WARM_MAGIC)
+    goto fail;
+
+  count = urkel_read32(data + 4);
+
+  if (count != (size - 8 - 20) / URKEL_PTR_SIZE)
+    goto fail;
+
+  raw = data + 8;
+
+  for (i = 0; i < count; i++) {
+    urkel_pointer_read(&ptr, raw);
+    urkel_warmer_push(warmer, &ptr);
+    raw += URKEL_PTR_SIZE;
   }
 
-  return 1;
+  warmer->thread = urkel_thread_create(urkel_warmer_run, store);
+
+  /* No threads on this platform: a synchronous warmup
+     would only delay the open. */
+  if (warmer->thread == NULL)
+    warmer->len = 0;
+
+fail:
+  free(data);
 }
 
-int
-urkel_store_has_history(data_store_t *store, const unsigned char *root_hash) {
-  urkel_node_t root;
-  int ret;
+static void
+urkel_store_warm_save(data_store_t *store) {
+  urkel_warmer_t *warmer = &store->warmer;
+  urkel_node_t *root = &store->state.root_node;
+  char path[URKEL_PATH_MAX + 1];
+  char tmp[URKEL_PATH_MAX + 1];
+  unsigned char *data, *raw;
+  size_t i, size;
 
-  ret = urkel_store_read_history(store, &root, root_hash);
+  if (warmer->levels == 0)
+    return;
 
-  if (ret)
-    urkel_node_clear(&root);
+  urkel_warmer_stop(warmer);
 
-  return ret;
-}
+  urkel_store_path(store, path, "warm");
+  urkel_store_path(store, tmp, "warm~");
 
-urkel_node_t *
-urkel_store_get_history(data_store_t *store, const unsigned char *root_hash) {
-  urkel_node_t *root = checked_malloc(sizeof(urkel_node_t));
+  warmer->len = 0;
 
-  if (!urkel_store_read_history(store, root, root_hash)) {
-    free(root);
-    return NULL;
+  if (root->type == URKEL_NODE_NULL
+      || !urkel_store_warm_walk(store, &root->ptr, 0)) {
+    urkel_fs_unlink(path);
+    return;
   }
 
-  return root;
+  size = 8 + warmer->len * URKEL_PTR_SIZE + 20;
+  data = checked_malloc(size);
+
+  raw = urkel_write32(data, WARM_MAGIC);
+  raw = urkel_write32(raw, warmer->len);
+
+  for (i = 0; i < warmer->len; i++)
+    raw = urkel_pointer_write(&warmer->ptrs[i], raw);
+
+  raw = urkel_checksum(raw, data, raw - data, store->key);
+
+  CHECK((size_t)(raw - data) == size);
+
+  if (urkel_fs_write_file(tmp, 0640, data, size))
+    urkel_fs_rename(tmp, path);
+  else
+    urkel_fs_unlink(tmp);
+
+  free(data);
 }
 
 /*
@@ -1027,6 +3321,39 @@ done:
   return ret;
 }
 
+static int
+urkel_store_align_file(const data_store_t *store, uint32_t index) {
+  /* Direct writes append whole blocks, but recovery
+     truncates the file to its last meta root. Pad it
+     back out with zeroes before appending again. */
+  char path[URKEL_PATH_MAX + 1];
+  urkel_stat_t st;
+  int ret = 0;
+  int fd;
+
+  urkel_store_path_index(store, path, index);
+
+  fd = urkel_fs_open(path, URKEL_O_RDWR, 0);
+
+  if (fd == -1)
+    return 1;
+
+  if (!urkel_fs_fstat(fd, &st))
+    goto done;
+
+  if (st.st_size % DIRECT_ALIGN) {
+    st.st_size += DIRECT_ALIGN - (st.st_size % DIRECT_ALIGN);
+
+    if (!urkel_fs_ftruncate(fd, st.st_size))
+      goto done;
+  }
+
+  ret = 1;
+done:
+  urkel_fs_close(fd);
+  return ret;
+}
+
 static int
 urkel_store_recover_state(const data_store_t *store,
                           urkel_meta_t *state,
@@ -1069,9 +3396,36 @@ static void
 urkel_store_clear(data_store_t *store);
 
 static int
-urkel_store_init(data_store_t *store, const char *prefix) {
+urkel_store_init(data_store_t *store,
+                 const char *prefix,
+                 const urkel_tree_options_t *options) {
+  urkel_tree_options_t defaults;
   uint32_t index;
 
+  if (options == NULL) {
+    urkel_tree_options_init(&defaults);
+    options = &defaults;
+  }
+
+  memset(&store->metrics, 0, sizeof(store->metrics));
+
+  store->flags = options->flags;
+  store->write_flags = WRITE_FLAGS;
+  store->write_buffer = WRITE_BUFFER;
+
+  if (options->memory != 0) {
+    size_t share = options->memory / WRITE_BUFFER_SHARE;
+
+    if (share < READ_BUFFER)
+      share = READ_BUFFER;
+
+    if (share < store->write_buffer)
+      store->write_buffer = share;
+  }
+
+  if (store->flags & URKEL_OPTION_DIRECT)
+    store->write_flags |= URKEL_O_DIRECT;
+
   if (!urkel_store_init_prefix(store, prefix))
     return 0;
 
@@ -1096,9 +3450,24 @@ urkel_store_init(data_store_t *store, const char *prefix) {
   urkel_filemap_init(&store->files);
   urkel_cache_init(&store->cache);
   urkel_rng_init(&store->rng);
+  urkel_keys_init(&store->keys);
+  urkel_lookup_init(&store->lookup);
+  urkel_dedup_init(&store->dedup, store->flags & URKEL_OPTION_DEDUP);
+  urkel_syncer_init(&store->syncer, options);
+  urkel_governor_init(&store->governor, options->memory);
+  urkel_warmer_init(&store->warmer);
+
+  if (store->flags & URKEL_OPTION_DIRECT) {
+    store->slab.align = DIRECT_ALIGN;
+
+    if (!urkel_store_align_file(store, index)) {
+      urkel_store_clear(store);
+      return 0;
+    }
+  }
 
   store->index = index;
-  store->current = urkel_store_open_file(store, index, WRITE_FLAGS);
+  store->current = urkel_store_open_file(store, index, store->write_flags);
 
   if (store->current == NULL) {
     urkel_store_clear(store);
@@ -1114,6 +3483,16 @@ urkel_store_init(data_store_t *store, const char *prefix) {
     return 0;
   }
 
+  if (store->flags & URKEL_OPTION_FILTER)
+    urkel_store_filter_load(store);
+
+  if (store->flags & URKEL_OPTION_INDEX)
+    urkel_store_index_load(store);
+
+  urkel_store_warm_load(store, options->warm_levels);
+  urkel_store_account(store);
+  urkel_syncer_start(store);
+
   return 1;
 }
 
@@ -1121,12 +3500,21 @@ static void
 urkel_store_clear(data_store_t *store) {
   char path[URKEL_PATH_MAX + 1];
 
+  urkel_syncer_clear(store);
+  urkel_store_warm_save(store);
+  urkel_store_filter_save(store);
+  urkel_store_index_save(store);
   urkel_store_path(store, path, "lock");
 
   urkel_slab_clear(&store->slab);
   urkel_filemap_clear(&store->files);
   urkel_cache_clear(&store->cache);
   urkel_rng_clear(&store->rng);
+  urkel_keys_clear(&store->keys);
+  urkel_lookup_clear(&store->lookup);
+  urkel_dedup_clear(&store->dedup);
+  urkel_governor_clear(&store->governor);
+  urkel_warmer_clear(&store->warmer);
   urkel_fs_close_lock(store->lock_fd);
   urkel_fs_unlink(path);
 
@@ -1134,10 +3522,10 @@ urkel_store_clear(data_store_t *store) {
 }
 
 data_store_t *
-urkel_store_open(const char *prefix) {
+urkel_store_open(const char *prefix, const urkel_tree_options_t *options) {
   data_store_t *store = checked_malloc(sizeof(data_store_t));
 
-  if (!urkel_store_init(store, prefix)) {
+  if (!urkel_store_init(store, prefix, options)) {
     free(store);
     return NULL;
   }
@@ -1238,7 +3626,14 @@ urkel_store_destroy(const char *prefix) {
   for (i = 0; i < count; i++) {
     const char *name = list[i]->d_name;
 
-    if (urkel_parse_u32(NULL, name) || strcmp(name, "meta") == 0) {
+    if (urkel_parse_u32(NULL, name)
+        || strcmp(name, "meta") == 0
+        || strcmp(name, "filter") == 0
+        || strcmp(name, "filter~") == 0
+        || strcmp(name, "index") == 0
+        || strcmp(name, "index~") == 0
+        || strcmp(name, "warm") == 0
+        || strcmp(name, "warm~") == 0) {
       memcpy(path + path_len, name, strlen(name) + 1);
       urkel_fs_unlink(path);
     }
@@ -23,7 +23,7 @@ typedef struct urkel_store_s urkel_store_t;
  */
 
 urkel_store_t *
-urkel_store_open(const char *prefix);
+urkel_store_open(const char *prefix, const urkel_tree_options_t *options);
 
 void
 urkel_store_close(urkel_store_t *store);
@@ -43,6 +43,9 @@ urkel_store_get_root(urkel_store_t *store);
 const unsigned char *
 urkel_store_root_hash(urkel_store_t *store);
 
+void
+urkel_store_durable_root(urkel_store_t *store, unsigned char *hash);
+
 int
 urkel_store_retrieve(urkel_store_t *store,
                      const urkel_node_t *node,
@@ -52,6 +55,16 @@ urkel_store_retrieve(urkel_store_t *store,
 urkel_node_t *
 urkel_store_resolve(urkel_store_t *store, const urkel_node_t *node);
 
+int
+urkel_store_resolve_frame(urkel_store_t *store,
+                          urkel_frame_t *frame,
+                          const urkel_node_t *node);
+
+int
+urkel_store_read_view(urkel_store_t *store,
+                      urkel_view_t *view,
+                      const urkel_pointer_t *ptr);
+
 void
 urkel_store_write_node(urkel_store_t *store, urkel_node_t *node);
 
@@ -65,7 +78,12 @@ int
 urkel_store_flush(urkel_store_t *store);
 
 int
-urkel_store_commit(urkel_store_t *store, const urkel_node_t *root);
+urkel_store_commit(urkel_store_t *store,
+                   const urkel_node_t *root,
+                   const unsigned char *base);
+
+int
+urkel_store_spill(urkel_store_t *store);
 
 int
 urkel_store_has_history(urkel_store_t *store, const unsigned char *root_hash);
@@ -73,4 +91,48 @@ urkel_store_has_history(urkel_store_t *store, const unsigned char *root_hash);
 urkel_node_t *
 urkel_store_get_history(urkel_store_t *store, const unsigned char *root_hash);
 
+void
+urkel_store_abort(urkel_store_t *store);
+
+void
+urkel_store_memory(urkel_store_t *store, urkel_memory_t *usage);
+
+void
+urkel_store_metrics(urkel_store_t *store, urkel_metrics_t *metrics);
+
+int
+urkel_store_over_budget(urkel_store_t *store);
+
+int
+urkel_store_charge(urkel_store_t *store, size_t size);
+
+void
+urkel_store_release(urkel_store_t *store, size_t size);
+
+void
+urkel_store_trim(urkel_store_t *store);
+
+void
+urkel_store_charge_tx(urkel_store_t *store, size_t alloc, size_t freed);
+
+int
+urkel_store_scrub(const urkel_store_t *store,
+                  const urkel_node_t *root,
+                  unsigned int threads,
+                  urkel_scrub_t *stats);
+
+int
+urkel_store_filter_has(urkel_store_t *store,
+                       const unsigned char *root_hash,
+                       const unsigned char *key);
+
+int
+urkel_store_index_get(urkel_store_t *store,
+                      urkel_node_t *leaf,
+                      const unsigned char *root_hash,
+                      const unsigned char *key);
+
+void
+urkel_store_index_remove(urkel_store_t *store, const unsigned char *key);
+
 #endif /* _URKEL_STORE_H */
@@ -15,6 +15,20 @@
 #include "store.h"
 #include "util.h"
 
+/*
+ * Defines
+ */
+
+/* Levels of a transaction kept in memory when it spills. */
+#define SPILL_LEVELS 8
+
+/* Lock roles counted with URKEL_OPTION_LOCKSTATS. */
+#define LOCK_TREE_READ 0
+#define LOCK_TREE_WRITE 1
+#define LOCK_TX_READ 2
+#define LOCK_TX_WRITE 3
+#define LOCK_ROLES 4
+
 /*
  * Structs
  */
@@ -23,19 +37,37 @@ typedef struct urkel_s {
   urkel_store_t *store;
   urkel_rwlock_t *lock;
   unsigned char hash[URKEL_HASH_SIZE];
+  unsigned int flags;
+  size_t spill;
+  unsigned int resident;
   int revert;
+  urkel_lockstat_t locks[LOCK_ROLES];
 } tree_db_t;
 
+typedef struct urkel_savepoint_s {
+  urkel_node_t *root;
+  size_t removed_len;
+} urkel_savepoint_t;
+
 typedef struct urkel_tx_s {
   tree_db_t *tree;
   urkel_node_t *root;
-  urkel_rwlock_t *lock;
+  unsigned char base[URKEL_HASH_SIZE]; /* Committed root we started from. */
+  unsigned char *removed; /* Keys removed since `base` (for the index). */
+  size_t removed_len;
+  size_t removed_size;
+  urkel_savepoint_t *saved; /* Savepoints (each holds a reference). */
+  size_t saved_len;
+  size_t saved_size;
+  size_t memory; /* Bytes of nodes charged to the memory budget. */
+  size_t unspilled; /* Memory a spill found nothing to write at. */
+  urkel_rwlock_t *lock; /* Shared with forks (see urkel_tx_fork). */
+  size_t *forks; /* Number of transactions sharing `lock`. */
 } tree_tx_t;
 
 typedef struct urkel_state_s {
   urkel_node_t *node;
   unsigned int depth;
-  int resolved;
   int child;
 } urkel_state_t;
 
@@ -46,6 +78,7 @@ typedef struct urkel_iter_s {
   urkel_node_t *root;
   urkel_node_t *node;
   urkel_state_t stack[URKEL_KEY_BITS];
+  urkel_frame_t *frames[URKEL_KEY_BITS]; /* Reused by stack position. */
   size_t stack_len;
   int done;
   int transient;
@@ -76,73 +109,144 @@ __urkel_get_errno(void) {
  */
 
 static int
-urkel_tree_get(tree_db_t *tree,
-               unsigned char *value,
-               size_t *size,
-               urkel_node_t *node,
-               const unsigned char *key,
-               unsigned int depth) {
-  switch (node->type) {
-    case URKEL_NODE_NULL: {
-      /* Empty tree. */
-      urkel_errno = URKEL_ENOTFOUND;
+urkel_tree_get_view(tree_db_t *tree,
+                    unsigned char *value,
+                    size_t *size,
+                    const urkel_node_t *node,
+                    const unsigned char *key,
+                    unsigned int depth) {
+  /* Below the first hash node everything is on disk. Each
+     record is read into a view and only the parts needed to
+     pick the next one are decoded. */
+  urkel_pointer_t ptr = node->ptr;
+  urkel_view_t view;
+
+  for (;;) {
+    if (!urkel_store_read_view(tree->store, &view, &ptr)) {
+      urkel_errno = URKEL_ECORRUPTION;
       return 0;
     }
 
-    case URKEL_NODE_INTERNAL: {
-      urkel_internal_t *internal = &node->u.internal;
-      urkel_bits_t *prefix = &internal->prefix;
-      unsigned int bit;
+    if (view.type == URKEL_NODE_LEAF)
+      break;
 
-      if (!urkel_bits_has(prefix, key, depth)) {
+    if (view.bits > 0) {
+      urkel_bits_t prefix;
+
+      urkel_view_prefix(&view, &prefix);
+
+      if (!urkel_bits_has(&prefix, key, depth)) {
         urkel_errno = URKEL_ENOTFOUND;
         return 0;
       }
 
-      depth += prefix->size;
+      depth += prefix.size;
+    }
 
-      bit = urkel_get_bit(key, depth);
-      node = urkel_node_get(node, bit);
+    urkel_view_pointer(&view, urkel_get_bit(key, depth), &ptr);
 
-      return urkel_tree_get(tree, value, size, node, key, depth + 1);
+    depth += 1;
+  }
+
+  /* Prefix collision. */
+  if (memcmp(urkel_view_key(&view), key, URKEL_KEY_SIZE) != 0) {
+    urkel_errno = URKEL_ENOTFOUND;
+    return 0;
+  }
+
+  if (value != NULL && size != NULL) {
+    urkel_node_t leaf;
+
+    urkel_view_leaf(&view, &leaf);
+
+    if (!urkel_store_retrieve(tree->store, &leaf, value, size)) {
+      urkel_errno = URKEL_ECORRUPTION;
+      return 0;
     }
+  }
 
-    case URKEL_NODE_LEAF: {
-      /* Prefix collision. */
-      if (!urkel_node_key_equals(node, key)) {
+  return 1;
+}
+
+static int
+urkel_tree_get(tree_db_t *tree,
+               unsigned char *value,
+               size_t *size,
+               urkel_node_t *node,
+               const unsigned char *key,
+               unsigned int depth,
+               int attach) {
+  for (;;) {
+    switch (node->type) {
+      case URKEL_NODE_NULL: {
+        /* Empty tree. */
         urkel_errno = URKEL_ENOTFOUND;
         return 0;
       }
 
-      if (value != NULL && size != NULL) {
-        if (!urkel_store_retrieve(tree->store, node, value, size)) {
-          urkel_errno = URKEL_ECORRUPTION;
+      case URKEL_NODE_INTERNAL: {
+        urkel_internal_t *internal = &node->u.internal;
+        urkel_bits_t *prefix = &internal->prefix;
+        urkel_node_t *child;
+        unsigned int bit;
+
+        if (!urkel_bits_has(prefix, key, depth)) {
+          urkel_errno = URKEL_ENOTFOUND;
           return 0;
         }
-      }
 
-      return 1;
-    }
+        depth += prefix->size;
 
-    case URKEL_NODE_HASH: {
-      urkel_node_t *rn = urkel_store_resolve(tree->store, node);
-      int ret;
+        bit = urkel_get_bit(key, depth);
+        child = urkel_node_get(node, bit);
 
-      if (rn == NULL) {
-        urkel_errno = URKEL_ECORRUPTION;
-        return 0;
+        /* Swap the resolved node in for the hash node. It stays
+           marked as written, so committing does not rewrite it. */
+        if (attach && child->type == URKEL_NODE_HASH) {
+          urkel_node_t *rn = urkel_store_resolve(tree->store, child);
+
+          if (rn == NULL) {
+            urkel_errno = URKEL_ECORRUPTION;
+            return 0;
+          }
+
+          urkel_node_set(node, bit, rn);
+          urkel_node_destroy(child, 1);
+
+          child = rn;
+        }
+
+        node = child;
+        depth += 1;
+
+        break;
       }
 
-      ret = urkel_tree_get(tree, value, size, rn, key, depth);
+      case URKEL_NODE_LEAF: {
+        /* Prefix collision. */
+        if (!urkel_node_key_equals(node, key)) {
+          urkel_errno = URKEL_ENOTFOUND;
+          return 0;
+        }
+
+        if (value != NULL && size != NULL) {
+          if (!urkel_store_retrieve(tree->store, node, value, size)) {
+            urkel_errno = URKEL_ECORRUPTION;
+            return 0;
+          }
+        }
 
-      urkel_node_destroy(rn, 1);
+        return 1;
+      }
 
-      return ret;
-    }
+      case URKEL_NODE_HASH: {
+        return urkel_tree_get_view(tree, value, size, node, key, depth);
+      }
 
-    default: {
-      urkel_abort(); /* LCOV_EXCL_LINE */
-      return 0;
+      default: {
+        urkel_abort(); /* LCOV_EXCL_LINE */
+        return 0;
+      }
     }
   }
 }
@@ -175,6 +279,8 @@ urkel_tree_insert(tree_db_t *tree,
 
       bit = urkel_get_bit(key, depth);
 
+      urkel_node_unshare(node);
+
       if (bits != prefix->size) {
         urkel_node_t *leaf = urkel_node_create_leaf(key, value, size);
         urkel_bits_t front, back;
@@ -198,8 +304,10 @@ urkel_tree_insert(tree_db_t *tree,
       y = urkel_node_get(node, bit ^ 1);
       z = urkel_tree_insert(tree, x, key, value, size, depth + 1);
 
-      if (z == NULL)
+      if (z == NULL) {
+        urkel_node_reshare(node);
         return NULL;
+      }
 
       out = urkel_node_create_internal(prefix, z, y, bit);
 
@@ -293,12 +401,17 @@ urkel_tree_remove(tree_db_t *tree,
       depth += prefix->size;
 
       bit = urkel_get_bit(key, depth);
+
+      urkel_node_unshare(node);
+
       x = urkel_node_get(node, bit ^ 0);
       y = urkel_node_get(node, bit ^ 1);
       z = urkel_tree_remove(tree, x, key, depth + 1);
 
-      if (z == NULL)
+      if (z == NULL) {
+        urkel_node_reshare(node);
         return NULL;
+      }
 
       if (z->type == URKEL_NODE_NULL) {
         urkel_node_t *side = y;
@@ -317,6 +430,7 @@ urkel_tree_remove(tree_db_t *tree,
           urkel_bits_t pre;
 
           urkel_bits_join(&pre, prefix, &si->prefix, bit ^ 1);
+          urkel_node_unshare(side);
 
           out = urkel_node_create_internal(&pre, si->left, si->right, 0);
 
@@ -381,97 +495,167 @@ urkel_tree_remove(tree_db_t *tree,
 }
 
 static int
-urkel_tree_prove(tree_db_t *tree,
-                 urkel_proof_t *proof,
-                 urkel_node_t *node,
-                 const unsigned char *key,
-                 unsigned int depth) {
-  switch (node->type) {
-    case URKEL_NODE_NULL: {
-      proof->type = URKEL_TYPE_DEADEND;
+urkel_tree_prove_view(tree_db_t *tree,
+                      urkel_proof_t *proof,
+                      const urkel_node_t *node,
+                      const unsigned char *key,
+                      unsigned int depth) {
+  /* See urkel_tree_get_view. */
+  urkel_pointer_t ptr = node->ptr;
+  unsigned char value[URKEL_VALUE_SIZE];
+  const unsigned char *leaf_key;
+  urkel_view_t view;
+  urkel_node_t leaf;
+  size_t size;
+
+  for (;;) {
+    urkel_bits_t prefix;
+    unsigned int bit;
+
+    if (!urkel_store_read_view(tree->store, &view, &ptr)) {
+      urkel_errno = URKEL_ECORRUPTION;
+      return 0;
+    }
+
+    if (view.type == URKEL_NODE_LEAF)
+      break;
+
+    urkel_view_prefix(&view, &prefix);
+
+    if (!urkel_bits_has(&prefix, key, depth)) {
+      proof->type = URKEL_TYPE_SHORT;
       proof->depth = depth;
+      proof->prefix = prefix;
+
+      memcpy(proof->left, urkel_view_hash(&view, 0), URKEL_HASH_SIZE);
+      memcpy(proof->right, urkel_view_hash(&view, 1), URKEL_HASH_SIZE);
+
       return 1;
     }
 
-    case URKEL_NODE_INTERNAL: {
-      urkel_internal_t *internal = &node->u.internal;
-      urkel_bits_t *prefix = &internal->prefix;
-      urkel_node_t *x, *y;
-      unsigned int bit;
+    depth += prefix.size;
 
-      if (!urkel_bits_has(prefix, key, depth)) {
-        const unsigned char *left = urkel_node_hash(internal->left);
-        const unsigned char *right = urkel_node_hash(internal->right);
+    bit = urkel_get_bit(key, depth);
 
-        proof->type = URKEL_TYPE_SHORT;
-        proof->depth = depth;
-        proof->prefix = *prefix;
+    urkel_proof_push(proof, &prefix, urkel_view_hash(&view, bit ^ 1));
+    urkel_view_pointer(&view, bit, &ptr);
+
+    depth += 1;
+  }
+
+  urkel_view_leaf(&view, &leaf);
+
+  if (!urkel_store_retrieve(tree->store, &leaf, value, &size)) {
+    urkel_errno = URKEL_ECORRUPTION;
+    return 0;
+  }
+
+  leaf_key = urkel_view_key(&view);
+
+  if (memcmp(leaf_key, key, URKEL_KEY_SIZE) == 0) {
+    proof->type = URKEL_TYPE_EXISTS;
+    proof->depth = depth;
+    proof->size = size;
+
+    if (size > 0)
+      memcpy(proof->value, value, size);
+  } else {
+    proof->type = URKEL_TYPE_COLLISION;
+    proof->depth = depth;
+
+    memcpy(proof->key, leaf_key, URKEL_KEY_SIZE);
+
+    urkel_hash_raw(proof->hash, value, size);
+  }
 
-        memcpy(proof->left, left, URKEL_HASH_SIZE);
-        memcpy(proof->right, right, URKEL_HASH_SIZE);
+  return 1;
+}
 
+static int
+urkel_tree_prove(tree_db_t *tree,
+                 urkel_proof_t *proof,
+                 urkel_node_t *node,
+                 const unsigned char *key,
+                 unsigned int depth) {
+  for (;;) {
+    switch (node->type) {
+      case URKEL_NODE_NULL: {
+        proof->type = URKEL_TYPE_DEADEND;
+        proof->depth = depth;
         return 1;
       }
 
-      depth += prefix->size;
+      case URKEL_NODE_INTERNAL: {
+        urkel_internal_t *internal = &node->u.internal;
+        urkel_bits_t *prefix = &internal->prefix;
+        urkel_node_t *x, *y;
+        unsigned int bit;
 
-      bit = urkel_get_bit(key, depth);
-      x = urkel_node_get(node, bit ^ 0);
-      y = urkel_node_get(node, bit ^ 1);
+        if (!urkel_bits_has(prefix, key, depth)) {
+          const unsigned char *left = urkel_node_hash(internal->left);
+          const unsigned char *right = urkel_node_hash(internal->right);
 
-      urkel_proof_push(proof, prefix, urkel_node_hash(y));
+          proof->type = URKEL_TYPE_SHORT;
+          proof->depth = depth;
+          proof->prefix = *prefix;
 
-      return urkel_tree_prove(tree, proof, x, key, depth + 1);
-    }
+          memcpy(proof->left, left, URKEL_HASH_SIZE);
+          memcpy(proof->right, right, URKEL_HASH_SIZE);
 
-    case URKEL_NODE_LEAF: {
-      urkel_leaf_t *leaf = &node->u.leaf;
-      unsigned char value[URKEL_VALUE_SIZE];
-      size_t size;
+          return 1;
+        }
 
-      if (!urkel_store_retrieve(tree->store, node, value, &size)) {
-        urkel_errno = URKEL_ECORRUPTION;
-        return 0;
-      }
+        depth += prefix->size;
 
-      if (urkel_node_key_equals(node, key)) {
-        proof->type = URKEL_TYPE_EXISTS;
-        proof->depth = depth;
-        proof->size = size;
+        bit = urkel_get_bit(key, depth);
+        x = urkel_node_get(node, bit ^ 0);
+        y = urkel_node_get(node, bit ^ 1);
 
-        if (size > 0)
-          memcpy(proof->value, value, size);
-      } else {
-        proof->type = URKEL_TYPE_COLLISION;
-        proof->depth = depth;
+        urkel_proof_push(proof, prefix, urkel_node_hash(y));
 
-        memcpy(proof->key, leaf->key, URKEL_KEY_SIZE);
+        node = x;
+        depth += 1;
 
-        urkel_hash_raw(proof->hash, value, size);
+        break;
       }
 
-      return 1;
-    }
+      case URKEL_NODE_LEAF: {
+        urkel_leaf_t *leaf = &node->u.leaf;
+        unsigned char value[URKEL_VALUE_SIZE];
+        size_t size;
 
-    case URKEL_NODE_HASH: {
-      urkel_node_t *rn = urkel_store_resolve(tree->store, node);
-      int ret;
+        if (!urkel_store_retrieve(tree->store, node, value, &size)) {
+          urkel_errno = URKEL_ECORRUPTION;
+          return 0;
+        }
 
-      if (rn == NULL) {
-        urkel_errno = URKEL_ECORRUPTION;
-        return 0;
-      }
+        if (urkel_node_key_equals(node, key)) {
+          proof->type = URKEL_TYPE_EXISTS;
+          proof->depth = depth;
+          proof->size = size;
 
-      ret = urkel_tree_prove(tree, proof, rn, key, depth);
+          if (size > 0)
+            memcpy(proof->value, value, size);
+        } else {
+          proof->type = URKEL_TYPE_COLLISION;
+          proof->depth = depth;
 
-      urkel_node_destroy(rn, 1);
+          memcpy(proof->key, leaf->key, URKEL_KEY_SIZE);
 
-      return ret;
-    }
+          urkel_hash_raw(proof->hash, value, size);
+        }
 
-    default: {
-      urkel_abort(); /* LCOV_EXCL_LINE */
-      return 0;
+        return 1;
+      }
+
+      case URKEL_NODE_HASH: {
+        return urkel_tree_prove_view(tree, proof, node, key, depth);
+      }
+
+      default: {
+        urkel_abort(); /* LCOV_EXCL_LINE */
+        return 0;
+      }
     }
   }
 }
@@ -511,7 +695,7 @@ urkel_tree_compact(tree_db_t *dst, tree_db_t *src, urkel_node_t *node) {
           return NULL;
       }
 
-      out = checked_malloc(sizeof(urkel_node_t));
+      out = urkel_node_alloc();
       urkel_node_hash(node);
       urkel_node_to_hash(node, out);
       urkel_node_destroy(node, 1);
@@ -539,7 +723,7 @@ urkel_tree_compact(tree_db_t *dst, tree_db_t *src, urkel_node_t *node) {
           return NULL;
       }
 
-      out = checked_malloc(sizeof(urkel_node_t));
+      out = urkel_node_alloc();
       urkel_node_hash(node);
       urkel_node_to_hash(node, out);
       urkel_node_destroy(node, 1);
@@ -571,12 +755,18 @@ urkel_compact(const char *dst_prefix,
               const char *src_prefix,
               const unsigned char *hash) {
   const unsigned char *root_hash;
+  urkel_tree_options_t options;
   tree_db_t *dst, *src;
   urkel_node_t *root = NULL;
   urkel_node_t *out = NULL;
   int ret = 1;
 
-  dst = urkel_open(dst_prefix);
+  urkel_tree_options_init(&options);
+
+  /* Values shared between leaves are copied once. */
+  options.flags |= URKEL_OPTION_DEDUP;
+
+  dst = urkel_open_ex(dst_prefix, &options);
 
   if (dst == NULL)
     return 0;
@@ -609,7 +799,7 @@ urkel_compact(const char *dst_prefix,
     goto fail;
   }
 
-  if (!urkel_store_commit(dst->store, out)) {
+  if (!urkel_store_commit(dst->store, out, NULL)) {
     urkel_errno = URKEL_EBADWRITE;
     ret = 0;
     goto fail;
@@ -623,8 +813,52 @@ fail:
   return ret;
 }
 
+int
+urkel_scrub(tree_db_t *tree,
+            const unsigned char *root,
+            unsigned int threads,
+            urkel_scrub_t *stats) {
+  tree_tx_t *tx = urkel_tx_create(tree, root);
+  int ret;
+
+  memset(stats, 0, sizeof(*stats));
+
+  if (tx == NULL)
+    return 0;
+
+  /* Records are immutable once written, so the
+     walk does not need to hold the tree lock. */
+  ret = urkel_store_scrub(tree->store, tx->root, threads, stats);
+
+  urkel_tx_destroy(tx);
+
+  if (!ret)
+    urkel_errno = URKEL_ECORRUPTION;
+
+  return ret;
+}
+
 static urkel_node_t *
-urkel_tree_write(tree_db_t *tree, urkel_node_t *node) {
+urkel_tree_write(tree_db_t *tree, urkel_node_t *node, unsigned int keep) {
+  /* Writing marks nodes and swaps out their children.
+     Nodes shared with a fork are written as a copy.
+     Internal nodes in the top `keep` levels stay in
+     memory; everything else becomes a hash node. */
+  if (node->refs > 0 && (node->type == URKEL_NODE_INTERNAL
+                      || node->type == URKEL_NODE_LEAF)) {
+    urkel_node_t *copy = urkel_node_copy(node);
+    urkel_node_t *out = urkel_tree_write(tree, copy, keep);
+
+    if (out == NULL) {
+      urkel_node_destroy(copy, 1);
+      return NULL;
+    }
+
+    urkel_node_destroy(node, 1);
+
+    return out;
+  }
+
   switch (node->type) {
     case URKEL_NODE_NULL: {
       return node;
@@ -634,14 +868,14 @@ urkel_tree_write(tree_db_t *tree, urkel_node_t *node) {
       urkel_internal_t *internal = &node->u.internal;
       urkel_node_t *left, *right, *out;
 
-      left = urkel_tree_write(tree, internal->left);
+      left = urkel_tree_write(tree, internal->left, keep ? keep - 1 : 0);
 
       if (left == NULL)
         return NULL;
 
       internal->left = left;
 
-      right = urkel_tree_write(tree, internal->right);
+      right = urkel_tree_write(tree, internal->right, keep ? keep - 1 : 0);
 
       if (right == NULL)
         return NULL;
@@ -657,9 +891,13 @@ urkel_tree_write(tree_db_t *tree, urkel_node_t *node) {
         }
       }
 
-      out = checked_malloc(sizeof(urkel_node_t));
-
       urkel_node_hash(node);
+
+      if (keep > 0)
+        return node;
+
+      out = urkel_node_alloc();
+
       urkel_node_to_hash(node, out);
       urkel_node_destroy(node, 1);
 
@@ -679,7 +917,7 @@ urkel_tree_write(tree_db_t *tree, urkel_node_t *node) {
         }
       }
 
-      out = checked_malloc(sizeof(urkel_node_t));
+      out = urkel_node_alloc();
 
       urkel_node_hash(node);
       urkel_node_to_hash(node, out);
@@ -701,17 +939,20 @@ urkel_tree_write(tree_db_t *tree, urkel_node_t *node) {
 }
 
 static urkel_node_t *
-urkel_tree_commit(tree_db_t *tree, urkel_node_t *node) {
-  urkel_node_t *root = urkel_tree_write(tree, node);
+urkel_tree_commit(tree_db_t *tree,
+                  urkel_node_t *node,
+                  const unsigned char *base) {
+  urkel_node_t *root = urkel_tree_write(tree, node, tree->resident);
 
   if (root == NULL) {
     urkel_node_destroy(node, 1);
+    urkel_store_abort(tree->store);
     urkel_errno = URKEL_EBADWRITE;
     return NULL;
   }
 
-  if (!urkel_store_commit(tree->store, root)) {
-    urkel_node_destroy(root, 0);
+  if (!urkel_store_commit(tree->store, root, base)) {
+    urkel_node_destroy(root, 1);
     urkel_errno = URKEL_EBADWRITE;
     return NULL;
   }
@@ -721,16 +962,77 @@ urkel_tree_commit(tree_db_t *tree, urkel_node_t *node) {
   return root;
 }
 
+static int
+urkel_tree_spill(tree_db_t *tree,
+                 urkel_node_t *node,
+                 unsigned int level,
+                 size_t *spilled) {
+  /* Write lock is held. Every change passes through the
+     top levels, so those stay in memory and everything
+     below them is written out and replaced by hashes.
+     Shared subtrees are skipped: a fork or savepoint
+     keeps them alive regardless. */
+  unsigned int bit;
+
+  if (node->type != URKEL_NODE_INTERNAL || node->refs > 0)
+    return 1;
+
+  for (bit = 0; bit < 2; bit++) {
+    urkel_node_t *child = urkel_node_get(node, bit);
+
+    if (level + 1 < SPILL_LEVELS) {
+      if (!urkel_tree_spill(tree, child, level + 1, spilled))
+        return 0;
+
+      continue;
+    }
+
+    if (child->refs > 0)
+      continue;
+
+    /* Written subtrees are only swapped for hashes. */
+    if (child->type != URKEL_NODE_NULL
+        && !(child->flags & URKEL_FLAG_WRITTEN)) {
+      *spilled += 1;
+    }
+
+    child = urkel_tree_write(tree, child, 0);
+
+    if (child == NULL)
+      return 0;
+
+    urkel_node_set(node, bit, child);
+  }
+
+  return 1;
+}
+
 /*
  * Database
  */
 
+void
+urkel_tree_options_init(urkel_tree_options_t *options) {
+  memset(options, 0, sizeof(*options));
+
+#ifdef URKEL_FSYNC
+  options->durability = URKEL_DURABLE_COMMIT;
+#else
+  options->durability = URKEL_DURABLE_ROLLOVER;
+#endif
+}
+
 tree_db_t *
 urkel_open(const char *prefix) {
+  return urkel_open_ex(prefix, NULL);
+}
+
+tree_db_t *
+urkel_open_ex(const char *prefix, const urkel_tree_options_t *options) {
   tree_db_t *tree = checked_malloc(sizeof(tree_db_t));
   const unsigned char *root;
 
-  tree->store = urkel_store_open(prefix);
+  tree->store = urkel_store_open(prefix, options);
 
   if (tree->store == NULL) {
     urkel_errno = URKEL_EBADOPEN;
@@ -743,8 +1045,20 @@ urkel_open(const char *prefix) {
 
   memcpy(tree->hash, root, URKEL_HASH_SIZE);
 
+  tree->flags = options != NULL ? options->flags : 0;
+  tree->spill = options != NULL ? options->tx_memory : 0;
+  tree->resident = options != NULL ? options->tx_levels : 0;
+
   tree->revert = 0;
 
+  memset(tree->locks, 0, sizeof(tree->locks));
+
+  if (tree->flags & URKEL_OPTION_LOCKSTATS) {
+    urkel_rwlock_watch(tree->lock,
+                       &tree->locks[LOCK_TREE_READ],
+                       &tree->locks[LOCK_TREE_WRITE]);
+  }
+
   return tree;
 }
 
@@ -800,6 +1114,47 @@ urkel_root(tree_db_t *tree, unsigned char *hash) {
   urkel_rwlock_rdunlock(tree->lock);
 }
 
+void
+urkel_durable_root(tree_db_t *tree, unsigned char *hash) {
+  urkel_store_durable_root(tree->store, hash);
+}
+
+void
+urkel_memory_usage(tree_db_t *tree, urkel_memory_t *usage) {
+  urkel_store_memory(tree->store, usage);
+}
+
+int
+urkel_memory_charge(tree_db_t *tree, size_t size) {
+  if (!urkel_store_charge(tree->store, size)) {
+    urkel_errno = URKEL_ENOMEM;
+    return 0;
+  }
+
+  return 1;
+}
+
+void
+urkel_memory_release(tree_db_t *tree, size_t size) {
+  urkel_store_release(tree->store, size);
+}
+
+static void
+urkel_lock_metrics(urkel_lock_metrics_t *out, urkel_lockstat_t *stat) {
+  out->contended = urkel_atomic_load(&stat->contended);
+  out->wait_time = urkel_atomic_load(&stat->wait_time);
+  out->max_wait = urkel_atomic_load(&stat->max_wait);
+}
+
+void
+urkel_metrics(tree_db_t *tree, urkel_metrics_t *metrics) {
+  urkel_store_metrics(tree->store, metrics);
+  urkel_lock_metrics(&metrics->tree_read, &tree->locks[LOCK_TREE_READ]);
+  urkel_lock_metrics(&metrics->tree_write, &tree->locks[LOCK_TREE_WRITE]);
+  urkel_lock_metrics(&metrics->tx_read, &tree->locks[LOCK_TX_READ]);
+  urkel_lock_metrics(&metrics->tx_write, &tree->locks[LOCK_TX_WRITE]);
+}
+
 int
 urkel_inject(tree_db_t *tree, const unsigned char *hash) {
   int ret = 0;
@@ -985,9 +1340,41 @@ urkel_iterate(tree_db_t *tree, const unsigned char *root) {
  * Transaction
  */
 
+static void
+urkel_tx_meter(tree_tx_t *tx, size_t meter) {
+  /* Charge what this thread allocated (or freed)
+     for the transaction since sampling `meter`. */
+  size_t now = urkel_node_allocated();
+
+  /* Nodes shared with a fork stay charged to the transaction
+     which allocated them. Whichever one frees them last can
+     free more than it was charged for. */
+  if (meter > now && meter - now > tx->memory)
+    meter = now + tx->memory;
+
+  tx->memory += now;
+  tx->memory -= meter;
+
+  urkel_store_charge_tx(tx->tree->store, now, meter);
+}
+
+static void
+urkel_tx_unsave(tree_tx_t *tx, size_t len) {
+  /* Write lock is held. Drop savepoints past `len`. */
+  while (tx->saved_len > len) {
+    urkel_savepoint_t *sp = &tx->saved[--tx->saved_len];
+
+    urkel_node_destroy(sp->root, 1);
+  }
+
+  /* Fewer shared nodes, or a new root: worth spilling again. */
+  tx->unspilled = 0;
+}
+
 tree_tx_t *
 urkel_tx_create(tree_db_t *tree, const unsigned char *hash) {
   tree_tx_t *tx = checked_malloc(sizeof(tree_tx_t));
+  size_t meter = urkel_node_allocated();
   int write_lock;
 
   urkel_rwlock_rdlock(tree->lock);
@@ -1011,10 +1398,34 @@ urkel_tx_create(tree_db_t *tree, const unsigned char *hash) {
     tx->root = urkel_store_get_root(tree->store);
 
   tx->lock = urkel_rwlock_create();
+  tx->forks = checked_malloc(sizeof(size_t));
+
+  if (tree->flags & URKEL_OPTION_LOCKSTATS) {
+    urkel_rwlock_watch(tx->lock,
+                       &tree->locks[LOCK_TX_READ],
+                       &tree->locks[LOCK_TX_WRITE]);
+  }
+
+  tx->removed = NULL;
+  tx->removed_len = 0;
+  tx->removed_size = 0;
+  tx->saved = NULL;
+  tx->saved_len = 0;
+  tx->saved_size = 0;
+  tx->memory = 0;
+  tx->unspilled = 0;
+
+  *tx->forks = 1;
+
+  if (tx->root != NULL) {
+    memcpy(tx->base, tx->root->hash, URKEL_HASH_SIZE);
+    urkel_tx_meter(tx, meter);
+  }
 
   if (tx->root == NULL) {
     urkel_errno = URKEL_ENOTFOUND;
     urkel_rwlock_destroy(tx->lock);
+    free(tx->forks);
     free(tx);
     tx = NULL;
   }
@@ -1027,24 +1438,85 @@ urkel_tx_create(tree_db_t *tree, const unsigned char *hash) {
   return tx;
 }
 
+tree_tx_t *
+urkel_tx_fork(tree_tx_t *tx) {
+  tree_tx_t *fork = checked_malloc(sizeof(tree_tx_t));
+
+  urkel_rwlock_wrlock(tx->lock);
+
+  /* Shared nodes must never be written to again,
+     so compute any missing hashes up front. */
+  urkel_node_hash(tx->root);
+
+  fork->tree = tx->tree;
+  fork->root = urkel_node_ref(tx->root);
+  fork->removed = NULL;
+  fork->removed_len = tx->removed_len;
+  fork->removed_size = tx->removed_len;
+  fork->saved = NULL;
+  fork->saved_len = 0;
+  fork->saved_size = 0;
+  fork->memory = 0;
+  fork->unspilled = 0;
+  fork->lock = tx->lock;
+  fork->forks = tx->forks;
+
+  memcpy(fork->base, tx->base, URKEL_HASH_SIZE);
+
+  if (tx->removed_len > 0) {
+    fork->removed = checked_malloc(tx->removed_len * URKEL_KEY_SIZE);
+
+    memcpy(fork->removed, tx->removed, tx->removed_len * URKEL_KEY_SIZE);
+  }
+
+  *tx->forks += 1;
+
+  urkel_rwlock_wrunlock(tx->lock);
+
+  return fork;
+}
+
 void
 urkel_tx_destroy(tree_tx_t *tx) {
+  size_t forks;
+
   urkel_rwlock_wrlock(tx->lock);
+  urkel_tx_unsave(tx, 0);
   urkel_node_destroy(tx->root, 1);
+  urkel_store_charge_tx(tx->tree->store, 0, tx->memory);
+  forks = --*tx->forks;
   urkel_rwlock_wrunlock(tx->lock);
-  urkel_rwlock_destroy(tx->lock);
+
+  if (forks == 0) {
+    urkel_rwlock_destroy(tx->lock);
+    free(tx->forks);
+  }
+
+  if (tx->removed != NULL)
+    free(tx->removed);
+
+  if (tx->saved != NULL)
+    free(tx->saved);
 
   free(tx);
 }
 
 void
 urkel_tx_clear(tree_tx_t *tx) {
+  size_t meter = urkel_node_allocated();
+
   urkel_rwlock_wrlock(tx->lock);
   urkel_rwlock_rdlock(tx->tree->lock);
 
+  urkel_tx_unsave(tx, 0);
   urkel_node_destroy(tx->root, 1);
 
   tx->root = urkel_store_get_root(tx->tree->store);
+  tx->removed_len = 0;
+
+  urkel_tx_meter(tx, meter);
+
+  memcpy(tx->base, tx->root->hash, URKEL_HASH_SIZE);
 
   urkel_rwlock_rdunlock(tx->tree->lock);
   urkel_rwlock_wrunlock(tx->lock);
@@ -1075,6 +1547,7 @@ urkel_tx_root(tree_tx_t *tx, unsigned char *hash) {
 
 int
 urkel_tx_inject(tree_tx_t *tx, const unsigned char *hash) {
+  size_t meter = urkel_node_allocated();
   urkel_node_t *root;
 
   urkel_rwlock_wrlock(tx->lock);
@@ -1083,9 +1556,15 @@ urkel_tx_inject(tree_tx_t *tx, const unsigned char *hash) {
   root = urkel_store_get_history(tx->tree->store, hash);
 
   if (root != NULL) {
+    urkel_tx_unsave(tx, 0);
     urkel_node_destroy(tx->root, 1);
 
     tx->root = root;
+    tx->removed_len = 0;
+
+    memcpy(tx->base, root->hash, URKEL_HASH_SIZE);
+
+    urkel_tx_meter(tx, meter);
   } else {
     urkel_errno = URKEL_ENOTFOUND;
   }
@@ -1096,47 +1575,186 @@ urkel_tx_inject(tree_tx_t *tx, const unsigned char *hash) {
   return root != NULL;
 }
 
-int
-urkel_tx_get(tree_tx_t *tx,
-             unsigned char *value,
-             size_t *size,
-             const unsigned char *key) {
+static int
+urkel_tx_lookup(tree_tx_t *tx,
+                unsigned char *value,
+                size_t *size,
+                const unsigned char *key,
+                int attach) {
+  urkel_store_t *store = tx->tree->store;
+  urkel_node_t *root = tx->root;
+  urkel_node_t leaf;
   int ret;
 
-  urkel_rwlock_rdlock(tx->lock);
-  urkel_rwlock_rdlock(tx->tree->lock);
+  /* A hash node root, or a node attached in its
+     place, means the transaction is clean. */
+  if (root->type == URKEL_NODE_NULL
+      || !(root->flags & URKEL_FLAG_HASHED)
+      || !(root->flags & URKEL_FLAG_WRITTEN)) {
+    return urkel_tree_get(tx->tree, value, size, root, key, 0, attach);
+  }
+
+  if (!urkel_store_filter_has(store, root->hash, key)) {
+    urkel_errno = URKEL_ENOTFOUND;
+    return 0;
+  }
 
-  ret = urkel_tree_get(tx->tree, value, size, tx->root, key, 0);
+  switch (urkel_store_index_get(store, &leaf, root->hash, key)) {
+    case 0: {
+      urkel_errno = URKEL_ENOTFOUND;
+      return 0;
+    }
 
-  if (!ret)
-    *size = 0;
+    case 1: {
+      ret = 1;
 
-  urkel_rwlock_rdunlock(tx->tree->lock);
-  urkel_rwlock_rdunlock(tx->lock);
+      if (value != NULL && size != NULL) {
+        if (!urkel_store_retrieve(store, &leaf, value, size)) {
+          urkel_errno = URKEL_ECORRUPTION;
+          ret = 0;
+        }
+      }
+
+      urkel_node_clear(&leaf);
+
+      return ret;
+    }
+  }
+
+  if (attach && root->type == URKEL_NODE_HASH) {
+    urkel_node_t *rn = urkel_store_resolve(store, root);
+
+    if (rn == NULL) {
+      urkel_errno = URKEL_ECORRUPTION;
+      return 0;
+    }
+
+    urkel_node_destroy(root, 1);
+
+    tx->root = root = rn;
+  }
+
+  return urkel_tree_get(tx->tree, value, size, root, key, 0, attach);
+}
+
+static int
+urkel_tx_read(tree_tx_t *tx,
+              unsigned char *value,
+              size_t *size,
+              const unsigned char *key) {
+  size_t meter = urkel_node_allocated();
+  tree_db_t *tree = tx->tree;
+  int attach = 0;
+  int ret;
+
+  /* Attaching needs the write lock. We never wait for it: an
+     iterator open on this transaction holds the read lock. */
+  if (tree->flags & URKEL_OPTION_ATTACH)
+    attach = urkel_rwlock_trywrlock(tx->lock);
+
+  if (!attach)
+    urkel_rwlock_rdlock(tx->lock);
+
+  urkel_rwlock_rdlock(tree->lock);
+
+  if (attach) {
+    int room = !urkel_store_over_budget(tree->store)
+            && (tree->spill == 0 || tx->memory < tree->spill);
+
+    ret = urkel_tx_lookup(tx, value, size, key, room);
+
+    urkel_tx_meter(tx, meter);
+  } else {
+    ret = urkel_tx_lookup(tx, value, size, key, 0);
+  }
+
+  urkel_rwlock_rdunlock(tree->lock);
+
+  if (attach)
+    urkel_rwlock_wrunlock(tx->lock);
+  else
+    urkel_rwlock_rdunlock(tx->lock);
 
   return ret;
 }
 
-int
-urkel_tx_has(tree_tx_t *tx, const unsigned char *key) {
+static void
+urkel_tx_removed(tree_tx_t *tx, const unsigned char *key) {
+  /* Write lock is held. */
+  if (!(tx->tree->flags & URKEL_OPTION_INDEX))
+    return;
+
+  if (tx->removed_len == tx->removed_size) {
+    size_t size = tx->removed_size == 0 ? 16 : tx->removed_size * 2;
+
+    tx->removed = checked_realloc(tx->removed, size * URKEL_KEY_SIZE);
+    tx->removed_size = size;
+  }
+
+  memcpy(tx->removed + tx->removed_len * URKEL_KEY_SIZE, key, URKEL_KEY_SIZE);
+
+  tx->removed_len += 1;
+}
+
+static int
+urkel_tx_spill(tree_tx_t *tx) {
+  /* Write lock is held. */
+  tree_db_t *tree = tx->tree;
+  size_t spilled = 0;
   int ret;
 
-  urkel_rwlock_rdlock(tx->lock);
-  urkel_rwlock_rdlock(tx->tree->lock);
+  if (tree->spill == 0 || tx->memory <= tree->spill)
+    return 1;
 
-  ret = urkel_tree_get(tx->tree, NULL, NULL, tx->root, key, 0);
+  /* Nothing was left to write last time (e.g. a savepoint
+     pins the tree). Wait for another budget's worth. */
+  if (tx->unspilled > 0 && tx->memory <= tx->unspilled + tree->spill)
+    return 1;
 
-  urkel_rwlock_rdunlock(tx->tree->lock);
-  urkel_rwlock_rdunlock(tx->lock);
+  urkel_rwlock_wrlock(tree->lock);
+
+  ret = urkel_tree_spill(tree, tx->root, 0, &spilled);
+
+  /* Flushing invalidates the index: only do it if we wrote. */
+  if (ret && spilled > 0)
+    ret = urkel_store_spill(tree->store);
+
+  tx->unspilled = spilled > 0 ? 0 : tx->memory;
+
+  if (!ret) {
+    urkel_store_abort(tree->store);
+    urkel_errno = URKEL_EBADWRITE;
+  }
+
+  urkel_rwlock_wrunlock(tree->lock);
 
   return ret;
 }
 
+int
+urkel_tx_get(tree_tx_t *tx,
+             unsigned char *value,
+             size_t *size,
+             const unsigned char *key) {
+  int ret = urkel_tx_read(tx, value, size, key);
+
+  if (!ret)
+    *size = 0;
+
+  return ret;
+}
+
+int
+urkel_tx_has(tree_tx_t *tx, const unsigned char *key) {
+  return urkel_tx_read(tx, NULL, NULL, key);
+}
+
 int
 urkel_tx_insert(tree_tx_t *tx,
                 const unsigned char *key,
                 const unsigned char *value,
                 size_t size) {
+  size_t meter = urkel_node_allocated();
   urkel_node_t *root;
 
   if (size > URKEL_VALUE_SIZE) {
@@ -1145,6 +1763,23 @@ urkel_tx_insert(tree_tx_t *tx,
   }
 
   urkel_rwlock_wrlock(tx->lock);
+
+  /* Spilling first may bring us back under budget. */
+  if (!urkel_tx_spill(tx)) {
+    urkel_tx_meter(tx, meter);
+    urkel_rwlock_wrunlock(tx->lock);
+    return 0;
+  }
+
+  /* Refuse to grow while over budget. Committing
+     frees the transaction and trims the store. */
+  if (urkel_store_over_budget(tx->tree->store)) {
+    urkel_tx_meter(tx, meter);
+    urkel_rwlock_wrunlock(tx->lock);
+    urkel_errno = URKEL_ENOMEM;
+    return 0;
+  }
+
   urkel_rwlock_rdlock(tx->tree->lock);
 
   root = urkel_tree_insert(tx->tree, tx->root, key, value, size, 0);
@@ -1152,6 +1787,8 @@ urkel_tx_insert(tree_tx_t *tx,
   if (root != NULL)
     tx->root = root;
 
+  urkel_tx_meter(tx, meter);
+
   urkel_rwlock_rdunlock(tx->tree->lock);
   urkel_rwlock_wrunlock(tx->lock);
 
@@ -1160,15 +1797,27 @@ urkel_tx_insert(tree_tx_t *tx,
 
 int
 urkel_tx_remove(tree_tx_t *tx, const unsigned char *key) {
+  size_t meter = urkel_node_allocated();
   urkel_node_t *root;
 
   urkel_rwlock_wrlock(tx->lock);
+
+  if (!urkel_tx_spill(tx)) {
+    urkel_tx_meter(tx, meter);
+    urkel_rwlock_wrunlock(tx->lock);
+    return 0;
+  }
+
   urkel_rwlock_rdlock(tx->tree->lock);
 
   root = urkel_tree_remove(tx->tree, tx->root, key, 0);
 
-  if (root != NULL)
+  if (root != NULL) {
     tx->root = root;
+    urkel_tx_removed(tx, key);
+  }
+
+  urkel_tx_meter(tx, meter);
 
   urkel_rwlock_rdunlock(tx->tree->lock);
   urkel_rwlock_wrunlock(tx->lock);
@@ -1176,6 +1825,86 @@ urkel_tx_remove(tree_tx_t *tx, const unsigned char *key) {
   return root != NULL;
 }
 
+size_t
+urkel_tx_savepoint(tree_tx_t *tx) {
+  size_t meter = urkel_node_allocated();
+  urkel_savepoint_t *sp;
+  size_t id;
+
+  urkel_rwlock_wrlock(tx->lock);
+
+  if (tx->saved_len == tx->saved_size) {
+    size_t size = tx->saved_size == 0 ? 8 : tx->saved_size * 2;
+
+    tx->saved = checked_realloc(tx->saved, size * sizeof(urkel_savepoint_t));
+    tx->saved_size = size;
+  }
+
+  /* Sharing the root keeps later changes from destroying
+     the nodes they replace (see urkel_node_unshare). */
+  sp = &tx->saved[tx->saved_len];
+  sp->root = urkel_node_ref(tx->root);
+  sp->removed_len = tx->removed_len;
+
+  id = tx->saved_len++;
+
+  urkel_tx_meter(tx, meter);
+
+  urkel_rwlock_wrunlock(tx->lock);
+
+  return id;
+}
+
+int
+urkel_tx_rollback_to(tree_tx_t *tx, size_t savepoint) {
+  size_t meter = urkel_node_allocated();
+  urkel_savepoint_t *sp;
+
+  urkel_rwlock_wrlock(tx->lock);
+
+  if (savepoint >= tx->saved_len) {
+    urkel_rwlock_wrunlock(tx->lock);
+    urkel_errno = URKEL_EINVAL;
+    return 0;
+  }
+
+  /* The savepoint itself survives the rollback. */
+  urkel_tx_unsave(tx, savepoint + 1);
+
+  sp = &tx->saved[savepoint];
+
+  urkel_node_destroy(tx->root, 1);
+
+  tx->root = urkel_node_ref(sp->root);
+  tx->removed_len = sp->removed_len;
+
+  urkel_tx_meter(tx, meter);
+
+  urkel_rwlock_wrunlock(tx->lock);
+
+  return 1;
+}
+
+int
+urkel_tx_release(tree_tx_t *tx, size_t savepoint) {
+  size_t meter = urkel_node_allocated();
+
+  urkel_rwlock_wrlock(tx->lock);
+
+  if (savepoint >= tx->saved_len) {
+    urkel_rwlock_wrunlock(tx->lock);
+    urkel_errno = URKEL_EINVAL;
+    return 0;
+  }
+
+  urkel_tx_unsave(tx, savepoint);
+  urkel_tx_meter(tx, meter);
+
+  urkel_rwlock_wrunlock(tx->lock);
+
+  return 1;
+}
+
 int
 urkel_tx_prove(tree_tx_t *tx,
                unsigned char **proof_raw,
@@ -1224,15 +1953,35 @@ urkel_tx_prove(tree_tx_t *tx,
 
 int
 urkel_tx_commit(tree_tx_t *tx) {
+  size_t meter = urkel_node_allocated();
   urkel_node_t *root;
+  size_t i;
 
   urkel_rwlock_wrlock(tx->lock);
   urkel_rwlock_wrlock(tx->tree->lock);
 
-  root = urkel_tree_commit(tx->tree, tx->root);
+  /* Savepoints cannot outlive the base they were taken on. */
+  urkel_tx_unsave(tx, 0);
 
-  if (root != NULL)
+  /* Queue removals ahead of the leaves we are about to write. */
+  for (i = 0; i < tx->removed_len; i++) {
+    urkel_store_index_remove(tx->tree->store,
+                             tx->removed + i * URKEL_KEY_SIZE);
+  }
+
+  root = urkel_tree_commit(tx->tree, tx->root, tx->base);
+
+  if (root != NULL) {
     tx->root = root;
+    tx->removed_len = 0;
+
+    memcpy(tx->base, root->hash, URKEL_HASH_SIZE);
+  }
+
+  urkel_tx_meter(tx, meter);
+
+  if (urkel_store_over_budget(tx->tree->store))
+    urkel_store_trim(tx->tree->store);
 
   urkel_rwlock_wrunlock(tx->tree->lock);
   urkel_rwlock_wrunlock(tx->lock);
@@ -1260,6 +2009,8 @@ urkel_iter_create(tree_tx_t *tx) {
   iter->done = 0;
   iter->transient = 0;
 
+  memset(iter->frames, 0, sizeof(iter->frames));
+
   return iter;
 }
 
@@ -1269,11 +2020,9 @@ urkel_iter_destroy(tree_iter_t *iter) {
 
   urkel_mutex_lock(iter->lock);
 
-  for (i = 0; i < iter->stack_len; i++) {
-    urkel_state_t *state = &iter->stack[i];
-
-    if (state->resolved)
-      urkel_node_destroy(state->node, 1);
+  for (i = 0; i < URKEL_KEY_BITS; i++) {
+    if (iter->frames[i] != NULL)
+      free(iter->frames[i]);
   }
 
   urkel_rwlock_rdunlock(iter->tree->lock);
@@ -1289,10 +2038,7 @@ urkel_iter_destroy(tree_iter_t *iter) {
 }
 
 static void
-urkel_iter_push(tree_iter_t *iter,
-                urkel_node_t *node,
-                unsigned int depth,
-                int resolved) {
+urkel_iter_push(tree_iter_t *iter, urkel_node_t *node, unsigned int depth) {
   urkel_state_t *state;
 
   CHECK(iter->stack_len < URKEL_KEY_BITS);
@@ -1301,14 +2047,29 @@ urkel_iter_push(tree_iter_t *iter,
 
   state->node = node;
   state->depth = depth;
-  state->resolved = resolved;
   state->child = -1;
 }
 
-static urkel_state_t *
+static urkel_frame_t *
+urkel_iter_frame(tree_iter_t *iter) {
+  /* The frame for the next stack position. Anything
+     decoded into it before has been popped since. */
+  urkel_frame_t **frame;
+
+  CHECK(iter->stack_len < URKEL_KEY_BITS);
+
+  frame = &iter->frames[iter->stack_len];
+
+  if (*frame == NULL)
+    *frame = checked_malloc(sizeof(urkel_frame_t));
+
+  return *frame;
+}
+
+static void
 urkel_iter_pop(tree_iter_t *iter) {
   CHECK(iter->stack_len > 0);
-  return &iter->stack[--iter->stack_len];
+  iter->stack_len -= 1;
 }
 
 static urkel_state_t *
@@ -1329,12 +2090,9 @@ urkel_iter_seek(tree_iter_t *iter) {
   }
 
   if (iter->stack_len == 0) {
-    urkel_iter_push(iter, iter->root, 0, 0);
+    urkel_iter_push(iter, iter->root, 0);
   } else {
-    urkel_state_t *state = urkel_iter_pop(iter);
-
-    if (state->resolved)
-      urkel_node_destroy(state->node, 1);
+    urkel_iter_pop(iter);
 
     if (iter->stack_len == 0) {
       iter->done = 1;
@@ -1363,9 +2121,9 @@ urkel_iter_seek(tree_iter_t *iter) {
         parent->child += 1;
 
         if (parent->child)
-          urkel_iter_push(iter, ni->right, depth + ni->prefix.size + 1, 0);
+          urkel_iter_push(iter, ni->right, depth + ni->prefix.size + 1);
         else
-          urkel_iter_push(iter, ni->left, depth + ni->prefix.size + 1, 0);
+          urkel_iter_push(iter, ni->left, depth + ni->prefix.size + 1);
 
         break;
       }
@@ -1376,21 +2134,21 @@ urkel_iter_seek(tree_iter_t *iter) {
       }
 
       case URKEL_NODE_HASH: {
-        urkel_node_t *rn;
+        urkel_frame_t *frame;
 
         if (parent->child >= 0)
           return 1;
 
         parent->child += 1;
 
-        rn = urkel_store_resolve(tree->store, node);
+        frame = urkel_iter_frame(iter);
 
-        if (rn == NULL) {
+        if (!urkel_store_resolve_frame(tree->store, frame, node)) {
           urkel_errno = URKEL_ECORRUPTION;
           return 0;
         }
 
-        urkel_iter_push(iter, rn, depth, 1);
+        urkel_iter_push(iter, &frame->node, depth);
 
         break;
       }
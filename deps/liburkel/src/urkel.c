@@ -147,6 +147,7 @@ urkel_base16_print(const uint8_t *src, size_t srclen) {
 #define URKEL_ACTION_LIST 7
 #define URKEL_ACTION_PROVE 8
 #define URKEL_ACTION_VERIFY 9
+#define URKEL_ACTION_SCRUB 10
 
 static const struct {
   const char *name;
@@ -161,7 +162,8 @@ static const struct {
   { "remove", URKEL_ACTION_REMOVE },
   { "list", URKEL_ACTION_LIST },
   { "prove", URKEL_ACTION_PROVE },
-  { "verify", URKEL_ACTION_VERIFY }
+  { "verify", URKEL_ACTION_VERIFY },
+  { "scrub", URKEL_ACTION_SCRUB }
 };
 
 /*
@@ -186,6 +188,7 @@ urkel_usage(void) {
     "    list                  list all keys\n"
     "    prove <key>           create proof\n"
     "    verify <key> <proof>  verify proof (requires --root)\n"
+    "    scrub                 check every record for corruption\n"
     "\n"
     "  Options:\n"
     "\n"
@@ -422,7 +425,8 @@ urkel_main(const urkel_options_t *opt) {
     case URKEL_ACTION_INSERT:
     case URKEL_ACTION_REMOVE:
     case URKEL_ACTION_LIST:
-    case URKEL_ACTION_PROVE: {
+    case URKEL_ACTION_PROVE:
+    case URKEL_ACTION_SCRUB: {
       db = urkel_open(opt->path);
 
       if (db == NULL) {
@@ -592,6 +596,26 @@ urkel_main(const urkel_options_t *opt) {
 
       break;
     }
+
+    case URKEL_ACTION_SCRUB: {
+      urkel_scrub_t stats;
+      int ok = urkel_scrub(db, opt->root, 4, &stats);
+
+      if (!ok && urkel_errno != URKEL_ECORRUPTION) {
+        fprintf(stderr, "Root not found.\n");
+        goto fail;
+      }
+
+      printf("Nodes:   %lu\n", (unsigned long)stats.nodes);
+      printf("Values:  %lu\n", (unsigned long)stats.values);
+      printf("Checked: %lu\n", (unsigned long)stats.checked);
+      printf("Corrupt: %lu\n", (unsigned long)stats.corrupt);
+
+      if (!ok)
+        goto fail;
+
+      break;
+    }
   }
 
   ret = 1;
@@ -14,43 +14,209 @@
 #include "hrtime.h"
 #include "utils.h"
 
-#define URKEL_ITERATIONS 100000
+#define BENCH_KEYS 100000
+
+/* Roots written while building the store (the oldest
+   holds the first tenth of the keys). */
+#define BENCH_ROOTS 10
+
+/* Proofs verified round robin. */
+#define BENCH_PROOFS 1000
+
+/* Opens timed per open benchmark. */
+#define BENCH_OPENS 10
+
+/*
+ * Options
+ */
+
+static int bench_json = 0;
+static size_t bench_keys = BENCH_KEYS;
+static char **bench_groups = NULL;
+static size_t bench_groups_len = 0;
+static size_t bench_results = 0;
+
+static int
+bench_selected(const char *group) {
+  size_t i;
+
+  if (bench_groups_len == 0)
+    return 1;
+
+  for (i = 0; i < bench_groups_len; i++) {
+    if (strcmp(bench_groups[i], group) == 0)
+      return 1;
+  }
+
+  return 0;
+}
 
 /*
  * Benchmarks
  */
 
-typedef uint64_t bench_t;
+typedef struct bench_s {
+  const char *name;
+  urkel_t *db; /* Reports metrics deltas if set. */
+  urkel_metrics_t metrics;
+  uint64_t start;
+  uint64_t elapsed;
+} bench_t;
 
 static void
-bench_start(bench_t *start, const char *name) {
-  printf("Benchmarking %s...\n", name);
-  *start = urkel_hrtime();
+bench_start(bench_t *bench, urkel_t *db, const char *name) {
+  bench->name = name;
+  bench->db = db;
+  bench->elapsed = 0;
+
+  if (db != NULL)
+    urkel_metrics(db, &bench->metrics);
+
+  if (!bench_json)
+    printf("Benchmarking %s...\n", name);
+
+  bench->start = urkel_hrtime();
 }
 
 static void
-bench_end(bench_t *start, uint64_t ops) {
-  bench_t nsec = urkel_hrtime() - *start;
-  double sec = (double)nsec / 1000000000.0;
+bench_pause(bench_t *bench) {
+  bench->elapsed += urkel_hrtime() - bench->start;
+}
 
-  printf("  Operations:  %" PRIu64 "\n", ops);
-  printf("  Nanoseconds: %" PRIu64 "\n", nsec);
-  printf("  Seconds:     %f\n", sec);
-  printf("  Ops/Sec:     %f\n", (double)ops / sec);
-  printf("  Sec/Op:      %f\n", sec / (double)ops);
+static void
+bench_resume(bench_t *bench) {
+  bench->start = urkel_hrtime();
 }
 
 static void
-bench_urkel(void) {
-  urkel_kv_t *kvs = urkel_kv_generate(URKEL_ITERATIONS);
+bench_end(bench_t *bench, uint64_t ops) {
+  uint64_t nsec = bench->elapsed + (urkel_hrtime() - bench->start);
+  double sec = (double)nsec / 1000000000.0;
+  double rate = sec > 0 ? (double)ops / sec : 0;
+  double per = ops > 0 ? sec / (double)ops : 0;
+  uint64_t node_reads = 0;
+  uint64_t bytes_read = 0;
+  uint64_t bytes_written = 0;
+  urkel_metrics_t metrics;
+
+  if (bench->db != NULL) {
+    urkel_metrics(bench->db, &metrics);
+
+    node_reads = metrics.node_reads - bench->metrics.node_reads;
+    bytes_read = metrics.bytes_read - bench->metrics.bytes_read;
+    bytes_written = metrics.bytes_written - bench->metrics.bytes_written;
+  }
+
+  if (bench_json) {
+    printf("%s    {\"name\": \"%s\", \"ops\": %" PRIu64 ","
+           " \"nsec\": %" PRIu64 ", \"ops_per_sec\": %f,"
+           " \"sec_per_op\": %.9f, \"node_reads\": %" PRIu64 ","
+           " \"bytes_read\": %" PRIu64 ", \"bytes_written\": %" PRIu64 "}",
+           bench_results > 0 ? ",\n" : "",
+           bench->name, ops, nsec, rate, per,
+           node_reads, bytes_read, bytes_written);
+  } else {
+    printf("  Operations:  %" PRIu64 "\n", ops);
+    printf("  Nanoseconds: %" PRIu64 "\n", nsec);
+    printf("  Seconds:     %f\n", sec);
+    printf("  Ops/Sec:     %f\n", rate);
+    printf("  Sec/Op:      %f\n", per);
+
+    if (bench->db != NULL) {
+      printf("  Node Reads:  %" PRIu64 "\n", node_reads);
+      printf("  Bytes In:    %" PRIu64 "\n", bytes_read);
+      printf("  Bytes Out:   %" PRIu64 "\n", bytes_written);
+    }
+  }
+
+  fflush(stdout);
+
+  bench_results += 1;
+}
+
+/*
+ * Workloads
+ */
+
+static uint64_t bench_seed = UINT64_C(0x9e3779b97f4a7c15);
+
+static uint64_t
+bench_random(void) {
+  /* xorshift64* (deterministic across runs). */
+  bench_seed ^= bench_seed >> 12;
+  bench_seed ^= bench_seed << 25;
+  bench_seed ^= bench_seed >> 27;
+  return bench_seed * UINT64_C(2685821657736338717);
+}
+
+static size_t *
+bench_uniform(size_t range, size_t len) {
+  size_t *out = malloc(len * sizeof(size_t));
+  size_t i;
+
+  ASSERT(out != NULL);
+
+  for (i = 0; i < len; i++)
+    out[i] = bench_random() % range;
+
+  return out;
+}
+
+static size_t *
+bench_zipf(size_t range, size_t len) {
+  /* Zipf with an exponent of 1: the key at rank r is picked with
+     probability proportional to 1 / r. Keys are hashes, so the
+     hot keys are spread over the whole tree. */
+  double *cdf = malloc(range * sizeof(double));
+  size_t *out = malloc(len * sizeof(size_t));
+  double total = 0;
+  size_t i;
+
+  ASSERT(cdf != NULL);
+  ASSERT(out != NULL);
+
+  for (i = 0; i < range; i++) {
+    total += 1.0 / (double)(i + 1);
+    cdf[i] = total;
+  }
+
+  for (i = 0; i < len; i++) {
+    double x = (double)(bench_random() >> 11) / 9007199254740992.0 * total;
+    size_t lo = 0;
+    size_t hi = range - 1;
+
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (cdf[mid] < x)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+    out[i] = lo;
+  }
+
+  free(cdf);
+
+  return out;
+}
+
+static urkel_t *
+bench_populate(const char *prefix,
+               const urkel_tree_options_t *options,
+               const urkel_kv_t *kvs,
+               size_t len,
+               size_t commits,
+               unsigned char roots[][32]) {
+  size_t batch = len / commits;
   urkel_tx_t *tx;
   urkel_t *db;
-  bench_t tv;
-  size_t i;
+  size_t i, j;
 
-  urkel_destroy(URKEL_PATH);
+  urkel_destroy(prefix);
 
-  db = urkel_open(URKEL_PATH);
+  db = urkel_open_ex(prefix, options);
 
   ASSERT(db != NULL);
 
@@ -58,45 +224,204 @@ bench_urkel(void) {
 
   ASSERT(tx != NULL);
 
-  {
-    bench_start(&tv, "insert");
+  for (i = 0; i < commits; i++) {
+    size_t end = i == commits - 1 ? len : (i + 1) * batch;
 
-    for (i = 0; i < URKEL_ITERATIONS; i++) {
-      unsigned char *key = kvs[i].key;
-      unsigned char *value = kvs[i].value;
+    for (j = i * batch; j < end; j++)
+      ASSERT(urkel_tx_insert(tx, kvs[j].key, kvs[j].value, 64));
 
-      ASSERT(urkel_tx_insert(tx, key, value, 64));
-    }
+    ASSERT(urkel_tx_commit(tx));
 
-    bench_end(&tv, i);
+    if (roots != NULL)
+      urkel_tx_root(tx, roots[i]);
   }
 
-  {
-    bench_start(&tv, "get (cached)");
+  urkel_tx_destroy(tx);
 
-    for (i = 0; i < URKEL_ITERATIONS; i++) {
-      unsigned char *key = kvs[i].key;
-      unsigned char value[64];
-      size_t size;
+  return db;
+}
 
-      ASSERT(urkel_tx_get(tx, value, &size, key));
-    }
+/*
+ * Insert
+ */
 
-    bench_end(&tv, i);
-  }
+static void
+bench_insert(const urkel_kv_t *kvs, size_t len) {
+  urkel_kv_t *sorted = urkel_kv_dup((urkel_kv_t *)kvs, len);
+  static const char *names[2][2] = {
+    { "insert (random)", "commit (random)" },
+    { "insert (sorted)", "commit (sorted)" }
+  };
+  const urkel_kv_t *order[2];
+  urkel_tx_t *tx;
+  urkel_t *db;
+  bench_t bench;
+  size_t i, j;
+
+  urkel_kv_sort(sorted, len);
+
+  order[0] = kvs;
+  order[1] = sorted;
+
+  for (i = 0; i < 2; i++) {
+    urkel_destroy(URKEL_TMP_PATH);
+
+    db = urkel_open(URKEL_TMP_PATH);
+
+    ASSERT(db != NULL);
 
-  {
-    bench_start(&tv, "commit");
+    tx = urkel_tx_create(db, NULL);
+
+    ASSERT(tx != NULL);
+
+    bench_start(&bench, db, names[i][0]);
+
+    for (j = 0; j < len; j++)
+      ASSERT(urkel_tx_insert(tx, order[i][j].key, order[i][j].value, 64));
+
+    bench_end(&bench, len);
+
+    bench_start(&bench, db, names[i][1]);
 
     ASSERT(urkel_tx_commit(tx));
 
-    bench_end(&tv, 1);
+    bench_end(&bench, 1);
+
+    urkel_tx_destroy(tx);
+    urkel_close(db);
+  }
+
+  ASSERT(urkel_destroy(URKEL_TMP_PATH));
+
+  urkel_kv_free(sorted);
+}
+
+/*
+ * Commit
+ */
+
+static void
+bench_commit(const urkel_kv_t *kvs, size_t len) {
+  /* Commits of each batch size on top of a populated tree. Only
+     the commits are timed. */
+  static const size_t batches[] = { 1, 10, 100, 1000, 10000 };
+  size_t rounds[ARRAY_SIZE(batches)];
+  size_t total = len;
+  urkel_kv_t *extra;
+  urkel_tx_t *tx;
+  urkel_t *db;
+  bench_t bench;
+  char name[64];
+  size_t i, j, k;
+
+  for (i = 0; i < ARRAY_SIZE(batches); i++) {
+    rounds[i] = 20000 / batches[i];
+
+    if (rounds[i] > 200)
+      rounds[i] = 200;
+
+    if (rounds[i] < 5)
+      rounds[i] = 5;
+
+    total += batches[i] * rounds[i];
+  }
+
+  /* Keys past `len` are not in the tree yet. */
+  extra = urkel_kv_generate(total);
+
+  db = bench_populate(URKEL_TMP_PATH, NULL, kvs, len, 1, NULL);
+  tx = urkel_tx_create(db, NULL);
+
+  ASSERT(tx != NULL);
+
+  total = len;
+
+  for (i = 0; i < ARRAY_SIZE(batches); i++) {
+    sprintf(name, "commit (batch=%lu)", (unsigned long)batches[i]);
+
+    bench_start(&bench, db, name);
+
+    for (j = 0; j < rounds[i]; j++) {
+      bench_pause(&bench);
+
+      for (k = 0; k < batches[i]; k++) {
+        urkel_kv_t *kv = &extra[total++];
+
+        ASSERT(urkel_tx_insert(tx, kv->key, kv->value, 64));
+      }
+
+      bench_resume(&bench);
+
+      ASSERT(urkel_tx_commit(tx));
+    }
+
+    bench_end(&bench, rounds[i]);
   }
 
   urkel_tx_destroy(tx);
   urkel_close(db);
 
-  db = urkel_open(URKEL_PATH);
+  ASSERT(urkel_destroy(URKEL_TMP_PATH));
+
+  urkel_kv_free(extra);
+}
+
+/*
+ * Get
+ */
+
+static void
+bench_get(const urkel_kv_t *kvs, size_t len, unsigned char roots[][32]) {
+  /* Each lookup pass runs on a freshly opened tree (cold), and the
+     warm passes repeat it through a transaction which holds every
+     node it has read (URKEL_OPTION_ATTACH). The page cache is not
+     dropped in between. */
+  size_t old = len / BENCH_ROOTS;
+  size_t *seqs[4];
+  static const char *names[4] = {
+    "get (head, uniform)",
+    "get (head, zipf)",
+    "get (history, uniform)",
+    "get (history, zipf)"
+  };
+  urkel_tree_options_t options;
+  unsigned char value[64];
+  size_t size;
+  urkel_tx_t *tx;
+  urkel_t *db;
+  bench_t bench;
+  size_t i, j;
+
+  seqs[0] = bench_uniform(len, len);
+  seqs[1] = bench_zipf(len, len);
+  seqs[2] = bench_uniform(old, len);
+  seqs[3] = bench_zipf(old, len);
+
+  for (i = 0; i < 4; i++) {
+    const unsigned char *root = i < 2 ? NULL : roots[0];
+
+    db = urkel_open(URKEL_PATH);
+
+    ASSERT(db != NULL);
+
+    bench_start(&bench, db, names[i]);
+
+    for (j = 0; j < len; j++) {
+      const urkel_kv_t *kv = &kvs[seqs[i][j]];
+
+      ASSERT(urkel_get(db, value, &size, kv->key, root));
+    }
+
+    bench_end(&bench, len);
+
+    urkel_close(db);
+  }
+
+  urkel_tree_options_init(&options);
+
+  options.flags |= URKEL_OPTION_ATTACH;
+
+  db = urkel_open_ex(URKEL_PATH, &options);
 
   ASSERT(db != NULL);
 
@@ -104,115 +429,338 @@ bench_urkel(void) {
 
   ASSERT(tx != NULL);
 
-  {
-    bench_start(&tv, "get (uncached)");
+  for (j = 0; j < len; j++)
+    ASSERT(urkel_tx_get(tx, value, &size, kvs[j].key));
 
-    for (i = 0; i < URKEL_ITERATIONS; i++) {
-      unsigned char *key = kvs[i].key;
-      unsigned char value[64];
-      size_t size;
+  bench_start(&bench, db, "get (warm, uniform)");
 
-      ASSERT(urkel_tx_get(tx, value, &size, key));
-    }
+  for (j = 0; j < len; j++)
+    ASSERT(urkel_tx_get(tx, value, &size, kvs[seqs[0][j]].key));
+
+  bench_end(&bench, len);
+
+  bench_start(&bench, db, "get (warm, zipf)");
+
+  for (j = 0; j < len; j++)
+    ASSERT(urkel_tx_get(tx, value, &size, kvs[seqs[1][j]].key));
 
-    bench_end(&tv, i);
+  bench_end(&bench, len);
+
+  urkel_tx_destroy(tx);
+  urkel_close(db);
+
+  for (i = 0; i < 4; i++)
+    free(seqs[i]);
+}
+
+/*
+ * Prove
+ */
+
+static void
+bench_prove(const urkel_kv_t *kvs, size_t len, unsigned char roots[][32]) {
+  size_t old = len / BENCH_ROOTS;
+  size_t *head = bench_uniform(len, len);
+  size_t *hist = bench_uniform(old, len);
+  unsigned char *proofs[BENCH_PROOFS];
+  size_t proof_lens[BENCH_PROOFS];
+  unsigned char value[1024];
+  unsigned char root[32];
+  size_t value_len;
+  urkel_t *db;
+  bench_t bench;
+  int exists;
+  size_t i;
+
+  db = urkel_open(URKEL_PATH);
+
+  ASSERT(db != NULL);
+
+  bench_start(&bench, db, "prove (head)");
+
+  for (i = 0; i < len; i++) {
+    unsigned char *proof_raw;
+    size_t proof_len;
+
+    ASSERT(urkel_prove(db, &proof_raw, &proof_len, kvs[head[i]].key, NULL));
+
+    urkel_free(proof_raw);
   }
 
-  {
-    bench_start(&tv, "remove");
+  bench_end(&bench, len);
 
-    for (i = 0; i < URKEL_ITERATIONS; i++) {
-      unsigned char *key = kvs[i].key;
+  bench_start(&bench, db, "prove (history)");
 
-      if (i & 1)
-        ASSERT(urkel_tx_remove(tx, key));
-    }
+  for (i = 0; i < len; i++) {
+    unsigned char *proof_raw;
+    size_t proof_len;
 
-    bench_end(&tv, i);
+    ASSERT(urkel_prove(db, &proof_raw, &proof_len,
+                       kvs[hist[i]].key, roots[0]));
+
+    urkel_free(proof_raw);
   }
 
-  {
-    bench_start(&tv, "commit");
+  bench_end(&bench, len);
 
-    ASSERT(urkel_tx_commit(tx));
+  urkel_root(db, root);
 
-    bench_end(&tv, 1);
+  for (i = 0; i < BENCH_PROOFS; i++) {
+    ASSERT(urkel_prove(db, &proofs[i], &proof_lens[i],
+                       kvs[head[i % len]].key, NULL));
   }
 
-  {
-    bench_start(&tv, "commit (nothing)");
+  bench_start(&bench, NULL, "verify");
 
-    ASSERT(urkel_tx_commit(tx));
+  for (i = 0; i < len; i++) {
+    size_t j = i % BENCH_PROOFS;
 
-    bench_end(&tv, 1);
+    ASSERT(urkel_verify(&exists, value, &value_len,
+                        proofs[j], proof_lens[j],
+                        kvs[head[j % len]].key, root));
+
+    ASSERT(exists == 1);
+    ASSERT(value_len == 64);
   }
 
-  urkel_tx_destroy(tx);
+  bench_end(&bench, len);
+
+  for (i = 0; i < BENCH_PROOFS; i++)
+    urkel_free(proofs[i]);
+
   urkel_close(db);
 
+  free(head);
+  free(hist);
+}
+
+/*
+ * Iterate
+ */
+
+static void
+bench_iterate(size_t len) {
+  unsigned char key[32];
+  unsigned char value[1024];
+  urkel_iter_t *iter;
+  size_t size;
+  urkel_t *db;
+  bench_t bench;
+  size_t count = 0;
+
   db = urkel_open(URKEL_PATH);
 
   ASSERT(db != NULL);
 
-  tx = urkel_tx_create(db, NULL);
+  bench_start(&bench, db, "iterate");
 
-  ASSERT(tx != NULL);
+  iter = urkel_iterate(db, NULL);
 
-  {
-    bench_start(&tv, "prove");
+  ASSERT(iter != NULL);
 
-    for (i = 0; i < URKEL_ITERATIONS; i++) {
-      unsigned char *key = kvs[i].key;
-      unsigned char *proof_raw;
-      size_t proof_len;
+  while (urkel_iter_next(iter, key, value, &size))
+    count += 1;
 
-      ASSERT(urkel_tx_prove(tx, &proof_raw, &proof_len, key));
+  ASSERT(urkel_errno == URKEL_EITEREND);
 
-      urkel_free(proof_raw);
-    }
+  urkel_iter_destroy(iter);
 
-    bench_end(&tv, i);
-  }
+  bench_end(&bench, count);
 
-  {
-    unsigned char root[32];
-    unsigned char *key = kvs[0].key;
-    unsigned char *proof_raw;
-    size_t proof_len;
-    int exists;
-    unsigned char value[1024];
-    size_t value_len;
+  ASSERT(count == len);
 
-    urkel_tx_root(tx, root);
+  urkel_close(db);
+}
+
+/*
+ * Compact
+ */
 
-    ASSERT(urkel_tx_prove(tx, &proof_raw, &proof_len, key));
+static void
+bench_compact(size_t len) {
+  /* One operation per leaf copied. */
+  bench_t bench;
 
-    bench_start(&tv, "verify");
+  urkel_destroy(URKEL_TMP_PATH);
 
-    for (i = 0; i < URKEL_ITERATIONS; i++) {
-      ASSERT(urkel_verify(&exists, value, &value_len,
-                          proof_raw, proof_len, key, root));
+  bench_start(&bench, NULL, "compact");
 
-      ASSERT(exists == 1);
-      ASSERT(value_len == 64);
-      ASSERT(urkel_memcmp(value, kvs[0].value, 64) == 0);
-    }
+  ASSERT(urkel_compact(URKEL_TMP_PATH, URKEL_PATH, NULL));
 
-    bench_end(&tv, i);
+  bench_end(&bench, len);
 
-    urkel_free(proof_raw);
+  ASSERT(urkel_destroy(URKEL_TMP_PATH));
+}
+
+/*
+ * Open
+ */
+
+static void
+bench_open(size_t len) {
+  /* Recovery is simulated by leaving the nodes of a spilled and
+     never committed transaction at the end of the newest data
+     file, which open has to scan back over to find the last meta
+     record. This leaves the store with garbage, so it runs last. */
+  urkel_kv_t *kvs = urkel_kv_generate(len + len / 4);
+  urkel_tree_options_t options;
+  urkel_tree_stat_t before, after;
+  urkel_tx_t *tx;
+  urkel_t *db;
+  bench_t bench;
+  size_t i;
+
+  bench_start(&bench, NULL, "open (clean)");
+
+  for (i = 0; i < BENCH_OPENS; i++) {
+    db = urkel_open(URKEL_PATH);
+
+    ASSERT(db != NULL);
+
+    bench_pause(&bench);
+    urkel_close(db);
+    bench_resume(&bench);
   }
 
+  bench_end(&bench, BENCH_OPENS);
+
+  /* urkel_stat adds to the counts. */
+  memset(&before, 0, sizeof(before));
+  memset(&after, 0, sizeof(after));
+
+  ASSERT(urkel_stat(URKEL_PATH, &before));
+
+  urkel_tree_options_init(&options);
+
+  options.tx_memory = 1 << 20;
+
+  db = urkel_open_ex(URKEL_PATH, &options);
+
+  ASSERT(db != NULL);
+
+  tx = urkel_tx_create(db, NULL);
+
+  ASSERT(tx != NULL);
+
+  for (i = len; i < len + len / 4; i++)
+    ASSERT(urkel_tx_insert(tx, kvs[i].key, kvs[i].value, 64));
+
   urkel_tx_destroy(tx);
   urkel_close(db);
 
-  ASSERT(urkel_destroy(URKEL_PATH));
+  ASSERT(urkel_stat(URKEL_PATH, &after));
+
+  if (!bench_json) {
+    printf("Uncommitted tail: %lu bytes\n",
+           (unsigned long)(after.size - before.size));
+  }
+
+  bench_start(&bench, NULL, "open (recovery)");
+
+  for (i = 0; i < BENCH_OPENS; i++) {
+    db = urkel_open(URKEL_PATH);
+
+    ASSERT(db != NULL);
+
+    bench_pause(&bench);
+    urkel_close(db);
+    bench_resume(&bench);
+  }
+
+  bench_end(&bench, BENCH_OPENS);
 
   urkel_kv_free(kvs);
 }
 
+/*
+ * Main
+ */
+
+static void
+bench_usage(void) {
+  fprintf(stderr, "Usage: urkel_bench [--json] [--keys N] [group...]\n");
+  fprintf(stderr, "Groups: insert, commit, get, prove, iterate,"
+                  " compact, open\n");
+  exit(1);
+}
+
 int
-main(void) {
-  bench_urkel();
+main(int argc, char **argv) {
+  unsigned char roots[BENCH_ROOTS][32];
+  urkel_kv_t *kvs;
+  urkel_t *db;
+  int store;
+  int i;
+
+  bench_groups = malloc(argc * sizeof(char *));
+
+  ASSERT(bench_groups != NULL);
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--json") == 0) {
+      bench_json = 1;
+    } else if (strcmp(argv[i], "--keys") == 0) {
+      if (i + 1 >= argc)
+        bench_usage();
+
+      bench_keys = strtoul(argv[++i], NULL, 10);
+
+      if (bench_keys < BENCH_ROOTS * 10)
+        bench_usage();
+    } else if (argv[i][0] == '-') {
+      bench_usage();
+    } else {
+      bench_groups[bench_groups_len++] = argv[i];
+    }
+  }
+
+  store = bench_selected("get")
+       || bench_selected("prove")
+       || bench_selected("iterate")
+       || bench_selected("compact")
+       || bench_selected("open");
+
+  kvs = urkel_kv_generate(bench_keys);
+
+  if (bench_json)
+    printf("{\n  \"keys\": %lu,\n  \"results\": [\n",
+           (unsigned long)bench_keys);
+
+  if (bench_selected("insert"))
+    bench_insert(kvs, bench_keys);
+
+  if (bench_selected("commit"))
+    bench_commit(kvs, bench_keys);
+
+  if (store) {
+    db = bench_populate(URKEL_PATH, NULL, kvs, bench_keys,
+                        BENCH_ROOTS, roots);
+    urkel_close(db);
+  }
+
+  if (bench_selected("get"))
+    bench_get(kvs, bench_keys, roots);
+
+  if (bench_selected("prove"))
+    bench_prove(kvs, bench_keys, roots);
+
+  if (bench_selected("iterate"))
+    bench_iterate(bench_keys);
+
+  if (bench_selected("compact"))
+    bench_compact(bench_keys);
+
+  if (bench_selected("open"))
+    bench_open(bench_keys);
+
+  if (store)
+    ASSERT(urkel_destroy(URKEL_PATH));
+
+  if (bench_json)
+    printf("\n  ]\n}\n");
+
+  urkel_kv_free(kvs);
+  free(bench_groups);
+
   return 0;
 }
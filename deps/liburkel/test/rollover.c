@@ -0,0 +1,136 @@
+/*!
+ * rollover.c - file rollover tests for liburkel
+ * Copyright (c) 2020, Christopher Jeffrey (MIT License).
+ * https://github.com/handshake-org/liburkel
+ *
+ * Built against a store with tiny data files
+ * (see URKEL_MAX_FILE_SIZE in CMakeLists.txt).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <urkel.h>
+#include "utils.h"
+
+#define ROLLOVER_COMMITS 3
+#define ROLLOVER_KEYS 500 /* Per commit: well over one file. */
+
+static int
+urkel_wait_durable(urkel_t *db, const unsigned char *root, time_t timeout) {
+  time_t start = time(NULL);
+  unsigned char hash[32];
+
+  do {
+    urkel_durable_root(db, hash);
+
+    if (urkel_memcmp(hash, root, 32) == 0)
+      return 1;
+  } while (time(NULL) - start < timeout);
+
+  return 0;
+}
+
+static void
+test_urkel_rollover_durability(void) {
+  static const unsigned int modes[4] = {
+    URKEL_DURABLE_NONE,
+    URKEL_DURABLE_COMMIT,
+    URKEL_DURABLE_BATCH,
+    URKEL_DURABLE_ROLLOVER
+  };
+  urkel_kv_t *kvs = urkel_kv_generate(ROLLOVER_COMMITS * ROLLOVER_KEYS);
+  unsigned char roots[ROLLOVER_COMMITS + 1][32];
+  unsigned char result[64];
+  unsigned char hash[32];
+  urkel_tree_options_t options;
+  urkel_tree_stat_t stat;
+  size_t result_len;
+  urkel_tx_t *tx;
+  urkel_t *db;
+  size_t i, j, k;
+
+  for (k = 0; k < ARRAY_SIZE(modes); k++) {
+    urkel_destroy(URKEL_PATH);
+    urkel_tree_options_init(&options);
+
+    /* Batches never come due: only rollovers sync. */
+    options.durability = modes[k];
+    options.sync_commits = 1000;
+    options.sync_interval = 60 * 1000;
+
+    db = urkel_open_ex(URKEL_PATH, &options);
+
+    ASSERT(db != NULL);
+
+    urkel_root(db, roots[0]);
+
+    tx = urkel_tx_create(db, NULL);
+
+    ASSERT(tx != NULL);
+
+    for (i = 1; i <= ROLLOVER_COMMITS; i++) {
+      for (j = (i - 1) * ROLLOVER_KEYS; j < i * ROLLOVER_KEYS; j++)
+        ASSERT(urkel_tx_insert(tx, kvs[j].key, kvs[j].value, 64));
+
+      ASSERT(urkel_tx_commit(tx));
+
+      urkel_tx_root(tx, roots[i]);
+    }
+
+    memset(&stat, 0, sizeof(stat));
+
+    ASSERT(urkel_stat(URKEL_PATH, &stat));
+    ASSERT(stat.files > ROLLOVER_COMMITS);
+
+    /* Files retired during the last commit hold
+       everything up to the commit before it. */
+    switch (modes[k]) {
+      case URKEL_DURABLE_NONE:
+        ASSERT(!urkel_wait_durable(db, roots[ROLLOVER_COMMITS - 1], 2));
+
+        urkel_durable_root(db, hash);
+
+        ASSERT(urkel_memcmp(hash, roots[0], 32) == 0);
+
+        break;
+      case URKEL_DURABLE_COMMIT:
+        urkel_durable_root(db, hash);
+
+        ASSERT(urkel_memcmp(hash, roots[ROLLOVER_COMMITS], 32) == 0);
+
+        break;
+      default:
+        ASSERT(urkel_wait_durable(db, roots[ROLLOVER_COMMITS - 1], 10));
+        break;
+    }
+
+    urkel_tx_destroy(tx);
+    urkel_close(db);
+
+    db = urkel_open_ex(URKEL_PATH, &options);
+
+    ASSERT(db != NULL);
+
+    urkel_root(db, hash);
+
+    ASSERT(urkel_memcmp(hash, roots[ROLLOVER_COMMITS], 32) == 0);
+
+    for (j = 0; j < ROLLOVER_COMMITS * ROLLOVER_KEYS; j += 7) {
+      ASSERT(urkel_get(db, result, &result_len, kvs[j].key, NULL));
+      ASSERT(urkel_memcmp(result, kvs[j].value, 64) == 0);
+    }
+
+    urkel_close(db);
+  }
+
+  ASSERT(urkel_destroy(URKEL_PATH));
+
+  urkel_kv_free(kvs);
+}
+
+int
+main(void) {
+  test_urkel_rollover_durability();
+  return 0;
+}
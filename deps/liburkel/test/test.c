@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <urkel.h>
 #include "utils.h"
 
@@ -463,6 +464,278 @@ test_urkel_leaky_inject(void) {
   urkel_kv_free(kvs);
 }
 
+static void
+test_urkel_fork(void) {
+  urkel_kv_t *kvs = urkel_kv_generate(256);
+  unsigned char expect[32];
+  unsigned char root[32];
+  unsigned char base[32];
+  unsigned char result[64];
+  size_t result_len;
+  urkel_tx_t *tx, *fork, *fork2, *check;
+  urkel_t *db;
+  size_t i;
+
+  urkel_destroy(URKEL_PATH);
+
+  db = urkel_open(URKEL_PATH);
+
+  ASSERT(db != NULL);
+
+  tx = urkel_tx_create(db, NULL);
+
+  ASSERT(tx != NULL);
+
+  for (i = 0; i < 128; i++)
+    ASSERT(urkel_tx_insert(tx, kvs[i].key, kvs[i].value, 64));
+
+  ASSERT(urkel_tx_commit(tx));
+
+  urkel_root(db, base);
+
+  /* Fork with uncommitted changes. */
+  for (i = 128; i < 192; i++)
+    ASSERT(urkel_tx_insert(tx, kvs[i].key, kvs[i].value, 64));
+
+  urkel_tx_root(tx, root);
+
+  fork = urkel_tx_fork(tx);
+
+  ASSERT(fork != NULL);
+
+  urkel_tx_root(fork, expect);
+
+  ASSERT(urkel_memcmp(expect, root, 32) == 0);
+
+  /* Diverge. */
+  for (i = 192; i < 256; i++)
+    ASSERT(urkel_tx_insert(fork, kvs[i].key, kvs[i].value, 64));
+
+  for (i = 0; i < 64; i++)
+    ASSERT(urkel_tx_remove(fork, kvs[i].key));
+
+  for (i = 128; i < 160; i++)
+    ASSERT(urkel_tx_remove(tx, kvs[i].key));
+
+  for (i = 64; i < 96; i++)
+    ASSERT(urkel_tx_insert(tx, kvs[i].key, kvs[i + 1].value, 64));
+
+  for (i = 0; i < 256; i++) {
+    int in_tx = i < 128 || (i >= 160 && i < 192);
+    int in_fork = i >= 64;
+
+    ASSERT(urkel_tx_has(tx, kvs[i].key) == in_tx);
+    ASSERT(urkel_tx_has(fork, kvs[i].key) == in_fork);
+  }
+
+  ASSERT(urkel_tx_get(tx, result, &result_len, kvs[64].key));
+  ASSERT(urkel_memcmp(result, kvs[65].value, 64) == 0);
+
+  ASSERT(urkel_tx_get(fork, result, &result_len, kvs[64].key));
+  ASSERT(urkel_memcmp(result, kvs[64].value, 64) == 0);
+
+  /* Same changes, replayed without sharing. */
+  check = urkel_tx_create(db, base);
+
+  ASSERT(check != NULL);
+
+  for (i = 64; i < 256; i++)
+    ASSERT(urkel_tx_insert(check, kvs[i].key, kvs[i].value, 64));
+
+  for (i = 0; i < 64; i++)
+    ASSERT(urkel_tx_remove(check, kvs[i].key));
+
+  urkel_tx_root(check, expect);
+  urkel_tx_root(fork, root);
+
+  ASSERT(urkel_memcmp(expect, root, 32) == 0);
+
+  urkel_tx_destroy(check);
+
+  /* A fork of a fork outlives both of its parents. */
+  fork2 = urkel_tx_fork(fork);
+
+  ASSERT(fork2 != NULL);
+
+  ASSERT(urkel_tx_commit(fork));
+
+  urkel_root(db, expect);
+
+  ASSERT(urkel_memcmp(expect, root, 32) == 0);
+
+  urkel_tx_destroy(fork);
+
+  ASSERT(urkel_tx_commit(tx));
+
+  urkel_tx_root(tx, expect);
+
+  urkel_tx_destroy(tx);
+
+  urkel_tx_root(fork2, result);
+
+  ASSERT(urkel_memcmp(result, root, 32) == 0);
+
+  for (i = 0; i < 64; i++)
+    ASSERT(urkel_tx_insert(fork2, kvs[i].key, kvs[i].value, 64));
+
+  ASSERT(urkel_tx_commit(fork2));
+
+  for (i = 0; i < 256; i++)
+    ASSERT(urkel_tx_has(fork2, kvs[i].key));
+
+  urkel_tx_destroy(fork2);
+
+  /* Both branches were committed. */
+  check = urkel_tx_create(db, root);
+
+  ASSERT(check != NULL);
+  ASSERT(!urkel_tx_has(check, kvs[0].key));
+  ASSERT(urkel_tx_has(check, kvs[255].key));
+
+  ASSERT(urkel_tx_inject(check, expect));
+  ASSERT(urkel_tx_has(check, kvs[0].key));
+  ASSERT(!urkel_tx_has(check, kvs[128].key));
+  ASSERT(!urkel_tx_has(check, kvs[255].key));
+
+  urkel_tx_destroy(check);
+
+  {
+    urkel_memory_t usage;
+
+    urkel_memory_usage(db, &usage);
+
+    ASSERT(usage.txs == 0);
+  }
+
+  urkel_close(db);
+
+  ASSERT(urkel_destroy(URKEL_PATH));
+
+  urkel_kv_free(kvs);
+}
+
+static void
+test_urkel_savepoint(void) {
+  urkel_kv_t *kvs = urkel_kv_generate(128);
+  urkel_tree_options_t options;
+  unsigned char root0[32];
+  unsigned char root1[32];
+  unsigned char root[32];
+  urkel_memory_t usage;
+  size_t sp0, sp1;
+  urkel_tx_t *tx;
+  urkel_t *db;
+  size_t i;
+
+  urkel_destroy(URKEL_PATH);
+
+  urkel_tree_options_init(&options);
+
+  options.flags = URKEL_OPTION_INDEX;
+
+  db = urkel_open_ex(URKEL_PATH, &options);
+
+  ASSERT(db != NULL);
+
+  tx = urkel_tx_create(db, NULL);
+
+  ASSERT(tx != NULL);
+
+  for (i = 0; i < 64; i++)
+    ASSERT(urkel_tx_insert(tx, kvs[i].key, kvs[i].value, 64));
+
+  ASSERT(urkel_tx_commit(tx));
+
+  for (i = 64; i < 80; i++)
+    ASSERT(urkel_tx_insert(tx, kvs[i].key, kvs[i].value, 64));
+
+  urkel_tx_root(tx, root0);
+
+  sp0 = urkel_tx_savepoint(tx);
+
+  for (i = 80; i < 96; i++)
+    ASSERT(urkel_tx_insert(tx, kvs[i].key, kvs[i].value, 64));
+
+  for (i = 0; i < 8; i++)
+    ASSERT(urkel_tx_remove(tx, kvs[i].key));
+
+  urkel_tx_root(tx, root1);
+
+  sp1 = urkel_tx_savepoint(tx);
+
+  ASSERT(sp1 == sp0 + 1);
+
+  for (i = 96; i < 128; i++)
+    ASSERT(urkel_tx_insert(tx, kvs[i].key, kvs[i].value, 64));
+
+  for (i = 8; i < 16; i++)
+    ASSERT(urkel_tx_remove(tx, kvs[i].key));
+
+  /* Roll back to each savepoint in turn. */
+  ASSERT(urkel_tx_rollback_to(tx, sp1));
+
+  urkel_tx_root(tx, root);
+
+  ASSERT(urkel_memcmp(root, root1, 32) == 0);
+  ASSERT(!urkel_tx_has(tx, kvs[96].key));
+  ASSERT(urkel_tx_has(tx, kvs[8].key));
+  ASSERT(!urkel_tx_has(tx, kvs[0].key));
+
+  /* Again, after more changes. */
+  ASSERT(urkel_tx_insert(tx, kvs[100].key, kvs[100].value, 64));
+  ASSERT(urkel_tx_rollback_to(tx, sp1));
+
+  urkel_tx_root(tx, root);
+
+  ASSERT(urkel_memcmp(root, root1, 32) == 0);
+
+  ASSERT(urkel_tx_rollback_to(tx, sp0));
+
+  urkel_tx_root(tx, root);
+
+  ASSERT(urkel_memcmp(root, root0, 32) == 0);
+  ASSERT(urkel_tx_has(tx, kvs[0].key));
+  ASSERT(!urkel_tx_has(tx, kvs[80].key));
+
+  /* Later savepoints are gone. */
+  ASSERT(!urkel_tx_rollback_to(tx, sp1));
+  ASSERT(urkel_errno == URKEL_EINVAL);
+
+  ASSERT(urkel_tx_release(tx, sp0));
+  ASSERT(!urkel_tx_rollback_to(tx, sp0));
+
+  /* Rolled back removals are not applied to the index. */
+  ASSERT(urkel_tx_commit(tx));
+
+  urkel_root(db, root);
+
+  ASSERT(urkel_memcmp(root, root0, 32) == 0);
+
+  urkel_tx_clear(tx);
+
+  for (i = 0; i < 80; i++)
+    ASSERT(urkel_tx_has(tx, kvs[i].key));
+
+  /* Committing drops savepoints. */
+  sp0 = urkel_tx_savepoint(tx);
+
+  ASSERT(urkel_tx_remove(tx, kvs[0].key));
+  ASSERT(urkel_tx_commit(tx));
+  ASSERT(!urkel_tx_rollback_to(tx, sp0));
+
+  urkel_tx_destroy(tx);
+
+  urkel_memory_usage(db, &usage);
+
+  ASSERT(usage.txs == 0);
+
+  urkel_close(db);
+
+  ASSERT(urkel_destroy(URKEL_PATH));
+
+  urkel_kv_free(kvs);
+}
+
 static void
 test_urkel_max_value_size(void) {
   unsigned char key[32];
@@ -548,13 +821,1559 @@ test_urkel_compact(void) {
   ASSERT(urkel_destroy(URKEL_TMP_PATH));
 }
 
+static void
+test_urkel_filter(void) {
+  static const size_t PAIRS = 200;
+  urkel_kv_t *kvs = urkel_kv_generate(PAIRS * 2);
+  urkel_tree_options_t options;
+  unsigned char root[32];
+  unsigned char result[64];
+  size_t result_len;
+  urkel_tx_t *tx;
+  urkel_t *db;
+  size_t i;
+
+  urkel_destroy(URKEL_PATH);
+
+  urkel_tree_options_init(&options);
+
+  options.flags |= URKEL_OPTION_FILTER;
+
+  db = urkel_open_ex(URKEL_PATH, &options);
+
+  ASSERT(db != NULL);
+
+  tx = urkel_tx_create(db, NULL);
+
+  ASSERT(tx != NULL);
+
+  for (i = 0; i < PAIRS / 2; i++)
+    ASSERT(urkel_tx_insert(tx, kvs[i].key, kvs[i].value, 64));
+
+  ASSERT(urkel_tx_commit(tx));
+
+  urkel_tx_root(tx, root);
+
+  for (i = PAIRS / 2; i < PAIRS; i++)
+    ASSERT(urkel_tx_insert(tx, kvs[i].key, kvs[i].value, 64));
+
+  ASSERT(urkel_tx_commit(tx));
+
+  /* Removed keys must still be found in older roots. */
+  ASSERT(urkel_tx_remove(tx, kvs[0].key));
+  ASSERT(urkel_tx_commit(tx));
+
+  ASSERT(urkel_has(db, kvs[0].key, root));
+  ASSERT(!urkel_has(db, kvs[0].key, NULL));
+
+  for (i = 1; i < PAIRS; i++) {
+    ASSERT(urkel_tx_has(tx, kvs[i].key));
+    ASSERT(urkel_tx_get(tx, result, &result_len, kvs[i].key));
+    ASSERT(result_len == 64);
+    ASSERT(urkel_memcmp(result, kvs[i].value, 64) == 0);
+  }
+
+  for (i = PAIRS; i < PAIRS * 2; i++) {
+    urkel_errno = 0;
+    ASSERT(!urkel_tx_get(tx, result, &result_len, kvs[i].key));
+    ASSERT(urkel_errno == URKEL_ENOTFOUND);
+    ASSERT(result_len == 0);
+  }
+
+  urkel_tx_destroy(tx);
+
+  /* Rebuilding a transaction on an older root. */
+  tx = urkel_tx_create(db, NULL);
+
+  ASSERT(tx != NULL);
+  ASSERT(urkel_tx_inject(tx, root));
+  ASSERT(urkel_tx_insert(tx, kvs[PAIRS].key, kvs[PAIRS].value, 64));
+  ASSERT(urkel_tx_commit(tx));
+  ASSERT(urkel_tx_has(tx, kvs[PAIRS].key));
+  ASSERT(urkel_tx_has(tx, kvs[1].key));
+  ASSERT(!urkel_tx_has(tx, kvs[PAIRS - 1].key));
+
+  urkel_tx_root(tx, root);
+  urkel_tx_destroy(tx);
+  urkel_close(db);
+
+  /* Reopen with the persisted filter. */
+  db = urkel_open_ex(URKEL_PATH, &options);
+
+  ASSERT(db != NULL);
+
+  for (i = 0; i < PAIRS / 2; i++)
+    ASSERT(urkel_has(db, kvs[i].key, NULL));
+
+  for (i = PAIRS / 2; i < PAIRS; i++)
+    ASSERT(!urkel_has(db, kvs[i].key, NULL));
+
+  ASSERT(urkel_has(db, kvs[PAIRS].key, root));
+
+  urkel_close(db);
+
+  ASSERT(urkel_destroy(URKEL_PATH));
+
+  urkel_kv_free(kvs);
+}
+
+static void
+test_urkel_index(void) {
+  static const size_t PAIRS = 3000;
+  urkel_kv_t *kvs = urkel_kv_generate(PAIRS + 100);
+  urkel_tree_options_t options;
+  urkel_metrics_t before, after;
+  unsigned char roots[3][32];
+  unsigned char result[64];
+  size_t result_len;
+  urkel_tx_t *tx;
+  urkel_t *db;
+  size_t i, j;
+
+  urkel_destroy(URKEL_PATH);
+
+  urkel_tree_options_init(&options);
+
+  options.flags |= URKEL_OPTION_INDEX;
+
+  db = urkel_open_ex(URKEL_PATH, &options);
+
+  ASSERT(db != NULL);
+
+  tx = urkel_tx_create(db, NULL);
+
+  ASSERT(tx != NULL);
+
+  /* Enough commits to grow the table a few times. */
+  for (i = 0; i < PAIRS; i += 500) {
+    for (j = i; j < i + 500; j++)
+      ASSERT(urkel_tx_insert(tx, kvs[j].key, kvs[j].value, 64));
+
+    ASSERT(urkel_tx_commit(tx));
+  }
+
+  urkel_tx_root(tx, roots[0]);
+
+  /* Remove, then remove and re-insert with a new value. */
+  for (i = 0; i < 100; i++)
+    ASSERT(urkel_tx_remove(tx, kvs[i].key));
+
+  for (i = 100; i < 200; i++) {
+    ASSERT(urkel_tx_remove(tx, kvs[i].key));
+    ASSERT(urkel_tx_insert(tx, kvs[i].key, kvs[i + 1].value, 64));
+  }
+
+  ASSERT(urkel_tx_commit(tx));
+
+  urkel_tx_root(tx, roots[1]);
+
+  for (i = 0; i < PAIRS + 100; i++) {
+    int exists = (i >= 100 && i < PAIRS);
+    const unsigned char *value = kvs[i < 200 ? i + 1 : i].value;
+
+    ASSERT(urkel_tx_has(tx, kvs[i].key) == exists);
+    ASSERT(urkel_get(db, result, &result_len, kvs[i].key, NULL) == exists);
+
+    if (exists) {
+      ASSERT(result_len == 64);
+      ASSERT(urkel_memcmp(result, value, 64) == 0);
+    }
+  }
+
+  /* Every head lookup is answered by the index. */
+  urkel_metrics(db, &before);
+
+  for (i = 200; i < PAIRS; i++)
+    ASSERT(urkel_get(db, result, &result_len, kvs[i].key, NULL));
+
+  urkel_metrics(db, &after);
+
+  ASSERT(after.index_hits - before.index_hits == PAIRS - 200);
+  ASSERT(after.index_misses == before.index_misses);
+
+  /* Older roots walk the tree. */
+  ASSERT(urkel_get(db, result, &result_len, kvs[0].key, roots[0]));
+  ASSERT(urkel_memcmp(result, kvs[0].value, 64) == 0);
+
+  urkel_tx_destroy(tx);
+  urkel_close(db);
+
+  /* Persisted index. */
+  db = urkel_open_ex(URKEL_PATH, &options);
+
+  ASSERT(db != NULL);
+  ASSERT(!urkel_has(db, kvs[0].key, NULL));
+  ASSERT(urkel_get(db, result, &result_len, kvs[150].key, NULL));
+  ASSERT(urkel_memcmp(result, kvs[151].value, 64) == 0);
+
+  urkel_metrics(db, &before);
+
+  for (i = 200; i < PAIRS; i++)
+    ASSERT(urkel_get(db, result, &result_len, kvs[i].key, NULL));
+
+  urkel_metrics(db, &after);
+
+  ASSERT(after.index_hits - before.index_hits == PAIRS - 200);
+  ASSERT(after.index_misses == before.index_misses);
+
+  /* Build on an older root; the index is rebuilt on open. */
+  tx = urkel_tx_create(db, roots[0]);
+
+  ASSERT(tx != NULL);
+  ASSERT(urkel_tx_insert(tx, kvs[PAIRS].key, kvs[PAIRS].value, 64));
+  ASSERT(urkel_tx_commit(tx));
+
+  urkel_tx_root(tx, roots[2]);
+  urkel_tx_destroy(tx);
+  urkel_close(db);
+
+  db = urkel_open_ex(URKEL_PATH, &options);
+
+  ASSERT(db != NULL);
+
+  urkel_root(db, result);
+
+  ASSERT(urkel_memcmp(result, roots[2], 32) == 0);
+
+  for (i = 0; i < PAIRS + 100; i++) {
+    int exists = (i <= PAIRS);
+
+    ASSERT(urkel_has(db, kvs[i].key, NULL) == exists);
+
+    if (exists) {
+      ASSERT(urkel_get(db, result, &result_len, kvs[i].key, NULL));
+      ASSERT(urkel_memcmp(result, kvs[i].value, 64) == 0);
+    }
+  }
+
+  urkel_close(db);
+
+  ASSERT(urkel_destroy(URKEL_PATH));
+
+  urkel_kv_free(kvs);
+}
+
+static size_t
+urkel_compress_value(unsigned char *out, const urkel_kv_t *kv, size_t i) {
+  /* Every fourth value is random, the rest are repetitive. */
+  size_t size = (i & 3) ? 24 + (i * 37) % 1000 : 64;
+  size_t j;
+
+  if ((i & 3) == 0) {
+    memcpy(out, kv->value, 64);
+    return 64;
+  }
+
+  for (j = 0; j < size; j++)
+    out[j] = kv->value[(j / 3) % 8];
+
+  return size;
+}
+
+static void
+test_urkel_compress(void) {
+  static const size_t PAIRS = 400;
+  urkel_kv_t *kvs = urkel_kv_generate(PAIRS);
+  urkel_tree_options_t options;
+  urkel_tree_stat_t stats[2];
+  unsigned char roots[2][32];
+  unsigned char value[1023];
+  unsigned char result[1023];
+  size_t size, result_len;
+  const char *paths[2];
+  urkel_tx_t *tx;
+  urkel_t *db;
+  size_t i, k;
+
+  paths[0] = URKEL_PATH;
+  paths[1] = URKEL_TMP_PATH;
+
+  memset(stats, 0, sizeof(stats));
+
+  urkel_destroy(URKEL_PATH);
+  urkel_destroy(URKEL_TMP_PATH);
+
+  /* Same data with and without compression. */
+  for (k = 0; k < 2; k++) {
+    urkel_tree_options_init(&options);
+
+    if (k == 0)
+      options.flags |= URKEL_OPTION_COMPRESS;
+
+    db = urkel_open_ex(paths[k], &options);
+
+    ASSERT(db != NULL);
+
+    tx = urkel_tx_create(db, NULL);
+
+    ASSERT(tx != NULL);
+
+    for (i = 0; i < PAIRS; i++) {
+      size = urkel_compress_value(value, &kvs[i], i);
+
+      ASSERT(urkel_tx_insert(tx, kvs[i].key, value, size));
+    }
+
+    /* Largest value. */
+    memset(value, 0xaa, sizeof(value));
+
+    ASSERT(urkel_tx_insert(tx, kvs[0].key, value, sizeof(value)));
+    ASSERT(urkel_tx_commit(tx));
+
+    urkel_tx_root(tx, roots[k]);
+    urkel_tx_destroy(tx);
+    urkel_close(db);
+
+    ASSERT(urkel_stat(paths[k], &stats[k]));
+  }
+
+  ASSERT(urkel_memcmp(roots[0], roots[1], 32) == 0);
+  ASSERT(stats[0].size < stats[1].size / 2);
+
+  ASSERT(urkel_destroy(URKEL_TMP_PATH));
+
+  /* Compacting writes the values back out in full. */
+  ASSERT(urkel_compact(URKEL_TMP_PATH, URKEL_PATH, NULL));
+
+  for (k = 0; k < 2; k++) {
+    /* Compressed values are readable without the option. */
+    db = urkel_open(paths[k]);
+
+    ASSERT(db != NULL);
+
+    urkel_root(db, result);
+
+    ASSERT(urkel_memcmp(result, roots[0], 32) == 0);
+
+    ASSERT(urkel_get(db, result, &result_len, kvs[0].key, NULL));
+    ASSERT(result_len == sizeof(value));
+    ASSERT(urkel_memcmp(result, value, sizeof(value)) == 0);
+
+    for (i = 1; i < PAIRS; i++) {
+      size = urkel_compress_value(value, &kvs[i], i);
+
+      ASSERT(urkel_get(db, result, &result_len, kvs[i].key, NULL));
+      ASSERT(result_len == size);
+      ASSERT(urkel_memcmp(result, value, size) == 0);
+    }
+
+    memset(value, 0xaa, sizeof(value));
+
+    urkel_close(db);
+  }
+
+  ASSERT(urkel_destroy(URKEL_PATH));
+  ASSERT(urkel_destroy(URKEL_TMP_PATH));
+
+  urkel_kv_free(kvs);
+}
+
+static void
+test_urkel_dedup(void) {
+  static const size_t PAIRS = 300;
+  urkel_kv_t *kvs = urkel_kv_generate(PAIRS);
+  urkel_tree_options_t options;
+  urkel_tree_stat_t stats[3];
+  unsigned char roots[2][32];
+  unsigned char value[256];
+  unsigned char result[256];
+  size_t result_len;
+  const char *paths[2];
+  urkel_tx_t *tx;
+  urkel_t *db;
+  size_t i, k;
+
+  paths[0] = URKEL_PATH;
+  paths[1] = URKEL_TMP_PATH;
+
+  memset(stats, 0, sizeof(stats));
+
+  urkel_destroy(URKEL_PATH);
+  urkel_destroy(URKEL_TMP_PATH);
+
+  /* Ten distinct values shared by all keys. */
+  for (k = 0; k < 2; k++) {
+    urkel_tree_options_init(&options);
+
+    if (k == 0)
+      options.flags |= URKEL_OPTION_DEDUP;
+
+    db = urkel_open_ex(paths[k], &options);
+
+    ASSERT(db != NULL);
+
+    tx = urkel_tx_create(db, NULL);
+
+    ASSERT(tx != NULL);
+
+    for (i = 0; i < PAIRS; i++) {
+      memset(value, i % 10, sizeof(value));
+
+      ASSERT(urkel_tx_insert(tx, kvs[i].key, value, sizeof(value)));
+
+      if (i % 100 == 99)
+        ASSERT(urkel_tx_commit(tx));
+    }
+
+    /* Revert a value and put it back. */
+    memset(value, 0xff, sizeof(value));
+
+    ASSERT(urkel_tx_insert(tx, kvs[0].key, value, sizeof(value)));
+    ASSERT(urkel_tx_commit(tx));
+
+    memset(value, 0, sizeof(value));
+
+    ASSERT(urkel_tx_insert(tx, kvs[0].key, value, sizeof(value)));
+    ASSERT(urkel_tx_commit(tx));
+
+    urkel_tx_root(tx, roots[k]);
+    urkel_tx_destroy(tx);
+    urkel_close(db);
+
+    ASSERT(urkel_stat(paths[k], &stats[k]));
+  }
+
+  ASSERT(urkel_memcmp(roots[0], roots[1], 32) == 0);
+  ASSERT(stats[0].size + (PAIRS - 11) * sizeof(value) <= stats[1].size);
+
+  /* Compaction copies each distinct value once. */
+  ASSERT(urkel_destroy(URKEL_PATH));
+  ASSERT(urkel_compact(URKEL_PATH, URKEL_TMP_PATH, NULL));
+  ASSERT(urkel_stat(URKEL_PATH, &stats[2]));
+  ASSERT(stats[2].size + (PAIRS - 10) * sizeof(value) <= stats[1].size);
+
+  for (k = 0; k < 2; k++) {
+    db = urkel_open(paths[k]);
+
+    ASSERT(db != NULL);
+
+    for (i = 0; i < PAIRS; i++) {
+      memset(value, i % 10, sizeof(value));
+
+      ASSERT(urkel_get(db, result, &result_len, kvs[i].key, NULL));
+      ASSERT(result_len == sizeof(value));
+      ASSERT(urkel_memcmp(result, value, sizeof(value)) == 0);
+    }
+
+    urkel_close(db);
+  }
+
+  ASSERT(urkel_destroy(URKEL_PATH));
+  ASSERT(urkel_destroy(URKEL_TMP_PATH));
+
+  urkel_kv_free(kvs);
+}
+
+static void
+test_urkel_direct(void) {
+  static const size_t PAIRS = 300;
+  urkel_kv_t *kvs = urkel_kv_generate(PAIRS);
+  urkel_tree_options_t options;
+  unsigned char roots[2][32];
+  unsigned char result[64];
+  size_t result_len;
+  const char *paths[2];
+  urkel_tx_t *tx;
+  urkel_t *db;
+  size_t i, k, j;
+
+  paths[0] = URKEL_PATH;
+  paths[1] = URKEL_TMP_PATH;
+
+  urkel_destroy(URKEL_PATH);
+  urkel_destroy(URKEL_TMP_PATH);
+
+  /* Commit across several opens to exercise re-alignment. */
+  for (k = 0; k < 2; k++) {
+    urkel_tree_options_init(&options);
+
+    if (k == 0)
+      options.flags |= URKEL_OPTION_DIRECT;
+
+    for (j = 0; j < 3; j++) {
+      urkel_tree_stat_t stat;
+
+      db = urkel_open_ex(paths[k], &options);
+
+      ASSERT(db != NULL);
+
+      tx = urkel_tx_create(db, NULL);
+
+      ASSERT(tx != NULL);
+
+      for (i = j * 100; i < (j + 1) * 100; i++) {
+        ASSERT(urkel_tx_insert(tx, kvs[i].key, kvs[i].value, 64));
+
+        if (i % 30 == 29)
+          ASSERT(urkel_tx_commit(tx));
+      }
+
+      ASSERT(urkel_tx_commit(tx));
+
+      urkel_tx_root(tx, roots[k]);
+      urkel_tx_destroy(tx);
+      urkel_close(db);
+
+      memset(&stat, 0, sizeof(stat));
+
+      ASSERT(urkel_stat(paths[k], &stat));
+
+      if (k == 0)
+        ASSERT(stat.size % 4096 == 0);
+    }
+  }
+
+  ASSERT(urkel_memcmp(roots[0], roots[1], 32) == 0);
+
+  /* Readable with and without the option. */
+  for (k = 0; k < 2; k++) {
+    urkel_tree_options_init(&options);
+
+    if (k == 0)
+      options.flags |= URKEL_OPTION_DIRECT;
+
+    db = urkel_open_ex(URKEL_PATH, &options);
+
+    ASSERT(db != NULL);
+
+    urkel_root(db, result);
+
+    ASSERT(urkel_memcmp(result, roots[0], 32) == 0);
+
+    for (i = 0; i < PAIRS; i++) {
+      ASSERT(urkel_get(db, result, &result_len, kvs[i].key, NULL));
+      ASSERT(result_len == 64);
+      ASSERT(urkel_memcmp(result, kvs[i].value, 64) == 0);
+    }
+
+    urkel_close(db);
+  }
+
+  ASSERT(urkel_destroy(URKEL_PATH));
+  ASSERT(urkel_destroy(URKEL_TMP_PATH));
+
+  urkel_kv_free(kvs);
+}
+
+static void
+test_urkel_memory(void) {
+  static const size_t LIMIT = 4 << 20;
+  urkel_kv_t *kvs = urkel_kv_generate(10000);
+  urkel_tree_options_t options;
+  unsigned char value[1000];
+  urkel_memory_t usage;
+  urkel_tx_t *tx;
+  urkel_t *db;
+  size_t i, n;
+
+  urkel_destroy(URKEL_PATH);
+  urkel_tree_options_init(&options);
+
+  options.memory = LIMIT;
+
+  db = urkel_open_ex(URKEL_PATH, &options);
+
+  ASSERT(db != NULL);
+
+  urkel_memory_usage(db, &usage);
+
+  ASSERT(usage.limit == LIMIT);
+  ASSERT(usage.used <= LIMIT);
+
+  tx = urkel_tx_create(db, NULL);
+
+  ASSERT(tx != NULL);
+
+  /* Transactions grow until the budget runs out. */
+  for (n = 0; n < 10000; n++) {
+    memset(value, n & 0xff, sizeof(value));
+
+    if (!urkel_tx_insert(tx, kvs[n].key, value, sizeof(value)))
+      break;
+  }
+
+  urkel_memory_usage(db, &usage);
+
+  if (usage.txs > 0) {
+    ASSERT(n < 10000);
+    ASSERT(urkel_errno == URKEL_ENOMEM);
+    ASSERT(usage.used > LIMIT);
+    ASSERT(usage.txs >= n * sizeof(value));
+    ASSERT(!urkel_memory_charge(db, 1));
+    ASSERT(urkel_errno == URKEL_ENOMEM);
+  }
+
+  /* Committing releases the transaction's nodes. */
+  ASSERT(urkel_tx_commit(tx));
+
+  urkel_memory_usage(db, &usage);
+
+  ASSERT(usage.used <= LIMIT);
+  ASSERT(usage.txs < 1024);
+  ASSERT(usage.buffer <= LIMIT / 2);
+
+  memset(value, 0xff, sizeof(value));
+
+  ASSERT(urkel_tx_insert(tx, kvs[n].key, value, sizeof(value)));
+
+  urkel_tx_destroy(tx);
+
+  urkel_memory_usage(db, &usage);
+
+  ASSERT(usage.txs == 0);
+
+  /* Callers draw on the same budget. */
+  ASSERT(urkel_memory_charge(db, LIMIT / 4));
+
+  urkel_memory_usage(db, &usage);
+
+  ASSERT(usage.other == LIMIT / 4);
+  ASSERT(!urkel_memory_charge(db, LIMIT));
+
+  urkel_memory_release(db, LIMIT / 4);
+  urkel_memory_usage(db, &usage);
+
+  ASSERT(usage.other == 0);
+
+  for (i = 0; i < n; i++) {
+    unsigned char result[1000];
+    size_t result_len;
+
+    memset(value, i & 0xff, sizeof(value));
+
+    ASSERT(urkel_get(db, result, &result_len, kvs[i].key, NULL));
+    ASSERT(result_len == sizeof(value));
+    ASSERT(urkel_memcmp(result, value, sizeof(value)) == 0);
+  }
+
+  urkel_close(db);
+
+  ASSERT(urkel_destroy(URKEL_PATH));
+
+  urkel_kv_free(kvs);
+}
+
+static void
+test_urkel_spill(void) {
+  static const size_t LIMIT = 256 << 10;
+  urkel_kv_t *kvs = urkel_kv_generate(4000);
+  unsigned char expect[32];
+  unsigned char root[32];
+  unsigned char result[64];
+  urkel_tree_options_t options;
+  urkel_memory_t usage;
+  size_t result_len;
+  urkel_tx_t *tx;
+  urkel_t *db;
+  size_t i;
+
+  urkel_destroy(URKEL_PATH);
+  urkel_destroy(URKEL_TMP_PATH);
+
+  /* Reference root, built in memory. */
+  db = urkel_open(URKEL_TMP_PATH);
+
+  ASSERT(db != NULL);
+
+  tx = urkel_tx_create(db, NULL);
+
+  ASSERT(tx != NULL);
+
+  for (i = 0; i < 4000; i++)
+    ASSERT(urkel_tx_insert(tx, kvs[i].key, kvs[i].value, 64));
+
+  for (i = 0; i < 4000; i += 7)
+    ASSERT(urkel_tx_remove(tx, kvs[i].key));
+
+  urkel_tx_root(tx, expect);
+  urkel_tx_destroy(tx);
+  urkel_close(db);
+
+  urkel_tree_options_init(&options);
+
+  options.flags = URKEL_OPTION_INDEX;
+  options.tx_memory = LIMIT;
+
+  db = urkel_open_ex(URKEL_PATH, &options);
+
+  ASSERT(db != NULL);
+
+  tx = urkel_tx_create(db, NULL);
+
+  ASSERT(tx != NULL);
+
+  /* The transaction spills instead of growing past the cap. */
+  for (i = 0; i < 4000; i++) {
+    ASSERT(urkel_tx_insert(tx, kvs[i].key, kvs[i].value, 64));
+
+    urkel_memory_usage(db, &usage);
+
+    ASSERT(usage.txs <= LIMIT + 8192);
+  }
+
+  for (i = 0; i < 4000; i += 7)
+    ASSERT(urkel_tx_remove(tx, kvs[i].key));
+
+  /* Spilled nodes read back before anything is committed. */
+  for (i = 0; i < 4000; i++) {
+    if (i % 7 == 0) {
+      ASSERT(!urkel_tx_has(tx, kvs[i].key));
+      continue;
+    }
+
+    ASSERT(urkel_tx_get(tx, result, &result_len, kvs[i].key));
+    ASSERT(result_len == 64);
+    ASSERT(urkel_memcmp(result, kvs[i].value, 64) == 0);
+  }
+
+  urkel_tx_root(tx, root);
+
+  ASSERT(urkel_memcmp(root, expect, 32) == 0);
+
+  /* Nothing is reachable until the commit. */
+  urkel_root(db, root);
+
+  ASSERT(urkel_memcmp(root, expect, 32) != 0);
+  ASSERT(!urkel_has(db, kvs[1].key, NULL));
+
+  ASSERT(urkel_tx_commit(tx));
+
+  urkel_tx_destroy(tx);
+  urkel_close(db);
+
+  db = urkel_open_ex(URKEL_PATH, &options);
+
+  ASSERT(db != NULL);
+
+  urkel_root(db, root);
+
+  ASSERT(urkel_memcmp(root, expect, 32) == 0);
+
+  for (i = 0; i < 4000; i++) {
+    int has = urkel_get(db, result, &result_len, kvs[i].key, NULL);
+
+    ASSERT(has == (i % 7 != 0));
+  }
+
+  urkel_close(db);
+
+  ASSERT(urkel_destroy(URKEL_PATH));
+  ASSERT(urkel_destroy(URKEL_TMP_PATH));
+
+  urkel_kv_free(kvs);
+}
+
+static void
+test_urkel_spill_savepoint(void) {
+  static const size_t LIMIT = 64 << 10;
+  urkel_kv_t *kvs = urkel_kv_generate(5000);
+  urkel_metrics_t before, after;
+  unsigned char expect[32];
+  unsigned char root[32];
+  unsigned char result[64];
+  urkel_tree_options_t options;
+  size_t result_len, sp;
+  urkel_tx_t *tx;
+  urkel_t *db;
+  size_t i;
+
+  urkel_destroy(URKEL_PATH);
+  urkel_tree_options_init(&options);
+
+  /* Always over the cap, but nothing below the kept levels. */
+  options.flags = URKEL_OPTION_INDEX;
+  options.tx_memory = 1;
+
+  db = urkel_open_ex(URKEL_PATH, &options);
+
+  ASSERT(db != NULL);
+
+  tx = urkel_tx_create(db, NULL);
+
+  ASSERT(tx != NULL);
+  ASSERT(urkel_tx_insert(tx, kvs[0].key, kvs[0].value, 64));
+  ASSERT(urkel_tx_insert(tx, kvs[1].key, kvs[1].value, 64));
+
+  sp = urkel_tx_savepoint(tx);
+
+  ASSERT(urkel_tx_insert(tx, kvs[2].key, kvs[2].value, 64));
+  ASSERT(urkel_tx_rollback_to(tx, sp));
+  ASSERT(urkel_tx_release(tx, sp));
+  ASSERT(urkel_tx_commit(tx));
+
+  /* No spill wrote anything, so the index is still trusted. */
+  urkel_metrics(db, &before);
+
+  ASSERT(urkel_get(db, result, &result_len, kvs[0].key, NULL));
+  ASSERT(urkel_get(db, result, &result_len, kvs[1].key, NULL));
+  ASSERT(!urkel_has(db, kvs[2].key, NULL));
+
+  urkel_metrics(db, &after);
+
+  ASSERT(after.index_hits - before.index_hits == 3);
+  ASSERT(after.index_misses == before.index_misses);
+
+  urkel_tx_destroy(tx);
+  urkel_close(db);
+
+  /* Spilling under a savepoint leaves the saved tree intact. */
+  urkel_destroy(URKEL_PATH);
+
+  options.tx_memory = LIMIT;
+
+  db = urkel_open_ex(URKEL_PATH, &options);
+
+  ASSERT(db != NULL);
+
+  tx = urkel_tx_create(db, NULL);
+
+  ASSERT(tx != NULL);
+
+  for (i = 0; i < 4000; i++)
+    ASSERT(urkel_tx_insert(tx, kvs[i].key, kvs[i].value, 64));
+
+  urkel_tx_root(tx, expect);
+
+  sp = urkel_tx_savepoint(tx);
+
+  for (i = 4000; i < 5000; i++)
+    ASSERT(urkel_tx_insert(tx, kvs[i].key, kvs[i].value, 64));
+
+  for (i = 0; i < 1000; i++)
+    ASSERT(urkel_tx_remove(tx, kvs[i].key));
+
+  ASSERT(!urkel_tx_has(tx, kvs[0].key));
+  ASSERT(urkel_tx_has(tx, kvs[4999].key));
+  ASSERT(urkel_tx_rollback_to(tx, sp));
+
+  urkel_tx_root(tx, root);
+
+  ASSERT(urkel_memcmp(root, expect, 32) == 0);
+
+  for (i = 0; i < 5000; i++)
+    ASSERT(urkel_tx_has(tx, kvs[i].key) == (i < 4000));
+
+  ASSERT(urkel_tx_release(tx, sp));
+  ASSERT(urkel_tx_commit(tx));
+
+  urkel_tx_destroy(tx);
+  urkel_close(db);
+
+  db = urkel_open_ex(URKEL_PATH, &options);
+
+  ASSERT(db != NULL);
+
+  urkel_root(db, root);
+
+  ASSERT(urkel_memcmp(root, expect, 32) == 0);
+
+  for (i = 0; i < 5000; i += 10) {
+    ASSERT(urkel_get(db, result, &result_len, kvs[i].key, NULL) == (i < 4000));
+
+    if (i < 4000)
+      ASSERT(urkel_memcmp(result, kvs[i].value, 64) == 0);
+  }
+
+  urkel_close(db);
+
+  ASSERT(urkel_destroy(URKEL_PATH));
+
+  urkel_kv_free(kvs);
+}
+
+static void
+test_urkel_attach(void) {
+  urkel_kv_t *kvs = urkel_kv_generate(2000);
+  unsigned char expect[32];
+  unsigned char root[32];
+  unsigned char result[64];
+  urkel_tree_options_t options;
+  urkel_memory_t usage;
+  size_t result_len, attached;
+  urkel_iter_t *iter;
+  urkel_tx_t *tx;
+  urkel_t *db;
+  size_t i;
+
+  urkel_destroy(URKEL_PATH);
+  urkel_tree_options_init(&options);
+
+  options.flags = URKEL_OPTION_ATTACH;
+
+  db = urkel_open_ex(URKEL_PATH, &options);
+
+  ASSERT(db != NULL);
+
+  tx = urkel_tx_create(db, NULL);
+
+  ASSERT(tx != NULL);
+
+  for (i = 0; i < 2000; i++)
+    ASSERT(urkel_tx_insert(tx, kvs[i].key, kvs[i].value, 64));
+
+  ASSERT(urkel_tx_commit(tx));
+
+  urkel_tx_root(tx, expect);
+  urkel_tx_destroy(tx);
+
+  tx = urkel_tx_create(db, NULL);
+
+  ASSERT(tx != NULL);
+
+  /* Reads keep the nodes they resolve. */
+  for (i = 0; i < 2000; i += 2) {
+    ASSERT(urkel_tx_get(tx, result, &result_len, kvs[i].key));
+    ASSERT(result_len == 64);
+    ASSERT(urkel_memcmp(result, kvs[i].value, 64) == 0);
+  }
+
+  urkel_memory_usage(db, &usage);
+
+  attached = usage.txs;
+
+  /* Walking the same paths again allocates nothing. */
+  for (i = 0; i < 2000; i += 2)
+    ASSERT(urkel_tx_has(tx, kvs[i].key));
+
+  urkel_memory_usage(db, &usage);
+
+  ASSERT(usage.txs == attached);
+
+  /* Nothing attaches while an iterator holds the transaction. */
+  iter = urkel_iter_create(tx);
+
+  ASSERT(iter != NULL);
+
+  for (i = 1; i < 2000; i += 2)
+    ASSERT(urkel_tx_has(tx, kvs[i].key));
+
+  urkel_memory_usage(db, &usage);
+
+  ASSERT(usage.txs == attached);
+
+  urkel_iter_destroy(iter);
+
+  for (i = 1; i < 2000; i += 2)
+    ASSERT(urkel_tx_has(tx, kvs[i].key));
+
+  urkel_memory_usage(db, &usage);
+
+  /* Memory is only metered with thread local storage. */
+  if (attached > 0)
+    ASSERT(usage.txs > attached);
+
+  urkel_tx_root(tx, root);
+
+  ASSERT(urkel_memcmp(root, expect, 32) == 0);
+
+  /* Attached nodes are clean. */
+  ASSERT(urkel_tx_remove(tx, kvs[0].key));
+  ASSERT(urkel_tx_insert(tx, kvs[0].key, kvs[0].value, 64));
+  ASSERT(urkel_tx_commit(tx));
+
+  urkel_tx_root(tx, root);
+
+  ASSERT(urkel_memcmp(root, expect, 32) == 0);
+
+  urkel_tx_destroy(tx);
+
+  urkel_memory_usage(db, &usage);
+
+  ASSERT(usage.txs == 0);
+
+  urkel_close(db);
+
+  ASSERT(urkel_destroy(URKEL_PATH));
+
+  urkel_kv_free(kvs);
+}
+
+static void
+test_urkel_resident(void) {
+  urkel_kv_t *kvs = urkel_kv_generate(2000);
+  unsigned char expect[32];
+  unsigned char root[32];
+  unsigned char result[64];
+  urkel_tree_options_t options;
+  urkel_memory_t usage;
+  size_t result_len;
+  urkel_tx_t *tx;
+  urkel_t *db;
+  size_t i;
+
+  urkel_destroy(URKEL_PATH);
+  urkel_tree_options_init(&options);
+
+  options.flags = URKEL_OPTION_INDEX;
+  options.tx_levels = 4;
+
+  db = urkel_open_ex(URKEL_PATH, &options);
+
+  ASSERT(db != NULL);
+
+  tx = urkel_tx_create(db, NULL);
+
+  ASSERT(tx != NULL);
+
+  for (i = 0; i < 1000; i++)
+    ASSERT(urkel_tx_insert(tx, kvs[i].key, kvs[i].value, 64));
+
+  ASSERT(urkel_tx_commit(tx));
+
+  /* The top levels stay in memory. */
+  urkel_memory_usage(db, &usage);
+
+  if (usage.txs > 0)
+    ASSERT(usage.txs > 1024 && usage.txs < 16 * 1024);
+
+  urkel_tx_root(tx, root);
+  urkel_root(db, expect);
+
+  ASSERT(urkel_memcmp(root, expect, 32) == 0);
+
+  for (i = 0; i < 1000; i++) {
+    ASSERT(urkel_tx_get(tx, result, &result_len, kvs[i].key));
+    ASSERT(result_len == 64);
+    ASSERT(urkel_memcmp(result, kvs[i].value, 64) == 0);
+  }
+
+  ASSERT(!urkel_tx_has(tx, kvs[1000].key));
+
+  /* And can be built on. */
+  for (i = 1000; i < 2000; i++)
+    ASSERT(urkel_tx_insert(tx, kvs[i].key, kvs[i].value, 64));
+
+  for (i = 0; i < 2000; i += 3)
+    ASSERT(urkel_tx_remove(tx, kvs[i].key));
+
+  ASSERT(urkel_tx_commit(tx));
+
+  urkel_tx_root(tx, expect);
+  urkel_tx_destroy(tx);
+
+  urkel_memory_usage(db, &usage);
+
+  ASSERT(usage.txs == 0);
+
+  urkel_close(db);
+
+  db = urkel_open(URKEL_PATH);
+
+  ASSERT(db != NULL);
+
+  urkel_root(db, root);
+
+  ASSERT(urkel_memcmp(root, expect, 32) == 0);
+
+  for (i = 0; i < 2000; i++) {
+    int has = urkel_get(db, result, &result_len, kvs[i].key, NULL);
+
+    ASSERT(has == (i % 3 != 0));
+  }
+
+  urkel_close(db);
+
+  ASSERT(urkel_destroy(URKEL_PATH));
+
+  urkel_kv_free(kvs);
+}
+
+static void
+test_urkel_metrics(void) {
+  urkel_kv_t *kvs = urkel_kv_generate(1000);
+  unsigned char result[64];
+  unsigned char root[32];
+  urkel_tree_options_t options;
+  urkel_metrics_t metrics;
+  size_t result_len;
+  urkel_tx_t *tx;
+  urkel_t *db;
+  size_t i;
+
+  urkel_destroy(URKEL_PATH);
+  urkel_tree_options_init(&options);
+
+  options.flags = URKEL_OPTION_FILTER
+                | URKEL_OPTION_DEDUP
+                | URKEL_OPTION_LOCKSTATS;
+  options.durability = URKEL_DURABLE_COMMIT;
+
+  db = urkel_open_ex(URKEL_PATH, &options);
+
+  ASSERT(db != NULL);
+
+  urkel_metrics(db, &metrics);
+
+  ASSERT(metrics.commits == 0);
+  ASSERT(metrics.bytes_written == 0);
+
+  tx = urkel_tx_create(db, NULL);
+
+  ASSERT(tx != NULL);
+
+  for (i = 0; i < 500; i++)
+    ASSERT(urkel_tx_insert(tx, kvs[i].key, kvs[i].value, 64));
+
+  /* Shared with the value of the first key. */
+  ASSERT(urkel_tx_insert(tx, kvs[500].key, kvs[0].value, 64));
+  ASSERT(urkel_tx_commit(tx));
+
+  urkel_tx_root(tx, root);
+
+  for (i = 501; i < 1000; i++)
+    ASSERT(urkel_tx_insert(tx, kvs[i].key, kvs[i].value, 64));
+
+  ASSERT(urkel_tx_commit(tx));
+
+  urkel_tx_destroy(tx);
+  urkel_metrics(db, &metrics);
+
+  ASSERT(metrics.commits == 2);
+  ASSERT(metrics.flushes == 2);
+  ASSERT(metrics.syncs >= 2);
+  ASSERT(metrics.bytes_written > 1000 * 64);
+  ASSERT(metrics.dedup_hits == 1);
+  ASSERT(metrics.dedup_misses == 999);
+
+  /* Reads from disk. */
+  for (i = 0; i < 1000; i++) {
+    ASSERT(urkel_get(db, result, &result_len, kvs[i].key, NULL));
+    ASSERT(result_len == 64);
+  }
+
+  ASSERT(!urkel_get(db, result, &result_len, kvs[0].value, NULL));
+
+  urkel_metrics(db, &metrics);
+
+  ASSERT(metrics.node_reads > 1000);
+  ASSERT(metrics.value_reads == 1000);
+  ASSERT(metrics.bytes_read > 1000 * 64);
+  ASSERT(metrics.filter_misses == 1000);
+  ASSERT(metrics.filter_hits + metrics.filter_misses == 1001);
+
+  /* An older root is found in the cache. */
+  ASSERT(urkel_get(db, result, &result_len, kvs[0].key, root));
+
+  urkel_metrics(db, &metrics);
+
+  ASSERT(metrics.root_hits == 1);
+
+  /* Nothing ever waited on a lock. */
+  ASSERT(metrics.tree_read.contended == 0);
+  ASSERT(metrics.tree_write.contended == 0);
+  ASSERT(metrics.tx_read.contended == 0);
+  ASSERT(metrics.tx_write.contended == 0);
+  ASSERT(metrics.tx_write.wait_time == 0);
+
+  urkel_close(db);
+
+  ASSERT(urkel_destroy(URKEL_PATH));
+
+  urkel_kv_free(kvs);
+}
+
+static long
+urkel_file_size(const char *path) {
+  FILE *fp = fopen(path, "rb");
+  long size;
+
+  if (fp == NULL)
+    return -1;
+
+  fseek(fp, 0, SEEK_END);
+
+  size = ftell(fp);
+
+  fclose(fp);
+
+  return size;
+}
+
+static void
+test_urkel_warm(void) {
+  urkel_kv_t *kvs = urkel_kv_generate(2000);
+  unsigned char result[64];
+  urkel_tree_options_t options;
+  size_t result_len;
+  urkel_tx_t *tx;
+  urkel_t *db;
+  long size;
+  size_t i;
+  FILE *fp;
+
+  urkel_destroy(URKEL_PATH);
+  urkel_tree_options_init(&options);
+
+  options.warm_levels = 6;
+
+  db = urkel_open_ex(URKEL_PATH, &options);
+
+  ASSERT(db != NULL);
+
+  tx = urkel_tx_create(db, NULL);
+
+  ASSERT(tx != NULL);
+
+  for (i = 0; i < 2000; i++)
+    ASSERT(urkel_tx_insert(tx, kvs[i].key, kvs[i].value, 64));
+
+  ASSERT(urkel_tx_commit(tx));
+
+  urkel_tx_destroy(tx);
+  urkel_close(db);
+
+  /* Magic, count, 63 pointers and a checksum. */
+  size = urkel_file_size(URKEL_PATH "/warm");
+
+  ASSERT(size == 8 + 63 * 7 + 20);
+
+  /* Reads are unaffected by the warmup. */
+  db = urkel_open_ex(URKEL_PATH, &options);
+
+  ASSERT(db != NULL);
+
+  for (i = 0; i < 2000; i++) {
+    ASSERT(urkel_get(db, result, &result_len, kvs[i].key, NULL));
+    ASSERT(result_len == 64);
+    ASSERT(urkel_memcmp(result, kvs[i].value, 64) == 0);
+  }
+
+  urkel_close(db);
+
+  /* Closing stops a warmup in progress. */
+  db = urkel_open_ex(URKEL_PATH, &options);
+
+  ASSERT(db != NULL);
+
+  urkel_close(db);
+
+  ASSERT(urkel_file_size(URKEL_PATH "/warm") == size);
+
+  /* A damaged manifest is ignored. */
+  fp = fopen(URKEL_PATH "/warm", "wb");
+
+  ASSERT(fp != NULL);
+  ASSERT(fwrite("garbage", 1, 7, fp) == 7);
+
+  fclose(fp);
+
+  db = urkel_open_ex(URKEL_PATH, &options);
+
+  ASSERT(db != NULL);
+  ASSERT(urkel_get(db, result, &result_len, kvs[0].key, NULL));
+
+  urkel_close(db);
+
+  ASSERT(urkel_file_size(URKEL_PATH "/warm") == size);
+
+  ASSERT(urkel_destroy(URKEL_PATH));
+
+  urkel_kv_free(kvs);
+}
+
+static int
+urkel_flip_data(const char *path, const unsigned char *data, size_t len) {
+  unsigned char *raw;
+  size_t size, i;
+  int ret = 0;
+  FILE *fp;
+
+  fp = fopen(path, "r+b");
+
+  if (fp == NULL)
+    return 0;
+
+  fseek(fp, 0, SEEK_END);
+
+  size = ftell(fp);
+  raw = malloc(size);
+
+  ASSERT(raw != NULL);
+
+  fseek(fp, 0, SEEK_SET);
+
+  if (fread(raw, 1, size, fp) != size)
+    goto fail;
+
+  for (i = 0; i + len <= size; i++) {
+    if (urkel_memcmp(raw + i, data, len) == 0) {
+      raw[i + len / 2] ^= 1;
+      fseek(fp, i + len / 2, SEEK_SET);
+      ret = fwrite(raw + i + len / 2, 1, 1, fp) == 1;
+      break;
+    }
+  }
+
+fail:
+  free(raw);
+  fclose(fp);
+  return ret;
+}
+
+static void
+test_urkel_checksum(void) {
+  static const size_t PAIRS = 400;
+  urkel_kv_t *kvs = urkel_kv_generate(PAIRS);
+  urkel_tree_options_t options;
+  urkel_scrub_t stats[2];
+  urkel_scrub_t stats2;
+  unsigned char roots[2][32];
+  unsigned char value[1023];
+  unsigned char result[1023];
+  size_t size, result_len;
+  const char *paths[2];
+  urkel_tx_t *tx;
+  urkel_t *db;
+  size_t i, k;
+
+  paths[0] = URKEL_PATH;
+  paths[1] = URKEL_TMP_PATH;
+
+  urkel_destroy(URKEL_PATH);
+  urkel_destroy(URKEL_TMP_PATH);
+
+  /* Same data with and without checksums. */
+  for (k = 0; k < 2; k++) {
+    urkel_tree_options_init(&options);
+
+    if (k == 0) {
+      options.flags |= URKEL_OPTION_CHECKSUM;
+      options.flags |= URKEL_OPTION_COMPRESS;
+      options.flags |= URKEL_OPTION_DEDUP;
+    }
+
+    db = urkel_open_ex(paths[k], &options);
+
+    ASSERT(db != NULL);
+
+    tx = urkel_tx_create(db, NULL);
+
+    ASSERT(tx != NULL);
+
+    for (i = 0; i < PAIRS; i++) {
+      size = urkel_compress_value(value, &kvs[i], i);
+
+      /* Shared between keys. */
+      if ((i & 3) == 2) {
+        size = 100;
+        memset(value, 0x11, size);
+      }
+
+      ASSERT(urkel_tx_insert(tx, kvs[i].key, value, size));
+
+      if (i % 100 == 99)
+        ASSERT(urkel_tx_commit(tx));
+    }
+
+    urkel_tx_root(tx, roots[k]);
+    urkel_tx_destroy(tx);
+
+    ASSERT(urkel_scrub(db, NULL, 4, &stats[k]));
+    ASSERT(urkel_scrub(db, NULL, 1, &stats2));
+    ASSERT(urkel_memcmp(&stats[k], &stats2, sizeof(stats2)) == 0);
+
+    urkel_close(db);
+  }
+
+  ASSERT(urkel_memcmp(roots[0], roots[1], 32) == 0);
+
+  ASSERT(stats[0].nodes == stats[1].nodes);
+  ASSERT(stats[0].values == PAIRS);
+  ASSERT(stats[0].checked == stats[0].nodes + stats[0].values);
+  ASSERT(stats[0].corrupt == 0);
+  ASSERT(stats[1].values == PAIRS);
+  ASSERT(stats[1].checked == 0);
+  ASSERT(stats[1].corrupt == 0);
+
+  /* Checksums are verified with or without the option. */
+  db = urkel_open(URKEL_PATH);
+
+  ASSERT(db != NULL);
+
+  for (i = 0; i < PAIRS; i++) {
+    size = urkel_compress_value(value, &kvs[i], i);
+
+    if ((i & 3) == 2) {
+      size = 100;
+      memset(value, 0x11, size);
+    }
+
+    ASSERT(urkel_get(db, result, &result_len, kvs[i].key, NULL));
+    ASSERT(result_len == size);
+    ASSERT(urkel_memcmp(result, value, size) == 0);
+  }
+
+  urkel_close(db);
+
+  /* Flip a bit in a stored (incompressible) value. */
+  ASSERT(urkel_flip_data(URKEL_PATH "/0000000001", kvs[4].value, 64));
+
+  db = urkel_open(URKEL_PATH);
+
+  ASSERT(db != NULL);
+
+  ASSERT(!urkel_get(db, result, &result_len, kvs[4].key, NULL));
+  ASSERT(urkel_errno == URKEL_ECORRUPTION);
+  ASSERT(urkel_get(db, result, &result_len, kvs[8].key, NULL));
+
+  ASSERT(!urkel_scrub(db, NULL, 4, &stats2));
+  ASSERT(urkel_errno == URKEL_ECORRUPTION);
+  ASSERT(stats2.nodes == stats[0].nodes);
+  ASSERT(stats2.corrupt == 1);
+
+  urkel_close(db);
+
+  ASSERT(urkel_destroy(URKEL_PATH));
+  ASSERT(urkel_destroy(URKEL_TMP_PATH));
+
+  urkel_kv_free(kvs);
+}
+
+static int
+urkel_wait_durable(urkel_t *db, const unsigned char *root) {
+  time_t start = time(NULL);
+  unsigned char hash[32];
+
+  do {
+    urkel_durable_root(db, hash);
+
+    if (urkel_memcmp(hash, root, 32) == 0)
+      return 1;
+  } while (time(NULL) - start < 10);
+
+  return 0;
+}
+
+static void
+test_urkel_durability(void) {
+  static const unsigned int modes[4] = {
+    URKEL_DURABLE_NONE,
+    URKEL_DURABLE_COMMIT,
+    URKEL_DURABLE_BATCH,
+    URKEL_DURABLE_ROLLOVER
+  };
+  urkel_kv_t *kvs = urkel_kv_generate(4);
+  urkel_tree_options_t options;
+  unsigned char roots[3][32];
+  unsigned char hash[32];
+  urkel_tx_t *tx;
+  urkel_t *db;
+  size_t i, k;
+
+  for (k = 0; k < ARRAY_SIZE(modes); k++) {
+    urkel_destroy(URKEL_PATH);
+    urkel_tree_options_init(&options);
+
+    ASSERT(options.durability == URKEL_DURABLE_ROLLOVER);
+
+    options.durability = modes[k];
+    options.sync_commits = 2;
+    options.sync_interval = 60 * 1000;
+
+    db = urkel_open_ex(URKEL_PATH, &options);
+
+    ASSERT(db != NULL);
+
+    urkel_root(db, roots[0]);
+    urkel_durable_root(db, hash);
+
+    ASSERT(urkel_memcmp(hash, roots[0], 32) == 0);
+
+    tx = urkel_tx_create(db, NULL);
+
+    ASSERT(tx != NULL);
+
+    for (i = 1; i < 3; i++) {
+      ASSERT(urkel_tx_insert(tx, kvs[i].key, kvs[i].value, 64));
+      ASSERT(urkel_tx_commit(tx));
+
+      urkel_tx_root(tx, roots[i]);
+      urkel_durable_root(db, hash);
+
+      switch (modes[k]) {
+        case URKEL_DURABLE_COMMIT:
+          ASSERT(urkel_memcmp(hash, roots[i], 32) == 0);
+          break;
+        case URKEL_DURABLE_BATCH:
+          /* Synced in the background after the second commit. */
+          if (i == 2)
+            ASSERT(urkel_wait_durable(db, roots[2]));
+          else
+            ASSERT(urkel_memcmp(hash, roots[0], 32) == 0);
+          break;
+        default:
+          /* No rollover happens here. */
+          ASSERT(urkel_memcmp(hash, roots[0], 32) == 0);
+          break;
+      }
+    }
+
+    urkel_tx_destroy(tx);
+    urkel_close(db);
+
+    db = urkel_open_ex(URKEL_PATH, &options);
+
+    ASSERT(db != NULL);
+
+    urkel_root(db, hash);
+
+    ASSERT(urkel_memcmp(hash, roots[2], 32) == 0);
+
+    urkel_close(db);
+  }
+
+  /* Time-based batches. */
+  urkel_destroy(URKEL_PATH);
+  urkel_tree_options_init(&options);
+
+  options.durability = URKEL_DURABLE_BATCH;
+  options.sync_interval = 10;
+
+  db = urkel_open_ex(URKEL_PATH, &options);
+
+  ASSERT(db != NULL);
+
+  tx = urkel_tx_create(db, NULL);
+
+  ASSERT(tx != NULL);
+  ASSERT(urkel_tx_insert(tx, kvs[3].key, kvs[3].value, 64));
+  ASSERT(urkel_tx_commit(tx));
+
+  urkel_tx_root(tx, roots[0]);
+
+  ASSERT(urkel_wait_durable(db, roots[0]));
+
+  urkel_tx_destroy(tx);
+  urkel_close(db);
+
+  ASSERT(urkel_destroy(URKEL_PATH));
+
+  urkel_kv_free(kvs);
+}
+
 int
 main(void) {
   test_memcmp();
   test_urkel_sanity();
   test_urkel_node_replacement();
   test_urkel_leaky_inject();
+  test_urkel_fork();
+  test_urkel_savepoint();
   test_urkel_max_value_size();
   test_urkel_compact();
+  test_urkel_filter();
+  test_urkel_index();
+  test_urkel_compress();
+  test_urkel_dedup();
+  test_urkel_direct();
+  test_urkel_durability();
+  test_urkel_checksum();
+  test_urkel_memory();
+  test_urkel_spill();
+  test_urkel_spill_savepoint();
+  test_urkel_attach();
+  test_urkel_resident();
+  test_urkel_warm();
+  test_urkel_metrics();
   return 0;
 }
@@ -54,6 +54,7 @@ const URKEL_ENOUPDATE = 10;
 const URKEL_EBADWRITE = 11;
 const URKEL_EBADOPEN = 12;
 const URKEL_EITEREND = 13;
+const URKEL_ENOMEM = 14;
 
 /**
  * Verification error codes.
@@ -75,7 +76,8 @@ const statusCodes = {
   URKEL_ENOUPDATE,
   URKEL_EBADWRITE,
   URKEL_EBADOPEN,
-  URKEL_EITEREND
+  URKEL_EITEREND,
+  URKEL_ENOMEM
 };
 
 const statusCodesByVal = [
@@ -92,7 +94,8 @@ const statusCodesByVal = [
   'URKEL_ENOUPDATE',
   'URKEL_EBADWRITE',
   'URKEL_EBADOPEN',
-  'URKEL_EITEREND'
+  'URKEL_EITEREND',
+  'URKEL_ENOMEM'
 ];
 
 const TYPE_DEADEND = 0;
@@ -158,6 +161,68 @@ const iteratorTypesByVal = [
   'ITER_TYPE_KEY_VAL'
 ];
 
+/*
+ * Tree options
+ */
+
+const OPTION_FILTER = 1 << 0;
+const OPTION_INDEX = 1 << 1;
+const OPTION_COMPRESS = 1 << 2;
+const OPTION_DEDUP = 1 << 3;
+const OPTION_DIRECT = 1 << 4;
+const OPTION_CHECKSUM = 1 << 5;
+const OPTION_ATTACH = 1 << 6;
+const OPTION_LOCKSTATS = 1 << 7;
+
+/**
+ * Tree option flags (must match URKEL_OPTION_*).
+ * @enum {Number}
+ */
+
+const optionFlags = {
+  OPTION_FILTER,
+  OPTION_INDEX,
+  OPTION_COMPRESS,
+  OPTION_DEDUP,
+  OPTION_DIRECT,
+  OPTION_CHECKSUM,
+  OPTION_ATTACH,
+  OPTION_LOCKSTATS
+};
+
+/*
+ * Durability
+ */
+
+const DURABLE_NONE = 0;
+const DURABLE_COMMIT = 1;
+const DURABLE_BATCH = 2;
+const DURABLE_ROLLOVER = 3;
+
+/**
+ * Durability modes (must match URKEL_DURABLE_*).
+ * @enum {Number}
+ */
+
+const durabilityModes = {
+  DURABLE_NONE,
+  DURABLE_COMMIT,
+  DURABLE_BATCH,
+  DURABLE_ROLLOVER
+};
+
+/**
+ * Durability modes by option name.
+ * @const {Object}
+ */
+
+const durabilityModesByName = {
+  'none': DURABLE_NONE,
+  'commit': DURABLE_COMMIT,
+  'batch': DURABLE_BATCH,
+  'rollover': DURABLE_ROLLOVER
+};
+
 const HASH_SIZE = 32;
 
 exports.asyncIterator = asyncIterator;
@@ -169,4 +234,7 @@ exports.proofTypes = proofTypes;
 exports.proofTypesByVal = proofTypesByVal;
 exports.iteratorTypes = iteratorTypes;
 exports.iteratorTypesByVal = iteratorTypesByVal;
+exports.optionFlags = optionFlags;
+exports.durabilityModes = durabilityModes;
+exports.durabilityModesByName = durabilityModesByName;
 exports.HASH_SIZE = HASH_SIZE;
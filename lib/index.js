@@ -64,6 +64,21 @@ defineGet('UrkelTree', () => nurkel._urkel.Tree);
  * @param {Boolean} [options.memory=false] - should use memory tree.
  * @param {Boolean} [options.urkel] - should use urkel tree.
  * @param {String} [options.prefix] - prefix for the database.
+ * @param {Boolean} [options.filter] - keep a key filter (nurkel only).
+ * @param {Boolean} [options.index] - keep a key index (nurkel only).
+ * @param {Boolean} [options.compress] - compress values (nurkel only).
+ * @param {Boolean} [options.dedup] - share identical values (nurkel only).
+ * @param {Boolean} [options.direct] - direct io writes (nurkel only).
+ * @param {Boolean} [options.checksum] - checksum records (nurkel only).
+ * @param {Boolean} [options.attach] - keep read nodes (nurkel only).
+ * @param {Boolean} [options.lockStats] - time lock waits (nurkel only).
+ * @param {String} [options.durability] - sync mode (nurkel only).
+ * @param {Number} [options.syncCommits] - batch sync commits (nurkel only).
+ * @param {Number} [options.syncInterval] - batch sync ms (nurkel only).
+ * @param {Number} [options.memoryBudget] - memory budget (nurkel only).
+ * @param {Number} [options.txMemory] - spill transactions (nurkel only).
+ * @param {Number} [options.residentLevels] - levels kept (nurkel only).
+ * @param {Number} [options.warmLevels] - levels prefetched (nurkel only).
  * @returns {Tree|UrkelTree}
  */
 
@@ -78,7 +93,22 @@ nurkel.create = (options) => {
   }
 
   return new nurkel.Tree({
-    prefix: options.prefix
+    prefix: options.prefix,
+    filter: options.filter,
+    index: options.index,
+    compress: options.compress,
+    dedup: options.dedup,
+    direct: options.direct,
+    checksum: options.checksum,
+    attach: options.attach,
+    lockStats: options.lockStats,
+    durability: options.durability,
+    syncCommits: options.syncCommits,
+    syncInterval: options.syncInterval,
+    memoryBudget: options.memoryBudget,
+    txMemory: options.txMemory,
+    residentLevels: options.residentLevels,
+    warmLevels: options.warmLevels
   });
 };
 
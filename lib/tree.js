@@ -18,7 +18,9 @@ const {
   errors,
   statusCodes,
   statusCodesByVal,
-  iteratorTypes
+  iteratorTypes,
+  optionFlags,
+  durabilityModesByName
 } = require('./common');
 
 const {
@@ -43,6 +45,17 @@ const {
   ITER_TYPE_KEY_VAL
 } = iteratorTypes;
 
+const {
+  OPTION_FILTER,
+  OPTION_INDEX,
+  OPTION_COMPRESS,
+  OPTION_DEDUP,
+  OPTION_DIRECT,
+  OPTION_CHECKSUM,
+  OPTION_ATTACH,
+  OPTION_LOCKSTATS
+} = optionFlags;
+
 const VTX_OP_INSERT = 1;
 const VTX_OP_REMOVE = 2;
 
@@ -50,6 +63,36 @@ class Tree {
   /**
    * @param {Object} options
    * @param {String} options.prefix
+   * @param {Boolean} [options.filter=false] - keep a key filter
+   *   so that most lookups of missing keys skip the disk.
+   * @param {Boolean} [options.index=false] - keep a key index
+   *   for lookups against the current root.
+   * @param {Boolean} [options.compress=false] - store leaf values
+   *   compressed when that makes them smaller.
+   * @param {Boolean} [options.dedup=false] - store identical
+   *   values once.
+   * @param {Boolean} [options.direct=false] - write data files
+   *   around the page cache.
+   * @param {Boolean} [options.checksum=false] - store a CRC32C
+   *   with every record and verify it on read.
+   * @param {Boolean} [options.attach=false] - keep nodes read by
+   *   a transaction in memory until it is committed.
+   * @param {Boolean} [options.lockStats=false] - time waits on the
+   *   tree and transaction locks (see metricsSync).
+   * @param {String} [options.durability='rollover'] - when to sync
+   *   data files: `none`, `commit`, `batch` or `rollover`.
+   * @param {Number} [options.syncCommits=0] - batch: sync after
+   *   this many commits.
+   * @param {Number} [options.syncInterval=0] - batch: sync after
+   *   this many milliseconds (1000 if neither is set).
+   * @param {Number} [options.memoryBudget=0] - memory budget in bytes
+   *   shared by caches, transactions and iterators (0 = none).
+   * @param {Number} [options.txMemory=0] - write transactions out
+   *   to disk above this many bytes (0 = never).
+   * @param {Number} [options.residentLevels=0] - levels of the tree
+   *   a transaction keeps in memory after it commits.
+   * @param {Number} [options.warmLevels=0] - levels of the tree
+   *   prefetched in the background after open.
    */
 
   constructor(options) {
@@ -155,7 +198,7 @@ class Tree {
     await this.ensure();
     await this.lockFile.open();
 
-    await nurkel.tree_open(this.tree, this.prefix);
+    await nurkel.tree_open(this.tree, this.prefix, this.options.toNative());
     this.isOpen = true;
 
     if (rootHash)
@@ -218,6 +261,40 @@ class Tree {
     return nurkel.tree_root_hash(this.tree);
   }
 
+  /**
+   * Get the last root known to be synced to disk.
+   * @returns {Buffer}
+   */
+
+  durableRootSync() {
+    assert(this.isOpen, ERR_NOT_OPEN);
+    return nurkel.tree_durable_root_sync(this.tree);
+  }
+
+  /**
+   * Get memory usage against the budget, in bytes.
+   * @returns {Object} - limit, used, buffer, cache, dedup, txs, other.
+   */
+
+  memoryUsageSync() {
+    assert(this.isOpen, ERR_NOT_OPEN);
+    return nurkel.tree_memory_usage_sync(this.tree);
+  }
+
+  /**
+   * Get counters since open: disk reads and writes, cache
+   * hits and misses, commits, flushes and syncs (times in
+   * microseconds), file opens and root history scans. With
+   * `lockStats`, also contended acquisitions, total and longest
+   * waits for the tree and transaction locks, by read and write.
+   * @returns {Object}
+   */
+
+  metricsSync() {
+    assert(this.isOpen, ERR_NOT_OPEN);
+    return nurkel.tree_metrics_sync(this.tree);
+  }
+
   /**
    * Get value by the key.
    * @param {Buffer} key
@@ -604,11 +681,47 @@ class Tree {
   static statSync(prefix) {
     return nurkel.stat_sync(prefix);
   }
+
+  /**
+   * Get latency histograms of async operations, for all trees
+   * in the process. For each of get, has, insert, remove, prove,
+   * commit, iterNext, apply and compact: the time spent queued
+   * for the thread pool and executing, each as count, mean, max,
+   * p50, p90, p99 and p999 (microseconds).
+   * @returns {Object}
+   */
+
+  static latencySync() {
+    return nurkel.latency_snapshot_sync();
+  }
+
+  /**
+   * Reset latency histograms.
+   */
+
+  static resetLatencySync() {
+    nurkel.latency_reset_sync();
+  }
 }
 
 class TreeOptions {
   constructor(options) {
     this.prefix = '/';
+    this.filter = false;
+    this.index = false;
+    this.compress = false;
+    this.dedup = false;
+    this.direct = false;
+    this.checksum = false;
+    this.attach = false;
+    this.lockStats = false;
+    this.durability = 'rollover';
+    this.syncCommits = 0;
+    this.syncInterval = 0;
+    this.memoryBudget = 0;
+    this.txMemory = 0;
+    this.residentLevels = 0;
+    this.warmLevels = 0;
 
     this.fromOptions(options);
   }
@@ -619,6 +732,144 @@ class TreeOptions {
       'options.prefix must be a string.');
 
     this.prefix = options.prefix;
+
+    if (options.filter != null) {
+      assert(typeof options.filter === 'boolean',
+        'options.filter must be a boolean.');
+      this.filter = options.filter;
+    }
+
+    if (options.index != null) {
+      assert(typeof options.index === 'boolean',
+        'options.index must be a boolean.');
+      this.index = options.index;
+    }
+
+    if (options.compress != null) {
+      assert(typeof options.compress === 'boolean',
+        'options.compress must be a boolean.');
+      this.compress = options.compress;
+    }
+
+    if (options.dedup != null) {
+      assert(typeof options.dedup === 'boolean',
+        'options.dedup must be a boolean.');
+      this.dedup = options.dedup;
+    }
+
+    if (options.direct != null) {
+      assert(typeof options.direct === 'boolean',
+        'options.direct must be a boolean.');
+      this.direct = options.direct;
+    }
+
+    if (options.checksum != null) {
+      assert(typeof options.checksum === 'boolean',
+        'options.checksum must be a boolean.');
+      this.checksum = options.checksum;
+    }
+
+    if (options.attach != null) {
+      assert(typeof options.attach === 'boolean',
+        'options.attach must be a boolean.');
+      this.attach = options.attach;
+    }
+
+    if (options.lockStats != null) {
+      assert(typeof options.lockStats === 'boolean',
+        'options.lockStats must be a boolean.');
+      this.lockStats = options.lockStats;
+    }
+
+    if (options.durability != null) {
+      assert(typeof options.durability === 'string',
+        'options.durability must be a string.');
+      assert(durabilityModesByName[options.durability] != null,
+        'options.durability is not a valid mode.');
+      this.durability = options.durability;
+    }
+
+    if (options.syncCommits != null) {
+      assert((options.syncCommits >>> 0) === options.syncCommits,
+        'options.syncCommits must be a uint32.');
+      this.syncCommits = options.syncCommits;
+    }
+
+    if (options.syncInterval != null) {
+      assert((options.syncInterval >>> 0) === options.syncInterval,
+        'options.syncInterval must be a uint32.');
+      this.syncInterval = options.syncInterval;
+    }
+
+    if (options.memoryBudget != null) {
+      assert(Number.isSafeInteger(options.memoryBudget)
+        && options.memoryBudget >= 0,
+        'options.memoryBudget must be a non-negative integer.');
+      this.memoryBudget = options.memoryBudget;
+    }
+
+    if (options.txMemory != null) {
+      assert(Number.isSafeInteger(options.txMemory)
+        && options.txMemory >= 0,
+        'options.txMemory must be a non-negative integer.');
+      this.txMemory = options.txMemory;
+    }
+
+    if (options.residentLevels != null) {
+      assert((options.residentLevels >>> 0) === options.residentLevels,
+        'options.residentLevels must be a uint32.');
+      this.residentLevels = options.residentLevels;
+    }
+
+    if (options.warmLevels != null) {
+      assert((options.warmLevels >>> 0) === options.warmLevels,
+        'options.warmLevels must be a uint32.');
+      this.warmLevels = options.warmLevels;
+    }
+  }
+
+  /**
+   * Options passed to the native tree_open.
+   * @returns {Object}
+   */
+
+  toNative() {
+    let flags = 0;
+
+    if (this.filter)
+      flags |= OPTION_FILTER;
+
+    if (this.index)
+      flags |= OPTION_INDEX;
+
+    if (this.compress)
+      flags |= OPTION_COMPRESS;
+
+    if (this.dedup)
+      flags |= OPTION_DEDUP;
+
+    if (this.direct)
+      flags |= OPTION_DIRECT;
+
+    if (this.checksum)
+      flags |= OPTION_CHECKSUM;
+
+    if (this.attach)
+      flags |= OPTION_ATTACH;
+
+    if (this.lockStats)
+      flags |= OPTION_LOCKSTATS;
+
+    return {
+      flags,
+      durability: durabilityModesByName[this.durability],
+      syncCommits: this.syncCommits,
+      syncInterval: this.syncInterval,
+      memoryBudget: this.memoryBudget,
+      txMemory: this.txMemory,
+      residentLevels: this.residentLevels,
+      warmLevels: this.warmLevels
+    };
   }
 }
 
@@ -965,6 +1216,59 @@ class Transaction extends Snapshot {
     assert(this.isOpen, ERR_TX_NOT_OPEN);
     return nurkel.tx_clear_sync(this.tx);
   }
+
+  /**
+   * Remember the current state of the transaction.
+   * Savepoints are dropped on commit, clear and inject.
+   * @returns {Number} - savepoint.
+   */
+
+  savepoint() {
+    assert(this.isOpen, ERR_TX_NOT_OPEN);
+    return nurkel.tx_savepoint_sync(this.tx);
+  }
+
+  /**
+   * Undo changes made since the savepoint. Later
+   * savepoints are dropped, this one is kept.
+   * @param {Number} savepoint
+   * @returns {void}
+   */
+
+  rollbackTo(savepoint) {
+    assert(this.isOpen, ERR_TX_NOT_OPEN);
+    assert((savepoint >>> 0) === savepoint);
+    return nurkel.tx_rollback_to_sync(this.tx, savepoint);
+  }
+
+  /**
+   * Drop the savepoint (and later ones), keeping the changes.
+   * @param {Number} savepoint
+   * @returns {void}
+   */
+
+  releaseSavepoint(savepoint) {
+    assert(this.isOpen, ERR_TX_NOT_OPEN);
+    assert((savepoint >>> 0) === savepoint);
+    return nurkel.tx_release_sync(this.tx, savepoint);
+  }
+
+  /**
+   * Fork the transaction. The fork starts out sharing this
+   * transaction's nodes and both can then change independently.
+   * Operations on a transaction and its forks are serialized.
+   * @returns {Transaction} - open transaction.
+   */
+
+  fork() {
+    assert(this.isOpen, ERR_TX_NOT_OPEN);
+
+    const txn = new Transaction(this.tree);
+    nurkel.tx_fork_sync(txn.tx, this.tx);
+    txn.isOpen = true;
+
+    return txn;
+  }
 }
 
 class VirtualTransaction {
@@ -21,7 +21,8 @@ urkel_errors[] = {
   "URKEL_ENOUPDATE",
   "URKEL_EBADWRITE",
   "URKEL_EBADOPEN",
-  "URKEL_EITEREND"
+  "URKEL_EITEREND",
+  "URKEL_ENOMEM"
 };
 
 const int urkel_errors_len = sizeof(urkel_errors) / sizeof(urkel_errors[0]);
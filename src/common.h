@@ -169,6 +169,8 @@ typedef struct nurkel_iter_s {
   uint32_t cache_size;
   /** Allocated memory for the cache size. */
   nurkel_iter_result_t *buffer;
+  /** Bytes of `buffer` charged to the tree's memory budget. */
+  size_t charged;
 
   /** Nurkel Transaction linked list entry. */
   nurkel_dlist_entry_t *entry;
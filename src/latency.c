@@ -0,0 +1,343 @@
+/**
+ * latency.c - operation latency histograms for the nurkel.
+ * Copyright (c) 2022, Nodari Chkuaselidze (MIT License)
+ * https://github.com/nodech/nurkel
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <node_api.h>
+#include <uv.h>
+
+#include "common.h"
+#include "util.h"
+#include "latency.h"
+
+/*
+ * Atomics
+ */
+
+/* Workers record from the thread pool without locks. */
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+
+static void
+nurkel_atomic_add(uint64_t *x, uint64_t y) {
+  _InterlockedExchangeAdd64((volatile __int64 *)x, (__int64)y);
+}
+
+static uint64_t
+nurkel_atomic_load(uint64_t *x) {
+  return (uint64_t)_InterlockedOr64((volatile __int64 *)x, 0);
+}
+
+static void
+nurkel_atomic_store(uint64_t *x, uint64_t y) {
+  _InterlockedExchange64((volatile __int64 *)x, (__int64)y);
+}
+
+static void
+nurkel_atomic_max(uint64_t *x, uint64_t y) {
+  uint64_t cur = nurkel_atomic_load(x);
+
+  while (cur < y) {
+    uint64_t old = (uint64_t)_InterlockedCompareExchange64(
+      (volatile __int64 *)x, (__int64)y, (__int64)cur);
+
+    if (old == cur)
+      break;
+
+    cur = old;
+  }
+}
+#else
+static void
+nurkel_atomic_add(uint64_t *x, uint64_t y) {
+  __atomic_fetch_add(x, y, __ATOMIC_RELAXED);
+}
+
+static uint64_t
+nurkel_atomic_load(uint64_t *x) {
+  return __atomic_load_n(x, __ATOMIC_RELAXED);
+}
+
+static void
+nurkel_atomic_store(uint64_t *x, uint64_t y) {
+  __atomic_store_n(x, y, __ATOMIC_RELAXED);
+}
+
+static void
+nurkel_atomic_max(uint64_t *x, uint64_t y) {
+  uint64_t cur = nurkel_atomic_load(x);
+
+  while (cur < y) {
+    if (__atomic_compare_exchange_n(x, &cur, y, 1,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+}
+#endif
+
+/*
+ * Histogram
+ */
+
+/**
+ * Log-linear buckets in the style of HdrHistogram: values
+ * below 2^SUB_BITS get a bucket each, and every power of two
+ * above is split into 2^SUB_BITS buckets, which keeps each
+ * bucket within 6.25% of the values it holds. Values are in
+ * nanoseconds and anything above 2^MAX_BITS (~18 minutes)
+ * lands in the last bucket.
+ */
+
+#define NURKEL_HIST_SUB_BITS 4
+#define NURKEL_HIST_SUB (1 << NURKEL_HIST_SUB_BITS)
+#define NURKEL_HIST_MAX_BITS 40
+#define NURKEL_HIST_BUCKETS \
+  ((NURKEL_HIST_MAX_BITS - NURKEL_HIST_SUB_BITS + 1) * NURKEL_HIST_SUB)
+
+typedef struct nurkel_hist_s {
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[NURKEL_HIST_BUCKETS];
+} nurkel_hist_t;
+
+enum nurkel_phase {
+  nurkel_phase_queue = 0,
+  nurkel_phase_exec = 1,
+  nurkel_phase_max = 2
+};
+
+static const char *nurkel_op_names[nurkel_op_max] = {
+  "get",
+  "has",
+  "insert",
+  "remove",
+  "prove",
+  "commit",
+  "iterNext",
+  "apply",
+  "compact"
+};
+
+static const char *nurkel_phase_names[nurkel_phase_max] = {
+  "queue",
+  "exec"
+};
+
+static nurkel_hist_t nurkel_hists[nurkel_op_max][nurkel_phase_max];
+
+static size_t
+nurkel_hist_index(uint64_t value) {
+  size_t bits = 0;
+
+  if (value < NURKEL_HIST_SUB)
+    return value;
+
+  if (value >> NURKEL_HIST_MAX_BITS)
+    return NURKEL_HIST_BUCKETS - 1;
+
+  while (value >> (bits + 1))
+    bits++;
+
+  return (bits - NURKEL_HIST_SUB_BITS + 1) * NURKEL_HIST_SUB
+       + ((value >> (bits - NURKEL_HIST_SUB_BITS)) & (NURKEL_HIST_SUB - 1));
+}
+
+static uint64_t
+nurkel_hist_value(size_t index) {
+  /* Highest value which falls into the bucket. */
+  size_t shift, sub;
+
+  if (index < NURKEL_HIST_SUB)
+    return index;
+
+  shift = index / NURKEL_HIST_SUB - 1;
+  sub = index % NURKEL_HIST_SUB;
+
+  return ((uint64_t)(NURKEL_HIST_SUB + sub + 1) << shift) - 1;
+}
+
+static void
+nurkel_hist_record(nurkel_hist_t *hist, uint64_t value) {
+  nurkel_atomic_add(&hist->buckets[nurkel_hist_index(value)], 1);
+  nurkel_atomic_add(&hist->sum, value);
+  nurkel_atomic_max(&hist->max, value);
+}
+
+static void
+nurkel_hist_reset(nurkel_hist_t *hist) {
+  size_t i;
+
+  for (i = 0; i < NURKEL_HIST_BUCKETS; i++)
+    nurkel_atomic_store(&hist->buckets[i], 0);
+
+  nurkel_atomic_store(&hist->sum, 0);
+  nurkel_atomic_store(&hist->max, 0);
+}
+
+/*
+ * Timing
+ */
+
+void
+nurkel_latency_wrap(nurkel_timing_t *timing,
+                    int op,
+                    void *data,
+                    napi_async_execute_callback execute,
+                    napi_async_complete_callback complete) {
+  timing->data = data;
+  timing->execute = execute;
+  timing->complete = complete;
+  timing->op = op;
+
+  /* Work is queued right after it is created. */
+  timing->queued = uv_hrtime();
+}
+
+void
+nurkel_latency_execute(napi_env env, void *data) {
+  nurkel_timing_t *timing = data;
+  uint64_t start = uv_hrtime();
+  nurkel_hist_t *hists;
+
+  timing->execute(env, timing->data);
+
+  if (timing->op == nurkel_op_none)
+    return;
+
+  hists = nurkel_hists[timing->op];
+
+  nurkel_hist_record(&hists[nurkel_phase_queue], start - timing->queued);
+  nurkel_hist_record(&hists[nurkel_phase_exec], uv_hrtime() - start);
+}
+
+void
+nurkel_latency_complete(napi_env env, napi_status status, void *data) {
+  nurkel_timing_t *timing = data;
+
+  /* Frees the worker, and `timing` along with it. */
+  timing->complete(env, status, timing->data);
+}
+
+/*
+ * Methods
+ */
+
+static napi_status
+nurkel_set_number(napi_env env,
+                  napi_value object,
+                  const char *name,
+                  double value) {
+  napi_status status;
+  napi_value prop;
+
+  RET_NAPI_NOK(napi_create_double(env, value, &prop));
+  RET_NAPI_NOK(napi_set_named_property(env, object, name, prop));
+
+  return napi_ok;
+}
+
+/**
+ * Summarize a histogram: count, and mean, max and
+ * percentiles in microseconds.
+ */
+
+static napi_status
+nurkel_hist_summary(napi_env env, nurkel_hist_t *hist, napi_value *result) {
+  static const struct {
+    const char *name;
+    double quantile;
+  } percentiles[] = {
+    { "p50", 0.5 },
+    { "p90", 0.9 },
+    { "p99", 0.99 },
+    { "p999", 0.999 }
+  };
+
+  uint64_t buckets[NURKEL_HIST_BUCKETS];
+  uint64_t count = 0;
+  uint64_t sum = nurkel_atomic_load(&hist->sum);
+  uint64_t max = nurkel_atomic_load(&hist->max);
+  napi_status status;
+  size_t i, j;
+
+  for (i = 0; i < NURKEL_HIST_BUCKETS; i++) {
+    buckets[i] = nurkel_atomic_load(&hist->buckets[i]);
+    count += buckets[i];
+  }
+
+  RET_NAPI_NOK(napi_create_object(env, result));
+  RET_NAPI_NOK(nurkel_set_number(env, *result, "count", (double)count));
+  RET_NAPI_NOK(nurkel_set_number(env, *result, "mean",
+               count > 0 ? (double)sum / count / 1000 : 0));
+  RET_NAPI_NOK(nurkel_set_number(env, *result, "max", (double)max / 1000));
+
+  for (i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+    uint64_t target = (uint64_t)(percentiles[i].quantile * count + 0.5);
+    uint64_t seen = 0;
+    uint64_t value = 0;
+
+    if (target == 0)
+      target = 1;
+
+    for (j = 0; j < NURKEL_HIST_BUCKETS && count > 0; j++) {
+      seen += buckets[j];
+
+      if (seen >= target) {
+        value = nurkel_hist_value(j);
+        break;
+      }
+    }
+
+    /* The bucket bound can overshoot the largest value seen. */
+    if (value > max)
+      value = max;
+
+    RET_NAPI_NOK(nurkel_set_number(env, *result, percentiles[i].name,
+                                   (double)value / 1000));
+  }
+
+  return napi_ok;
+}
+
+NURKEL_METHOD(latency_snapshot_sync) {
+  napi_value result, op, summary;
+  size_t i, j;
+
+  (void)info;
+
+  JS_NAPI_OK(napi_create_object(env, &result));
+
+  for (i = 0; i < nurkel_op_max; i++) {
+    JS_NAPI_OK(napi_create_object(env, &op));
+
+    for (j = 0; j < nurkel_phase_max; j++) {
+      JS_NAPI_OK(nurkel_hist_summary(env, &nurkel_hists[i][j], &summary));
+      JS_NAPI_OK(napi_set_named_property(env, op, nurkel_phase_names[j],
+                                         summary));
+    }
+
+    JS_NAPI_OK(napi_set_named_property(env, result, nurkel_op_names[i], op));
+  }
+
+  return result;
+}
+
+NURKEL_METHOD(latency_reset_sync) {
+  napi_value result;
+  size_t i, j;
+
+  (void)info;
+
+  for (i = 0; i < nurkel_op_max; i++) {
+    for (j = 0; j < nurkel_phase_max; j++)
+      nurkel_hist_reset(&nurkel_hists[i][j]);
+  }
+
+  JS_NAPI_OK(napi_get_undefined(env, &result));
+
+  return result;
+}
@@ -0,0 +1,81 @@
+/**
+ * latency.h - operation latency histograms for the nurkel.
+ * Copyright (c) 2022, Nodari Chkuaselidze (MIT License)
+ * https://github.com/nodech/nurkel
+ */
+
+#ifndef _NURKEL_LATENCY_H
+#define _NURKEL_LATENCY_H
+
+#include <stdint.h>
+#include <node_api.h>
+#include "util.h"
+
+/*
+ * Operations
+ */
+
+enum nurkel_op {
+  nurkel_op_none = -1,
+  nurkel_op_get = 0,
+  nurkel_op_has = 1,
+  nurkel_op_insert = 2,
+  nurkel_op_remove = 3,
+  nurkel_op_prove = 4,
+  nurkel_op_commit = 5,
+  nurkel_op_iter_next = 6,
+  nurkel_op_apply = 7,
+  nurkel_op_compact = 8,
+  nurkel_op_max = 9
+};
+
+/* Histogram of each async work (see NURKEL_CREATE_ASYNC_WORK). */
+#define NURKEL_OP_tree_open nurkel_op_none
+#define NURKEL_OP_tree_root_hash nurkel_op_none
+#define NURKEL_OP_tree_inject nurkel_op_none
+#define NURKEL_OP_tree_get nurkel_op_get
+#define NURKEL_OP_tree_has nurkel_op_has
+#define NURKEL_OP_tree_prove nurkel_op_prove
+#define NURKEL_OP_tx_open nurkel_op_none
+#define NURKEL_OP_tx_root_hash nurkel_op_none
+#define NURKEL_OP_tx_inject nurkel_op_none
+#define NURKEL_OP_tx_clear nurkel_op_none
+#define NURKEL_OP_tx_get nurkel_op_get
+#define NURKEL_OP_tx_has nurkel_op_has
+#define NURKEL_OP_tx_insert nurkel_op_insert
+#define NURKEL_OP_tx_remove nurkel_op_remove
+#define NURKEL_OP_tx_prove nurkel_op_prove
+#define NURKEL_OP_tx_commit nurkel_op_commit
+#define NURKEL_OP_tx_apply nurkel_op_apply
+#define NURKEL_OP_iter_next nurkel_op_iter_next
+#define NURKEL_OP_compact nurkel_op_compact
+#define NURKEL_OP_verify nurkel_op_none
+#define NURKEL_OP_destroy nurkel_op_none
+#define NURKEL_OP_hash nurkel_op_none
+#define NURKEL_OP_stat nurkel_op_none
+
+/*
+ * Timing
+ */
+
+void
+nurkel_latency_wrap(nurkel_timing_t *timing,
+                    int op,
+                    void *data,
+                    napi_async_execute_callback execute,
+                    napi_async_complete_callback complete);
+
+void
+nurkel_latency_execute(napi_env env, void *data);
+
+void
+nurkel_latency_complete(napi_env env, napi_status status, void *data);
+
+/*
+ * Methods
+ */
+
+NURKEL_METHOD(latency_snapshot_sync);
+NURKEL_METHOD(latency_reset_sync);
+
+#endif /* _NURKEL_LATENCY_H */
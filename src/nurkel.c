@@ -16,6 +16,7 @@
 #include "util.h"
 #include "tree.h"
 #include "transaction.h"
+#include "latency.h"
 #include "blake2b.h"
 
 /*
@@ -42,6 +43,9 @@ NAPI_MODULE_INIT() {
     F(tree_close),
     F(tree_root_hash_sync),
     F(tree_root_hash),
+    F(tree_durable_root_sync),
+    F(tree_memory_usage_sync),
+    F(tree_metrics_sync),
     F(tree_inject_sync),
     F(tree_inject),
     F(tree_get_sync),
@@ -69,6 +73,7 @@ NAPI_MODULE_INIT() {
     /* TX Methods */
     F(tx_init),
     F(tx_open),
+    F(tx_fork_sync),
     F(tx_close),
     F(tx_root_hash_sync),
     F(tx_root_hash),
@@ -88,6 +93,9 @@ NAPI_MODULE_INIT() {
     F(tx_clear),
     F(tx_inject_sync),
     F(tx_inject),
+    F(tx_savepoint_sync),
+    F(tx_rollback_to_sync),
+    F(tx_release_sync),
     F(tx_apply),
     F(tx_apply_sync),
 
@@ -97,6 +105,10 @@ NAPI_MODULE_INIT() {
     F(iter_next_sync),
     F(iter_next),
 
+    /* Latency */
+    F(latency_snapshot_sync),
+    F(latency_reset_sync),
+
     /** Blake */
     F(blake2b_create),
     F(blake2b_init),
@@ -7,6 +7,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include "transaction.h"
+#include "latency.h"
 
 const char *txn_state_errors[] = {
   "ok.",
@@ -539,6 +540,41 @@ NURKEL_METHOD(tx_open) {
   return result;
 }
 
+NURKEL_METHOD(tx_fork_sync) {
+  napi_value result;
+  nurkel_tx_t *parent = NULL;
+  enum nurkel_state_err tx_state;
+
+  NURKEL_ARGV(2);
+  NURKEL_TX_CONTEXT();
+
+  JS_ASSERT(ntx->state == nurkel_state_closed, "Transaction is not closed.");
+  JS_ASSERT(ntx->close_worker == NULL, "Transaction is closing.");
+
+  NURKEL_TREE_READY();
+
+  JS_ASSERT(napi_get_value_external(env, argv[1], (void **)&parent) == napi_ok,
+            JS_ERR_ARG);
+  JS_ASSERT(parent != NULL, JS_ERR_ARG);
+  JS_ASSERT(parent->ntree == ntree, JS_ERR_ARG);
+
+  tx_state = nurkel_ntx_ready(parent);
+
+  if (tx_state != nurkel_state_err_ok)
+    JS_THROW(txn_state_errors[tx_state]);
+
+  ntx->tx = urkel_tx_fork(parent->tx);
+  memcpy(ntx->init_root, parent->init_root, URKEL_HASH_SIZE);
+
+  /* Make sure Tree does not close and free while we are working with it. */
+  nurkel_register_tx(ntx);
+  ntx->state = nurkel_state_open;
+
+  JS_NAPI_OK(napi_get_undefined(env, &result));
+
+  return result;
+}
+
 NURKEL_METHOD(tx_close) {
   napi_value result;
   napi_status status;
@@ -1427,6 +1463,58 @@ NURKEL_METHOD(tx_inject_sync) {
   return result;
 }
 
+NURKEL_METHOD(tx_savepoint_sync) {
+  napi_value result;
+  size_t savepoint;
+
+  NURKEL_ARGV(1);
+  NURKEL_TX_CONTEXT();
+  NURKEL_TX_READY();
+
+  savepoint = urkel_tx_savepoint(ntx->tx);
+
+  JS_NAPI_OK(napi_create_int64(env, savepoint, &result));
+  return result;
+}
+
+NURKEL_METHOD(tx_rollback_to_sync) {
+  napi_value result;
+  int64_t savepoint;
+
+  NURKEL_ARGV(2);
+  NURKEL_TX_CONTEXT();
+  NURKEL_TX_READY();
+
+  JS_ASSERT(napi_get_value_int64(env, argv[1], &savepoint) == napi_ok,
+            JS_ERR_ARG);
+  JS_ASSERT(savepoint >= 0, JS_ERR_ARG);
+
+  if (!urkel_tx_rollback_to(ntx->tx, savepoint))
+    JS_THROW_CODE(urkel_errno, "Failed to tx_rollback_to_sync.");
+
+  JS_NAPI_OK(napi_get_undefined(env, &result));
+  return result;
+}
+
+NURKEL_METHOD(tx_release_sync) {
+  napi_value result;
+  int64_t savepoint;
+
+  NURKEL_ARGV(2);
+  NURKEL_TX_CONTEXT();
+  NURKEL_TX_READY();
+
+  JS_ASSERT(napi_get_value_int64(env, argv[1], &savepoint) == napi_ok,
+            JS_ERR_ARG);
+  JS_ASSERT(savepoint >= 0, JS_ERR_ARG);
+
+  if (!urkel_tx_release(ntx->tx, savepoint))
+    JS_THROW_CODE(urkel_errno, "Failed to tx_release_sync.");
+
+  JS_NAPI_OK(napi_get_undefined(env, &result));
+  return result;
+}
+
 NURKEL_EXEC(tx_inject) {
   (void)env;
 
@@ -1850,6 +1938,7 @@ nurkel_niter_init(nurkel_iter_t *niter) {
   niter->cache_max_size = 1;
   niter->cache_size = 0;
   niter->buffer = NULL;
+  niter->charged = 0;
 
   niter->entry = NULL;
 
@@ -1875,6 +1964,15 @@ nurkel_niter_free(napi_env env, nurkel_iter_t *niter) {
   return napi_ok;
 }
 
+static void
+nurkel_niter_uncharge(nurkel_iter_t *niter) {
+  if (niter->charged == 0)
+    return;
+
+  urkel_memory_release(niter->ntx->ntree->tree, niter->charged);
+  niter->charged = 0;
+}
+
 static void
 nurkel_niter_env_cleanup_hook(void *arg) {
   CHECK(arg != NULL);
@@ -1887,6 +1985,7 @@ nurkel_niter_env_cleanup_hook(void *arg) {
 
   if (niter->state == nurkel_state_open) {
     urkel_iter_destroy(niter->iter);
+    nurkel_niter_uncharge(niter);
     nurkel_tx_unregister_iter(niter);
     niter->state = nurkel_state_closed;
   }
@@ -1936,6 +2035,7 @@ nurkel_iter_close_worker_exec(napi_env env, void *data) {
   nurkel_iter_t *niter = worker->ctx;
 
   urkel_iter_destroy(niter->iter);
+  nurkel_niter_uncharge(niter);
   niter->iter = NULL;
   worker->success = true;
 }
@@ -2035,6 +2135,7 @@ NURKEL_METHOD(iter_init) {
   napi_status status;
   nurkel_iter_t *niter;
   uint32_t cache_max_size;
+  size_t buffer_size;
   char *err;
 
   NURKEL_ARGV(2);
@@ -2051,8 +2152,18 @@ NURKEL_METHOD(iter_init) {
 
   niter->ntx = ntx;
   niter->cache_max_size = cache_max_size;
-  niter->buffer = malloc(sizeof(nurkel_iter_result_t) * cache_max_size);
+  buffer_size = sizeof(nurkel_iter_result_t) * cache_max_size;
+  niter->buffer = malloc(buffer_size);
   JS_ASSERT_GOTO_THROW(niter->buffer != NULL, JS_ERR_ALLOC);
+
+  /* The result cache draws on the tree's memory budget. */
+  if (!urkel_memory_charge(ntx->ntree->tree, buffer_size)) {
+    free(niter->buffer);
+    free(niter);
+    JS_THROW(urkel_errors[URKEL_ENOMEM]);
+  }
+
+  niter->charged = buffer_size;
   niter->iter = urkel_iter_create(ntx->tx);
 
   status = napi_create_external(env, niter, nurkel_niter_destroy, NULL, &result);
@@ -2077,6 +2188,8 @@ NURKEL_METHOD(iter_init) {
   return result;
 
 throw:
+  nurkel_niter_uncharge(niter);
+
   if (niter->buffer != NULL)
     free(niter->buffer);
 
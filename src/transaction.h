@@ -93,6 +93,7 @@ NURKEL_METHOD(tx_init);
 NURKEL_METHOD(tx_close);
 NURKEL_METHOD(tx_init);
 NURKEL_METHOD(tx_open);
+NURKEL_METHOD(tx_fork_sync);
 NURKEL_METHOD(tx_close);
 NURKEL_METHOD(tx_root_hash_sync);
 NURKEL_METHOD(tx_root_hash);
@@ -112,6 +113,9 @@ NURKEL_METHOD(tx_clear_sync);
 NURKEL_METHOD(tx_clear);
 NURKEL_METHOD(tx_inject_sync);
 NURKEL_METHOD(tx_inject);
+NURKEL_METHOD(tx_savepoint_sync);
+NURKEL_METHOD(tx_rollback_to_sync);
+NURKEL_METHOD(tx_release_sync);
 NURKEL_METHOD(tx_apply);
 NURKEL_METHOD(tx_apply_sync);
 
@@ -9,6 +9,7 @@
 #include <node_api.h>
 #include "common.h"
 #include "util.h"
+#include "latency.h"
 #include "tree.h"
 
 const char *tree_state_errors[] = {
@@ -27,6 +28,7 @@ typedef struct nurkel_open_worker_s {
   WORKER_BASE_PROPS(nurkel_tree_t)
   char *in_path;
   size_t in_path_len;
+  urkel_tree_options_t in_options;
 
   uint8_t out_hash[URKEL_HASH_SIZE];
 } nurkel_open_worker_t;
@@ -394,12 +396,73 @@ NURKEL_METHOD(tree_init) {
   return result;
 }
 
+/**
+ * Read tree options ({flags, durability, syncCommits, syncInterval,
+ * memoryBudget, txMemory, residentLevels, warmLevels}) passed from JS.
+ */
+
+static napi_status
+nurkel_read_tree_options(napi_env env,
+                         napi_value value,
+                         urkel_tree_options_t *options) {
+  napi_status status;
+  napi_value prop;
+  uint32_t flags, durability, sync_commits, sync_interval, resident, warm;
+  int64_t memory, tx_memory;
+
+  urkel_tree_options_init(options);
+
+  RET_NAPI_NOK(napi_get_named_property(env, value, "flags", &prop));
+  RET_NAPI_NOK(napi_get_value_uint32(env, prop, &flags));
+
+  RET_NAPI_NOK(napi_get_named_property(env, value, "durability", &prop));
+  RET_NAPI_NOK(napi_get_value_uint32(env, prop, &durability));
+
+  RET_NAPI_NOK(napi_get_named_property(env, value, "syncCommits", &prop));
+  RET_NAPI_NOK(napi_get_value_uint32(env, prop, &sync_commits));
+
+  RET_NAPI_NOK(napi_get_named_property(env, value, "syncInterval", &prop));
+  RET_NAPI_NOK(napi_get_value_uint32(env, prop, &sync_interval));
+
+  RET_NAPI_NOK(napi_get_named_property(env, value, "memoryBudget", &prop));
+  RET_NAPI_NOK(napi_get_value_int64(env, prop, &memory));
+
+  RET_NAPI_NOK(napi_get_named_property(env, value, "txMemory", &prop));
+  RET_NAPI_NOK(napi_get_value_int64(env, prop, &tx_memory));
+
+  RET_NAPI_NOK(napi_get_named_property(env, value, "residentLevels", &prop));
+  RET_NAPI_NOK(napi_get_value_uint32(env, prop, &resident));
+
+  RET_NAPI_NOK(napi_get_named_property(env, value, "warmLevels", &prop));
+  RET_NAPI_NOK(napi_get_value_uint32(env, prop, &warm));
+
+  if (durability > URKEL_DURABLE_ROLLOVER)
+    return napi_invalid_arg;
+
+  if (memory < 0 || (uint64_t)memory > SIZE_MAX)
+    return napi_invalid_arg;
+
+  if (tx_memory < 0 || (uint64_t)tx_memory > SIZE_MAX)
+    return napi_invalid_arg;
+
+  options->flags = flags;
+  options->durability = durability;
+  options->sync_commits = sync_commits;
+  options->sync_interval = sync_interval;
+  options->memory = (size_t)memory;
+  options->tx_memory = (size_t)tx_memory;
+  options->tx_levels = resident;
+  options->warm_levels = warm;
+
+  return napi_ok;
+}
+
 NURKEL_EXEC(tree_open) {
   (void)env;
   nurkel_open_worker_t *worker = data;
   nurkel_tree_t *ntree = worker->ctx;
 
-  ntree->tree = urkel_open(worker->in_path);
+  ntree->tree = urkel_open_ex(worker->in_path, &worker->in_options);
 
   if (ntree->tree == NULL) {
     worker->err_res = urkel_errno;
@@ -450,7 +513,7 @@ NURKEL_METHOD(tree_open) {
   nurkel_open_worker_t *worker = NULL;
   char *err;
 
-  NURKEL_ARGV(2);
+  NURKEL_ARGV(3);
   NURKEL_TREE_CONTEXT();
 
   JS_ASSERT(ntree->state != nurkel_state_open, "Tree is already open.");
@@ -468,6 +531,13 @@ NURKEL_METHOD(tree_open) {
   worker->in_path_len = 0;
   memset(worker->out_hash, 0, URKEL_HASH_SIZE);
 
+  status = nurkel_read_tree_options(env, argv[2], &worker->in_options);
+
+  if (status != napi_ok) {
+    free(worker);
+    JS_THROW(JS_ERR_ARG);
+  }
+
   status = read_value_string_latin1(env,
                                     argv[1],
                                     &worker->in_path,
@@ -547,6 +617,123 @@ NURKEL_METHOD(tree_root_hash_sync) {
   return result;
 }
 
+NURKEL_METHOD(tree_durable_root_sync) {
+  napi_value result;
+  uint8_t hash[URKEL_HASH_SIZE];
+
+  NURKEL_ARGV(1);
+  NURKEL_TREE_CONTEXT();
+  NURKEL_TREE_READY();
+
+  urkel_durable_root(ntree->tree, hash);
+
+  JS_ASSERT(napi_create_buffer_copy(env,
+                                    URKEL_HASH_SIZE,
+                                    hash,
+                                    NULL,
+                                    &result) == napi_ok, JS_ERR_NODE);
+
+  return result;
+}
+
+NURKEL_METHOD(tree_memory_usage_sync) {
+  napi_value result, prop;
+  urkel_memory_t usage;
+  size_t i;
+
+  NURKEL_ARGV(1);
+  NURKEL_TREE_CONTEXT();
+  NURKEL_TREE_READY();
+
+  urkel_memory_usage(ntree->tree, &usage);
+
+  const struct {
+    const char *name;
+    size_t value;
+  } fields[] = {
+    { "limit", usage.limit },
+    { "used", usage.used },
+    { "buffer", usage.buffer },
+    { "cache", usage.cache },
+    { "dedup", usage.dedup },
+    { "txs", usage.txs },
+    { "other", usage.other }
+  };
+
+  JS_ASSERT(napi_create_object(env, &result) == napi_ok, JS_ERR_NODE);
+
+  for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+    JS_ASSERT(napi_create_int64(env, fields[i].value, &prop) == napi_ok,
+              JS_ERR_NODE);
+    JS_ASSERT(napi_set_named_property(env, result, fields[i].name,
+                                      prop) == napi_ok, JS_ERR_NODE);
+  }
+
+  return result;
+}
+
+NURKEL_METHOD(tree_metrics_sync) {
+  napi_value result, prop;
+  urkel_metrics_t metrics;
+  size_t i;
+
+  NURKEL_ARGV(1);
+  NURKEL_TREE_CONTEXT();
+  NURKEL_TREE_READY();
+
+  urkel_metrics(ntree->tree, &metrics);
+
+  const struct {
+    const char *name;
+    uint64_t value;
+  } fields[] = {
+    { "nodeReads", metrics.node_reads },
+    { "valueReads", metrics.value_reads },
+    { "bytesRead", metrics.bytes_read },
+    { "bytesWritten", metrics.bytes_written },
+    { "rootHits", metrics.root_hits },
+    { "rootMisses", metrics.root_misses },
+    { "filterHits", metrics.filter_hits },
+    { "filterMisses", metrics.filter_misses },
+    { "indexHits", metrics.index_hits },
+    { "indexMisses", metrics.index_misses },
+    { "dedupHits", metrics.dedup_hits },
+    { "dedupMisses", metrics.dedup_misses },
+    { "commits", metrics.commits },
+    { "commitTime", metrics.commit_time },
+    { "flushes", metrics.flushes },
+    { "flushTime", metrics.flush_time },
+    { "syncs", metrics.syncs },
+    { "syncTime", metrics.sync_time },
+    { "fileOpens", metrics.file_opens },
+    { "fileEvictions", metrics.file_evictions },
+    { "historyScans", metrics.history_scans },
+    { "treeReadContended", metrics.tree_read.contended },
+    { "treeReadWaitTime", metrics.tree_read.wait_time },
+    { "treeReadMaxWait", metrics.tree_read.max_wait },
+    { "treeWriteContended", metrics.tree_write.contended },
+    { "treeWriteWaitTime", metrics.tree_write.wait_time },
+    { "treeWriteMaxWait", metrics.tree_write.max_wait },
+    { "txReadContended", metrics.tx_read.contended },
+    { "txReadWaitTime", metrics.tx_read.wait_time },
+    { "txReadMaxWait", metrics.tx_read.max_wait },
+    { "txWriteContended", metrics.tx_write.contended },
+    { "txWriteWaitTime", metrics.tx_write.wait_time },
+    { "txWriteMaxWait", metrics.tx_write.max_wait }
+  };
+
+  JS_ASSERT(napi_create_object(env, &result) == napi_ok, JS_ERR_NODE);
+
+  for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+    JS_ASSERT(napi_create_int64(env, (int64_t)fields[i].value,
+                                &prop) == napi_ok, JS_ERR_NODE);
+    JS_ASSERT(napi_set_named_property(env, result, fields[i].name,
+                                      prop) == napi_ok, JS_ERR_NODE);
+  }
+
+  return result;
+}
+
 NURKEL_EXEC(tree_root_hash) {
   (void)env;
   nurkel_root_hash_worker_t *worker = data;
@@ -75,6 +75,9 @@ NURKEL_METHOD(tree_open);
 NURKEL_METHOD(tree_close);
 NURKEL_METHOD(tree_root_hash_sync);
 NURKEL_METHOD(tree_root_hash);
+NURKEL_METHOD(tree_durable_root_sync);
+NURKEL_METHOD(tree_memory_usage_sync);
+NURKEL_METHOD(tree_metrics_sync);
 NURKEL_METHOD(tree_inject_sync);
 NURKEL_METHOD(tree_inject);
 NURKEL_METHOD(tree_get_sync);
@@ -11,6 +11,7 @@
 
 #include "common.h"
 #include "util.h"
+#include "latency.h"
 
 void
 nurkel_assert_fail(const char *file, int line, const char *expr) {
@@ -98,6 +99,8 @@ napi_status
 nurkel_create_work(napi_env env,
                    char *name,
                    void *worker,
+                   nurkel_timing_t *timing,
+                   int op,
                    napi_async_work *work,
                    napi_async_execute_callback execute,
                    napi_async_complete_callback complete,
@@ -116,12 +119,14 @@ nurkel_create_work(napi_env env,
   if (status != napi_ok)
     return status;
 
+  nurkel_latency_wrap(timing, op, worker, execute, complete);
+
   status = napi_create_async_work(env,
                                   NULL,
                                   workname,
-                                  execute,
-                                  complete,
-                                  worker,
+                                  nurkel_latency_execute,
+                                  nurkel_latency_complete,
+                                  timing,
                                   work);
 
   if (status != napi_ok)
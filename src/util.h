@@ -7,6 +7,7 @@
 #ifndef _NURKEL_UTIL_H
 #define _NURKEL_UTIL_H
 
+#include <stdint.h>
 #include <node_api.h>
 
 /*
@@ -95,10 +96,13 @@ nurkel_ ## name ## _complete(napi_env env, napi_status status, void *data)
                                   false);          \
 } while(0)
 
+/* Needs latency.h for NURKEL_OP_<name>. */
 #define NURKEL_CREATE_ASYNC_WORK(name, worker, result) do { \
   status = nurkel_create_work(env,                                      \
                               "nurkel_" #name,                          \
                               worker,                                   \
+                              &worker->timing,                          \
+                              NURKEL_OP_ ## name,                       \
                               &worker->work,                            \
                               NURKEL_EXEC_NAME(name),                   \
                               NURKEL_COMPLETE_NAME(name),               \
@@ -110,13 +114,27 @@ nurkel_ ## name ## _complete(napi_env env, napi_status status, void *data)
  * Workers helper macros
  */
 
+/**
+ * Wraps the callbacks of a worker so that its time in the
+ * queue and in the thread pool can be measured.
+ */
+
+typedef struct nurkel_timing_s {
+  void *data;
+  napi_async_execute_callback execute;
+  napi_async_complete_callback complete;
+  int op;
+  uint64_t queued;
+} nurkel_timing_t;
+
 #define WORKER_BASE_PROPS(ctx_t) \
   ctx_t *ctx;                    \
   int err_res;                   \
   bool success;                  \
   napi_deferred deferred;        \
   napi_async_work work;          \
-  napi_ref ref;
+  napi_ref ref;                  \
+  nurkel_timing_t timing;
 
 #define WORKER_INIT(worker) do { \
   worker->err_res = 0;           \
@@ -145,6 +163,8 @@ napi_status
 nurkel_create_work(napi_env env,
                    char *name,
                    void *worker,
+                   nurkel_timing_t *timing,
+                   int op,
                    napi_async_work *work,
                    napi_async_execute_callback execute,
                    napi_async_complete_callback complete,
@@ -147,6 +147,109 @@ describe(`Urkel Transaction (${name})`, function () {
     assert.bufferEqual(txn1.rootHash(), NULL_HASH);
   });
 
+  it('should fork', async () => {
+    const txn1 = tree.txn();
+
+    if (typeof txn1.fork !== 'function')
+      this.skip();
+
+    await txn1.open();
+
+    const keys = [];
+
+    for (let i = 0; i < 20; i++) {
+      keys.push(randomKey());
+      await txn1.insert(keys[i], Buffer.from([i]));
+    }
+
+    await txn1.commit();
+
+    const extra = randomKey();
+    await txn1.insert(extra, Buffer.from('extra'));
+
+    const root = txn1.rootHash();
+    const txn2 = txn1.fork();
+
+    assert.bufferEqual(txn2.rootHash(), root);
+    assert.bufferEqual(await txn2.get(extra), Buffer.from('extra'));
+
+    await txn2.remove(keys[0]);
+    await txn2.insert(keys[1], Buffer.from('fork'));
+    await txn1.remove(extra);
+
+    assert.bufferEqual(await txn1.get(keys[0]), Buffer.from([0]));
+    assert.bufferEqual(await txn1.get(keys[1]), Buffer.from([1]));
+    assert.strictEqual(await txn1.has(extra), false);
+
+    assert.strictEqual(await txn2.has(keys[0]), false);
+    assert.bufferEqual(await txn2.get(keys[1]), Buffer.from('fork'));
+    assert.bufferEqual(await txn2.get(extra), Buffer.from('extra'));
+
+    const forkRoot = await txn2.commit();
+    assert.bufferEqual(tree.rootHash(), forkRoot);
+    await txn2.close();
+
+    await txn1.insert(keys[2], Buffer.from('parent'));
+    const parentRoot = await txn1.commit();
+    assert.notBufferEqual(parentRoot, forkRoot);
+
+    const snap = tree.snapshot(forkRoot);
+    await snap.open();
+    assert.strictEqual(await snap.has(keys[0]), false);
+    assert.bufferEqual(await snap.get(extra), Buffer.from('extra'));
+    await snap.close();
+
+    await txn1.close();
+  });
+
+  it('should roll back to savepoints', async () => {
+    const txn1 = tree.txn();
+
+    if (typeof txn1.savepoint !== 'function')
+      this.skip();
+
+    await txn1.open();
+
+    const keys = [];
+
+    for (let i = 0; i < 10; i++) {
+      keys.push(randomKey());
+      await txn1.insert(keys[i], Buffer.from([i]));
+    }
+
+    const root1 = txn1.rootHash();
+    const sp1 = txn1.savepoint();
+
+    await txn1.remove(keys[0]);
+    await txn1.insert(keys[1], Buffer.from('changed'));
+
+    const root2 = txn1.rootHash();
+    const sp2 = txn1.savepoint();
+
+    await txn1.insert(randomKey(), Buffer.from('more'));
+
+    txn1.rollbackTo(sp2);
+    assert.bufferEqual(txn1.rootHash(), root2);
+
+    txn1.rollbackTo(sp1);
+    assert.bufferEqual(txn1.rootHash(), root1);
+    assert.bufferEqual(await txn1.get(keys[0]), Buffer.from([0]));
+    assert.bufferEqual(await txn1.get(keys[1]), Buffer.from([1]));
+
+    assert.throws(() => txn1.rollbackTo(sp2), {
+      code: 'URKEL_EINVAL'
+    });
+
+    txn1.releaseSavepoint(sp1);
+
+    assert.throws(() => txn1.rollbackTo(sp1), {
+      code: 'URKEL_EINVAL'
+    });
+
+    assert.bufferEqual(await txn1.commit(), root1);
+    await txn1.close();
+  });
+
   it('should inject', async () => {
     // 5 roots with 5 entries
     const ROOTS = 5;
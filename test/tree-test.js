@@ -378,3 +378,795 @@ describe(`Urkel Tree (${name})`, function () {
   });
 });
 }
+
+const treeLookupOptions = {
+  'filter': { filter: true },
+  'index': { index: true },
+  'filter+index': { filter: true, index: true }
+};
+
+for (const [name, lookupOptions] of Object.entries(treeLookupOptions)) {
+describe(`Urkel Tree (nurkel ${name})`, function () {
+  let prefix, tree;
+
+  beforeEach(async () => {
+    prefix = testdir('tree-lookup');
+    tree = nurkel.create({ prefix, ...lookupOptions });
+    await tree.open();
+  });
+
+  afterEach(async () => {
+    if (tree.isOpen)
+      await tree.close();
+
+    if (isTreeDir(prefix))
+      rmTreeDir(prefix);
+  });
+
+  it('should answer lookups across commits and reopen', async () => {
+    const entries = [];
+    const roots = [];
+
+    for (let i = 0; i < 5; i++) {
+      const txn = tree.txn();
+      await txn.open();
+
+      for (let j = 0; j < 20; j++) {
+        const key = randomKey();
+        const value = Buffer.from(`value ${i}/${j}.`);
+
+        entries.push([key, value]);
+        await txn.insert(key, value);
+      }
+
+      roots.push(await txn.commit());
+      await txn.close();
+    }
+
+    const check = async () => {
+      for (const [key, value] of entries) {
+        assert.strictEqual(await tree.has(key), true);
+        assert.strictEqual(tree.hasSync(key), true);
+        assert.bufferEqual(await tree.get(key), value);
+      }
+
+      for (let i = 0; i < 100; i++) {
+        const key = randomKey();
+
+        assert.strictEqual(await tree.has(key), false);
+        assert.strictEqual(tree.hasSync(key), false);
+        assert.strictEqual(await tree.get(key), null);
+      }
+    };
+
+    await check();
+
+    await tree.close();
+
+    for (const file of Object.keys(lookupOptions))
+      assert(fs.existsSync(path.join(prefix, file)));
+
+    assert(isTreeDir(prefix));
+
+    await tree.open();
+    await check();
+
+    // Rewind to an older root and build on top of it.
+    await tree.inject(roots[1]);
+
+    const txn = tree.txn();
+    await txn.open();
+
+    const key = randomKey();
+    await txn.insert(key, Buffer.from('rewound'));
+    await txn.commit();
+    await txn.close();
+
+    assert.strictEqual(await tree.has(key), true);
+    assert.strictEqual(await tree.has(entries[0][0]), true);
+    assert.strictEqual(await tree.has(entries[99][0]), false);
+    assert.strictEqual(await tree.get(entries[99][0]), null);
+    assert.bufferEqual(await tree.get(entries[0][0]), entries[0][1]);
+  });
+
+  it('should not find removed keys', async () => {
+    const txn = tree.txn();
+    await txn.open();
+
+    const keys = [];
+
+    for (let i = 0; i < 50; i++) {
+      const key = randomKey();
+      keys.push(key);
+      await txn.insert(key, Buffer.from(`value ${i}.`));
+    }
+
+    await txn.commit();
+
+    for (let i = 0; i < 25; i++)
+      await txn.remove(keys[i]);
+
+    // Remove and re-insert within the same commit.
+    await txn.remove(keys[25]);
+    await txn.insert(keys[25], Buffer.from('again'));
+
+    await txn.commit();
+    await txn.close();
+
+    for (let i = 0; i < 25; i++) {
+      assert.strictEqual(await tree.has(keys[i]), false);
+      assert.strictEqual(tree.getSync(keys[i]), null);
+    }
+
+    assert.bufferEqual(await tree.get(keys[25]), Buffer.from('again'));
+
+    for (let i = 26; i < 50; i++)
+      assert.strictEqual(await tree.has(keys[i]), true);
+  });
+});
+}
+
+describe('Urkel Tree (nurkel compress)', function () {
+  let prefix, plainPrefix;
+
+  beforeEach(() => {
+    prefix = testdir('tree-compress');
+    plainPrefix = testdir('tree-compress-plain');
+  });
+
+  afterEach(() => {
+    for (const dir of [prefix, plainPrefix]) {
+      if (isTreeDir(dir))
+        rmTreeDir(dir);
+    }
+  });
+
+  it('should store values compressed without changing the tree', async () => {
+    const tree = nurkel.create({ prefix, compress: true });
+    const plain = nurkel.create({ prefix: plainPrefix });
+    const entries = [];
+
+    for (let i = 0; i < 100; i++) {
+      const value = i % 4 === 0
+        ? randomKey()
+        : Buffer.from(`value ${i}.`.repeat(i + 4));
+
+      entries.push([randomKey(), value]);
+    }
+
+    // Largest allowed value.
+    entries.push([randomKey(), Buffer.alloc(1023, 0xaa)]);
+
+    const roots = [];
+
+    for (const t of [tree, plain]) {
+      await t.open();
+
+      const txn = t.txn();
+      await txn.open();
+
+      for (const [key, value] of entries)
+        await txn.insert(key, value);
+
+      roots.push(await txn.commit());
+      await txn.close();
+    }
+
+    assert.bufferEqual(roots[0], roots[1]);
+
+    const [key, value] = entries[1];
+    const proof = await tree.prove(key);
+    const [code, data] = await nurkel.Tree.verify(roots[0], key, proof);
+
+    assert.strictEqual(code, statusCodes.URKEL_OK);
+    assert.bufferEqual(data, value);
+
+    await tree.close();
+    await plain.close();
+
+    const {size} = nurkel.Tree.statSync(prefix);
+    const {size: plainSize} = nurkel.Tree.statSync(plainPrefix);
+
+    assert(size < plainSize);
+
+    // Compressed values are readable without the option.
+    const reader = nurkel.create({ prefix });
+    await reader.open();
+
+    for (const [key, value] of entries) {
+      assert.bufferEqual(await reader.get(key), value);
+      assert.bufferEqual(reader.getSync(key), value);
+    }
+
+    await reader.close();
+  });
+});
+
+describe('Urkel Tree (nurkel dedup)', function () {
+  let prefix, plainPrefix;
+
+  beforeEach(() => {
+    prefix = testdir('tree-dedup');
+    plainPrefix = testdir('tree-dedup-plain');
+  });
+
+  afterEach(() => {
+    for (const dir of [prefix, plainPrefix]) {
+      if (isTreeDir(dir))
+        rmTreeDir(dir);
+    }
+  });
+
+  it('should store identical values once', async () => {
+    const tree = nurkel.create({ prefix, dedup: true });
+    const plain = nurkel.create({ prefix: plainPrefix });
+    const values = [];
+    const entries = [];
+
+    for (let i = 0; i < 5; i++)
+      values.push(Buffer.alloc(200, i));
+
+    for (let i = 0; i < 100; i++)
+      entries.push([randomKey(), values[i % values.length]]);
+
+    const roots = [];
+
+    for (const t of [tree, plain]) {
+      await t.open();
+
+      const txn = t.txn();
+      await txn.open();
+
+      for (const [key, value] of entries)
+        await txn.insert(key, value);
+
+      roots.push(await txn.commit());
+      await txn.close();
+      await t.close();
+    }
+
+    assert.bufferEqual(roots[0], roots[1]);
+
+    const {size} = nurkel.Tree.statSync(prefix);
+    const {size: plainSize} = nurkel.Tree.statSync(plainPrefix);
+
+    assert(size + 95 * 200 <= plainSize);
+
+    await tree.open();
+
+    for (const [key, value] of entries)
+      assert.bufferEqual(await tree.get(key), value);
+
+    await tree.close();
+  });
+});
+
+describe('Urkel Tree (nurkel direct)', function () {
+  let prefix;
+
+  beforeEach(() => {
+    prefix = testdir('tree-direct');
+  });
+
+  afterEach(() => {
+    if (isTreeDir(prefix))
+      rmTreeDir(prefix);
+  });
+
+  it('should write and reopen with direct io', async () => {
+    const entries = [];
+    let root;
+
+    for (let i = 0; i < 3; i++) {
+      const tree = nurkel.create({ prefix, direct: true });
+      await tree.open();
+
+      const txn = tree.txn();
+      await txn.open();
+
+      for (let j = 0; j < 50; j++) {
+        const entry = [randomKey(), Buffer.alloc(100, j)];
+        entries.push(entry);
+        await txn.insert(...entry);
+      }
+
+      root = await txn.commit();
+      await txn.close();
+      await tree.close();
+    }
+
+    const {size} = nurkel.Tree.statSync(prefix);
+    assert.strictEqual(size % 4096, 0);
+
+    for (const direct of [true, false]) {
+      const tree = nurkel.create({ prefix, direct });
+      await tree.open();
+
+      assert.bufferEqual(tree.rootHash(), root);
+
+      for (const [key, value] of entries)
+        assert.bufferEqual(await tree.get(key), value);
+
+      await tree.close();
+    }
+  });
+});
+
+describe('Urkel Tree (nurkel checksum)', function () {
+  let prefix;
+
+  beforeEach(() => {
+    prefix = testdir('tree-checksum');
+  });
+
+  afterEach(() => {
+    if (isTreeDir(prefix))
+      rmTreeDir(prefix);
+  });
+
+  it('should write checksummed records and reopen', async () => {
+    const entries = [];
+    let root;
+
+    {
+      const tree = nurkel.create({ prefix, checksum: true, compress: true });
+      await tree.open();
+
+      const txn = tree.txn();
+      await txn.open();
+
+      for (let i = 0; i < 100; i++) {
+        const entry = [randomKey(), Buffer.alloc(100 + i, i)];
+        entries.push(entry);
+        await txn.insert(...entry);
+      }
+
+      root = await txn.commit();
+      await txn.close();
+      await tree.close();
+    }
+
+    for (const checksum of [true, false]) {
+      const tree = nurkel.create({ prefix, checksum });
+      await tree.open();
+
+      assert.bufferEqual(tree.rootHash(), root);
+
+      for (const [key, value] of entries)
+        assert.bufferEqual(await tree.get(key), value);
+
+      await tree.close();
+    }
+  });
+});
+
+describe('Urkel Tree (nurkel memory)', function () {
+  const memoryBudget = 2 << 20;
+  let prefix;
+
+  beforeEach(() => {
+    prefix = testdir('tree-memory');
+  });
+
+  afterEach(() => {
+    if (isTreeDir(prefix))
+      rmTreeDir(prefix);
+  });
+
+  it('should refuse inserts over budget until commit', async () => {
+    const tree = nurkel.create({ prefix, memoryBudget });
+    await tree.open();
+
+    assert.strictEqual(tree.memoryUsageSync().limit, memoryBudget);
+
+    const txn = tree.txn();
+    await txn.open();
+
+    let err = null;
+    let count = 0;
+
+    for (; count < 10000; count++) {
+      try {
+        await txn.insert(randomKey(), Buffer.alloc(1000, count));
+      } catch (e) {
+        err = e;
+        break;
+      }
+    }
+
+    assert(err, 'Expected the budget to run out.');
+    assert.strictEqual(err.code, 'URKEL_ENOMEM');
+    assert(tree.memoryUsageSync().used > memoryBudget);
+
+    await txn.commit();
+
+    const usage = tree.memoryUsageSync();
+    assert(usage.used <= memoryBudget);
+    assert(usage.txs < 1024);
+
+    await txn.insert(randomKey(), Buffer.alloc(1000, 0));
+    await txn.close();
+    await tree.close();
+  });
+
+  it('should charge iterator caches', async () => {
+    const tree = nurkel.create({ prefix, memoryBudget });
+    await tree.open();
+
+    const snap = tree.snapshot();
+    await snap.open();
+
+    const iter = snap.iterator(100);
+    assert(tree.memoryUsageSync().other > 0);
+    await iter.end();
+    assert.strictEqual(tree.memoryUsageSync().other, 0);
+
+    assert.throws(() => snap.iterator(10000), {
+      code: 'URKEL_ENOMEM'
+    });
+
+    await snap.close();
+    await tree.close();
+  });
+
+  it('should keep nodes read by a transaction attached', async () => {
+    const tree = nurkel.create({ prefix, attach: true });
+    await tree.open();
+
+    const entries = [];
+
+    for (let i = 0; i < 500; i++)
+      entries.push([randomKey(), Buffer.alloc(100, i)]);
+
+    let txn = tree.txn();
+    await txn.open();
+
+    for (const [key, value] of entries)
+      await txn.insert(key, value);
+
+    const root = await txn.commit();
+    await txn.close();
+
+    txn = tree.txn();
+    await txn.open();
+
+    const base = tree.memoryUsageSync().txs;
+
+    for (const [key, value] of entries)
+      assert.bufferEqual(await txn.get(key), value);
+
+    const attached = tree.memoryUsageSync().txs;
+    assert(attached > base);
+
+    for (const [key, value] of entries)
+      assert.bufferEqual(await txn.get(key), value);
+
+    assert.strictEqual(tree.memoryUsageSync().txs, attached);
+    assert.bufferEqual(txn.rootHash(), root);
+
+    await txn.close();
+
+    assert.strictEqual(tree.memoryUsageSync().txs, 0);
+
+    await tree.close();
+  });
+
+  it('should keep the top levels after commit', async () => {
+    const tree = nurkel.create({ prefix, residentLevels: 4 });
+    await tree.open();
+
+    const entries = [];
+
+    for (let i = 0; i < 500; i++)
+      entries.push([randomKey(), Buffer.alloc(100, i)]);
+
+    const txn = tree.txn();
+    await txn.open();
+
+    for (const [key, value] of entries)
+      await txn.insert(key, value);
+
+    const root = await txn.commit();
+    const usage = tree.memoryUsageSync();
+
+    assert(usage.txs > 1024 && usage.txs < 16 * 1024);
+    assert.bufferEqual(txn.rootHash(), root);
+
+    for (const [key, value] of entries)
+      assert.bufferEqual(await txn.get(key), value);
+
+    await txn.close();
+
+    assert.strictEqual(tree.memoryUsageSync().txs, 0);
+
+    await tree.close();
+  });
+
+  it('should spill transactions over txMemory', async () => {
+    const txMemory = 256 << 10;
+    const entries = [];
+
+    for (let i = 0; i < 3000; i++)
+      entries.push([randomKey(), Buffer.alloc(100, i)]);
+
+    let tree = nurkel.create({ prefix });
+    await tree.open();
+
+    let txn = tree.txn();
+    await txn.open();
+
+    for (const [key, value] of entries)
+      await txn.insert(key, value);
+
+    const expect = txn.rootHash();
+
+    await txn.close();
+    await tree.close();
+
+    tree = nurkel.create({ prefix, txMemory });
+    await tree.open();
+
+    txn = tree.txn();
+    await txn.open();
+
+    for (const [key, value] of entries) {
+      await txn.insert(key, value);
+      assert(tree.memoryUsageSync().txs <= txMemory + 8192);
+    }
+
+    for (const [key, value] of entries)
+      assert.bufferEqual(await txn.get(key), value);
+
+    assert.bufferEqual(txn.rootHash(), expect);
+    assert.notBufferEqual(tree.rootHash(), expect);
+
+    await txn.commit();
+    await txn.close();
+
+    assert.bufferEqual(tree.rootHash(), expect);
+
+    for (const [key, value] of entries)
+      assert.bufferEqual(await tree.get(key), value);
+
+    await tree.close();
+  });
+
+  it('should warm the top levels after open', async () => {
+    const entries = [];
+
+    for (let i = 0; i < 500; i++)
+      entries.push([randomKey(), Buffer.alloc(100, i)]);
+
+    let tree = nurkel.create({ prefix, warmLevels: 4 });
+    await tree.open();
+
+    const txn = tree.txn();
+    await txn.open();
+
+    for (const [key, value] of entries)
+      await txn.insert(key, value);
+
+    const root = await txn.commit();
+    await txn.close();
+    await tree.close();
+
+    // Magic, count, 15 pointers and a checksum.
+    const manifest = path.join(prefix, 'warm');
+    assert.strictEqual(fs.statSync(manifest).size, 8 + 15 * 7 + 20);
+
+    tree = nurkel.create({ prefix, warmLevels: 4 });
+    await tree.open();
+
+    assert.bufferEqual(tree.rootHash(), root);
+
+    for (const [key, value] of entries)
+      assert.bufferEqual(await tree.get(key), value);
+
+    await tree.close();
+
+    assert.throws(() => nurkel.create({ prefix, warmLevels: -1 }));
+  });
+
+  it('should report metrics', async () => {
+    const tree = nurkel.create({ prefix, durability: 'commit' });
+    await tree.open();
+
+    const before = tree.metricsSync();
+    assert.strictEqual(before.commits, 0);
+    assert.strictEqual(before.bytesWritten, 0);
+
+    const entries = [];
+
+    for (let i = 0; i < 100; i++)
+      entries.push([randomKey(), Buffer.alloc(100, i)]);
+
+    const txn = tree.txn();
+    await txn.open();
+
+    for (const [key, value] of entries)
+      await txn.insert(key, value);
+
+    await txn.commit();
+    await txn.close();
+
+    for (const [key, value] of entries)
+      assert.bufferEqual(await tree.get(key), value);
+
+    const after = tree.metricsSync();
+    assert.strictEqual(after.commits, 1);
+    assert.strictEqual(after.flushes, 1);
+    assert(after.syncs >= 1);
+    assert(after.bytesWritten > 100 * 100);
+    assert(after.nodeReads > 100);
+    assert.strictEqual(after.valueReads, 100);
+    assert(after.bytesRead > 100 * 100);
+
+    await tree.close();
+
+    assert.throws(() => tree.metricsSync());
+  });
+
+  it('should report lock waits', async () => {
+    const tree = nurkel.create({ prefix, lockStats: true });
+    await tree.open();
+
+    const roles = ['treeRead', 'treeWrite', 'txRead', 'txWrite'];
+
+    for (const role of roles) {
+      const metrics = tree.metricsSync();
+      assert.strictEqual(metrics[role + 'Contended'], 0);
+      assert.strictEqual(metrics[role + 'WaitTime'], 0);
+      assert.strictEqual(metrics[role + 'MaxWait'], 0);
+    }
+
+    const keys = [];
+    const txn = tree.txn();
+    await txn.open();
+
+    for (let i = 0; i < 100; i++) {
+      const key = randomKey();
+      keys.push(key);
+      await txn.insert(key, Buffer.alloc(100, i));
+    }
+
+    // Reads race the commit for the tree lock.
+    await Promise.all([
+      txn.commit(),
+      ...keys.map(key => tree.get(key))
+    ]);
+
+    await txn.close();
+
+    const metrics = tree.metricsSync();
+
+    for (const role of roles) {
+      const contended = metrics[role + 'Contended'];
+      const waitTime = metrics[role + 'WaitTime'];
+      const maxWait = metrics[role + 'MaxWait'];
+
+      assert(contended >= 0);
+      assert(maxWait <= waitTime);
+
+      if (contended === 0)
+        assert.strictEqual(waitTime, 0);
+    }
+
+    await tree.close();
+  });
+
+  it('should record operation latency', async () => {
+    const tree = nurkel.create({ prefix });
+    await tree.open();
+
+    nurkel.Tree.resetLatencySync();
+
+    const txn = tree.txn();
+    await txn.open();
+
+    const key = randomKey();
+    await txn.insert(key, Buffer.from('value'));
+    await txn.commit();
+    await txn.close();
+
+    for (let i = 0; i < 10; i++)
+      await tree.get(key);
+
+    // Sync calls are not measured.
+    tree.getSync(key);
+
+    const latency = nurkel.Tree.latencySync();
+
+    assert.strictEqual(latency.get.exec.count, 10);
+    assert.strictEqual(latency.get.queue.count, 10);
+    assert.strictEqual(latency.insert.exec.count, 1);
+    assert.strictEqual(latency.commit.exec.count, 1);
+    assert.strictEqual(latency.prove.exec.count, 0);
+
+    const {exec} = latency.get;
+    assert(exec.p50 > 0);
+    assert(exec.p50 <= exec.p99);
+    assert(exec.p99 <= exec.p999);
+    assert(exec.p999 <= exec.max);
+    assert(exec.mean <= exec.max);
+
+    nurkel.Tree.resetLatencySync();
+    assert.strictEqual(nurkel.Tree.latencySync().get.exec.count, 0);
+
+    await tree.close();
+  });
+});
+
+describe('Urkel Tree (nurkel durability)', function () {
+  let prefix;
+
+  beforeEach(() => {
+    prefix = testdir('tree-durability');
+  });
+
+  afterEach(() => {
+    if (isTreeDir(prefix))
+      rmTreeDir(prefix);
+  });
+
+  const commit = async (tree) => {
+    const txn = tree.txn();
+    await txn.open();
+    await txn.insert(randomKey(), Buffer.from('value'));
+    const root = await txn.commit();
+    await txn.close();
+    return root;
+  };
+
+  it('should reject unknown modes', () => {
+    assert.throws(() => nurkel.create({ prefix, durability: 'always' }));
+    assert.throws(() => nurkel.create({ prefix, syncCommits: -1 }));
+  });
+
+  it('should report the durable root per mode', async () => {
+    for (const durability of ['none', 'commit', 'rollover']) {
+      const tree = nurkel.create({ prefix, durability });
+      await tree.open();
+
+      const initial = tree.rootHash();
+      assert.bufferEqual(tree.durableRootSync(), initial);
+
+      const root = await commit(tree);
+
+      if (durability === 'commit')
+        assert.bufferEqual(tree.durableRootSync(), root);
+      else
+        assert.bufferEqual(tree.durableRootSync(), initial);
+
+      await tree.close();
+    }
+  });
+
+  it('should sync batches in the background', async () => {
+    const tree = nurkel.create({
+      prefix,
+      durability: 'batch',
+      syncCommits: 2,
+      syncInterval: 60 * 1000
+    });
+
+    await tree.open();
+
+    const initial = tree.rootHash();
+
+    await commit(tree);
+    assert.bufferEqual(tree.durableRootSync(), initial);
+
+    const root = await commit(tree);
+
+    for (let i = 0; i < 1000; i++) {
+      if (tree.durableRootSync().equals(root))
+        break;
+
+      await new Promise(r => setTimeout(r, 10));
+    }
+
+    assert.bufferEqual(tree.durableRootSync(), root);
+
+    await tree.close();
+  });
+});
@@ -25,6 +25,12 @@ common.serializeU32 = (num) => {
   return str;
 };
 
+common.auxFiles = [
+  'filter',
+  'index',
+  'warm'
+];
+
 common.isTreeDir = (dir, locked) => {
   if (!fs.existsSync(dir))
     return false;
@@ -47,6 +53,10 @@ common.isTreeDir = (dir, locked) => {
 
   files.delete('lock');
 
+  // Optional auxiliary files.
+  for (const name of common.auxFiles)
+    files.delete(name);
+
   let i = 1;
   while (files.size > 0) {
     const fname = common.serializeU32(i);